@@ -2,7 +2,7 @@ QT      -= core gui
 CONFIG  -= c++11
 
 QMAKE_CXXFLAGS += -std=c++14
-QMAKE_LFLAGS   += -std=c++14
+QMAKE_LFLAGS   += -std=c++14 -pthread
 LIBS           += -lsfml-graphics -lsfml-window -lsfml-system \
                   -L/usr/lib/x86_64-linux-gnu -L$$PWD/../ksg -L$$PWD/../util-common
 
@@ -37,7 +37,27 @@ SOURCES += \
     ../src/TargetTextGrid.cpp \
     ../src/KsgTextGrid.cpp \
     ../src/LuaCodeModeler.cpp \
-    ../src/TextLineImage.cpp
+    ../src/TextLineImage.cpp \
+    ../src/BackgroundModeler.cpp \
+    ../src/ParallelModeler.cpp \
+    ../src/ModelCache.cpp \
+    ../src/ModelingScheduler.cpp \
+    ../src/UndoHistory.cpp \
+    ../src/TextLinesSnapshot.cpp \
+    ../src/SubstringSearcher.cpp \
+    ../src/RegexSearcher.cpp \
+    ../src/MultiTextSelection.cpp \
+    ../src/AnchorRegistry.cpp \
+    ../src/LineOffsetIndex.cpp \
+    ../src/DocumentWriter.cpp \
+    ../src/EditJournal.cpp \
+    ../src/DocumentReader.cpp \
+    ../src/MappedDocument.cpp \
+    ../src/FileFollower.cpp \
+    ../src/DocumentReloader.cpp \
+    ../src/DocumentDiff.cpp \
+    ../src/ModelStore.cpp \
+    ../src/ThreadPool.cpp
 
 HEADERS += \
     ../src/TextLines.hpp \
@@ -48,7 +68,27 @@ HEADERS += \
     ../src/KsgTextGrid.hpp \
     ../src/IteratorPair.hpp \
     ../src/LuaCodeModeler.hpp \
-    ../src/TextLineImage.hpp
+    ../src/TextLineImage.hpp \
+    ../src/BackgroundModeler.hpp \
+    ../src/ParallelModeler.hpp \
+    ../src/ModelCache.hpp \
+    ../src/ModelingScheduler.hpp \
+    ../src/UndoHistory.hpp \
+    ../src/TextLinesSnapshot.hpp \
+    ../src/SubstringSearcher.hpp \
+    ../src/RegexSearcher.hpp \
+    ../src/MultiTextSelection.hpp \
+    ../src/AnchorRegistry.hpp \
+    ../src/LineOffsetIndex.hpp \
+    ../src/DocumentWriter.hpp \
+    ../src/EditJournal.hpp \
+    ../src/DocumentReader.hpp \
+    ../src/MappedDocument.hpp \
+    ../src/FileFollower.hpp \
+    ../src/DocumentReloader.hpp \
+    ../src/DocumentDiff.hpp \
+    ../src/ModelStore.hpp \
+    ../src/ThreadPool.hpp
 
 INCLUDEPATH += \
     ../ksg/inc      \
@@ -0,0 +1,396 @@
+/****************************************************************************
+
+    File: AnchorRegistry.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "AnchorRegistry.hpp"
+#include "SubstringSearcher.hpp"
+
+#include <stdexcept>
+
+#include <cassert>
+
+namespace {
+
+void run_anchor_registry_tests();
+
+} // end of <anonymous> namespace
+
+/* static */ constexpr const int AnchorRegistry::NO_NODE;
+
+/* explicit */ AnchorRegistry::AnchorRegistry(TextLines & tlines):
+    m_lines(&tlines),
+    m_root (NO_NODE),
+    m_size (0),
+    m_seed (0x9E3779B9u)
+{ m_lines->add_edit_listener(this); }
+
+AnchorRegistry::~AnchorRegistry()
+    { m_lines->remove_edit_listener(this); }
+
+AnchorRegistry::Anchor AnchorRegistry::add(Cursor cursor) {
+    if (!m_lines->is_valid_cursor(cursor)) {
+        throw std::invalid_argument("AnchorRegistry::add: given cursor is "
+                                    "invalid.");
+    }
+    int idx = 0;
+    if (m_free_nodes.empty()) {
+        idx = int(m_nodes.size());
+        m_nodes.emplace_back();
+    } else {
+        idx = m_free_nodes.back();
+        m_free_nodes.pop_back();
+        m_nodes[std::size_t(idx)] = Node();
+    }
+    auto & node = m_nodes[std::size_t(idx)];
+    node.position = cursor;
+    node.priority = next_priority();
+    node.in_use   = true;
+
+    int before = NO_NODE, after = NO_NODE;
+    split(m_root, cursor, true, before, after);
+    m_root = merge(merge(before, idx), after);
+    m_nodes[std::size_t(m_root)].parent = NO_NODE;
+    ++m_size;
+    return idx;
+}
+
+void AnchorRegistry::remove(Anchor anchor) {
+    node_of("AnchorRegistry::remove", anchor);
+    // whatever is pending above the node must reach its children before
+    // they take its place
+    std::vector<int> path;
+    for (int i = anchor; i != NO_NODE; i = m_nodes[std::size_t(i)].parent)
+        path.push_back(i);
+    for (auto itr = path.rbegin(); itr != path.rend(); ++itr)
+        push_down(*itr);
+
+    auto & node = m_nodes[std::size_t(anchor)];
+    const int replacement = merge(node.left, node.right);
+    if (node.parent == NO_NODE) {
+        m_root = replacement;
+        if (m_root != NO_NODE) m_nodes[std::size_t(m_root)].parent = NO_NODE;
+    } else {
+        auto & parent = m_nodes[std::size_t(node.parent)];
+        set_child(parent.left == anchor ? parent.left : parent.right,
+                  replacement, node.parent);
+    }
+    node = Node();
+    m_free_nodes.push_back(anchor);
+    --m_size;
+}
+
+Cursor AnchorRegistry::position_of(Anchor anchor) const {
+    const auto & node = node_of("AnchorRegistry::position_of", anchor);
+    // moves pending above the node are from the nearest (oldest) up
+    Move move;
+    for (int i = node.parent; i != NO_NODE; i = m_nodes[std::size_t(i)].parent)
+        move.then(m_nodes[std::size_t(i)].pending);
+    return move.applied_to(node.position);
+}
+
+/* static */ void AnchorRegistry::run_tests()
+    { run_anchor_registry_tests(); }
+
+/* private */ Cursor AnchorRegistry::Move::applied_to(Cursor cursor) const {
+    if (to_one_place) return to;
+    return Cursor(cursor.line + lines, cursor.column + columns);
+}
+
+/* private */ void AnchorRegistry::Move::then(const Move & next) {
+    if (next.to_one_place) {
+        *this = next;
+    } else if (to_one_place) {
+        to = next.applied_to(to);
+    } else {
+        lines   += next.lines;
+        columns += next.columns;
+    }
+}
+
+/* private */ void AnchorRegistry::on_insertion
+    (const TextLines &, Cursor beg, Cursor end)
+{
+    if (beg == end) return;
+    // [at or before beg] [rest of beg's line] [later lines]
+    int before = NO_NODE, same_line = NO_NODE, later = NO_NODE;
+    split(m_root, beg, true, before, later);
+    split(later, Cursor(beg.line + 1, 0), false, same_line, later);
+
+    Move line_rest;
+    line_rest.lines   = end.line - beg.line;
+    line_rest.columns = end.column - beg.column;
+    move(same_line, line_rest);
+    Move later_lines;
+    later_lines.lines = end.line - beg.line;
+    move(later, later_lines);
+
+    m_root = merge(merge(before, same_line), later);
+    if (m_root != NO_NODE) m_nodes[std::size_t(m_root)].parent = NO_NODE;
+}
+
+/* private */ void AnchorRegistry::on_removal
+    (const TextLines &, Cursor beg, Cursor end, const std::u32string &)
+{
+    if (beg == end) return;
+    // [at or before beg] [removed] [rest of end's line] [later lines]
+    int before = NO_NODE, removed = NO_NODE, same_line = NO_NODE,
+        later  = NO_NODE;
+    split(m_root, beg, true, before, later);
+    split(later, end, false, removed, later);
+    split(later, Cursor(end.line + 1, 0), false, same_line, later);
+
+    Move collapse;
+    collapse.to_one_place = true;
+    collapse.to = beg;
+    move(removed, collapse);
+    Move line_rest;
+    line_rest.lines   = beg.line - end.line;
+    line_rest.columns = beg.column - end.column;
+    move(same_line, line_rest);
+    Move later_lines;
+    later_lines.lines = beg.line - end.line;
+    move(later, later_lines);
+
+    m_root = merge(merge(merge(before, removed), same_line), later);
+    if (m_root != NO_NODE) m_nodes[std::size_t(m_root)].parent = NO_NODE;
+}
+
+/* private */ void AnchorRegistry::on_reset(const TextLines & tlines) {
+    // anchors are kept as near to where they were as the new content allows,
+    // which keeps them in order
+    std::vector<int> to_visit;
+    if (m_root != NO_NODE) to_visit.push_back(m_root);
+    while (!to_visit.empty()) {
+        const int idx = to_visit.back();
+        to_visit.pop_back();
+        push_down(idx);
+        auto & node = m_nodes[std::size_t(idx)];
+        node.position = tlines.constrain_cursor(node.position);
+        if (node.left  != NO_NODE) to_visit.push_back(node.left );
+        if (node.right != NO_NODE) to_visit.push_back(node.right);
+    }
+}
+
+/* private */ void AnchorRegistry::move(int idx, const Move & move_) {
+    if (idx == NO_NODE || move_.is_noop()) return;
+    auto & node = m_nodes[std::size_t(idx)];
+    node.position = move_.applied_to(node.position);
+    node.pending.then(move_);
+}
+
+/* private */ void AnchorRegistry::push_down(int idx) {
+    auto & node = m_nodes[std::size_t(idx)];
+    if (node.pending.is_noop()) return;
+    move(node.left , node.pending);
+    move(node.right, node.pending);
+    node.pending = Move();
+}
+
+/* private */ void AnchorRegistry::split
+    (int idx, Cursor key, bool inclusive, int & left, int & right)
+{
+    if (idx == NO_NODE) {
+        left = right = NO_NODE;
+        return;
+    }
+    push_down(idx);
+    auto & node = m_nodes[std::size_t(idx)];
+    const bool goes_left = inclusive ? !(key < node.position) : node.position < key;
+    if (goes_left) {
+        int rest = NO_NODE;
+        split(node.right, key, inclusive, rest, right);
+        set_child(node.right, rest, idx);
+        left = idx;
+    } else {
+        int rest = NO_NODE;
+        split(node.left, key, inclusive, left, rest);
+        set_child(node.left, rest, idx);
+        right = idx;
+    }
+}
+
+/* private */ int AnchorRegistry::merge(int left, int right) {
+    if (left  == NO_NODE) return right;
+    if (right == NO_NODE) return left;
+    auto & lnode = m_nodes[std::size_t(left )];
+    auto & rnode = m_nodes[std::size_t(right)];
+    if (lnode.priority > rnode.priority) {
+        push_down(left);
+        set_child(lnode.right, merge(lnode.right, right), left);
+        return left;
+    }
+    push_down(right);
+    set_child(rnode.left, merge(left, rnode.left), right);
+    return right;
+}
+
+/* private */ void AnchorRegistry::set_child
+    (int & child_link, int child, int parent)
+{
+    child_link = child;
+    if (child != NO_NODE) m_nodes[std::size_t(child)].parent = parent;
+}
+
+/* private */ const AnchorRegistry::Node & AnchorRegistry::node_of
+    (const char * caller, Anchor anchor) const
+{
+    if (anchor < 0 || anchor >= int(m_nodes.size()) ||
+        !m_nodes[std::size_t(anchor)].in_use)
+    {
+        throw std::invalid_argument(std::string(caller) + ": there is no "
+                                    "such anchor.");
+    }
+    return m_nodes[std::size_t(anchor)];
+}
+
+/* private */ unsigned AnchorRegistry::next_priority() {
+    // xorshift, the tree only needs priorities to be well spread
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+// every anchor moved one at a time, by the same rules
+class NaiveAnchors final : public TextLines::EditListener {
+public:
+    explicit NaiveAnchors(TextLines & tlines): m_lines(&tlines)
+        { m_lines->add_edit_listener(this); }
+    ~NaiveAnchors() override { m_lines->remove_edit_listener(this); }
+
+    std::vector<Cursor> positions;
+private:
+    void on_insertion(const TextLines &, Cursor beg, Cursor end) override {
+        for (auto & pos : positions) {
+            if (!(beg < pos)) continue;
+            if (pos.line == beg.line)
+                pos = Cursor(end.line, pos.column - beg.column + end.column);
+            else
+                pos.line += end.line - beg.line;
+        }
+    }
+    void on_removal(const TextLines &, Cursor beg, Cursor end,
+                    const std::u32string &) override
+    {
+        for (auto & pos : positions) {
+            if (!(beg < pos)) continue;
+            if (pos < end)
+                pos = beg;
+            else if (pos.line == end.line)
+                pos = Cursor(beg.line, pos.column - end.column + beg.column);
+            else
+                pos.line -= end.line - beg.line;
+        }
+    }
+    void on_reset(const TextLines & tlines) override {
+        for (auto & pos : positions)
+            pos = tlines.constrain_cursor(pos);
+    }
+
+    TextLines * m_lines;
+};
+
+void run_anchor_registry_tests() {
+    // typing at, before and after anchors
+    {
+    TextLines tlines(U"abc\ndef");
+    AnchorRegistry anchors(tlines);
+    auto at_b   = anchors.add(Cursor(0, 1));
+    auto at_e   = anchors.add(Cursor(1, 1));
+    auto at_end = anchors.add(tlines.end_cursor());
+    tlines.push(Cursor(0, 1), U'x');
+    assert(anchors.position_of(at_b) == Cursor(0, 1));
+    tlines.push(Cursor(0, 0), TextLines::NEW_LINE);
+    assert(anchors.position_of(at_b) == Cursor(1, 1));
+    assert(anchors.position_of(at_e) == Cursor(2, 1));
+    assert(anchors.position_of(at_end) == tlines.end_cursor());
+    // removing what holds an anchor leaves it where the removal began
+    tlines.wipe(Cursor(1, 2), Cursor(2, 2));
+    assert(anchors.position_of(at_e) == Cursor(1, 2));
+    assert(anchors.position_of(at_b) == Cursor(1, 1));
+    assert(anchors.size() == 3);
+    anchors.remove(at_b);
+    assert(anchors.size() == 2 && anchors.position_of(at_e) == Cursor(1, 2));
+    bool threw = false;
+    try {
+        anchors.position_of(at_b);
+    } catch (std::invalid_argument &) {
+        threw = true;
+    }
+    assert(threw);
+    }
+    // many anchors over many edits, against moving each one at a time
+    {
+    std::u32string content;
+    for (int i = 0; i != 50; ++i) content += U"local a = b + a\n";
+    TextLines tlines(content);
+    AnchorRegistry anchors(tlines);
+    NaiveAnchors expected(tlines);
+    std::vector<AnchorRegistry::Anchor> handles;
+    unsigned seed = 7;
+    auto next_random = [&seed](int limit) {
+        seed = seed*1103515245u + 12345u;
+        return int((seed >> 16) % unsigned(limit));
+    };
+    auto random_cursor = [&]() {
+        const int line = next_random(int(tlines.lines().size()) + 1);
+        if (line == int(tlines.lines().size())) return tlines.end_cursor();
+        const auto & tline = tlines.lines()[std::size_t(line)];
+        return Cursor(line, next_random(tline.content_length() + 1));
+    };
+    for (int i = 0; i != 300; ++i) {
+        auto cursor = random_cursor();
+        handles.push_back(anchors.add(cursor));
+        expected.positions.push_back(cursor);
+    }
+    for (int i = 0; i != 400; ++i) {
+        auto beg = random_cursor(), end = random_cursor();
+        if (end < beg) std::swap(beg, end);
+        static const std::u32string text = U"xy\nz\n";
+        switch (i % 6) {
+        case 0: tlines.push(beg, U'q'); break;
+        case 1: tlines.push(beg, TextLines::NEW_LINE); break;
+        case 2: tlines.delete_behind(beg); break;
+        case 3: tlines.wipe(beg, tlines.constrain_cursor(Cursor(beg.line + 1, 2))); break;
+        case 4: tlines.deposit_chatacters_to(text.data(), text.data() + text.size(), beg); break;
+        case 5: SubstringSearcher(U"a").replace_all(tlines, U"\nbb"); break;
+        }
+        // some anchors come and go
+        if (i % 10 == 0) {
+            auto which = std::size_t(next_random(int(handles.size())));
+            anchors.remove(handles[which]);
+            auto cursor = random_cursor();
+            handles[which] = anchors.add(cursor);
+            expected.positions[which] = cursor;
+        }
+        for (std::size_t j = 0; j != handles.size(); ++j)
+            assert(anchors.position_of(handles[j]) == expected.positions[j]);
+    }
+    tlines.set_content(U"short");
+    for (std::size_t j = 0; j != handles.size(); ++j)
+        assert(anchors.position_of(handles[j]) == expected.positions[j]);
+    }
+}
+
+} // end of <anonymous> namespace
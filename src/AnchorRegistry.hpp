@@ -0,0 +1,117 @@
+/****************************************************************************
+
+    File: AnchorRegistry.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "TextLines.hpp"
+
+#include <vector>
+
+/** Positions in a TextLines (bookmarks, diagnostics, carets of other users)
+ *  which follow the text around them as it is edited.
+ *
+ *  Anchors are kept in order in a tree, where an edit moves every anchor
+ *  after it by leaving a note at the top of the subtrees concerned. So each
+ *  edit costs in proportion to the log of the number of anchors, however
+ *  many of them it moves, as does looking up where an anchor is now.
+ *
+ *  Text inserted right at an anchor goes after it, and removing text which
+ *  holds an anchor leaves the anchor where the removal began.
+ */
+class AnchorRegistry final : public TextLines::EditListener {
+public:
+    /** Refers to one anchor. Once an anchor is removed, its handle may be
+     *  given to a new anchor.
+     */
+    using Anchor = int;
+
+    /** Starts listening to the given lines.
+     *  @warning Does not in anyway maintain ownership over the given object.
+     *           Given object must survive the life of this object.
+     */
+    explicit AnchorRegistry(TextLines &);
+    ~AnchorRegistry() override;
+
+    AnchorRegistry(const AnchorRegistry &) = delete;
+    AnchorRegistry & operator = (const AnchorRegistry &) = delete;
+
+    /** @throws std::invalid_argument if the cursor is not valid for the
+     *          lines
+     */
+    Anchor add(Cursor);
+    /** @throws std::invalid_argument if there is no such anchor */
+    void remove(Anchor);
+    /** @throws std::invalid_argument if there is no such anchor */
+    Cursor position_of(Anchor) const;
+
+    std::size_t size() const { return m_size; }
+
+    static void run_tests();
+private:
+    static constexpr const int NO_NODE = -1;
+
+    // a change to every position in a subtree, either moving them all to one
+    // place or shifting them all by the same amount
+    struct Move {
+        bool is_noop() const { return !to_one_place && lines == 0 && columns == 0; }
+        Cursor applied_to(Cursor) const;
+        // this move followed by the given one
+        void then(const Move &);
+
+        bool to_one_place = false;
+        Cursor to;
+        int lines   = 0;
+        int columns = 0;
+    };
+
+    struct Node {
+        // up to date with the moves of every node above it
+        Cursor position;
+        // yet to be made to the children
+        Move pending;
+        int left   = NO_NODE;
+        int right  = NO_NODE;
+        int parent = NO_NODE;
+        unsigned priority = 0;
+        bool in_use = false;
+    };
+
+    void on_insertion(const TextLines &, Cursor beg, Cursor end) override;
+    void on_removal(const TextLines &, Cursor beg, Cursor end,
+                    const std::u32string & removed) override;
+    void on_reset(const TextLines &) override;
+
+    void move(int node, const Move &);
+    void push_down(int node);
+    // nodes before the key (or at it, if inclusive) go to the left
+    void split(int node, Cursor key, bool inclusive, int & left, int & right);
+    int merge(int left, int right);
+    void set_child(int & child_link, int child, int parent);
+    const Node & node_of(const char * caller, Anchor) const;
+    unsigned next_priority();
+
+    TextLines * m_lines;
+    std::vector<Node> m_nodes;
+    std::vector<int> m_free_nodes;
+    int m_root;
+    std::size_t m_size;
+    unsigned m_seed;
+};
@@ -0,0 +1,243 @@
+/****************************************************************************
+
+    File: BackgroundModeler.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "BackgroundModeler.hpp"
+#include "TextLines.hpp"
+#include "LuaCodeModeler.hpp"
+#include "ModelingScheduler.hpp"
+
+#include <algorithm>
+
+#include <cassert>
+
+namespace {
+
+void run_background_modeler_tests();
+
+} // end of <anonymous> namespace
+
+/* explicit */ BackgroundModeler::BackgroundModeler
+    (ModelerFactory make_modeler, int thread_count):
+    m_modeler       (make_modeler, thread_count),
+    m_working       (false),
+    m_stop_requested(false),
+    m_has_posted    (false),
+    m_posted_version(0)
+{
+    m_worker = std::thread([this]() { run_worker(); });
+}
+
+BackgroundModeler::~BackgroundModeler() {
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop_requested = true;
+    }
+    m_job_posted.notify_one();
+    m_worker.join();
+}
+
+void BackgroundModeler::post(const TextLines & textlines) {
+    auto job = std::make_shared<Job>();
+    job->lines = textlines.snapshot();
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_pending_job = job;
+    m_has_posted = true;
+    m_posted_version = job->lines.version();
+    }
+    m_job_posted.notify_one();
+}
+
+bool BackgroundModeler::post_if_idle(const TextLines & textlines) {
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_working || m_pending_job || m_finished) return false;
+    if (m_has_posted && m_posted_version == textlines.version()) return false;
+    }
+    post(textlines);
+    return true;
+}
+
+bool BackgroundModeler::apply_results_to(TextLines & textlines) {
+    std::unique_ptr<Results> results;
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    results.swap(m_finished);
+    }
+    if (!results) return false;
+    const auto & job = results->job->lines;
+    if (job.width_constraint() != textlines.width_constraint()) return false;
+
+    const bool is_current = job.version() == textlines.version();
+    const auto count = std::min(textlines.lines().size(), job.line_count());
+    bool any_taken = false;
+    for (std::size_t i = 0; i != count; ++i) {
+        const auto & line = textlines.lines()[i];
+        if (!is_current) {
+            // unchanged lines still share the snapshot's content
+            if (line.shared_content() != job.shared_line(i) &&
+                line.content() != job.line(i))
+            { continue; }
+            // and must still be entered in the state they were modeled from,
+            // which every line after depends on
+            const auto entry_state = (i == 0) ? CodeModeler::State() :
+                textlines.lines()[i - 1].modeler_exit_state();
+            if (!(results->images[i].modeler_entry_state() == entry_state))
+                break;
+        }
+        textlines.take_model_of(int(i), results->images[i]);
+        any_taken = true;
+    }
+    return any_taken;
+}
+
+bool BackgroundModeler::is_working() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_working || m_pending_job;
+}
+
+ModelCache::Statistics BackgroundModeler::cache_statistics() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_cache_statistics;
+}
+
+/* static */ void BackgroundModeler::run_tests()
+    { run_background_modeler_tests(); }
+
+/* private */ void BackgroundModeler::run_worker() {
+    while (true) {
+        std::shared_ptr<const Job> job;
+        {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_job_posted.wait(lock, [this]()
+            { return m_stop_requested || m_pending_job; });
+        if (m_stop_requested) return;
+        job.swap(m_pending_job);
+        m_working = true;
+        }
+        auto results = model_job(job);
+        auto stats = m_modeler.cache_statistics();
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cache_statistics = stats;
+        m_working = false;
+        if (results) m_finished = std::move(results);
+    }
+}
+
+/* private */ std::unique_ptr<BackgroundModeler::Results>
+    BackgroundModeler::model_job(std::shared_ptr<const Job> job)
+{
+    assert(job);
+    std::unique_ptr<Results> results(new Results());
+    results->job = job;
+    auto should_abandon = [this]() { return has_newer_job(); };
+    if (!m_modeler.model(job->lines, job->lines.width_constraint(),
+                         results->images, should_abandon))
+        return nullptr;
+    return results;
+}
+
+/* private */ bool BackgroundModeler::has_newer_job() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_stop_requested || m_pending_job;
+}
+
+namespace {
+
+std::unique_ptr<CodeModeler> make_lua_modeler()
+    { return std::unique_ptr<CodeModeler>(new LuaCodeModeler()); }
+
+void wait_on(const BackgroundModeler & modeler) {
+    while (modeler.is_working())
+        std::this_thread::yield();
+}
+
+void run_background_modeler_tests() {
+    // all lines are modeled
+    {
+    TextLines tlines(U"local a = 1\n-- comment\nreturn a");
+    tlines.constrain_to_width(80);
+    BackgroundModeler modeler(make_lua_modeler);
+    modeler.post(tlines);
+    wait_on(modeler);
+    assert(modeler.apply_results_to(tlines));
+    for (const auto & line : tlines.lines())
+        assert(!line.needs_modeling());
+    // nothing new to give
+    assert(!modeler.apply_results_to(tlines));
+    }
+    // a line edited after posting keeps its plain coloring, the rest take
+    // their results
+    {
+    TextLines tlines(U"local a = 1\nlocal b = 2");
+    tlines.constrain_to_width(80);
+    BackgroundModeler modeler(make_lua_modeler);
+    modeler.post(tlines);
+    tlines.push(Cursor(1, 0), U' ');
+    wait_on(modeler);
+    assert(modeler.apply_results_to(tlines));
+    assert(!tlines.lines()[0].needs_modeling());
+    assert( tlines.lines()[1].needs_modeling());
+    // idle and behind, so this posts
+    assert( modeler.post_if_idle(tlines));
+    wait_on(modeler);
+    assert(!modeler.post_if_idle(tlines));
+    assert( modeler.apply_results_to(tlines));
+    assert(!tlines.lines()[1].needs_modeling());
+    // the unchanged first line came from the cache
+    assert(modeler.cache_statistics().hits == 1);
+    }
+    // results for another width are discarded
+    {
+    TextLines tlines(U"local a = 1");
+    tlines.constrain_to_width(80);
+    BackgroundModeler modeler(make_lua_modeler);
+    modeler.post(tlines);
+    wait_on(modeler);
+    tlines.constrain_to_width(40);
+    assert(!modeler.apply_results_to(tlines));
+    assert(tlines.lines()[0].needs_modeling());
+    }
+    // stale results entered in another state than the lines now are (after
+    // an edit opened a string above them) are not taken
+    {
+    std::u32string content = U"local x = 1";
+    for (int i = 1; i != 50; ++i) content += U"\nlocal x = 1";
+    TextLines tlines(content);
+    tlines.constrain_to_width(80);
+    BackgroundModeler modeler(make_lua_modeler);
+    modeler.post(tlines);
+    wait_on(modeler);
+    static const std::u32string opening = U"s = [[";
+    tlines.deposit_chatacters_to(opening.data(), opening.data() + opening.size(), Cursor());
+    ModelingScheduler scheduler(make_lua_modeler());
+    while (scheduler.advance(tlines, 0, 10)) {}
+    (void)modeler.apply_results_to(tlines);
+    TextLines fresh(tlines.copy_characters_from(Cursor(), tlines.end_cursor()));
+    fresh.constrain_to_width(80);
+    LuaCodeModeler lcm;
+    fresh.update_modeler(lcm);
+    for (std::size_t i = 0; i != fresh.lines().size(); ++i)
+        assert(tlines.lines()[i].image() == fresh.lines()[i].image());
+    }
+}
+
+} // end of <anonymous> namespace
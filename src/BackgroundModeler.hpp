@@ -0,0 +1,108 @@
+/****************************************************************************
+
+    File: BackgroundModeler.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "TextLineImage.hpp"
+#include "ParallelModeler.hpp"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class TextLines;
+
+/** Runs a CodeModeler over a snapshot of some TextLines' content on a worker
+ *  thread, so that modeling large documents does not stall the UI thread.
+ *
+ *  Results are only ever handed to the TextLines on the thread calling
+ *  apply_results_to. A line takes its result only if the TextLines is still
+ *  at the version that was posted, or if that line's content is unchanged
+ *  and its result was modeled from the exit state the line before now has.
+ *  Once an unchanged line's result was entered differently, no line after
+ *  it takes a result.
+ *
+ *  Large documents are split across several threads with a ParallelModeler.
+ */
+class BackgroundModeler {
+public:
+    using ModelerFactory = ParallelModeler::ModelerFactory;
+
+    explicit BackgroundModeler
+        (ModelerFactory,
+         int thread_count = ParallelModeler::HARDWARE_THREAD_COUNT);
+    BackgroundModeler(const BackgroundModeler &) = delete;
+    BackgroundModeler & operator = (const BackgroundModeler &) = delete;
+    ~BackgroundModeler();
+
+    /** Takes a snapshot of the given lines and models it on the worker
+     *  thread. Any job the worker has not yet finished is abandoned.
+     */
+    void post(const TextLines &);
+
+    /** Posts the given lines only if the worker has nothing to do, and they
+     *  have changed since they were last posted.
+     *  @return true if the lines were posted
+     */
+    bool post_if_idle(const TextLines &);
+
+    /** @return true if any line took new tokens */
+    bool apply_results_to(TextLines &);
+
+    /** @return true if a posted job is still being modeled */
+    bool is_working() const;
+
+    /** @return the worker's cache statistics as of its last finished job */
+    ModelCache::Statistics cache_statistics() const;
+
+    static void run_tests();
+private:
+    struct Job {
+        TextLinesSnapshot lines;
+    };
+    struct Results {
+        std::shared_ptr<const Job> job;
+        std::vector<TextLineImage> images;
+    };
+
+    void run_worker();
+    // @return nullptr if the job was abandoned
+    std::unique_ptr<Results> model_job(std::shared_ptr<const Job>);
+    bool has_newer_job() const;
+
+    ParallelModeler m_modeler;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_job_posted;
+    std::shared_ptr<const Job> m_pending_job;
+    std::unique_ptr<Results> m_finished;
+    bool m_working;
+    bool m_stop_requested;
+    bool m_has_posted;
+    std::size_t m_posted_version;
+    ModelCache::Statistics m_cache_statistics;
+
+    // must be last, the worker may only start once everything else is ready
+    std::thread m_worker;
+};
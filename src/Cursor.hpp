@@ -36,10 +36,26 @@ struct Cursor {
     bool operator != (const Cursor & lhs) const
         { return line != lhs.line || column != lhs.column; }
 
+    // in reading order
+    bool operator < (const Cursor & lhs) const
+        { return line < lhs.line || (line == lhs.line && column < lhs.column); }
+
     int line;
     int column;
 };
 
+/** The characters from begin up to (not including) end. */
+struct CursorRange {
+    CursorRange() {}
+    CursorRange(Cursor begin_, Cursor end_): begin(begin_), end(end_) {}
+
+    bool operator == (const CursorRange & rhs) const
+        { return begin == rhs.begin && end == rhs.end; }
+
+    Cursor begin;
+    Cursor end;
+};
+
 struct CursorHasher {
     std::size_t operator () (const Cursor & rhs) const
         { return std::size_t(rhs.line*3753 ^ rhs.column); }
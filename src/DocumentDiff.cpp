@@ -0,0 +1,856 @@
+/****************************************************************************
+
+    File: DocumentDiff.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "DocumentDiff.hpp"
+#include "TextLines.hpp"
+#include "TextLinesSnapshot.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <memory>
+
+#include <cassert>
+
+namespace {
+
+using LineHunk = DocumentDiff::LineHunk;
+using Change   = DocumentDiff::Change;
+// runs of differing characters are kept as LineHunks too, by offset
+using Hunk     = DocumentDiff::LineHunk;
+using Index    = std::ptrdiff_t;
+
+// searches for the middle snake give up (and take the furthest path found)
+// past the square root of the elements compared, or this, whichever is more
+constexpr const Index MIN_MAX_COST = 256;
+
+// Lines are first compared as they are, which is quickest when few differ
+// (as is most often the case). Should that take more than this much work for
+// each line, it is given up, and lines with no equal in the other document
+// are set aside before trying again.
+constexpr const Index WORK_PER_LINE = 32;
+constexpr const Index MIN_WORK      = 64*1024;
+
+/** Myers' algorithm in linear space, finding which elements of two sequences
+ *  are not matched with any of the other.
+ *
+ *  Ranges are split on the middle of the shortest edit path between them
+ *  (found searching from both ends at once), until what is left of either
+ *  side is empty.
+ *
+ *  Elements are compared by position, by a function object which takes
+ *  signature: bool(*)(Index a_position, Index b_position)
+ */
+template <typename Equal>
+class MyersDiff {
+public:
+    static constexpr const Index NO_WORK_LIMIT = std::numeric_limits<Index>::max();
+
+    /** @param work_limit is roughly how many elements may be compared before
+     *                    the search is abandoned
+     */
+    MyersDiff(Equal equal, std::size_t a_size, std::size_t b_size,
+              Index work_limit = NO_WORK_LIMIT);
+
+    /** @return false if the search was abandoned, in which case nothing else
+     *          is meaningful
+     */
+    bool completed() const { return m_work <= m_work_limit; }
+
+    const std::vector<char> & a_changed() const { return m_a_changed; }
+    const std::vector<char> & b_changed() const { return m_b_changed; }
+
+private:
+    struct Split { Index a, b; };
+
+    void compare(Index a_beg, Index a_end, Index b_beg, Index b_end);
+    Split split(Index a_beg, Index a_end, Index b_beg, Index b_end);
+
+    // furthest a reached on a diagonal (a - b), from either end
+    Index & forward (Index diagonal) { return m_forward [diagonal + m_diagonal_offset]; }
+    Index & backward(Index diagonal) { return m_backward[diagonal + m_diagonal_offset]; }
+
+    Equal m_equal;
+    std::vector<char> m_a_changed;
+    std::vector<char> m_b_changed;
+    // (every entry is written before it is read)
+    std::unique_ptr<Index[]> m_forward;
+    std::unique_ptr<Index[]> m_backward;
+    Index m_diagonal_offset;
+    Index m_max_cost;
+    Index m_work;
+    Index m_work_limit;
+};
+
+template <typename T>
+struct ElementsEqual {
+    const T * a;
+    const T * b;
+    bool operator () (Index i, Index j) const { return a[i] == b[j]; }
+};
+
+// lines of a TextLines, whose hashes are kept by the lines themselves
+class TextLinesSide {
+public:
+    // lines are large, so their hashes are gathered together to be searched
+    // rather than lines being looked at again and again
+    static constexpr const bool SEARCHED_BY_HASH = true;
+
+    explicit TextLinesSide(const TextLines & tlines): m_lines(tlines.lines()) {}
+    // a document always has at least one line, if only an empty one
+    std::size_t size() const { return std::max(m_lines.size(), std::size_t(1)); }
+    const std::u32string & content(std::size_t) const;
+    std::uint64_t hash(std::size_t) const;
+private:
+    const std::vector<TextLine> & m_lines;
+};
+
+// lines of a snapshot, hashed only as they are needed
+class SnapshotSide {
+public:
+    static constexpr const bool SEARCHED_BY_HASH = false;
+
+    explicit SnapshotSide(const TextLinesSnapshot &);
+    std::size_t size() const { return m_lines.size(); }
+    const std::u32string & content(std::size_t idx) const { return *m_lines[idx]; }
+    std::uint64_t hash(std::size_t) const;
+private:
+    std::vector<const std::u32string *> m_lines;
+    // each plus one, so that zero is not yet hashed
+    mutable std::vector<std::uint64_t> m_hashes;
+};
+
+// Lines sharing their content are equal without even looking at it, lines of
+// differing lengths are not, and only failing either are their hashes
+// compared.
+template <typename Side>
+bool same_line(const Side & old_side, std::size_t i,
+               const Side & new_side, std::size_t j);
+
+// lines of each side from the same (leading) offset
+template <typename Side>
+struct LinesEqual {
+    const Side & old_side;
+    const Side & new_side;
+    std::size_t offset;
+    bool operator () (Index i, Index j) const {
+        return same_line(old_side, offset + std::size_t(i),
+                         new_side, offset + std::size_t(j));
+    }
+};
+
+/** A set of line hashes (which are already well mixed), open addressed,
+ *  which is much cheaper to build than a node based set.
+ */
+class HashSet {
+public:
+    HashSet(const std::uint64_t * beg, const std::uint64_t * end);
+    bool contains(std::uint64_t) const;
+private:
+    // hashes are under 2^61, each is kept plus one so that zero is empty
+    std::vector<std::uint64_t> m_slots;
+    std::size_t m_mask;
+};
+
+const std::u32string & empty_string();
+
+// marks every line which is not matched, old and new have no lines in common
+// at either end
+void mark_changed_lines(const std::uint64_t * old_hashes, std::size_t old_size,
+                        const std::uint64_t * new_hashes, std::size_t new_size,
+                        std::vector<char> & old_changed,
+                        std::vector<char> & new_changed);
+
+// as mark_changed_lines, setting aside lines with no equal on the other side
+// before searching (without limit) for how the rest are matched
+void mark_changed_matchable_lines
+    (const std::uint64_t * old_hashes, std::size_t old_size,
+     const std::uint64_t * new_hashes, std::size_t new_size,
+     std::vector<char> & old_changed, std::vector<char> & new_changed);
+
+Index work_limit_for(std::size_t old_size, std::size_t new_size);
+
+// @return runs of changed elements, each offset by the given amount
+std::vector<Hunk> hunks_from(const std::vector<char> & old_changed,
+                             const std::vector<char> & new_changed,
+                             std::size_t offset);
+
+template <typename Side>
+std::vector<LineHunk> diff_sides(const Side & old_side, const Side & new_side);
+
+template <typename Side>
+std::vector<Change> changes_of(const Side & old_side, const Side & new_side);
+
+// @return the range of the given lines (see DocumentDiff::Change), whose
+//         characters are written to text
+template <typename Side>
+CursorRange range_of_lines(const Side &, std::size_t beg, std::size_t end,
+                           std::u32string & text);
+
+// compares the characters of changed lines, adding what differs to changes
+void refine(CursorRange old_range, const std::u32string & old_text,
+            CursorRange new_range, const std::u32string & new_text,
+            std::vector<Change> & changes);
+
+void run_document_diff_tests();
+
+} // end of <anonymous> namespace
+
+/* static */ constexpr const std::size_t DocumentDiff::MAX_REFINED_LENGTH;
+/* static */ constexpr const std::size_t DocumentDiff::MIN_MATCHING_RUN;
+
+/* static */ std::vector<DocumentDiff::LineHunk> DocumentDiff::diff_lines
+    (const std::vector<std::uint64_t> & old_hashes,
+     const std::vector<std::uint64_t> & new_hashes)
+{
+    // lines in common at either end are set aside first
+    std::size_t leading = 0;
+    while (leading != old_hashes.size() && leading != new_hashes.size() &&
+           old_hashes[leading] == new_hashes[leading])
+    { ++leading; }
+    std::size_t trailing = 0;
+    while (trailing != old_hashes.size() - leading &&
+           trailing != new_hashes.size() - leading &&
+           old_hashes[old_hashes.size() - 1 - trailing] ==
+           new_hashes[new_hashes.size() - 1 - trailing])
+    { ++trailing; }
+    std::vector<char> old_changed(old_hashes.size() - leading - trailing, 0);
+    std::vector<char> new_changed(new_hashes.size() - leading - trailing, 0);
+    mark_changed_lines(old_hashes.data() + leading, old_changed.size(),
+                       new_hashes.data() + leading, new_changed.size(),
+                       old_changed, new_changed);
+    return hunks_from(old_changed, new_changed, leading);
+}
+
+/* static */ std::vector<DocumentDiff::LineHunk> DocumentDiff::diff_lines
+    (const TextLines & old_lines, const TextLines & new_lines)
+{ return diff_sides(TextLinesSide(old_lines), TextLinesSide(new_lines)); }
+
+/* static */ std::vector<DocumentDiff::LineHunk> DocumentDiff::diff_lines
+    (const TextLinesSnapshot & old_lines, const TextLinesSnapshot & new_lines)
+{ return diff_sides(SnapshotSide(old_lines), SnapshotSide(new_lines)); }
+
+/* static */ std::vector<DocumentDiff::Change> DocumentDiff::diff
+    (const TextLines & old_lines, const TextLines & new_lines)
+{ return changes_of(TextLinesSide(old_lines), TextLinesSide(new_lines)); }
+
+/* static */ std::vector<DocumentDiff::Change> DocumentDiff::diff
+    (const TextLinesSnapshot & old_lines, const TextLinesSnapshot & new_lines)
+{ return changes_of(SnapshotSide(old_lines), SnapshotSide(new_lines)); }
+
+/* static */ void DocumentDiff::run_tests() { run_document_diff_tests(); }
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+template <typename Equal>
+/* static */ constexpr const Index MyersDiff<Equal>::NO_WORK_LIMIT;
+
+template <typename Equal>
+MyersDiff<Equal>::MyersDiff
+    (Equal equal, std::size_t a_size, std::size_t b_size, Index work_limit):
+    m_equal          (equal),
+    m_a_changed      (a_size, 0),
+    m_b_changed      (b_size, 0),
+    // diagonals run from -b_size to a_size, with one more on either side
+    m_forward        (new Index[a_size + b_size + 3]),
+    m_backward       (new Index[a_size + b_size + 3]),
+    m_diagonal_offset(Index(b_size) + 1),
+    m_max_cost       (std::max(MIN_MAX_COST,
+                               Index(std::sqrt(double(a_size + b_size + 3))))),
+    m_work           (0),
+    m_work_limit     (work_limit)
+{ compare(0, Index(a_size), 0, Index(b_size)); }
+
+template <typename Equal>
+void MyersDiff<Equal>::compare(Index a_beg, Index a_end, Index b_beg, Index b_end) {
+    // the second half of each split is taken on here, rather than recursed
+    // into
+    while (completed()) {
+        for (; a_beg != a_end && b_beg != b_end && m_equal(a_beg, b_beg);
+             ++a_beg, ++b_beg) {}
+        for (; a_beg != a_end && b_beg != b_end && m_equal(a_end - 1, b_end - 1);
+             --a_end, --b_end) {}
+        if (a_beg != a_end && b_beg != b_end) {
+            const auto mid = split(a_beg, a_end, b_beg, b_end);
+            // should the split not divide the ranges, everything left is
+            // taken as changed
+            const bool divides = (mid.a != a_beg || mid.b != b_beg) &&
+                                 (mid.a != a_end || mid.b != b_end);
+            if (divides) {
+                compare(a_beg, mid.a, b_beg, mid.b);
+                a_beg = mid.a;
+                b_beg = mid.b;
+                continue;
+            }
+        }
+        std::fill(m_a_changed.begin() + a_beg, m_a_changed.begin() + a_end, 1);
+        std::fill(m_b_changed.begin() + b_beg, m_b_changed.begin() + b_end, 1);
+        return;
+    }
+}
+
+template <typename Equal>
+typename MyersDiff<Equal>::Split MyersDiff<Equal>::split
+    (Index a_beg, Index a_end, Index b_beg, Index b_end)
+{
+    static constexpr const Index NOWHERE = std::numeric_limits<Index>::max();
+    const Index min_diagonal = a_beg - b_end;
+    const Index max_diagonal = a_end - b_beg;
+    const Index forward_mid  = a_beg - b_beg;
+    const Index backward_mid = a_end - b_end;
+    // paths from either end only meet on the forward search's turn if the
+    // difference in their diagonals is odd
+    const bool odd = ((forward_mid - backward_mid) & 1) != 0;
+    Index forward_min  = forward_mid , forward_max  = forward_mid ;
+    Index backward_min = backward_mid, backward_max = backward_mid;
+    forward (forward_mid ) = a_beg;
+    backward(backward_mid) = a_end;
+
+    for (Index cost = 1; ; ++cost) {
+        // one more difference, searched for forward...
+        if (forward_min > min_diagonal) forward(--forward_min - 1) = -1;
+        else ++forward_min;
+        if (forward_max < max_diagonal) forward(++forward_max + 1) = -1;
+        else --forward_max;
+        for (Index k = forward_max; k >= forward_min; k -= 2) {
+            Index a = forward(k - 1) >= forward(k + 1) ? forward(k - 1) + 1 :
+                                                         forward(k + 1);
+            Index b = a - k;
+            const Index from = a;
+            for (; a < a_end && b < b_end && m_equal(a, b); ++a, ++b) {}
+            m_work += a - from + 1;
+            forward(k) = a;
+            if (odd && backward_min <= k && k <= backward_max && backward(k) <= a)
+                return Split { a, b };
+        }
+        // ...then backward
+        if (backward_min > min_diagonal) backward(--backward_min - 1) = NOWHERE;
+        else ++backward_min;
+        if (backward_max < max_diagonal) backward(++backward_max + 1) = NOWHERE;
+        else --backward_max;
+        for (Index k = backward_max; k >= backward_min; k -= 2) {
+            Index a = backward(k - 1) < backward(k + 1) ? backward(k - 1) :
+                                                          backward(k + 1) - 1;
+            Index b = a - k;
+            const Index from = a;
+            for (; a > a_beg && b > b_beg && m_equal(a - 1, b - 1); --a, --b) {}
+            m_work += from - a + 1;
+            backward(k) = a;
+            if (!odd && forward_min <= k && k <= forward_max && a <= forward(k))
+                return Split { a, b };
+        }
+        // abandoned, the split is of no consequence
+        if (!completed()) return Split { a_beg, b_beg };
+        if (cost < m_max_cost) continue;
+
+        // Too costly to go on, the split is made where either search got the
+        // furthest. Both halves are still compared, so the result is correct
+        // (if not minimal).
+        Index forward_best = -1, forward_best_a = -1;
+        for (Index k = forward_max; k >= forward_min; k -= 2) {
+            Index a = std::min(forward(k), a_end);
+            Index b = a - k;
+            if (b > b_end) {
+                a = b_end + k;
+                b = b_end;
+            }
+            if (a + b > forward_best) {
+                forward_best   = a + b;
+                forward_best_a = a;
+            }
+        }
+        Index backward_best = NOWHERE, backward_best_a = NOWHERE;
+        for (Index k = backward_max; k >= backward_min; k -= 2) {
+            Index a = std::max(a_beg, backward(k));
+            Index b = a - k;
+            if (b < b_beg) {
+                a = b_beg + k;
+                b = b_beg;
+            }
+            if (a + b < backward_best) {
+                backward_best   = a + b;
+                backward_best_a = a;
+            }
+        }
+        if ((a_end + b_end) - backward_best < forward_best - (a_beg + b_beg))
+            return Split { forward_best_a, forward_best - forward_best_a };
+        return Split { backward_best_a, backward_best - backward_best_a };
+    }
+}
+
+const std::u32string & TextLinesSide::content(std::size_t idx) const {
+    if (m_lines.empty()) return empty_string();
+    return *m_lines[idx].shared_content();
+}
+
+std::uint64_t TextLinesSide::hash(std::size_t idx) const
+    { return m_lines.empty() ? 0 : m_lines[idx].hash(); }
+
+/* explicit */ SnapshotSide::SnapshotSide(const TextLinesSnapshot & snapshot) {
+    m_lines.reserve(snapshot.line_count());
+    snapshot.for_each_line([this](const std::u32string & line)
+        { m_lines.push_back(&line); });
+    if (m_lines.empty()) m_lines.push_back(&empty_string());
+    m_hashes.resize(m_lines.size(), 0);
+}
+
+std::uint64_t SnapshotSide::hash(std::size_t idx) const {
+    if (m_hashes[idx] == 0) {
+        const auto & line = *m_lines[idx];
+        m_hashes[idx] = TextLine::hash_of(line.data(), line.data() + line.size()) + 1;
+    }
+    return m_hashes[idx] - 1;
+}
+
+template <typename Side>
+bool same_line(const Side & old_side, std::size_t i,
+               const Side & new_side, std::size_t j)
+{
+    const auto & old_line = old_side.content(i);
+    const auto & new_line = new_side.content(j);
+    return &old_line == &new_line ||
+           (old_line.size() == new_line.size() &&
+            old_side.hash(i) == new_side.hash(j));
+}
+
+HashSet::HashSet(const std::uint64_t * beg, const std::uint64_t * end) {
+    // at most half full
+    std::size_t capacity = 16;
+    while (capacity < std::size_t(end - beg)*2) capacity *= 2;
+    m_slots.resize(capacity, 0);
+    m_mask = capacity - 1;
+    for (; beg != end; ++beg) {
+        auto slot = std::size_t(*beg) & m_mask;
+        for (; m_slots[slot] != 0 && m_slots[slot] != *beg + 1; slot = (slot + 1) & m_mask) {}
+        m_slots[slot] = *beg + 1;
+    }
+}
+
+bool HashSet::contains(std::uint64_t hash) const {
+    auto slot = std::size_t(hash) & m_mask;
+    for (; m_slots[slot] != 0; slot = (slot + 1) & m_mask) {
+        if (m_slots[slot] == hash + 1) return true;
+    }
+    return false;
+}
+
+const std::u32string & empty_string() {
+    static const std::u32string instance;
+    return instance;
+}
+
+void mark_changed_lines(const std::uint64_t * old_hashes, std::size_t old_size,
+                        const std::uint64_t * new_hashes, std::size_t new_size,
+                        std::vector<char> & old_changed,
+                        std::vector<char> & new_changed)
+{
+    MyersDiff<ElementsEqual<std::uint64_t>> myers
+        (ElementsEqual<std::uint64_t> { old_hashes, new_hashes }, old_size,
+         new_size, work_limit_for(old_size, new_size));
+    if (myers.completed()) {
+        old_changed = myers.a_changed();
+        new_changed = myers.b_changed();
+        return;
+    }
+    mark_changed_matchable_lines(old_hashes, old_size, new_hashes, new_size,
+                                 old_changed, new_changed);
+}
+
+void mark_changed_matchable_lines
+    (const std::uint64_t * old_hashes, std::size_t old_size,
+     const std::uint64_t * new_hashes, std::size_t new_size,
+     std::vector<char> & old_changed, std::vector<char> & new_changed)
+{
+    // Lines with no equal in the other document are changed whatever else is,
+    // so they are left out of the search. Documents which are very different
+    // are mostly settled here.
+    const HashSet old_set(old_hashes, old_hashes + old_size);
+    const HashSet new_set(new_hashes, new_hashes + new_size);
+    std::vector<std::uint64_t> old_kept, new_kept;
+    std::vector<std::size_t> old_positions, new_positions;
+    auto keep_matchable = [](const std::uint64_t * hashes, std::size_t size,
+                             const HashSet & others,
+                             std::vector<std::uint64_t> & kept,
+                             std::vector<std::size_t> & positions,
+                             std::vector<char> & changed)
+    {
+        for (std::size_t i = 0; i != size; ++i) {
+            if (others.contains(hashes[i])) {
+                kept     .push_back(hashes[i]);
+                positions.push_back(i);
+            } else {
+                changed[i] = 1;
+            }
+        }
+    };
+    keep_matchable(old_hashes, old_size, new_set, old_kept, old_positions, old_changed);
+    keep_matchable(new_hashes, new_size, old_set, new_kept, new_positions, new_changed);
+
+    MyersDiff<ElementsEqual<std::uint64_t>> myers
+        (ElementsEqual<std::uint64_t> { old_kept.data(), new_kept.data() },
+         old_kept.size(), new_kept.size());
+    for (std::size_t i = 0; i != old_kept.size(); ++i)
+        old_changed[old_positions[i]] = myers.a_changed()[i];
+    for (std::size_t i = 0; i != new_kept.size(); ++i)
+        new_changed[new_positions[i]] = myers.b_changed()[i];
+}
+
+std::vector<Hunk> hunks_from(const std::vector<char> & old_changed,
+                             const std::vector<char> & new_changed,
+                             std::size_t offset)
+{
+    // unchanged elements of either are matched in order, one for one
+    std::vector<Hunk> hunks;
+    std::size_t i = 0, j = 0;
+    while (i != old_changed.size() || j != new_changed.size()) {
+        if (i != old_changed.size() && j != new_changed.size() &&
+            !old_changed[i] && !new_changed[j])
+        {
+            ++i, ++j;
+            continue;
+        }
+        Hunk hunk { i, i, j, j };
+        while (hunk.old_end != old_changed.size() && old_changed[hunk.old_end])
+            ++hunk.old_end;
+        while (hunk.new_end != new_changed.size() && new_changed[hunk.new_end])
+            ++hunk.new_end;
+        i = hunk.old_end;
+        j = hunk.new_end;
+        hunks.push_back(Hunk { hunk.old_begin + offset, hunk.old_end + offset,
+                               hunk.new_begin + offset, hunk.new_end + offset });
+    }
+    return hunks;
+}
+
+Index work_limit_for(std::size_t old_size, std::size_t new_size)
+    { return std::max(MIN_WORK, Index(old_size + new_size)*WORK_PER_LINE); }
+
+template <typename Side>
+std::vector<LineHunk> diff_sides(const Side & old_side, const Side & new_side) {
+    const auto old_size = old_side.size();
+    const auto new_size = new_side.size();
+    std::size_t leading = 0;
+    while (leading != old_size && leading != new_size &&
+           same_line(old_side, leading, new_side, leading))
+    { ++leading; }
+    std::size_t trailing = 0;
+    while (trailing != old_size - leading && trailing != new_size - leading &&
+           same_line(old_side, old_size - 1 - trailing,
+                     new_side, new_size - 1 - trailing))
+    { ++trailing; }
+
+    // otherwise the lines left between are searched as they are, so that
+    // only lines the search looks at (and which do not share their content)
+    // are hashed
+    const auto old_left = old_size - leading - trailing;
+    const auto new_left = new_size - leading - trailing;
+    if (!Side::SEARCHED_BY_HASH) {
+        MyersDiff<LinesEqual<Side>> myers
+            (LinesEqual<Side> { old_side, new_side, leading }, old_left, new_left,
+             work_limit_for(old_left, new_left));
+        if (myers.completed())
+            return hunks_from(myers.a_changed(), myers.b_changed(), leading);
+    }
+    std::vector<char> old_changed(old_left, 0), new_changed(new_left, 0);
+    std::vector<std::uint64_t> old_hashes, new_hashes;
+    old_hashes.reserve(old_left);
+    new_hashes.reserve(new_left);
+    for (auto i = leading; i != old_size - trailing; ++i)
+        old_hashes.push_back(old_side.hash(i));
+    for (auto i = leading; i != new_size - trailing; ++i)
+        new_hashes.push_back(new_side.hash(i));
+    if (Side::SEARCHED_BY_HASH) {
+        mark_changed_lines(old_hashes.data(), old_left, new_hashes.data(),
+                           new_left, old_changed, new_changed);
+    } else {
+        // too different to search as they were
+        mark_changed_matchable_lines(old_hashes.data(), old_left, new_hashes.data(),
+                                     new_left, old_changed, new_changed);
+    }
+    return hunks_from(old_changed, new_changed, leading);
+}
+
+template <typename Side>
+std::vector<Change> changes_of(const Side & old_side, const Side & new_side) {
+    std::vector<Change> changes;
+    std::u32string old_text, new_text;
+    for (const auto & hunk : diff_sides(old_side, new_side)) {
+        const auto old_range = range_of_lines(old_side, hunk.old_begin, hunk.old_end, old_text);
+        const auto new_range = range_of_lines(new_side, hunk.new_begin, hunk.new_end, new_text);
+        refine(old_range, old_text, new_range, new_text, changes);
+    }
+    return changes;
+}
+
+template <typename Side>
+CursorRange range_of_lines(const Side & side, std::size_t beg, std::size_t end,
+                           std::u32string & text)
+{
+    text.clear();
+    if (end != side.size()) {
+        // each line with the new line ending it
+        for (auto i = beg; i != end; ++i) {
+            text += side.content(i);
+            text += TextLines::NEW_LINE;
+        }
+        return CursorRange(Cursor(int(beg), 0), Cursor(int(end), 0));
+    }
+    // the last line has no new line of its own, so the one ending the line
+    // before is taken instead (if there is one)
+    const Cursor last_end(int(end - 1), int(side.content(end - 1).size()));
+    if (beg == 0) {
+        for (auto i = beg; i != end; ++i) {
+            if (i != beg) text += TextLines::NEW_LINE;
+            text += side.content(i);
+        }
+        return CursorRange(Cursor(), last_end);
+    }
+    for (auto i = beg; i != end; ++i) {
+        text += TextLines::NEW_LINE;
+        text += side.content(i);
+    }
+    return CursorRange(Cursor(int(beg - 1), int(side.content(beg - 1).size())),
+                       last_end);
+}
+
+void refine(CursorRange old_range, const std::u32string & old_text,
+            CursorRange new_range, const std::u32string & new_text,
+            std::vector<Change> & changes)
+{
+    if (old_text.empty() || new_text.empty() ||
+        old_text.size() > DocumentDiff::MAX_REFINED_LENGTH ||
+        new_text.size() > DocumentDiff::MAX_REFINED_LENGTH)
+    {
+        changes.push_back(Change { old_range, new_range });
+        return;
+    }
+    MyersDiff<ElementsEqual<UChar>> myers
+        (ElementsEqual<UChar> { old_text.data(), new_text.data() },
+         old_text.size(), new_text.size());
+    auto spans = hunks_from(myers.a_changed(), myers.b_changed(), 0);
+    // changes only a few matching characters apart read as one change
+    std::vector<Hunk> merged;
+    for (const auto & span : spans) {
+        if (!merged.empty() &&
+            span.old_begin - merged.back().old_end < DocumentDiff::MIN_MATCHING_RUN)
+        {
+            merged.back().old_end = span.old_end;
+            merged.back().new_end = span.new_end;
+        } else {
+            merged.push_back(span);
+        }
+    }
+    // offsets are turned into cursors walking forward through each text
+    struct Walker {
+        const std::u32string & text;
+        std::size_t offset;
+        Cursor cursor;
+        Cursor to(std::size_t target) {
+            for (; offset != target; ++offset) {
+                if (text[offset] == TextLines::NEW_LINE) {
+                    ++cursor.line;
+                    cursor.column = 0;
+                } else {
+                    ++cursor.column;
+                }
+            }
+            return cursor;
+        }
+    };
+    Walker old_walker { old_text, 0, old_range.begin };
+    Walker new_walker { new_text, 0, new_range.begin };
+    for (const auto & span : merged) {
+        const auto old_begin = old_walker.to(span.old_begin);
+        const auto old_end   = old_walker.to(span.old_end  );
+        const auto new_begin = new_walker.to(span.new_begin);
+        const auto new_end   = new_walker.to(span.new_end  );
+        changes.push_back(Change { CursorRange(old_begin, old_end),
+                                   CursorRange(new_begin, new_end) });
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+std::u32string content_of(const TextLines & tlines) {
+    if (tlines.lines().empty()) return std::u32string();
+    return tlines.copy_characters_from(Cursor(), tlines.end_cursor());
+}
+
+// applies the changes to a copy of old_lines
+std::u32string apply(const TextLines & old_lines, const TextLines & new_lines,
+                     const std::vector<Change> & changes)
+{
+    TextLines result(content_of(old_lines));
+    std::vector<CursorRange> ranges;
+    std::vector<std::u32string> replacements;
+    for (const auto & change : changes) {
+        ranges.push_back(change.old_range);
+        replacements.push_back(new_lines.copy_characters_from
+            (change.new_range.begin, change.new_range.end));
+    }
+    if (!ranges.empty()) result.replace_each(ranges, replacements);
+    return content_of(result);
+}
+
+// checks that the hunks are in order, apart, and account for every line
+void verify_hunks(const std::vector<std::uint64_t> & old_hashes,
+                  const std::vector<std::uint64_t> & new_hashes,
+                  const std::vector<LineHunk> & hunks)
+{
+    std::size_t i = 0, j = 0;
+    for (const auto & hunk : hunks) {
+        assert(hunk.old_begin - i == hunk.new_begin - j);
+        assert(hunk.old_begin <= hunk.old_end && hunk.new_begin <= hunk.new_end);
+        assert(hunk.old_begin != hunk.old_end || hunk.new_begin != hunk.new_end);
+        // none adjacent to the last
+        assert(&hunk == &hunks.front() || hunk.old_begin != i);
+        for (; i != hunk.old_begin; ++i, ++j) assert(old_hashes[i] == new_hashes[j]);
+        i = hunk.old_end;
+        j = hunk.new_end;
+    }
+    assert(old_hashes.size() - i == new_hashes.size() - j);
+    for (; i != old_hashes.size(); ++i, ++j) assert(old_hashes[i] == new_hashes[j]);
+}
+
+std::size_t count_changed(const std::vector<LineHunk> & hunks) {
+    std::size_t count = 0;
+    for (const auto & hunk : hunks)
+        count += (hunk.old_end - hunk.old_begin) + (hunk.new_end - hunk.new_begin);
+    return count;
+}
+
+std::size_t longest_common_subsequence(const std::vector<std::uint64_t> & a,
+                                       const std::vector<std::uint64_t> & b)
+{
+    std::vector<std::size_t> row(b.size() + 1, 0), prev(b.size() + 1, 0);
+    for (std::size_t i = 1; i <= a.size(); ++i) {
+        for (std::size_t j = 1; j <= b.size(); ++j) {
+            row[j] = a[i - 1] == b[j - 1] ? prev[j - 1] + 1 :
+                                            std::max(prev[j], row[j - 1]);
+        }
+        std::swap(row, prev);
+    }
+    return prev[b.size()];
+}
+
+void run_document_diff_tests() {
+    unsigned seed = 5;
+    auto next_random = [&seed](unsigned limit) {
+        seed = seed*1103515245u + 12345u;
+        return (seed >> 8) % limit;
+    };
+    // minimal, against the longest common subsequence
+    for (int round = 0; round != 300; ++round) {
+        std::vector<std::uint64_t> a, b;
+        const auto symbols = 2 + next_random(6);
+        for (auto i = next_random(40); i != 0; --i) a.push_back(next_random(symbols));
+        b = a;
+        for (auto i = next_random(12); i != 0 && !b.empty(); --i) {
+            const auto at = next_random(unsigned(b.size()));
+            if (next_random(2)) b.erase(b.begin() + at);
+            else b.insert(b.begin() + at, next_random(symbols));
+        }
+        const auto hunks = DocumentDiff::diff_lines(a, b);
+        verify_hunks(a, b, hunks);
+        assert(count_changed(hunks) == a.size() + b.size() - 2*longest_common_subsequence(a, b));
+    }
+    // past what is searched for exactly, still correct
+    {
+    std::vector<std::uint64_t> a, b;
+    for (int i = 0; i != 6000; ++i) a.push_back(next_random(8));
+    for (int i = 0; i != 6000; ++i) b.push_back(next_random(8));
+    verify_hunks(a, b, DocumentDiff::diff_lines(a, b));
+    // and nothing in common at all
+    for (auto & hash : b) hash += 100;
+    const auto hunks = DocumentDiff::diff_lines(a, b);
+    assert(hunks.size() == 1 && count_changed(hunks) == 12000);
+    }
+    // documents too different to be searched as they are
+    {
+    static const std::u32string words[] =
+        { U"a", U"b", U"end", U"do", U"x = 1", U"", U"--", U"}" };
+    std::u32string old_text, new_text;
+    for (int i = 0; i != 3000; ++i) {
+        old_text += words[next_random(8)] + U"\n";
+        new_text += words[next_random(8)] + U"\n";
+    }
+    TextLines old_lines(old_text), new_lines(new_text);
+    assert(apply(old_lines, new_lines, DocumentDiff::diff(old_lines.snapshot(), new_lines.snapshot()))
+           == new_text);
+    assert(apply(old_lines, new_lines, DocumentDiff::diff(old_lines, new_lines)) == new_text);
+    }
+    // by character, within the lines which differ
+    {
+    TextLines old_lines(U"local a = 1\nlocal b = 2\nreturn a");
+    TextLines new_lines(U"local a = 1\nlocal c = 2\nreturn a");
+    const auto changes = DocumentDiff::diff(old_lines, new_lines);
+    assert(changes.size() == 1);
+    assert(changes[0].old_range == CursorRange(Cursor(1, 6), Cursor(1, 7)));
+    assert(changes[0].new_range == CursorRange(Cursor(1, 6), Cursor(1, 7)));
+    }
+    // lines added and removed at either end, and to and from nothing
+    for (const auto & texts : {
+        std::make_pair(std::u32string(U"a\nb"       ), std::u32string(U"a\nb\nc")),
+        std::make_pair(std::u32string(U"a\nb\nc"    ), std::u32string(U"a\nb"   )),
+        std::make_pair(std::u32string(U"x\na\nb"    ), std::u32string(U"a\nb"   )),
+        std::make_pair(std::u32string(U""           ), std::u32string(U"a\n\nb" )),
+        std::make_pair(std::u32string(U"a\nb\n"     ), std::u32string(U""       )),
+        std::make_pair(std::u32string(U"a\n\n\nb"   ), std::u32string(U"a\n\nb" )) })
+    {
+        TextLines old_lines(texts.first), new_lines(texts.second);
+        assert(apply(old_lines, new_lines, DocumentDiff::diff(old_lines, new_lines))
+               == texts.second);
+    }
+    // random documents, randomly changed, between documents and snapshots
+    for (int round = 0; round != 200; ++round) {
+        static const std::u32string words[] =
+            { U"", U"a", U"end", U"local c = 1", U"é", U"\t" };
+        std::u32string text;
+        for (auto i = next_random(30); i != 0; --i) {
+            text += words[next_random(6)];
+            text += next_random(3) ? U"\n" : U" ";
+        }
+        TextLines old_lines(text);
+        TextLines new_lines(text);
+        const auto before = new_lines.snapshot();
+        for (auto i = 1 + next_random(6); i != 0; --i) {
+            const auto at = new_lines.cursor_at(next_random(unsigned(text.size() + 1)));
+            if (next_random(2)) {
+                const auto inserted = words[next_random(6)] + U"\n";
+                new_lines.deposit_chatacters_to(inserted.data(), inserted.data() + inserted.size(), at);
+            } else {
+                new_lines.wipe(at, new_lines.constrain_cursor(Cursor(at.line + 1, 0)));
+            }
+            text = content_of(new_lines);
+        }
+        assert(apply(old_lines, new_lines, DocumentDiff::diff(old_lines, new_lines))
+               == content_of(new_lines));
+        TextLines from_snapshot(content_of(old_lines));
+        assert(apply(from_snapshot, new_lines, DocumentDiff::diff(before, new_lines.snapshot()))
+               == content_of(new_lines));
+        assert(DocumentDiff::diff(new_lines.snapshot(), new_lines.snapshot()).empty());
+        assert(DocumentDiff::diff_lines(new_lines, TextLines(content_of(new_lines))).empty());
+    }
+}
+
+} // end of <anonymous> namespace
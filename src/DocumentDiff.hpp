@@ -0,0 +1,101 @@
+/****************************************************************************
+
+    File: DocumentDiff.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "Cursor.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class TextLines;
+class TextLinesSnapshot;
+
+/** Finds where two documents differ, first by line and then by character
+ *  within the lines which differ.
+ *
+ *  Lines are compared by their 64-bit hashes (see TextLine::hash), lines
+ *  sharing their content are known to be equal without looking at it.
+ *  Lines common to the beginning and end of both are set aside, as are lines
+ *  of either whose hash appears nowhere in the other (they can not be
+ *  matched). What is left is compared with Myers' algorithm, in linear space
+ *  (by splitting on the "middle snake"). Where that search grows too costly
+ *  (over about the square root of the lines left), the furthest reaching
+ *  path found is split on instead, which gives up minimality (but never
+ *  correctness) for huge, very different inputs.
+ *
+ *  Each run of differing lines is then compared by character, in the same
+ *  way, if it is not too long.
+ */
+class DocumentDiff {
+public:
+    // runs of differing lines longer than this (in characters, for either
+    // document) are not compared by character
+    static constexpr const std::size_t MAX_REFINED_LENGTH = 64*1024;
+    // runs of matching characters shorter than this, between two changes
+    // within the same lines, are taken as part of one change
+    static constexpr const std::size_t MIN_MATCHING_RUN = 3;
+
+    /** Lines [old_begin, old_end) of the old document differ, and are
+     *  replaced by lines [new_begin, new_end) of the new one.
+     */
+    struct LineHunk {
+        std::size_t old_begin, old_end;
+        std::size_t new_begin, new_end;
+    };
+
+    /** The old document's characters in old_range are replaced by the new
+     *  document's characters in new_range.
+     *
+     *  Ranges of whole lines include the new line which ends each, except for
+     *  ranges at the end of a document, which instead include the new line
+     *  before them (if any).
+     */
+    struct Change {
+        CursorRange old_range;
+        CursorRange new_range;
+    };
+
+    /** @return runs of lines which differ, in order, none adjacent to another
+     */
+    static std::vector<LineHunk> diff_lines
+        (const std::vector<std::uint64_t> & old_hashes,
+         const std::vector<std::uint64_t> & new_hashes);
+
+    static std::vector<LineHunk> diff_lines(const TextLines & old_lines,
+                                            const TextLines & new_lines);
+
+    static std::vector<LineHunk> diff_lines(const TextLinesSnapshot & old_lines,
+                                            const TextLinesSnapshot & new_lines);
+
+    /** Replacing each old range with what is in its new range (say with
+     *  TextLines::replace_each) makes the old document the same as the new.
+     *  @return changes, by character, in order
+     */
+    static std::vector<Change> diff(const TextLines & old_lines,
+                                    const TextLines & new_lines);
+
+    static std::vector<Change> diff(const TextLinesSnapshot & old_lines,
+                                    const TextLinesSnapshot & new_lines);
+
+    static void run_tests();
+};
@@ -0,0 +1,344 @@
+/****************************************************************************
+
+    File: DocumentReader.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "DocumentReader.hpp"
+#include "TextLines.hpp"
+
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+#include <cassert>
+
+namespace {
+
+void run_document_reader_tests();
+
+} // end of <anonymous> namespace
+
+/* static */ constexpr const std::size_t DocumentReader::FIRST_CHUNK_SIZE;
+/* static */ constexpr const std::size_t DocumentReader::CHUNK_SIZE;
+/* static */ constexpr const std::size_t DocumentReader::MAX_QUEUED_CHUNKS;
+/* static */ constexpr const std::size_t DocumentReader::DEFAULT_APPEND_LIMIT;
+/* static */ constexpr const UChar DocumentReader::REPLACEMENT_CHARACTER;
+
+DocumentReader::DocumentReader():
+    m_file_size     (0),
+    m_bytes_appended(0),
+    m_reading       (false),
+    m_stop_requested(false)
+{}
+
+DocumentReader::~DocumentReader() { stop_worker(); }
+
+void DocumentReader::open(const std::string & filename) {
+    stop_worker();
+    m_chunks.clear();
+    m_file_size = m_bytes_appended = 0;
+    m_error.clear();
+    m_reading = true;
+    m_stop_requested = false;
+    m_worker = std::thread([this, filename]() { run_worker(filename); });
+}
+
+bool DocumentReader::append_loaded_to
+    (TextLines & textlines, std::size_t max_characters)
+{
+    std::u32string text;
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_chunks.empty() && text.size() < max_characters) {
+        auto & chunk = m_chunks.front();
+        if (text.empty()) text.swap(chunk.text);
+        else              text += chunk.text;
+        m_bytes_appended = chunk.end_offset;
+        m_chunks.pop_front();
+    }
+    }
+    m_chunk_taken.notify_one();
+    if (text.empty()) return false;
+    // chunks may end mid line, so each goes on the end of the last line
+    const auto & lines = textlines.lines();
+    const auto at = lines.empty() ? Cursor() :
+        Cursor(int(lines.size()) - 1, lines.back().content_length());
+    textlines.deposit_chatacters_to(text.data(), text.data() + text.size(), at);
+    return true;
+}
+
+bool DocumentReader::is_loading() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_reading || !m_chunks.empty();
+}
+
+double DocumentReader::progress() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_reading || !m_chunks.empty()) {
+        return m_file_size == 0 ? 0. :
+               double(m_bytes_appended) / double(m_file_size);
+    }
+    return 1.;
+}
+
+std::string DocumentReader::error() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_error;
+}
+
+/* static */ void DocumentReader::decode_utf8
+    (const char *& beg, const char * end, std::u32string & out)
+{
+    // never more characters than bytes, written straight into place
+    const auto old_size = out.size();
+    out.resize(old_size + std::size_t(end - beg));
+    UChar * dest = &out[0] + old_size;
+    while (beg != end) {
+        // runs of ASCII (most of most files) are taken eight bytes at a time
+        std::uint64_t eight;
+        if (end - beg >= 8 &&
+            (std::memcpy(&eight, beg, 8), (eight & 0x8080808080808080ull) == 0))
+        {
+            for (int i = 0; i != 8; ++i)
+                *dest++ = beg[i] ? UChar(std::uint8_t(beg[i])) : REPLACEMENT_CHARACTER;
+            beg += 8;
+            continue;
+        }
+        const auto lead = std::uint8_t(*beg);
+        if (lead < 0x80) {
+            *dest++ = lead ? UChar(lead) : REPLACEMENT_CHARACTER;
+            ++beg;
+            continue;
+        }
+        int length = 0;
+        std::uint32_t code = 0;
+        if      ((lead & 0xE0) == 0xC0) { length = 2; code = lead & 0x1F; }
+        else if ((lead & 0xF0) == 0xE0) { length = 3; code = lead & 0x0F; }
+        else if ((lead & 0xF8) == 0xF0) { length = 4; code = lead & 0x07; }
+        int i = 1;
+        for (; length != 0 && i != length && beg + i != end; ++i) {
+            const auto byte = std::uint8_t(beg[i]);
+            if ((byte & 0xC0) != 0x80) break;
+            code = (code << 6) | (byte & 0x3F);
+        }
+        // the rest of the sequence may be in what is yet to be read
+        if (length != 0 && beg + i == end && i != length) break;
+        static constexpr const std::uint32_t SMALLEST_OF_LENGTH[] =
+            { 0, 0, 0x80, 0x800, 0x10000 };
+        if (length == 0 || i != length || code < SMALLEST_OF_LENGTH[length] ||
+            code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF))
+        {
+            *dest++ = REPLACEMENT_CHARACTER;
+            ++beg;
+            continue;
+        }
+        *dest++ = UChar(code);
+        beg += length;
+    }
+    out.resize(std::size_t(dest - out.data()));
+}
+
+/* static */ void DocumentReader::run_tests()
+    { run_document_reader_tests(); }
+
+/* private */ void DocumentReader::stop_worker() {
+    if (!m_worker.joinable()) return;
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop_requested = true;
+    }
+    m_chunk_taken.notify_one();
+    m_worker.join();
+}
+
+/* private */ void DocumentReader::run_worker(const std::string & filename) {
+    std::ifstream fin(filename, std::ios::binary);
+    if (!fin) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_error = "DocumentReader: \"" + filename + "\" could not be opened.";
+        m_reading = false;
+        return;
+    }
+    fin.seekg(0, std::ios::end);
+    const auto file_size = std::uint64_t(fin.tellg());
+    fin.seekg(0, std::ios::beg);
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_file_size = file_size;
+    }
+
+    std::vector<char> buffer;
+    // bytes of a sequence cut short by the end of the last read
+    std::size_t leftover = 0;
+    std::uint64_t offset = 0;
+    auto chunk_size = FIRST_CHUNK_SIZE;
+    while (true) {
+        buffer.resize(leftover + chunk_size);
+        fin.read(buffer.data() + leftover, std::streamsize(chunk_size));
+        const auto read = std::size_t(fin.gcount());
+        const bool at_end = !fin;
+        if (at_end && !fin.eof()) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_error = "DocumentReader: \"" + filename + "\" could not be read.";
+            m_reading = false;
+            return;
+        }
+        Chunk chunk;
+        const char * beg = buffer.data();
+        const char * end = buffer.data() + leftover + read;
+        decode_utf8(beg, end, chunk.text);
+        // a sequence cut short by the end of the file
+        if (at_end && beg != end) {
+            chunk.text.push_back(REPLACEMENT_CHARACTER);
+            beg = end;
+        }
+        leftover = std::size_t(end - beg);
+        std::memmove(buffer.data(), beg, leftover);
+        offset += read;
+        chunk.end_offset = offset;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_chunk_taken.wait(lock, [this]()
+            { return m_stop_requested || m_chunks.size() < MAX_QUEUED_CHUNKS; });
+        if (m_stop_requested) {
+            m_reading = false;
+            return;
+        }
+        if (!chunk.text.empty()) m_chunks.push_back(std::move(chunk));
+        else                     m_bytes_appended = offset;
+        if (at_end) {
+            m_reading = false;
+            return;
+        }
+        chunk_size = CHUNK_SIZE;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+std::u32string content_of(const TextLines & tlines) {
+    if (tlines.lines().empty()) return std::u32string();
+    return tlines.copy_characters_from(Cursor(), tlines.end_cursor());
+}
+
+void run_document_reader_tests() {
+    // decoding
+    {
+    const std::string encoded = "a\xC3\xA9\xE4\xB8\xAD\xF0\x9F\x98\x80";
+    std::u32string out;
+    const char * beg = encoded.data();
+    DocumentReader::decode_utf8(beg, encoded.data() + encoded.size(), out);
+    assert(out == U"aé中\U0001F600" && beg == encoded.data() + encoded.size());
+    // cut short, the rest may follow
+    out.clear();
+    beg = encoded.data();
+    DocumentReader::decode_utf8(beg, encoded.data() + 5, out);
+    assert(out == U"aé" && beg == encoded.data() + 3);
+    // overlong, surrogates, and stray continuation bytes
+    const std::string invalid = "\xC0\xAF" "\xED\xA0\x80" "\x80" "b";
+    out.clear();
+    beg = invalid.data();
+    DocumentReader::decode_utf8(beg, invalid.data() + invalid.size(), out);
+    assert(out == std::u32string(6, DocumentReader::REPLACEMENT_CHARACTER) + U"b");
+    // NULs, in and out of runs of ASCII
+    const std::string nuls("\0" "a" "\0" "bcdefgh\0" "ij", 13);
+    out.clear();
+    beg = nuls.data();
+    DocumentReader::decode_utf8(beg, nuls.data() + nuls.size(), out);
+    assert(out.size() == 13 && out.find(UChar(0)) == std::u32string::npos);
+    assert(out[0] == DocumentReader::REPLACEMENT_CHARACTER && out[1] == U'a' &&
+           out[10] == DocumentReader::REPLACEMENT_CHARACTER && out[12] == U'j');
+    }
+    const std::string filename = "ksg-te-document-reader-test.txt";
+    // a file of many chunks, multi-byte characters straddling some of their
+    // ends, appended a little at a time
+    {
+    std::u32string content;
+    for (int i = 0; content.size() < DocumentReader::CHUNK_SIZE*2; ++i)
+        content += U"local é" + std::u32string(std::size_t(i % 9), U'中') + U" = 1\n";
+    content += U"return";
+    std::string encoded;
+    for (auto uchr : content) {
+        if (uchr < 0x80) { encoded += char(uchr); continue; }
+        if (uchr < 0x800) {
+            encoded += char(0xC0 | (uchr >> 6));
+        } else {
+            encoded += char(0xE0 | (uchr >> 12));
+            encoded += char(0x80 | ((uchr >> 6) & 0x3F));
+        }
+        encoded += char(0x80 | (uchr & 0x3F));
+    }
+    std::ofstream(filename, std::ios::binary) << encoded;
+    TextLines tlines;
+    DocumentReader reader;
+    reader.open(filename);
+    double last_progress = 0.;
+    while (reader.is_loading()) {
+        reader.append_loaded_to(tlines, 1000);
+        assert(reader.progress() >= last_progress);
+        last_progress = reader.progress();
+        std::this_thread::yield();
+    }
+    assert(reader.progress() == 1. && reader.error().empty());
+    assert(!reader.append_loaded_to(tlines));
+    assert(content_of(tlines) == content);
+    // opening again starts over, abandoning the last load
+    reader.open(filename);
+    TextLines reloaded;
+    while (reader.is_loading())
+        reader.append_loaded_to(reloaded);
+    assert(content_of(reloaded) == content);
+    reader.open(filename);
+    }
+    // a file ending in a new line ends with an empty line
+    {
+    std::ofstream(filename, std::ios::binary) << "a\nb\n";
+    TextLines tlines;
+    DocumentReader reader;
+    reader.open(filename);
+    while (reader.is_loading())
+        reader.append_loaded_to(tlines);
+    assert(tlines.lines().size() == 3 && content_of(tlines) == U"a\nb\n");
+    }
+    // a file with NULs is loaded, with each NUL replaced
+    {
+    std::ofstream(filename, std::ios::binary).write("one\ntw\0o\n\0", 10);
+    TextLines tlines;
+    DocumentReader reader;
+    reader.open(filename);
+    while (reader.is_loading())
+        reader.append_loaded_to(tlines);
+    assert(reader.error().empty());
+    assert(content_of(tlines) == U"one\ntw\uFFFDo\n\uFFFD");
+    }
+    std::remove(filename.c_str());
+    // failures are reported, not thrown
+    {
+    DocumentReader reader;
+    reader.open("no-such-directory/file.txt");
+    while (reader.is_loading())
+        std::this_thread::yield();
+    assert(!reader.error().empty());
+    }
+}
+
+} // end of <anonymous> namespace
@@ -0,0 +1,110 @@
+/****************************************************************************
+
+    File: DocumentReader.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "Cursor.hpp"
+
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+class TextLines;
+
+/** Loads files (as UTF-8) into TextLines on a worker thread, a piece at a
+ *  time, so that the start of a large document can be shown long before the
+ *  rest of it is read.
+ *
+ *  The worker reads and decodes the file in chunks, the first one small so
+ *  that it is ready quickly. Decoded chunks are only ever appended to the
+ *  TextLines on the thread calling append_loaded_to. The worker only reads
+ *  so far ahead of what has been appended.
+ */
+class DocumentReader {
+public:
+    // the first chunk is only this large, so it is quick to show
+    static constexpr const std::size_t FIRST_CHUNK_SIZE = 64*1024;
+    static constexpr const std::size_t CHUNK_SIZE = 1 << 20;
+    // the worker waits once this many chunks are yet to be appended
+    static constexpr const std::size_t MAX_QUEUED_CHUNKS = 16;
+    static constexpr const std::size_t DEFAULT_APPEND_LIMIT = 4*CHUNK_SIZE;
+    // stands in for whatever cannot be decoded (or held by a line)
+    static constexpr const UChar REPLACEMENT_CHARACTER = 0xFFFD;
+
+    DocumentReader();
+    DocumentReader(const DocumentReader &) = delete;
+    DocumentReader & operator = (const DocumentReader &) = delete;
+    ~DocumentReader();
+
+    /** Begins loading the file on the worker thread. Any load in progress is
+     *  abandoned.
+     */
+    void open(const std::string & filename);
+
+    /** Appends chunks decoded since last called to the end of the given
+     *  lines, stopping once at least the given number of characters are.
+     *  @return true if anything was appended
+     */
+    bool append_loaded_to(TextLines &,
+                          std::size_t max_characters = DEFAULT_APPEND_LIMIT);
+
+    /** @return true until all of the opened file has been appended */
+    bool is_loading() const;
+
+    /** @return fraction of the file appended so far */
+    double progress() const;
+
+    /** @return why the file could not be read, empty if nothing went wrong */
+    std::string error() const;
+
+    /** Appends the decoded characters, each invalid byte (and each NUL,
+     *  which TextLines cannot hold) is decoded as U+FFFD.
+     *  @param beg is left at a sequence which was cut short by end (which is
+     *             left alone, as the rest may yet be read)
+     */
+    static void decode_utf8(const char *& beg, const char * end, std::u32string & out);
+
+    static void run_tests();
+private:
+    struct Chunk {
+        std::u32string text;
+        // bytes of the file read through to the end of this chunk
+        std::uint64_t end_offset;
+    };
+
+    void stop_worker();
+    void run_worker(const std::string & filename);
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_chunk_taken;
+    std::deque<Chunk> m_chunks;
+    std::uint64_t m_file_size;
+    std::uint64_t m_bytes_appended;
+    // true until the worker has queued its last chunk
+    bool m_reading;
+    bool m_stop_requested;
+    std::string m_error;
+
+    std::thread m_worker;
+};
@@ -0,0 +1,241 @@
+/****************************************************************************
+
+    File: DocumentReloader.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "DocumentReloader.hpp"
+#include "DocumentReader.hpp"
+#include "DocumentDiff.hpp"
+#include "TextLines.hpp"
+#include "LuaCodeModeler.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+
+#include <cassert>
+
+namespace {
+
+void run_document_reloader_tests();
+
+} // end of <anonymous> namespace
+
+/* explicit */ DocumentReloader::DocumentReloader(TextLines & textlines):
+    m_textlines(textlines)
+{}
+
+std::size_t DocumentReloader::reload(const std::u32string & content) {
+    const auto & lines = m_textlines.lines();
+    if (lines.empty()) {
+        m_textlines.set_content(content);
+        return 1;
+    }
+    // where each of the new lines begins, then one past where the last would
+    std::vector<std::size_t> begins(1, 0);
+    std::vector<std::uint64_t> new_hashes;
+    for (auto brk = content.find(TextLines::NEW_LINE); brk != std::u32string::npos;
+         brk = content.find(TextLines::NEW_LINE, brk + 1))
+    {
+        new_hashes.push_back(TextLine::hash_of(content.data() + begins.back(), content.data() + brk));
+        begins.push_back(brk + 1);
+    }
+    new_hashes.push_back(TextLine::hash_of(content.data() + begins.back(),
+                                           content.data() + content.size()));
+    begins.push_back(content.size() + 1);
+
+    // lines keep their hashes, so only those edited since are hashed again
+    std::vector<std::uint64_t> old_hashes;
+    old_hashes.reserve(lines.size());
+    for (const auto & line : lines) old_hashes.push_back(line.hash());
+    const auto hunks = DocumentDiff::diff_lines(old_hashes, new_hashes);
+
+    // each line with its new line, except for the last line
+    auto new_lines = [&content, &begins](std::size_t beg, std::size_t end) {
+        return content.substr(begins[beg], begins[end] - begins[beg]);
+    };
+    const auto old_count = lines.size();
+    std::vector<CursorRange> ranges;
+    std::vector<std::u32string> replacements;
+    for (const auto & hunk : hunks) {
+        if (hunk.old_end != old_count) {
+            // whole lines, each with its new line
+            ranges.emplace_back(Cursor(int(hunk.old_begin), 0),
+                                Cursor(int(hunk.old_end  ), 0));
+            replacements.push_back(new_lines(hunk.new_begin, hunk.new_end));
+        } else if (hunk.old_begin != 0) {
+            // the last lines have no new line of their own, so the one ending
+            // the line before goes instead
+            const auto & before = lines[hunk.old_begin - 1];
+            ranges.emplace_back(Cursor(int(hunk.old_begin - 1), before.content_length()),
+                                m_textlines.end_cursor());
+            replacements.push_back(hunk.new_begin == hunk.new_end ? std::u32string() :
+                TextLines::NEW_LINE + new_lines(hunk.new_begin, hunk.new_end));
+        } else {
+            // everything (nothing was in common with the old content)
+            ranges.emplace_back(Cursor(), m_textlines.end_cursor());
+            replacements.push_back(content);
+        }
+    }
+    if (!ranges.empty()) m_textlines.replace_each(ranges, replacements);
+    return hunks.size();
+}
+
+std::size_t DocumentReloader::reload_file(const std::string & filename) {
+    std::ifstream fin(filename, std::ios::binary);
+    if (!fin) {
+        throw std::runtime_error("DocumentReloader::reload_file: \"" + filename +
+                                 "\" could not be opened.");
+    }
+    const std::string encoded((std::istreambuf_iterator<char>(fin)),
+                              std::istreambuf_iterator<char>());
+    if (fin.bad()) {
+        throw std::runtime_error("DocumentReloader::reload_file: \"" + filename +
+                                 "\" could not be read.");
+    }
+    std::u32string content;
+    const char * beg = encoded.data();
+    DocumentReader::decode_utf8(beg, encoded.data() + encoded.size(), content);
+    // a sequence cut short by the end of the file
+    if (beg != encoded.data() + encoded.size())
+        content.push_back(DocumentReader::REPLACEMENT_CHARACTER);
+    return reload(content);
+}
+
+/* static */ void DocumentReloader::run_tests()
+    { run_document_reloader_tests(); }
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+std::u32string content_of(const TextLines & tlines) {
+    if (tlines.lines().empty()) return std::u32string();
+    return tlines.copy_characters_from(Cursor(), tlines.end_cursor());
+}
+
+int count_needing_modeling(const TextLines & tlines) {
+    return int(std::count_if(tlines.lines().begin(), tlines.lines().end(),
+        [](const TextLine & line) { return line.needs_modeling(); }));
+}
+
+void run_document_reloader_tests() {
+    // lines changed, inserted, removed and at either end
+    {
+    TextLines tlines(U"a\nb\nc\nd");
+    DocumentReloader reloader(tlines);
+    assert(reloader.reload(U"a\nB\nc\nd\ne") == 2);
+    assert(content_of(tlines) == U"a\nB\nc\nd\ne");
+    assert(reloader.reload(U"a\nB\nc\nd\ne") == 0);
+    assert(reloader.reload(U"x\na\nc") == 3);
+    assert(content_of(tlines) == U"x\na\nc");
+    assert(reloader.reload(U"x\na") == 1 && content_of(tlines) == U"x\na");
+    assert(reloader.reload(U"") == 1 && content_of(tlines) == U"");
+    assert(reloader.reload(U"\n\n") == 1 && content_of(tlines) == U"\n\n");
+    // edited since, so the document is hashed again
+    tlines.push(Cursor(1, 0), U'q');
+    assert(reloader.reload(U"\n\n") == 1 && content_of(tlines) == U"\n\n");
+    }
+    // random documents, randomly changed
+    {
+    unsigned seed = 7;
+    auto next_random = [&seed](unsigned limit) {
+        seed = seed*1103515245u + 12345u;
+        return (seed >> 8) % limit;
+    };
+    auto random_content = [&next_random](unsigned line_count) {
+        static const std::u32string words[] = { U"", U"a", U"b", U"local c = 1" };
+        std::u32string rv;
+        for (unsigned i = 0; i != line_count; ++i) {
+            if (i != 0) rv += TextLines::NEW_LINE;
+            rv += words[next_random(4)];
+        }
+        return rv;
+    };
+    TextLines tlines(random_content(30));
+    DocumentReloader reloader(tlines);
+    for (int round = 0; round != 300; ++round) {
+        const auto content = round % 50 == 0 ? random_content(1 + next_random(40)) :
+            content_of(tlines) + (next_random(2) ? U"" : U"\nb");
+        auto changed = content;
+        for (unsigned i = next_random(4); i != 0 && !changed.empty(); --i) {
+            const auto at = next_random(unsigned(changed.size()));
+            if (next_random(2)) changed.erase(at, 1);
+            else                changed.insert(at, 1, next_random(2) ? U'\n' : U'z');
+        }
+        (void)reloader.reload(content);
+        assert(content_of(tlines) == content);
+        (void)reloader.reload(changed);
+        assert(content_of(tlines) == changed);
+    }
+    }
+    // a few lines changed in a large, modeled, document, leave the rest of
+    // its lines modeled as they were
+    {
+    std::u32string content;
+    for (int i = 0; i != 20000; ++i)
+        content += U"local v" + std::u32string(std::size_t(i % 7), U'x') + U" = 1\n";
+    TextLines tlines(content);
+    LuaCodeModeler lcm;
+    tlines.update_modeler(lcm);
+    DocumentReloader reloader(tlines);
+    (void)reloader.reload(content);
+    assert(count_needing_modeling(tlines) == 0);
+    auto changed = content;
+    for (std::size_t at : { 10u, 40000u, 200000u, 300000u })
+        changed.insert(at, U"-- changed\n");
+    changed.erase(100000, 30);
+    assert(reloader.reload(changed) == 5);
+    assert(content_of(tlines) == changed);
+    // each run's new lines (two at most here), and the line after it
+    assert(count_needing_modeling(tlines) <= 5*3);
+    }
+    // nothing in common, replaced whole
+    {
+    std::u32string content, other;
+    for (int i = 0; i != 3000; ++i) {
+        content += U"a" + std::u32string(std::size_t(i % 11), U'b') + U"\n";
+        other   += U"c" + std::u32string(std::size_t(i % 13), U'd') + U"\n";
+    }
+    TextLines tlines(content);
+    DocumentReloader reloader(tlines);
+    assert(reloader.reload(other) == 1 && content_of(tlines) == other);
+    }
+    // from a file
+    {
+    const std::string filename = "ksg-te-document-reloader-test.txt";
+    std::ofstream(filename, std::ios::binary) << "one\ntw\xC3\xB4\nthree";
+    TextLines tlines(U"one\ntwo\nthree");
+    DocumentReloader reloader(tlines);
+    assert(reloader.reload_file(filename) == 1);
+    assert(content_of(tlines) == U"one\ntwô\nthree");
+    std::remove(filename.c_str());
+    bool threw = false;
+    try {
+        reloader.reload_file(filename);
+    } catch (std::runtime_error &) {
+        threw = true;
+    }
+    assert(threw);
+    }
+}
+
+} // end of <anonymous> namespace
@@ -0,0 +1,58 @@
+/****************************************************************************
+
+    File: DocumentReloader.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include <string>
+
+class TextLines;
+
+/** Reloads a document whose file was changed elsewhere, editing only the
+ *  lines which differ, so that the rest keep their tokens and layout.
+ *
+ *  Lines are compared by 64-bit hashes of their content (see
+ *  TextLine::hash). The new content's lines are diffed against the
+ *  document's (see DocumentDiff), and each differing run of lines is
+ *  replaced, all in one edit. Lines keep their hashes, so only those edited
+ *  since the last reload are hashed again.
+ */
+class DocumentReloader {
+public:
+    /** @warning Does not in anyway maintain ownership over the given object
+     *           reference. Given object must survive the life of this object.
+     */
+    explicit DocumentReloader(TextLines &);
+
+    /** Makes the lines' content the given content.
+     *  @return number of runs of lines replaced
+     */
+    std::size_t reload(const std::u32string & content);
+
+    /** Reloads from the given (UTF-8) file, invalid bytes (and nulls) are
+     *  read as U+FFFD.
+     *  @throws std::runtime_error if the file could not be read
+     */
+    std::size_t reload_file(const std::string & filename);
+
+    static void run_tests();
+private:
+    TextLines & m_textlines;
+};
@@ -0,0 +1,349 @@
+/****************************************************************************
+
+    File: DocumentWriter.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "DocumentWriter.hpp"
+#include "TextLines.hpp"
+
+#include <stdexcept>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#ifdef MACRO_PLATFORM_LINUX
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/stat.h>
+#endif
+
+#include <cassert>
+
+namespace {
+
+// where the content goes before it replaces the target
+std::string temporary_name_for(const std::string & filename)
+    { return filename + ".ksg-te-save"; }
+
+/** Writes to a new file, which is only made durable (where the platform
+ *  allows) on close. Takes the permissions of the file it is to replace.
+ */
+class OutputFile {
+public:
+    OutputFile(const std::string & filename, const std::string & replacing);
+    OutputFile(const OutputFile &) = delete;
+    OutputFile & operator = (const OutputFile &) = delete;
+    ~OutputFile();
+
+    void write(const char * data, std::size_t size);
+    // @throws std::runtime_error if anything buffered could not be written
+    void close();
+private:
+    [[noreturn]] void throw_error(const char * what) const;
+
+    std::string m_filename;
+#   ifdef MACRO_PLATFORM_LINUX
+    int m_fd;
+#   else
+    std::ofstream m_out;
+#   endif
+};
+
+void run_document_writer_tests();
+
+} // end of <anonymous> namespace
+
+/* static */ constexpr const std::size_t DocumentWriter::BUFFER_SIZE;
+
+DocumentWriter::DocumentWriter():
+    m_working       (false),
+    m_stop_requested(false)
+{
+    m_worker = std::thread([this]() { run_worker(); });
+}
+
+DocumentWriter::~DocumentWriter() {
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop_requested = true;
+    }
+    m_job_posted.notify_one();
+    m_worker.join();
+}
+
+void DocumentWriter::post(const TextLines & textlines, const std::string & filename) {
+    Job job;
+    job.lines    = textlines.snapshot();
+    job.filename = filename;
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_pending_jobs.push_back(std::move(job));
+    }
+    m_job_posted.notify_one();
+}
+
+bool DocumentWriter::take_result(Result & result) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_finished.empty()) return false;
+    result = std::move(m_finished.front());
+    m_finished.erase(m_finished.begin());
+    return true;
+}
+
+bool DocumentWriter::is_working() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_working || !m_pending_jobs.empty();
+}
+
+/* static */ std::size_t DocumentWriter::write
+    (const TextLinesSnapshot & lines, const std::string & filename)
+{
+    const auto temporary_name = temporary_name_for(filename);
+    std::size_t bytes_written = 0;
+    {
+    OutputFile out(temporary_name, filename);
+    std::string buffer;
+    buffer.reserve(BUFFER_SIZE);
+    std::size_t lines_left = lines.line_count();
+    lines.for_each_line([&](const std::u32string & line) {
+        encode_utf8(line, buffer);
+        // the last line has no new line after it
+        if (--lines_left != 0) buffer += '\n';
+        if (buffer.size() < BUFFER_SIZE) return;
+        out.write(buffer.data(), buffer.size());
+        bytes_written += buffer.size();
+        buffer.clear();
+    });
+    out.write(buffer.data(), buffer.size());
+    bytes_written += buffer.size();
+    out.close();
+    }
+    if (std::rename(temporary_name.c_str(), filename.c_str()) != 0) {
+        const auto error = std::string(std::strerror(errno));
+        std::remove(temporary_name.c_str());
+        throw std::runtime_error("DocumentWriter::write: could not replace \"" +
+                                 filename + "\": " + error);
+    }
+    return bytes_written;
+}
+
+/* static */ void DocumentWriter::encode_utf8
+    (const std::u32string & ustr, std::string & out)
+{
+    // room for the longest encoding, written through a pointer and trimmed
+    // after, which is much quicker than appending one byte at a time
+    const auto old_size = out.size();
+    out.resize(old_size + ustr.size()*4);
+    char * dest = &out[0] + old_size;
+    for (auto uchr : ustr) {
+        auto code = std::uint32_t(uchr);
+        if (code < 0x80) {
+            *dest++ = char(code);
+            continue;
+        }
+        if (code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF))
+            code = 0xFFFD;
+        if (code < 0x800) {
+            *dest++ = char(0xC0 | (code >> 6));
+        } else if (code < 0x10000) {
+            *dest++ = char(0xE0 | (code >> 12));
+            *dest++ = char(0x80 | ((code >> 6) & 0x3F));
+        } else {
+            *dest++ = char(0xF0 | (code >> 18));
+            *dest++ = char(0x80 | ((code >> 12) & 0x3F));
+            *dest++ = char(0x80 | ((code >> 6) & 0x3F));
+        }
+        *dest++ = char(0x80 | (code & 0x3F));
+    }
+    out.resize(std::size_t(dest - &out[0]));
+}
+
+/* static */ void DocumentWriter::run_tests()
+    { run_document_writer_tests(); }
+
+/* private */ void DocumentWriter::run_worker() {
+    while (true) {
+        std::vector<Job> jobs;
+        {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_job_posted.wait(lock, [this]()
+            { return m_stop_requested || !m_pending_jobs.empty(); });
+        // whatever was posted is still saved before stopping
+        if (m_pending_jobs.empty()) return;
+        jobs.swap(m_pending_jobs);
+        m_working = true;
+        }
+        for (auto & job : jobs) {
+            Result result;
+            result.filename = job.filename;
+            result.version  = job.lines.version();
+            try {
+                result.bytes_written = write(job.lines, job.filename);
+                result.succeeded = true;
+            } catch (std::exception & exp) {
+                result.error = exp.what();
+            }
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_finished.push_back(std::move(result));
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_working = false;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+#ifdef MACRO_PLATFORM_LINUX
+
+OutputFile::OutputFile(const std::string & filename, const std::string & replacing):
+    m_filename(filename),
+    m_fd(-1)
+{
+    mode_t mode = 0666;
+    struct stat replaced_stat;
+    if (::stat(replacing.c_str(), &replaced_stat) == 0)
+        mode = replaced_stat.st_mode & 07777;
+    m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (m_fd == -1) throw_error("could not be opened");
+}
+
+OutputFile::~OutputFile() {
+    // only still open if something went wrong
+    if (m_fd == -1) return;
+    ::close(m_fd);
+    ::unlink(m_filename.c_str());
+}
+
+void OutputFile::write(const char * data, std::size_t size) {
+    while (size != 0) {
+        const auto written = ::write(m_fd, data, size);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            throw_error("could not be written to");
+        }
+        data += written;
+        size -= std::size_t(written);
+    }
+}
+
+void OutputFile::close() {
+    // the content must be on disk before the rename makes it the target
+    if (::fsync(m_fd) != 0) throw_error("could not be synced");
+    const int fd = m_fd;
+    m_fd = -1;
+    if (::close(fd) != 0) {
+        ::unlink(m_filename.c_str());
+        throw_error("could not be closed");
+    }
+}
+
+#else
+
+OutputFile::OutputFile(const std::string & filename, const std::string &):
+    m_filename(filename),
+    m_out(filename, std::ios::binary | std::ios::trunc)
+{ if (!m_out) throw_error("could not be opened"); }
+
+OutputFile::~OutputFile() {
+    if (!m_out.is_open()) return;
+    m_out.close();
+    std::remove(m_filename.c_str());
+}
+
+void OutputFile::write(const char * data, std::size_t size) {
+    m_out.write(data, std::streamsize(size));
+    if (!m_out) throw_error("could not be written to");
+}
+
+void OutputFile::close() {
+    m_out.close();
+    if (m_out) return;
+    std::remove(m_filename.c_str());
+    throw_error("could not be closed");
+}
+
+#endif
+
+/* private */ void OutputFile::throw_error(const char * what) const {
+    throw std::runtime_error("DocumentWriter::write: \"" + m_filename +
+                             "\" " + what + ": " + std::strerror(errno));
+}
+
+std::string read_file(const std::string & filename) {
+    std::ifstream fin(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(fin),
+                       std::istreambuf_iterator<char>());
+}
+
+void run_document_writer_tests() {
+    // encoding
+    {
+    std::string out;
+    DocumentWriter::encode_utf8(U"aé中\U0001F600", out);
+    assert(out == "a\xC3\xA9\xE4\xB8\xAD\xF0\x9F\x98\x80");
+    out.clear();
+    DocumentWriter::encode_utf8(std::u32string(1, char32_t(0xD800)), out);
+    assert(out == "\xEF\xBF\xBD");
+    }
+    const std::string filename = "ksg-te-document-writer-test.txt";
+    // saves what the lines were when posted, over what was there before
+    {
+    std::ofstream(filename) << "old content";
+    TextLines tlines(U"local a = 1\né\n");
+    DocumentWriter writer;
+    writer.post(tlines, filename);
+    tlines.set_content(U"changed");
+    while (writer.is_working())
+        std::this_thread::yield();
+    DocumentWriter::Result result;
+    assert(writer.take_result(result) && !writer.take_result(result));
+    assert(result.succeeded && result.filename == filename);
+    assert(result.bytes_written == 15);
+    assert(read_file(filename) == "local a = 1\n\xC3\xA9\n");
+    assert(!std::ifstream(temporary_name_for(filename)));
+    }
+    // content spanning many buffers
+    {
+    std::u32string content;
+    while (content.size() < DocumentWriter::BUFFER_SIZE*2)
+        content += U"for i = 1, 10 do print(i) end\n";
+    TextLines tlines(content);
+    assert(DocumentWriter::write(tlines.snapshot(), filename) == content.size());
+    std::string expected;
+    DocumentWriter::encode_utf8(content, expected);
+    assert(read_file(filename) == expected);
+    }
+    std::remove(filename.c_str());
+    // failures are reported, not thrown
+    {
+    DocumentWriter writer;
+    writer.post(TextLines(U"a"), "no-such-directory/file.txt");
+    while (writer.is_working())
+        std::this_thread::yield();
+    DocumentWriter::Result result;
+    assert(writer.take_result(result) && !result.succeeded && !result.error.empty());
+    }
+}
+
+} // end of <anonymous> namespace
@@ -0,0 +1,106 @@
+/****************************************************************************
+
+    File: DocumentWriter.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "TextLinesSnapshot.hpp"
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class TextLines;
+
+/** Saves TextLines to files (as UTF-8) on a worker thread, so that saving
+ *  large documents does not stall the UI thread.
+ *
+ *  Each save writes a snapshot of the lines as they were when it was posted.
+ *  Lines are encoded straight from the snapshot into a fixed size buffer,
+ *  which is written out each time it fills. Everything is written to a
+ *  temporary file next to the target, which then replaces the target in
+ *  one rename. So the target is only ever the old file or the new one.
+ */
+class DocumentWriter {
+public:
+    // encoded characters are written out whenever this many are buffered
+    static constexpr const std::size_t BUFFER_SIZE = 1 << 20;
+
+    struct Result {
+        std::string filename;
+        // of the TextLines which were saved
+        std::size_t version = 0;
+        std::size_t bytes_written = 0;
+        bool succeeded = false;
+        // if not succeeded, why not
+        std::string error;
+    };
+
+    DocumentWriter();
+    DocumentWriter(const DocumentWriter &) = delete;
+    DocumentWriter & operator = (const DocumentWriter &) = delete;
+    /** Waits for any save in progress (or posted) to finish. */
+    ~DocumentWriter();
+
+    /** Takes a snapshot of the given lines and saves it on the worker
+     *  thread. Saves are made in the order they are posted.
+     */
+    void post(const TextLines &, const std::string & filename);
+
+    /** @return true if a save was finished since last asked, in which case
+     *          result is set to how it went
+     */
+    bool take_result(Result & result);
+
+    /** @return true if a posted save has yet to finish */
+    bool is_working() const;
+
+    /** Saves the snapshot, on this thread.
+     *  @throws std::runtime_error if the file could not be written
+     *  @return number of bytes written
+     */
+    static std::size_t write(const TextLinesSnapshot &, const std::string & filename);
+
+    /** Appends the UTF-8 encoding of the characters, anything which is not
+     *  a Unicode scalar value is encoded as U+FFFD.
+     */
+    static void encode_utf8(const std::u32string &, std::string & out);
+
+    static void run_tests();
+private:
+    struct Job {
+        TextLinesSnapshot lines;
+        std::string filename;
+    };
+
+    void run_worker();
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_job_posted;
+    std::vector<Job> m_pending_jobs;
+    std::vector<Result> m_finished;
+    bool m_working;
+    bool m_stop_requested;
+
+    // must be last, the worker may only start once everything else is ready
+    std::thread m_worker;
+};
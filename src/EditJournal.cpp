@@ -0,0 +1,695 @@
+/****************************************************************************
+
+    File: EditJournal.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "EditJournal.hpp"
+
+#include <stdexcept>
+#include <fstream>
+#include <iterator>
+#include <chrono>
+#include <memory>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#ifdef MACRO_PLATFORM_LINUX
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#include <cassert>
+
+namespace {
+
+// the journal begins with this, followed by frames of records, each frame
+// being: its size, its records, then a checksum of its records
+constexpr const char * const JOURNAL_MAGIC = "ksg-te journal 1\n";
+
+// each record begins with one of these, followed by numbers:
+// insertion : line, column, character count, characters
+// removal   : begin line, begin column, end line - begin line, end column
+// reset     : character count, characters
+// checkpoint: number, character count of the content
+// saved     : number of the checkpoint saved
+enum RecordKind : char {
+    INSERTION  = 'i',
+    REMOVAL    = 'r',
+    RESET      = 'z',
+    CHECKPOINT = 'c',
+    SAVED      = 's'
+};
+
+struct Record {
+    RecordKind kind;
+    Cursor beg, end;
+    std::u32string text;
+    // checkpoint number, or character count
+    std::uint64_t number = 0, length = 0;
+};
+
+/** Appends to a journal, only made durable (where the platform allows) on
+ *  sync.
+ */
+class JournalFile {
+public:
+    // @param truncate if true, the file is started over (or created)
+    JournalFile(const std::string & filename, bool truncate);
+    JournalFile(const JournalFile &) = delete;
+    JournalFile & operator = (const JournalFile &) = delete;
+    ~JournalFile();
+
+    void write(const char * data, std::size_t size);
+    void sync();
+    void truncate();
+private:
+    [[noreturn]] void throw_error(const char * what) const;
+
+    std::string m_filename;
+#   ifdef MACRO_PLATFORM_LINUX
+    int m_fd;
+#   else
+    std::ofstream m_out;
+#   endif
+};
+
+void append_number(std::string &, std::uint64_t);
+void append_characters(std::string &, const std::u32string &);
+// @return false if the number does not fit before end
+bool read_number(const char *& pos, const char * end, std::uint64_t &);
+// @throws std::runtime_error if the record is not whole
+Record read_record(const char *& pos, const char * end);
+std::uint32_t checksum_of(const char * beg, const char * end);
+std::size_t content_length_of(const TextLines &);
+
+struct JournalContents {
+    std::vector<Record> edits;
+    // for each checkpoint: how many edits precede it, and the content length
+    std::vector<std::pair<std::size_t, std::uint64_t>> checkpoints;
+    // number of the last checkpoint marked saved
+    std::size_t saved = 0;
+};
+
+// every record up to the first frame which was not written whole
+// @throws std::runtime_error if the file could not be read, or is not a
+//         journal
+JournalContents read_journal(const std::string & filename, const char * caller);
+
+void run_edit_journal_tests();
+
+} // end of <anonymous> namespace
+
+/* static */ constexpr const int EditJournal::DEFAULT_SYNC_INTERVAL_MS;
+
+EditJournal::EditJournal
+    (TextLines & tlines, const std::string & filename, int sync_interval_ms):
+    m_lines                  (&tlines),
+    m_filename               (filename),
+    m_sync_interval_ms       (sync_interval_ms),
+    m_checkpoint_count       (0),
+    m_saved_checkpoint       (0),
+    m_edited_since_checkpoint(false),
+    m_restart_requested      (false),
+    m_syncs_requested        (0),
+    m_syncs_finished         (0),
+    m_stop_requested         (false)
+{
+    if (has_unsaved_edits(filename)) {
+        throw std::runtime_error("EditJournal::EditJournal: \"" + filename +
+                                 "\" has edits yet to be recovered, which "
+                                 "starting over would lose.");
+    }
+    // created here so that failing to is thrown, it is written by the worker
+    (void)JournalFile(filename, true);
+    // the content now is what was last saved, which the journal starts with
+    mark_saved(checkpoint());
+    m_worker = std::thread([this]() { run_worker(); });
+    m_lines->add_edit_listener(this);
+}
+
+EditJournal::~EditJournal() {
+    m_lines->remove_edit_listener(this);
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop_requested = true;
+    }
+    m_sync_requested.notify_one();
+    m_worker.join();
+    // the saved file has everything
+    if (m_error.empty() && !m_edited_since_checkpoint &&
+        m_saved_checkpoint + 1 == m_checkpoint_count)
+    { std::remove(m_filename.c_str()); }
+}
+
+std::size_t EditJournal::checkpoint() {
+    std::string record(1, CHECKPOINT);
+    append_number(record, m_checkpoint_count);
+    append_number(record, content_length_of(*m_lines));
+    m_edited_since_checkpoint = false;
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_pending += record;
+    }
+    return m_checkpoint_count++;
+}
+
+void EditJournal::mark_saved(std::size_t checkpoint) {
+    if (checkpoint >= m_checkpoint_count) {
+        throw std::invalid_argument("EditJournal::mark_saved: no such "
+                                    "checkpoint was made.");
+    }
+    // saves finish in order, an older one has nothing to add
+    if (checkpoint < m_saved_checkpoint) return;
+    m_saved_checkpoint = checkpoint;
+    if (checkpoint + 1 == m_checkpoint_count && !m_edited_since_checkpoint) {
+        restart();
+        return;
+    }
+    std::string record(1, SAVED);
+    append_number(record, checkpoint);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_pending += record;
+}
+
+void EditJournal::sync() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const auto sync_number = ++m_syncs_requested;
+    m_sync_requested.notify_one();
+    m_synced.wait(lock, [this, sync_number]()
+        { return m_syncs_finished >= sync_number; });
+}
+
+std::string EditJournal::error() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_error;
+}
+
+/* static */ bool EditJournal::has_unsaved_edits(const std::string & filename) {
+    if (!std::ifstream(filename)) return false;
+    JournalContents contents;
+    try {
+        contents = read_journal(filename, "EditJournal::has_unsaved_edits");
+    } catch (std::runtime_error &) {
+        // there is no telling what it holds
+        return true;
+    }
+    const auto & checkpoints = contents.checkpoints;
+    const auto saved_edits = contents.saved < checkpoints.size() ?
+        checkpoints[contents.saved].first : std::size_t(0);
+    return contents.edits.size() != saved_edits;
+}
+
+/* static */ std::string EditJournal::set_aside(const std::string & filename) {
+    for (int i = 1; ; ++i) {
+        auto aside = filename + "." + std::to_string(i);
+        if (std::ifstream(aside)) continue;
+        if (std::rename(filename.c_str(), aside.c_str()) != 0) {
+            throw std::runtime_error("EditJournal::set_aside: \"" + filename +
+                                     "\" could not be moved: " +
+                                     std::strerror(errno));
+        }
+        return aside;
+    }
+}
+
+/* static */ std::size_t EditJournal::recover
+    (const std::string & filename, TextLines & tlines)
+{
+    const auto contents = read_journal(filename, "EditJournal::recover");
+    const auto & edits       = contents.edits;
+    const auto & checkpoints = contents.checkpoints;
+    const auto saved         = contents.saved;
+    // the last save is usually what the content is, though should a later
+    // one have replaced the file before being marked, it is that instead
+    const auto length = content_length_of(tlines);
+    auto matches = [&](std::size_t checkpoint) {
+        return checkpoint < checkpoints.size() &&
+               checkpoints[checkpoint].second == length;
+    };
+    auto from = saved;
+    for (auto i = checkpoints.size(); !matches(from) && i-- > saved + 1; )
+        from = i;
+    if (!matches(from)) {
+        throw std::runtime_error("EditJournal::recover: \"" + filename +
+                                 "\" does not follow from the given content.");
+    }
+
+    TextLines::Transaction transaction(tlines);
+    try {
+        for (auto itr = edits.begin() + std::ptrdiff_t(checkpoints[from].first);
+             itr != edits.end(); ++itr)
+        {
+            const auto & edit = *itr;
+            switch (edit.kind) {
+            case INSERTION:
+                tlines.deposit_chatacters_to
+                    (edit.text.data(), edit.text.data() + edit.text.size(), edit.beg);
+                break;
+            case REMOVAL: tlines.wipe(edit.beg, edit.end); break;
+            case RESET  : tlines.set_content(edit.text);    break;
+            default: assert(false); break;
+            }
+        }
+    } catch (std::invalid_argument &) {
+        throw std::runtime_error("EditJournal::recover: \"" + filename +
+                                 "\" has an edit which does not fit the "
+                                 "content.");
+    }
+    return std::size_t(edits.end() - edits.begin()) - checkpoints[from].first;
+}
+
+/* static */ void EditJournal::run_tests() { run_edit_journal_tests(); }
+
+/* private */ void EditJournal::on_insertion(const TextLines &, Cursor, Cursor)
+    { assert(false); /* told of insertions by on_insertion_of instead */ }
+
+/* private */ void EditJournal::on_insertion_of
+    (const TextLines &, Cursor beg, Cursor, const std::u32string & inserted)
+{
+    m_edited_since_checkpoint = true;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_error.empty()) return;
+    m_pending.push_back(INSERTION);
+    append_number(m_pending, std::uint64_t(beg.line));
+    append_number(m_pending, std::uint64_t(beg.column));
+    append_characters(m_pending, inserted);
+}
+
+/* private */ void EditJournal::on_removal
+    (const TextLines &, Cursor beg, Cursor end, const std::u32string &)
+{
+    m_edited_since_checkpoint = true;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_error.empty()) return;
+    m_pending.push_back(REMOVAL);
+    append_number(m_pending, std::uint64_t(beg.line));
+    append_number(m_pending, std::uint64_t(beg.column));
+    append_number(m_pending, std::uint64_t(end.line - beg.line));
+    append_number(m_pending, std::uint64_t(end.column));
+}
+
+/* private */ void EditJournal::on_reset(const TextLines & tlines) {
+    m_edited_since_checkpoint = true;
+    std::u32string content;
+    if (!tlines.lines().empty())
+        content = tlines.copy_characters_from(Cursor(), tlines.end_cursor());
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_error.empty()) return;
+    m_pending.push_back(RESET);
+    append_characters(m_pending, content);
+}
+
+/* private */ void EditJournal::restart() {
+    std::string records(1, CHECKPOINT);
+    append_number(records, m_checkpoint_count - 1);
+    append_number(records, content_length_of(*m_lines));
+    records.push_back(SAVED);
+    append_number(records, m_checkpoint_count - 1);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_pending.swap(records);
+    m_restart_requested = true;
+}
+
+/* private */ void EditJournal::run_worker() {
+    std::unique_ptr<JournalFile> file;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_sync_requested.wait_for
+            (lock, std::chrono::milliseconds(m_sync_interval_ms), [this]()
+            { return m_stop_requested || m_syncs_requested != m_syncs_finished; });
+        std::string records;
+        records.swap(m_pending);
+        const bool restart  = m_restart_requested;
+        const bool stopping = m_stop_requested;
+        const auto syncs    = m_syncs_requested;
+        const bool failed   = !m_error.empty();
+        m_restart_requested = false;
+        lock.unlock();
+
+        std::string error;
+        if (!failed && (restart || !records.empty())) {
+            try {
+                if (!file) file.reset(new JournalFile(m_filename, false));
+                if (restart) {
+                    file->truncate();
+                    file->write(JOURNAL_MAGIC, std::strlen(JOURNAL_MAGIC));
+                }
+                std::string frame;
+                append_number(frame, records.size());
+                frame += records;
+                const auto checksum = checksum_of(records.data(), records.data() + records.size());
+                frame.append(reinterpret_cast<const char *>(&checksum), 4);
+                file->write(frame.data(), frame.size());
+                file->sync();
+            } catch (std::exception & exp) {
+                error = exp.what();
+            }
+        }
+
+        lock.lock();
+        if (!error.empty()) m_error = error;
+        m_syncs_finished = syncs;
+        m_synced.notify_all();
+        if (stopping) return;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+#ifdef MACRO_PLATFORM_LINUX
+
+JournalFile::JournalFile(const std::string & filename, bool truncate):
+    m_filename(filename),
+    m_fd(::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC |
+                (truncate ? O_TRUNC : 0), 0666))
+{ if (m_fd == -1) throw_error("could not be opened"); }
+
+JournalFile::~JournalFile() { ::close(m_fd); }
+
+void JournalFile::write(const char * data, std::size_t size) {
+    while (size != 0) {
+        const auto written = ::write(m_fd, data, size);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            throw_error("could not be written to");
+        }
+        data += written;
+        size -= std::size_t(written);
+    }
+}
+
+void JournalFile::sync()
+    { if (::fdatasync(m_fd) != 0) throw_error("could not be synced"); }
+
+void JournalFile::truncate()
+    { if (::ftruncate(m_fd, 0) != 0) throw_error("could not be truncated"); }
+
+#else
+
+JournalFile::JournalFile(const std::string & filename, bool truncate):
+    m_filename(filename),
+    m_out(filename, std::ios::binary | (truncate ? std::ios::trunc : std::ios::app))
+{ if (!m_out) throw_error("could not be opened"); }
+
+JournalFile::~JournalFile() {}
+
+void JournalFile::write(const char * data, std::size_t size) {
+    m_out.write(data, std::streamsize(size));
+    if (!m_out) throw_error("could not be written to");
+}
+
+void JournalFile::sync() {
+    m_out.flush();
+    if (!m_out) throw_error("could not be synced");
+}
+
+void JournalFile::truncate() {
+    m_out.close();
+    m_out.open(m_filename, std::ios::binary | std::ios::trunc);
+    if (!m_out) throw_error("could not be truncated");
+}
+
+#endif
+
+/* private */ void JournalFile::throw_error(const char * what) const {
+    throw std::runtime_error("EditJournal: \"" + m_filename + "\" " + what +
+                             ": " + std::strerror(errno));
+}
+
+void append_number(std::string & out, std::uint64_t number) {
+    // seven bits at a time, the high bit is set on all but the last byte
+    while (number >= 0x80) {
+        out.push_back(char(0x80 | (number & 0x7F)));
+        number >>= 7;
+    }
+    out.push_back(char(number));
+}
+
+void append_characters(std::string & out, const std::u32string & ustr) {
+    append_number(out, ustr.size());
+    for (auto uchr : ustr)
+        append_number(out, std::uint64_t(uchr));
+}
+
+bool read_number(const char *& pos, const char * end, std::uint64_t & number) {
+    number = 0;
+    for (int shift = 0; pos != end && shift < 64; shift += 7) {
+        const auto byte = std::uint8_t(*pos++);
+        number |= std::uint64_t(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+Record read_record(const char *& pos, const char * end) {
+    std::uint64_t numbers[4] = {};
+    auto read_numbers = [&pos, end, &numbers](int count) {
+        for (int i = 0; i != count; ++i) {
+            if (read_number(pos, end, numbers[i])) continue;
+            throw std::runtime_error("EditJournal::recover: journal has a "
+                                     "broken record.");
+        }
+    };
+    auto read_text = [&pos, end, &numbers, &read_numbers](std::u32string & text) {
+        read_numbers(1);
+        text.reserve(std::size_t(std::min(numbers[0], std::uint64_t(end - pos))));
+        for (auto count = numbers[0]; count != 0; --count) {
+            read_numbers(1);
+            text.push_back(UChar(numbers[0]));
+        }
+    };
+    Record record;
+    record.kind = RecordKind(*pos++);
+    switch (record.kind) {
+    case INSERTION:
+        read_numbers(2);
+        record.beg = Cursor(int(numbers[0]), int(numbers[1]));
+        read_text(record.text);
+        break;
+    case REMOVAL:
+        read_numbers(4);
+        record.beg = Cursor(int(numbers[0]), int(numbers[1]));
+        record.end = Cursor(int(numbers[0] + numbers[2]), int(numbers[3]));
+        break;
+    case RESET: read_text(record.text); break;
+    case CHECKPOINT:
+        read_numbers(2);
+        record.number = numbers[0];
+        record.length = numbers[1];
+        break;
+    case SAVED:
+        read_numbers(1);
+        record.number = numbers[0];
+        break;
+    default:
+        throw std::runtime_error("EditJournal::recover: journal has a record "
+                                 "of an unknown kind.");
+    }
+    return record;
+}
+
+std::uint32_t checksum_of(const char * beg, const char * end) {
+    // FNV-1a
+    std::uint32_t hash = 2166136261u;
+    for (; beg != end; ++beg)
+        hash = (hash ^ std::uint8_t(*beg))*16777619u;
+    return hash;
+}
+
+std::size_t content_length_of(const TextLines & tlines)
+    { return tlines.offset_of(tlines.end_cursor()); }
+
+JournalContents read_journal(const std::string & filename, const char * caller) {
+    std::string data;
+    {
+    std::ifstream fin(filename, std::ios::binary);
+    if (!fin) {
+        throw std::runtime_error(std::string(caller) + ": \"" + filename +
+                                 "\" could not be opened.");
+    }
+    data.assign(std::istreambuf_iterator<char>(fin),
+                std::istreambuf_iterator<char>());
+    }
+    const auto magic_length = std::strlen(JOURNAL_MAGIC);
+    if (data.compare(0, magic_length, JOURNAL_MAGIC) != 0) {
+        throw std::runtime_error(std::string(caller) + ": \"" + filename +
+                                 "\" is not a journal.");
+    }
+    std::string records;
+    const char * pos = data.data() + magic_length;
+    const char * end = data.data() + data.size();
+    std::uint64_t frame_size = 0;
+    while (read_number(pos, end, frame_size)) {
+        if (std::uint64_t(end - pos) < frame_size + 4) break;
+        const char * frame_end = pos + frame_size;
+        std::uint32_t checksum = 0;
+        std::memcpy(&checksum, frame_end, 4);
+        if (checksum != checksum_of(pos, frame_end)) break;
+        records.append(pos, frame_end);
+        pos = frame_end + 4;
+    }
+
+    JournalContents contents;
+    auto & checkpoints = contents.checkpoints;
+    pos = records.data();
+    end = records.data() + records.size();
+    while (pos != end) {
+        auto record = read_record(pos, end);
+        switch (record.kind) {
+        case CHECKPOINT:
+            // numbers before a restart are missing, and match nothing
+            if (record.number >= checkpoints.size()) {
+                checkpoints.resize(std::size_t(record.number) + 1,
+                                   std::make_pair(std::size_t(0), std::uint64_t(-1)));
+            }
+            checkpoints[std::size_t(record.number)] =
+                std::make_pair(contents.edits.size(), record.length);
+            break;
+        case SAVED: contents.saved = std::size_t(record.number); break;
+        default: contents.edits.push_back(std::move(record)); break;
+        }
+    }
+    return contents;
+}
+
+// ------------------------------ tests helpers -------------------------------
+
+std::u32string content_of(const TextLines & tlines) {
+    if (tlines.lines().empty()) return std::u32string();
+    return tlines.copy_characters_from(Cursor(), tlines.end_cursor());
+}
+
+void run_edit_journal_tests() {
+    const std::string filename = "ksg-te-edit-journal-test.ksg-te-journal";
+    const std::u32string original = U"local a = 1\nlocal b = 2\nreturn a + b";
+    // every kind of edit replays to the same content
+    {
+    TextLines tlines(original);
+    {
+    EditJournal journal(tlines, filename);
+    Cursor cursor(1, 5);
+    for (auto uchr : std::u32string(U"x\ny é"))
+        cursor = tlines.push(cursor, uchr);
+    cursor = tlines.delete_behind(cursor);
+    tlines.delete_ahead(Cursor(0, 0));
+    const std::u32string pasted = U"-- one\n-- two\n";
+    tlines.deposit_chatacters_to(pasted.data(), pasted.data() + pasted.size(), Cursor(2, 0));
+    tlines.deposit_chatacters_to(pasted.data(), pasted.data() + pasted.size(), tlines.end_cursor());
+    tlines.wipe(Cursor(0, 2), Cursor(1, 3));
+    // each range is told of only once all are replaced
+    tlines.replace_all({ CursorRange(Cursor(2, 0), Cursor(2, 2)),
+                         CursorRange(Cursor(3, 0), Cursor(3, 2)) }, U"--[[\n]]");
+    {
+    TextLines::Transaction transaction(tlines);
+    tlines.push(Cursor(0, 0), U'a');
+    tlines.push(Cursor(0, 0), U'b');
+    tlines.wipe(Cursor(1, 0), Cursor(2, 0));
+    }
+    journal.sync();
+    assert(journal.error().empty());
+    }
+    // edits since the last save (none were) are left for recovery
+    TextLines recovered(original);
+    assert(EditJournal::recover(filename, recovered) == 17);
+    assert(content_of(recovered) == content_of(tlines));
+    // a torn write at the end is left out
+    std::ofstream(filename, std::ios::binary | std::ios::app) << "\x09" "ab";
+    recovered.set_content(original);
+    assert(EditJournal::recover(filename, recovered) == 17);
+    assert(content_of(recovered) == content_of(tlines));
+    // it does not follow from other content
+    bool threw = false;
+    try {
+        TextLines other(U"a");
+        EditJournal::recover(filename, other);
+    } catch (std::runtime_error &) {
+        threw = true;
+    }
+    assert(threw);
+    // a journal with edits to recover is not started over, until it is set
+    // aside
+    assert(EditJournal::has_unsaved_edits(filename));
+    threw = false;
+    try {
+        EditJournal replacement(recovered, filename);
+    } catch (std::runtime_error &) {
+        threw = true;
+    }
+    assert(threw && EditJournal::has_unsaved_edits(filename));
+    const auto aside = EditJournal::set_aside(filename);
+    assert(aside != filename && !std::ifstream(filename));
+    {
+    // edits replayed onto a new journal's lines are journaled again
+    TextLines replayed(original);
+    EditJournal replacement(replayed, filename);
+    assert(EditJournal::recover(aside, replayed) == 17);
+    replacement.sync();
+    }
+    std::remove(aside.c_str());
+    recovered.set_content(original);
+    assert(EditJournal::recover(filename, recovered) == 17);
+    assert(content_of(recovered) == content_of(tlines));
+    std::remove(filename.c_str());
+    assert(!EditJournal::has_unsaved_edits(filename));
+    }
+    // recovery is from the last save
+    {
+    TextLines tlines(U"a");
+    EditJournal journal(tlines, filename);
+    tlines.push(Cursor(0, 1), U'b');
+    const auto first_save = journal.checkpoint();
+    tlines.push(Cursor(0, 2), U'c');
+    journal.mark_saved(first_save);
+    const auto saved = content_of(tlines);
+    // this save replaced the file, but was never marked
+    const auto second_save = journal.checkpoint();
+    (void)second_save;
+    tlines.set_content(U"12345\n6");
+    tlines.push(Cursor(1, 1), U'7');
+    journal.sync();
+    TextLines recovered(U"ab");
+    assert(EditJournal::recover(filename, recovered) == 3);
+    assert(content_of(recovered) == content_of(tlines));
+    recovered.set_content(saved);
+    assert(EditJournal::recover(filename, recovered) == 2);
+    assert(content_of(recovered) == content_of(tlines));
+    }
+    std::remove(filename.c_str());
+    // with the last save having everything, the journal starts over and is
+    // removed at the end
+    {
+    TextLines tlines(original);
+    {
+    EditJournal journal(tlines, filename);
+    tlines.push(Cursor(0, 0), U'-');
+    journal.mark_saved(journal.checkpoint());
+    journal.sync();
+    TextLines recovered(content_of(tlines));
+    assert(EditJournal::recover(filename, recovered) == 0);
+    assert(!EditJournal::has_unsaved_edits(filename));
+    }
+    assert(!std::ifstream(filename));
+    }
+}
+
+} // end of <anonymous> namespace
@@ -0,0 +1,143 @@
+/****************************************************************************
+
+    File: EditJournal.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "TextLines.hpp"
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/** Keeps an append-only journal of every edit made to a TextLines, so that
+ *  work made since the last save survives a crash.
+ *
+ *  Edits are encoded compactly (numbers and characters as variable length
+ *  integers) into memory, which is all an edit costs the editing thread. A
+ *  worker thread writes whatever has built up and syncs it to disk every so
+ *  often, so a crash loses at most the last interval of edits. Each write is
+ *  framed with a checksum, a torn write at the end of the journal is simply
+ *  where recovery stops.
+ *
+ *  Saves are marked in the journal: a checkpoint where the saved content was
+ *  taken, and a mark once that content is on disk. Recovery replays whatever
+ *  follows the last saved checkpoint onto the saved file's content. Once
+ *  the content is saved with nothing edited since, the journal starts over.
+ */
+class EditJournal final : public TextLines::EditListener {
+public:
+    static constexpr const int DEFAULT_SYNC_INTERVAL_MS = 250;
+
+    /** Starts a new journal (replacing any at the given file, so long as it
+     *  has nothing to recover) of edits made to the lines from now on. Their
+     *  content is taken to be what was last saved.
+     *  @warning Does not in anyway maintain ownership over the given object.
+     *           Given object must survive the life of this object.
+     *  @throws std::runtime_error if the journal could not be created, or if
+     *          one with unsaved edits is at the given file (see set_aside)
+     */
+    EditJournal(TextLines &, const std::string & filename,
+                int sync_interval_ms = DEFAULT_SYNC_INTERVAL_MS);
+    /** Syncs whatever is left. The journal file is removed if it has nothing
+     *  to recover, otherwise it is left for recover.
+     */
+    ~EditJournal() override;
+
+    EditJournal(const EditJournal &) = delete;
+    EditJournal & operator = (const EditJournal &) = delete;
+
+    /** @return where the journal for the given document is kept */
+    static std::string journal_name_for(const std::string & document_filename)
+        { return document_filename + ".ksg-te-journal"; }
+
+    /** Marks the content as it is now, just before it is saved.
+     *  @return checkpoint to give to mark_saved once the save succeeds
+     */
+    std::size_t checkpoint();
+
+    /** Marks that the content at the given checkpoint is now on disk. */
+    void mark_saved(std::size_t checkpoint);
+
+    /** Waits until everything journaled so far is on disk. */
+    void sync();
+
+    /** @return why the journal could not be written, empty if it has had no
+     *          trouble (once it has, nothing more is journaled)
+     */
+    std::string error() const;
+
+    /** Replays the journal onto lines holding the last saved content.
+     *  @throws std::runtime_error if the journal could not be read, or does
+     *          not follow from the given content
+     *  @return number of edits replayed
+     */
+    static std::size_t recover(const std::string & filename, TextLines &);
+
+    /** @return true if there is a journal at the given file with edits made
+     *          since its last save (or one which cannot be read)
+     */
+    static bool has_unsaved_edits(const std::string & filename);
+
+    /** Moves the journal to a new name (the given one with a number added),
+     *  so that another can be started in its place.
+     *  @throws std::runtime_error if it could not be moved
+     *  @return the journal's new name
+     */
+    static std::string set_aside(const std::string & filename);
+
+    static void run_tests();
+private:
+    void on_insertion(const TextLines &, Cursor beg, Cursor end) override;
+    void on_insertion_of(const TextLines &, Cursor beg, Cursor end,
+                         const std::u32string & inserted) override;
+    void on_removal(const TextLines &, Cursor beg, Cursor end,
+                    const std::u32string & removed) override;
+    void on_reset(const TextLines &) override;
+
+    // starts over (on the worker thread) with only the latest checkpoint,
+    // marked as saved
+    void restart();
+    void run_worker();
+
+    TextLines * m_lines;
+    std::string m_filename;
+    int m_sync_interval_ms;
+    // only ever touched on the editing thread
+    std::size_t m_checkpoint_count;
+    std::size_t m_saved_checkpoint;
+    bool m_edited_since_checkpoint;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_sync_requested;
+    std::condition_variable m_synced;
+    // encoded records, yet to be written
+    std::string m_pending;
+    // journal is to be truncated before the pending records are written
+    bool m_restart_requested;
+    std::size_t m_syncs_requested;
+    std::size_t m_syncs_finished;
+    bool m_stop_requested;
+    std::string m_error;
+
+    // must be last, the worker may only start once everything else is ready
+    std::thread m_worker;
+};
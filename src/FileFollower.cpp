@@ -0,0 +1,230 @@
+/****************************************************************************
+
+    File: FileFollower.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "FileFollower.hpp"
+#include "DocumentReader.hpp"
+#include "TextLines.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <thread>
+#include <cstdio>
+
+#ifdef MACRO_PLATFORM_LINUX
+#   include <unistd.h>
+#   include <sys/inotify.h>
+#endif
+
+#include <cassert>
+
+namespace {
+
+void run_file_follower_tests();
+
+} // end of <anonymous> namespace
+
+/* static */ constexpr const std::size_t FileFollower::DEFAULT_READ_LIMIT;
+/* static */ constexpr const int FileFollower::POLL_INTERVAL_IN_MILLISECONDS;
+
+FileFollower::FileFollower():
+    m_offset      (0),
+    m_leftover    (0),
+    m_more_to_read(false),
+    m_watch_fd    (-1)
+{}
+
+FileFollower::~FileFollower() { stop(); }
+
+void FileFollower::follow(const std::string & filename) {
+    stop();
+    m_file.open(filename, std::ios::binary);
+    if (!m_file) {
+        throw std::runtime_error("FileFollower::follow: \"" + filename +
+                                 "\" could not be opened.");
+    }
+    m_filename = filename;
+    // all there is so far is read on the first call
+    m_more_to_read = true;
+#   ifdef MACRO_PLATFORM_LINUX
+    m_watch_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_watch_fd != -1 &&
+        ::inotify_add_watch(m_watch_fd, filename.c_str(),
+                            IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB) == -1)
+    {
+        ::close(m_watch_fd);
+        m_watch_fd = -1;
+    }
+#   endif
+}
+
+void FileFollower::stop() {
+#   ifdef MACRO_PLATFORM_LINUX
+    if (m_watch_fd != -1) ::close(m_watch_fd);
+#   endif
+    m_watch_fd = -1;
+    if (m_file.is_open()) m_file.close();
+    m_file.clear();
+    m_filename.clear();
+    m_offset = 0;
+    m_leftover = 0;
+    m_more_to_read = false;
+}
+
+FileFollower::Result FileFollower::append_new_to
+    (TextLines & textlines, std::size_t max_bytes)
+{
+    if (!is_following() || !may_have_changed()) return NOTHING_NEW;
+    auto rv = NOTHING_NEW;
+    m_file.clear();
+    m_file.seekg(0, std::ios::end);
+    const auto file_size = std::uint64_t(m_file.tellg());
+    if (file_size < m_offset) {
+        // truncated, and presumably written again from the start
+        textlines.set_content(U"");
+        m_offset = 0;
+        m_leftover = 0;
+        rv = STARTED_OVER;
+    }
+    const auto to_read = std::size_t(std::min<std::uint64_t>
+        (file_size - m_offset, std::max<std::size_t>(max_bytes, 1)));
+    m_more_to_read = to_read < file_size - m_offset;
+    if (to_read == 0) return rv;
+
+    m_buffer.resize(m_leftover + to_read);
+    m_file.seekg(std::streamoff(m_offset));
+    m_file.read(m_buffer.data() + m_leftover, std::streamsize(to_read));
+    if (std::size_t(m_file.gcount()) != to_read) {
+        throw std::runtime_error("FileFollower::append_new_to: \"" + m_filename +
+                                 "\" could not be read.");
+    }
+    m_offset += to_read;
+
+    std::u32string text;
+    const char * beg = m_buffer.data();
+    const char * end = m_buffer.data() + m_buffer.size();
+    DocumentReader::decode_utf8(beg, end, text);
+    m_leftover = std::size_t(end - beg);
+    std::copy(beg, end, m_buffer.begin());
+    if (text.empty()) return rv;
+    // each read may end mid line
+    const auto & lines = textlines.lines();
+    const auto at = lines.empty() ? Cursor() :
+        Cursor(int(lines.size()) - 1, lines.back().content_length());
+    textlines.deposit_chatacters_to(text.data(), text.data() + text.size(), at);
+    return rv == NOTHING_NEW ? APPENDED : rv;
+}
+
+/* static */ void FileFollower::run_tests()
+    { run_file_follower_tests(); }
+
+/* private */ bool FileFollower::may_have_changed() {
+    if (m_more_to_read) return true;
+#   ifdef MACRO_PLATFORM_LINUX
+    if (m_watch_fd != -1) {
+        // only whether there were any events matters, not what they were
+        bool changed = false;
+        char events[4096];
+        while (::read(m_watch_fd, events, sizeof(events)) > 0)
+            changed = true;
+        return changed;
+    }
+#   endif
+    const auto now = Clock::now();
+    if (now - m_last_poll < std::chrono::milliseconds(POLL_INTERVAL_IN_MILLISECONDS))
+        return false;
+    m_last_poll = now;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+std::u32string content_of(const TextLines & tlines) {
+    if (tlines.lines().empty()) return std::u32string();
+    return tlines.copy_characters_from(Cursor(), tlines.end_cursor());
+}
+
+// appends until something is, giving up after a while (a polled file is
+// only looked at so often)
+FileFollower::Result wait_for_append(FileFollower & follower, TextLines & tlines) {
+    const auto give_up = FileFollower::Clock::now() + std::chrono::seconds(2);
+    while (FileFollower::Clock::now() < give_up) {
+        auto res = follower.append_new_to(tlines);
+        if (res != FileFollower::NOTHING_NEW) return res;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return FileFollower::NOTHING_NEW;
+}
+
+void run_file_follower_tests() {
+    using Result = FileFollower::Result;
+    const std::string filename = "ksg-te-file-follower-test.log";
+    std::ofstream(filename, std::ios::binary) << "first\nsec";
+    TextLines tlines;
+    FileFollower follower;
+    follower.follow(filename);
+    // what is there to begin with is read right away
+    assert(follower.append_new_to(tlines) == Result::APPENDED);
+    assert(content_of(tlines) == U"first\nsec");
+    assert(follower.append_new_to(tlines) == Result::NOTHING_NEW);
+    // the line written in two parts, the 'é' split between them
+    {
+    std::ofstream out(filename, std::ios::binary | std::ios::app);
+    out << "ond \xC3";
+    out.flush();
+    assert(wait_for_append(follower, tlines) == Result::APPENDED);
+    assert(content_of(tlines) == U"first\nsecond ");
+    out << "\xA9\nthird\n";
+    out.flush();
+    assert(wait_for_append(follower, tlines) == Result::APPENDED);
+    assert(content_of(tlines) == U"first\nsecond é\nthird\n");
+    assert(follower.bytes_read() == 22);
+    }
+    // a little at a time
+    {
+    std::ofstream(filename, std::ios::binary | std::ios::app) << "fourth\n";
+    const auto give_up = FileFollower::Clock::now() + std::chrono::seconds(2);
+    while (content_of(tlines).size() != 28 && FileFollower::Clock::now() < give_up)
+        (void)follower.append_new_to(tlines, 2);
+    assert(content_of(tlines) == U"first\nsecond é\nthird\nfourth\n");
+    }
+    // truncated and written over
+    std::ofstream(filename, std::ios::binary).write("new\0", 4);
+    assert(wait_for_append(follower, tlines) == Result::STARTED_OVER);
+    assert(content_of(tlines) == U"new�");
+    follower.stop();
+    assert(!follower.is_following());
+    assert(follower.append_new_to(tlines) == Result::NOTHING_NEW);
+    std::remove(filename.c_str());
+    // files which can not be opened are thrown for
+    {
+    bool threw = false;
+    try {
+        follower.follow("no-such-directory/file.log");
+    } catch (std::runtime_error &) {
+        threw = true;
+    }
+    assert(threw && !follower.is_following());
+    }
+}
+
+} // end of <anonymous> namespace
@@ -0,0 +1,105 @@
+/****************************************************************************
+
+    File: FileFollower.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+
+class TextLines;
+
+/** Follows a file which is only ever appended to (such as a log), appending
+ *  whatever is written to it onto the end of some TextLines.
+ *
+ *  On Linux the file is watched with inotify, so that it is only read once
+ *  it has been written to. Elsewhere (or should inotify not be available)
+ *  the file's size is polled instead.
+ *
+ *  Only bytes past those already read are ever read, and all that is read
+ *  in one call is appended in one batch. Everything happens on the thread
+ *  calling append_new_to.
+ */
+class FileFollower {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // at most this much is read in one call, so that a file which is
+    // written faster than it is shown can not stall the caller
+    static constexpr const std::size_t DEFAULT_READ_LIMIT = 8*1024*1024;
+    // how often the file's size is checked, where it is not watched
+    static constexpr const int POLL_INTERVAL_IN_MILLISECONDS = 250;
+
+    enum Result {
+        NOTHING_NEW,
+        APPENDED,
+        // the file was truncated, the lines now begin from its new content
+        STARTED_OVER
+    };
+
+    FileFollower();
+    FileFollower(const FileFollower &) = delete;
+    FileFollower & operator = (const FileFollower &) = delete;
+    ~FileFollower();
+
+    /** Begins following the file from its start, any file followed before
+     *  is no longer followed.
+     *  @throws std::runtime_error if the file could not be opened
+     */
+    void follow(const std::string & filename);
+
+    void stop();
+
+    bool is_following() const { return m_file.is_open(); }
+
+    /** @return true if the file is watched, rather than polled */
+    bool is_watched() const { return m_watch_fd != -1; }
+
+    /** Appends (to the end of the last line) what has been written to the
+     *  file since last called. A multi-byte sequence cut short by the end
+     *  of the file is held until the rest of it is written. Invalid bytes
+     *  (and nulls) are appended as U+FFFD.
+     *  @throws std::runtime_error if the file could not be read
+     */
+    Result append_new_to(TextLines &, std::size_t max_bytes = DEFAULT_READ_LIMIT);
+
+    /** @return bytes of the file read so far */
+    std::uint64_t bytes_read() const { return m_offset; }
+
+    static void run_tests();
+private:
+    // @return true if the file may have been written to since last read
+    bool may_have_changed();
+
+    std::string m_filename;
+    std::ifstream m_file;
+    std::uint64_t m_offset;
+    // read bytes of a sequence cut short by the end of the file
+    std::vector<char> m_buffer;
+    std::size_t m_leftover;
+    // true if the last read stopped at its limit, rather than the file's end
+    bool m_more_to_read;
+    Clock::time_point m_last_poll;
+    // inotify's, -1 if the file is polled
+    int m_watch_fd;
+};
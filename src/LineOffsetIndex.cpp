@@ -0,0 +1,284 @@
+/****************************************************************************
+
+    File: LineOffsetIndex.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "LineOffsetIndex.hpp"
+
+#include <stdexcept>
+#include <numeric>
+#include <algorithm>
+#include <iterator>
+
+#include <cassert>
+
+namespace {
+
+std::size_t lowest_bit(std::size_t i) { return i & (~i + 1); }
+
+void run_line_offset_index_tests();
+
+} // end of <anonymous> namespace
+
+/* static */ constexpr const std::size_t LineOffsetIndex::MAX_CHUNK_SIZE;
+
+void LineOffsetIndex::splice
+    (std::size_t first, std::size_t old_count,
+     const std::size_t * beg, const std::size_t * end)
+{
+    if (first > m_size || old_count > m_size - first) {
+        throw std::invalid_argument("LineOffsetIndex::splice: given range of "
+                                    "lines is out of bounds.");
+    }
+    const auto new_count = std::size_t(end - beg);
+    if (old_count == new_count) {
+        for (std::size_t i = 0; i != new_count; ++i)
+            set_length(first + i, beg[i]);
+        return;
+    }
+    // chunks spanned by the old lines [chunk_beg, chunk_end), an insertion
+    // goes into the chunk it falls in (or the last, at the very end)
+    std::size_t chunk_beg = 0, chunk_end = 0, first_in_chunk = 0;
+    if (!m_chunks.empty()) {
+        const auto line = std::min(first, m_size - 1);
+        first_in_chunk = line;
+        chunk_beg = chunk_of(first_in_chunk);
+        first_in_chunk += first - line;
+        auto last = first + old_count - 1;
+        chunk_end = 1 + (old_count == 0 ? chunk_beg : chunk_of(last));
+    }
+    // the lines of those chunks, as they are to be
+    std::vector<std::size_t> lengths;
+    if (chunk_beg != chunk_end) {
+        const auto & head = m_chunks[chunk_beg].lengths;
+        const auto & tail = m_chunks[chunk_end - 1].lengths;
+        const auto tail_from = tail.size() - (m_chunk_sizes.prefix(chunk_end) - first - old_count);
+        lengths.insert(lengths.end(), head.begin(), head.begin() + std::ptrdiff_t(first_in_chunk));
+        lengths.insert(lengths.end(), beg, end);
+        lengths.insert(lengths.end(), tail.begin() + std::ptrdiff_t(tail_from), tail.end());
+    } else {
+        lengths.assign(beg, end);
+    }
+
+    std::vector<Chunk> chunks;
+    // a chunk split is left with room to grow
+    const auto chunk_size = lengths.size() > MAX_CHUNK_SIZE ? MAX_CHUNK_SIZE / 2 :
+                                                              MAX_CHUNK_SIZE;
+    for (std::size_t i = 0; i < lengths.size(); i += chunk_size) {
+        chunks.emplace_back();
+        auto & chunk = chunks.back();
+        const auto piece_end = std::min(lengths.size(), i + chunk_size);
+        chunk.lengths.assign(lengths.begin() + std::ptrdiff_t(i),
+                             lengths.begin() + std::ptrdiff_t(piece_end));
+        chunk.offsets.assign(chunk.lengths);
+    }
+    m_size = m_size - old_count + new_count;
+
+    if (chunks.size() == chunk_end - chunk_beg) {
+        for (std::size_t i = 0; i != chunks.size(); ++i) {
+            auto & chunk = m_chunks[chunk_beg + i];
+            const auto old_size  = chunk.lengths.size();
+            const auto old_total = chunk.offsets.prefix(old_size);
+            chunk = std::move(chunks[i]);
+            m_chunk_sizes .add(chunk_beg + i, chunk.lengths.size() - old_size);
+            m_chunk_totals.add(chunk_beg + i, chunk.offsets.prefix(chunk.lengths.size()) - old_total);
+        }
+        return;
+    }
+    auto at = m_chunks.erase(m_chunks.begin() + std::ptrdiff_t(chunk_beg),
+                             m_chunks.begin() + std::ptrdiff_t(chunk_end));
+    m_chunks.insert(at, std::make_move_iterator(chunks.begin()),
+                        std::make_move_iterator(chunks.end  ()));
+    rebuild_chunk_trees();
+}
+
+void LineOffsetIndex::set_length(std::size_t line, std::size_t length) {
+    if (line >= m_size) {
+        throw std::invalid_argument("LineOffsetIndex::set_length: given line "
+                                    "is out of bounds.");
+    }
+    const auto chunk_idx = chunk_of(line);
+    auto & chunk = m_chunks[chunk_idx];
+    const std::size_t delta = length - chunk.lengths[line];
+    if (delta == 0) return;
+    chunk.lengths[line] = length;
+    chunk.offsets.add(line, delta);
+    m_chunk_totals.add(chunk_idx, delta);
+}
+
+std::size_t LineOffsetIndex::length(std::size_t line) const {
+    if (line >= m_size) {
+        throw std::invalid_argument("LineOffsetIndex::length: given line is "
+                                    "out of bounds.");
+    }
+    const auto chunk_idx = chunk_of(line);
+    return m_chunks[chunk_idx].lengths[line];
+}
+
+std::size_t LineOffsetIndex::offset_of(std::size_t line) const {
+    if (line > m_size) {
+        throw std::invalid_argument("LineOffsetIndex::offset_of: given line "
+                                    "is out of bounds.");
+    }
+    if (line == m_size) return total();
+    const auto chunk_idx = chunk_of(line);
+    return m_chunk_totals.prefix(chunk_idx) +
+           m_chunks[chunk_idx].offsets.prefix(line);
+}
+
+std::size_t LineOffsetIndex::line_at(std::size_t offset) const {
+    const auto chunk_idx = m_chunk_totals.count_within(offset);
+    if (chunk_idx == m_chunks.size()) return m_size;
+    return m_chunk_sizes.prefix(chunk_idx) +
+           m_chunks[chunk_idx].offsets.count_within(offset);
+}
+
+/* static */ void LineOffsetIndex::run_tests()
+    { run_line_offset_index_tests(); }
+
+/* private */ void LineOffsetIndex::Fenwick::assign
+    (const std::vector<std::size_t> & values)
+{
+    // O(n), each node passes its total on to its parent
+    m_tree.assign(values.size() + 1, 0);
+    for (std::size_t i = 1; i < m_tree.size(); ++i) {
+        m_tree[i] += values[i - 1];
+        const auto parent = i + lowest_bit(i);
+        if (parent < m_tree.size()) m_tree[parent] += m_tree[i];
+    }
+}
+
+/* private */ void LineOffsetIndex::Fenwick::add
+    (std::size_t idx, std::size_t delta)
+{
+    for (auto i = idx + 1; i < m_tree.size(); i += lowest_bit(i))
+        m_tree[i] += delta;
+}
+
+/* private */ std::size_t LineOffsetIndex::Fenwick::prefix
+    (std::size_t count) const
+{
+    std::size_t rv = 0;
+    for (auto i = count; i != 0; i -= lowest_bit(i))
+        rv += m_tree[i];
+    return rv;
+}
+
+/* private */ std::size_t LineOffsetIndex::Fenwick::count_within
+    (std::size_t & total) const
+{
+    if (m_tree.empty()) return 0;
+    // descends the tree, taking each span which still fits
+    const auto size = m_tree.size() - 1;
+    std::size_t pos = 0;
+    std::size_t step = 1;
+    while (step*2 <= size) step *= 2;
+    for (; step != 0; step /= 2) {
+        if (pos + step > size || m_tree[pos + step] > total) continue;
+        pos   += step;
+        total -= m_tree[pos];
+    }
+    return pos;
+}
+
+/* private */ std::size_t LineOffsetIndex::chunk_of(std::size_t & line) const {
+    assert(line < m_size);
+    // no chunk is empty, so the line is short of the next chunk's start
+    return m_chunk_sizes.count_within(line);
+}
+
+/* private */ void LineOffsetIndex::rebuild_chunk_trees() {
+    std::vector<std::size_t> sizes, totals;
+    sizes .reserve(m_chunks.size());
+    totals.reserve(m_chunks.size());
+    for (const auto & chunk : m_chunks) {
+        sizes .push_back(chunk.lengths.size());
+        totals.push_back(chunk.offsets.prefix(chunk.lengths.size()));
+    }
+    m_chunk_sizes .assign(sizes );
+    m_chunk_totals.assign(totals);
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+void run_line_offset_index_tests() {
+    {
+    LineOffsetIndex index;
+    assert(index.total() == 0 && index.line_at(0) == 0);
+    const std::vector<std::size_t> lengths = { 4, 1, 7, 3 };
+    index.splice(0, 0, lengths.data(), lengths.data() + lengths.size());
+    assert(index.offset_of(2) == 5 && index.total() == 15);
+    assert(index.line_at(0) == 0 && index.line_at(3) == 0);
+    assert(index.line_at(4) == 1 && index.line_at(5) == 2);
+    assert(index.line_at(14) == 3 && index.line_at(15) == 4);
+    index.set_length(1, 10);
+    assert(index.offset_of(2) == 14 && index.line_at(13) == 1);
+    index.set_length(1, 1);
+    assert(index.offset_of(3) == 12);
+    bool threw = false;
+    try {
+        index.splice(3, 2, nullptr, nullptr);
+    } catch (std::invalid_argument &) {
+        threw = true;
+    }
+    assert(threw);
+    }
+    // random splices (some across many chunks), against summing every line
+    {
+    LineOffsetIndex index;
+    std::vector<std::size_t> expected;
+    unsigned seed = 11;
+    auto next_random = [&seed](std::size_t limit) {
+        seed = seed*1103515245u + 12345u;
+        return std::size_t((seed >> 16) % unsigned(limit));
+    };
+    for (int i = 0; i != 300; ++i) {
+        const bool is_big = i % 7 == 0;
+        std::vector<std::size_t> lengths(next_random(is_big ? 1500 : 5));
+        for (auto & length : lengths) length = 1 + next_random(20);
+        const auto first = next_random(expected.size() + 1);
+        const auto old_count = next_random
+            (std::min(expected.size() - first, std::size_t(is_big ? 1200 : 4)) + 1);
+        index.splice(first, old_count, lengths.data(), lengths.data() + lengths.size());
+        auto at = expected.erase(expected.begin() + std::ptrdiff_t(first),
+                                 expected.begin() + std::ptrdiff_t(first + old_count));
+        expected.insert(at, lengths.begin(), lengths.end());
+        if (!expected.empty()) {
+            const auto line = next_random(expected.size());
+            index.set_length(line, expected[line] = 1 + next_random(20));
+        }
+        assert(index.size() == expected.size());
+        std::vector<std::size_t> offsets(expected.size() + 1, 0);
+        std::partial_sum(expected.begin(), expected.end(), offsets.begin() + 1);
+        for (std::size_t line = 0; line <= expected.size(); line += 1 + line % 13) {
+            assert(index.offset_of(line) == offsets[line]);
+            assert(index.line_at(offsets[line]) == line);
+            if (line != expected.size()) {
+                assert(index.length(line) == expected[line]);
+                assert(index.line_at(offsets[line + 1] - 1) == line);
+            }
+        }
+        assert(index.total() == offsets.back());
+    }
+    }
+}
+
+} // end of <anonymous> namespace
@@ -0,0 +1,94 @@
+/****************************************************************************
+
+    File: LineOffsetIndex.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+/** Running totals of the lengths of a sequence of lines.
+ *
+ *  Lines are held in chunks, each with a Fenwick (binary indexed) tree of
+ *  its lengths, under a Fenwick tree of each chunk's line count and total
+ *  length. Changing the length of a line, the total before a line, and
+ *  finding the line holding some offset are all O(log n). Adding or
+ *  removing lines only rebuilds the chunks they fall in (and the trees over
+ *  the chunks, should their number change).
+ */
+class LineOffsetIndex {
+public:
+    // chunks are split once they grow past this many lines
+    static constexpr const std::size_t MAX_CHUNK_SIZE = 1024;
+
+    LineOffsetIndex(): m_size(0) {}
+
+    /** Replaces old_count lengths starting from first with the given ones.
+     *  @throws std::invalid_argument if the lines replaced are out of bounds
+     */
+    void splice(std::size_t first, std::size_t old_count,
+                const std::size_t * beg, const std::size_t * end);
+
+    void set_length(std::size_t line, std::size_t length);
+    std::size_t length(std::size_t line) const;
+
+    /** @return total length of every line before the given one */
+    std::size_t offset_of(std::size_t line) const;
+    std::size_t total() const { return m_chunk_totals.prefix(m_chunks.size()); }
+
+    /** @return the last line starting at or before the offset (size() if
+     *          the offset is past every line)
+     */
+    std::size_t line_at(std::size_t offset) const;
+
+    std::size_t size() const { return m_size; }
+
+    static void run_tests();
+private:
+    class Fenwick {
+    public:
+        void assign(const std::vector<std::size_t> & values);
+        // unsigned arithmetic wraps, so a negative delta is added just the
+        // same
+        void add(std::size_t idx, std::size_t delta);
+        // @return total of the first count values
+        std::size_t prefix(std::size_t count) const;
+        // @return most values whose total fits in the given one, which is
+        //         then reduced by their total
+        std::size_t count_within(std::size_t & total) const;
+    private:
+        // one based, m_tree[i] is the total of values (i - lowbit(i), i]
+        std::vector<std::size_t> m_tree;
+    };
+
+    struct Chunk {
+        std::vector<std::size_t> lengths;
+        Fenwick offsets;
+    };
+
+    // @return chunk holding the line, line is made relative to the chunk
+    std::size_t chunk_of(std::size_t & line) const;
+    void rebuild_chunk_trees();
+
+    std::vector<Chunk> m_chunks;
+    Fenwick m_chunk_sizes;
+    Fenwick m_chunk_totals;
+    std::size_t m_size;
+};
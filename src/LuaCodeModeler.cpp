@@ -71,6 +71,29 @@ void LuaCodeModeler::reset_state() {
     m_in_multiline_size = NOT_MULTILINE;
 }
 
+// layout of a saved state, chosen so that the reset state saves as zero
+// bits  0 - 31: multiline size plus one (so NOT_MULTILINE is zero)
+// bits 32 - 52: current string quote
+// bit       53: in comment
+// bit       54: string terminates (always clear at a line's end)
+LuaCodeModeler::State LuaCodeModeler::save_state() const {
+    static_assert(NOT_MULTILINE + 1 == 0, "");
+    auto multiline_bits = std::uint64_t(std::uint32_t(m_in_multiline_size + 1));
+    auto quote_bits     = std::uint64_t(m_current_string_quote) & 0x1FFFFF;
+    return State(multiline_bits | (quote_bits << 32) |
+                 (std::uint64_t(m_in_comment       ) << 53) |
+                 (std::uint64_t(m_string_terminates) << 54));
+}
+
+void LuaCodeModeler::restore_state(State state) {
+    auto value = state.value();
+    m_in_multiline_size    = int(std::uint32_t(value & 0xFFFFFFFF)) - 1;
+    m_current_string_quote = UChar((value >> 32) & 0x1FFFFF);
+    m_in_comment           = ((value >> 53) & 1) != 0;
+    m_string_terminates    = ((value >> 54) & 1) != 0;
+    check_invarients();
+}
+
 LuaCodeModeler::Response LuaCodeModeler::update_model
     (UStringCIter itr, Cursor)
 {
@@ -153,6 +176,11 @@ LuaCodeModeler::Response LuaCodeModeler::update_model
     return rv;
 }
 
+// "Lua" in the upper bytes, and in the lower a revision of how lines are
+// modeled, to be incremented with any change to the tokens or states given
+std::uint64_t LuaCodeModeler::model_version() const
+    { return 0x4C75610000000001ull; }
+
 /* static */ ColorPair LuaCodeModeler::colors_for_pair(int pid) {
     auto with_default_back = [](uint8_t r, uint8_t g, uint8_t b) {
         static const sf::Color default_back_c = sf::Color(20, 20, 20);
@@ -260,7 +288,7 @@ LuaCodeModeler::Response LuaCodeModeler::update_model
     (UStringCIter itr)
 {
     assert(*itr == TextLines::NEW_LINE);
-    m_in_comment = false;
+    m_in_comment = m_string_terminates = false;
     m_current_string_quote = NOT_IN_STRING;
     return make_resp(itr + 1, REGULAR_CODE, false);
 }
@@ -337,6 +365,40 @@ void run_lua_code_modeler_tests() {
     std::u32string code = U"";
     LuaCodeModeler lcm;
     }
+    // the reset state saves as the default state
+    {
+    LuaCodeModeler lcm;
+    assert(lcm.is_in_reset_state());
+    assert(lcm.save_state() == LuaCodeModeler::State());
+    }
+    // saving and restoring in the middle of a multiline string
+    {
+    static const std::u32string first_c  = U"local a = [==[ text";
+    static const std::u32string second_c = U"more ]==] local b = 'c";
+    LuaCodeModeler continuing, restored;
+    TextLineImage first_image, continued_image, restored_image;
+    first_image.update_modeler(continuing, first_c);
+    auto saved = continuing.save_state();
+    assert(!continuing.is_in_reset_state());
+    assert(saved == first_image.modeler_exit_state());
+
+    restored.restore_state(saved);
+    assert(restored.state_equals(saved));
+    continued_image.update_modeler(continuing, second_c);
+    restored_image .update_modeler(restored  , second_c);
+    assert(continued_image == restored_image);
+    // string and comment states end with the line
+    assert(continuing.is_in_reset_state());
+    }
+    // a line with a closed string exits in the reset state
+    {
+    static const std::u32string content = U"local s = \"x\"";
+    LuaCodeModeler lcm;
+    TextLineImage image;
+    image.update_modeler(lcm, content);
+    assert(lcm.is_in_reset_state());
+    assert(image.modeler_exit_state() == LuaCodeModeler::State());
+    }
 }
 
 const std::set<std::u32string> & get_lua_keywords() {
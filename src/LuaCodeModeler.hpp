@@ -38,7 +38,10 @@ public:
 
     LuaCodeModeler();
     void reset_state() override;
+    State save_state() const override;
+    void restore_state(State) override;
     Response update_model(UStringCIter, Cursor) override;
+    std::uint64_t model_version() const override;
     static ColorPair colors_for_pair(int);
     static void run_tests();
 private:
@@ -0,0 +1,320 @@
+/****************************************************************************
+
+    File: MappedDocument.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "MappedDocument.hpp"
+#include "DocumentReader.hpp"
+#include "TextLineImage.hpp"
+#include "TargetTextGrid.hpp"
+#include "TextLines.hpp"
+#include "SubstringSearcher.hpp"
+
+#include <stdexcept>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cerrno>
+
+#ifdef MACRO_PLATFORM_LINUX
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#endif
+
+#include <cassert>
+
+namespace {
+
+// pages scanned only for the index are given back a block at a time
+constexpr const std::size_t RELEASE_BLOCK_SIZE = 16*1024*1024;
+
+// @return where the next new line is at or after beg, or end
+const char * find_new_line(const char * beg, const char * end);
+
+void run_mapped_document_tests();
+
+} // end of <anonymous> namespace
+
+/* static */ constexpr const std::size_t MappedDocument::LINES_PER_INDEX_ENTRY;
+
+/* explicit */ MappedDocument::MappedDocument(const std::string & filename):
+    m_data             (nullptr),
+    m_size             (0),
+    m_rendering_options(&RenderOptions::get_default_instance()),
+    m_index            (1, 0),
+    m_scanned_line     (0),
+    m_scanned_offset   (0),
+    m_fully_indexed    (false),
+    m_hint_line        (0),
+    m_hint_offset      (0)
+{
+    auto throw_error = [&filename](const char * what) {
+        throw std::runtime_error("MappedDocument: \"" + filename + "\" " +
+                                 what + ": " + std::strerror(errno));
+    };
+#   ifdef MACRO_PLATFORM_LINUX
+    const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) throw_error("could not be opened");
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0) {
+        ::close(fd);
+        throw_error("could not be examined");
+    }
+    m_size = std::size_t(file_stat.st_size);
+    // an empty file can not be mapped, nor does it need to be
+    if (m_size != 0) {
+        void * mapped = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            throw_error("could not be mapped");
+        }
+        m_data = static_cast<const char *>(mapped);
+    }
+    // the mapping keeps the file for as long as it needs it
+    ::close(fd);
+#   else
+    std::ifstream fin(filename, std::ios::binary);
+    if (!fin) throw_error("could not be opened");
+    m_content.assign(std::istreambuf_iterator<char>(fin),
+                     std::istreambuf_iterator<char>());
+    m_data = m_content.data();
+    m_size = m_content.size();
+#   endif
+}
+
+MappedDocument::~MappedDocument() {
+#   ifdef MACRO_PLATFORM_LINUX
+    if (m_data) ::munmap(const_cast<char *>(m_data), m_size);
+#   endif
+}
+
+std::size_t MappedDocument::line_count() const {
+    index_through(std::size_t(-1));
+    return m_scanned_line + 1;
+}
+
+std::u32string MappedDocument::line(std::size_t idx) const {
+    if (!index_through(idx)) {
+        throw std::invalid_argument("MappedDocument::line: given line is out "
+                                    "of bounds.");
+    }
+    const auto begin = line_begin(idx);
+    const auto end   = line_end_from(begin);
+    m_hint_line   = idx;
+    m_hint_offset = begin;
+
+    std::u32string rv;
+    const char * beg = m_data + begin;
+    DocumentReader::decode_utf8(beg, m_data + end, rv);
+    // a sequence cut short by the end of the line
+    if (beg != m_data + end) rv.push_back(DocumentReader::REPLACEMENT_CHARACTER);
+    return rv;
+}
+
+void MappedDocument::assign_render_options(const RenderOptions & options)
+    { m_rendering_options = &options; }
+
+void MappedDocument::render_to(TargetTextGrid & target, std::size_t first_line) const {
+    // each line shown is only decoded and modeled for as long as it is drawn
+    int offset = 0;
+    TextLineImage image;
+    image.assign_render_options(*m_rendering_options);
+    image.constrain_to_width(target.width());
+    for (auto i = first_line; offset < target.height() && index_through(i); ++i) {
+        const auto content = line(i);
+        image.set_line_number(int(i));
+        image.update_modeler(CodeModeler::default_instance(), content);
+        image.render_to(target, offset, content);
+        offset += image.height_in_cells();
+    }
+    if (offset >= target.height()) return;
+    const auto def_pair = m_rendering_options->get_default_pair();
+    for (Cursor cursor(offset, 0); cursor != target.end_cursor();
+         cursor = target.next_cursor(cursor))
+    { target.set_cell(cursor, U' ', def_pair); }
+}
+
+/* static */ void MappedDocument::run_tests()
+    { run_mapped_document_tests(); }
+
+/* private */ bool MappedDocument::index_through(std::size_t line) const {
+    if (m_fully_indexed || line <= m_scanned_line) return line <= m_scanned_line;
+    const char * const end = m_data + m_size;
+    const char * pos = m_data + m_scanned_offset;
+    auto released_to = m_scanned_offset;
+    while (m_scanned_line < line) {
+        const char * new_line = find_new_line(pos, end);
+        if (new_line == end) {
+            m_fully_indexed = true;
+            break;
+        }
+        pos = new_line + 1;
+        m_scanned_offset = std::size_t(pos - m_data);
+        if (++m_scanned_line % LINES_PER_INDEX_ENTRY == 0)
+            m_index.push_back(m_scanned_offset);
+#       ifdef MACRO_PLATFORM_LINUX
+        // pages scanned over are not kept, they are read again from the
+        // file should they be needed
+        if (m_scanned_offset - released_to >= RELEASE_BLOCK_SIZE) {
+            static const auto page_size = std::size_t(::sysconf(_SC_PAGESIZE));
+            const auto from = (released_to + page_size - 1) / page_size * page_size;
+            const auto to   = m_scanned_offset / page_size * page_size;
+            if (from < to) {
+                ::madvise(const_cast<char *>(m_data) + from, to - from,
+                          MADV_DONTNEED);
+            }
+            released_to = m_scanned_offset;
+        }
+#       endif
+    }
+    return line <= m_scanned_line;
+}
+
+/* private */ std::size_t MappedDocument::line_begin(std::size_t line) const {
+    assert(line <= m_scanned_line);
+    if (line == m_scanned_line) return m_scanned_offset;
+    // from the last line read (if it is close behind), or the nearest entry
+    auto from_line   = line / LINES_PER_INDEX_ENTRY * LINES_PER_INDEX_ENTRY;
+    auto from_offset = m_index[line / LINES_PER_INDEX_ENTRY];
+    if (m_hint_line <= line && m_hint_line > from_line) {
+        from_line   = m_hint_line;
+        from_offset = m_hint_offset;
+    }
+    const char * const end = m_data + m_size;
+    const char * pos = m_data + from_offset;
+    for (; from_line != line; ++from_line)
+        pos = find_new_line(pos, end) + 1;
+    return std::size_t(pos - m_data);
+}
+
+/* private */ std::size_t MappedDocument::line_end_from(std::size_t offset) const {
+    const char * const end = m_data + m_size;
+    return std::size_t(find_new_line(m_data + offset, end) - m_data);
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+const char * find_new_line(const char * beg, const char * end) {
+    if (beg == end) return end;
+    // vectorized by the C library
+    const void * found = std::memchr(beg, '\n', std::size_t(end - beg));
+    return found ? static_cast<const char *>(found) : end;
+}
+
+class TestGrid final : public TargetTextGrid {
+public:
+    TestGrid(int width, int height):
+        m_width(width), m_cells(std::size_t(width*height), U'?') {}
+    int width () const override { return m_width; }
+    int height() const override { return int(m_cells.size()) / m_width; }
+    void set_cell(Cursor cursor, UChar uchr, ColorPair) override
+        { m_cells[std::size_t(cursor.line*m_width + cursor.column)] = uchr; }
+    std::u32string row(int line) const {
+        return std::u32string(m_cells.begin() + line*m_width,
+                              m_cells.begin() + (line + 1)*m_width);
+    }
+private:
+    int m_width;
+    std::u32string m_cells;
+};
+
+void run_mapped_document_tests() {
+    const std::string filename = "ksg-te-mapped-document-test.txt";
+    // lines split as TextLines splits them, decoded only when asked for
+    {
+    std::string encoded;
+    std::u32string content;
+    for (int i = 0; i != 5000; ++i) {
+        const auto number = std::to_string(i);
+        encoded += "line " + number + " \xC3\xA9\n";
+        content += U"line " + std::u32string(number.begin(), number.end()) + U" é\n";
+    }
+    encoded += "last";
+    content += U"last";
+    std::ofstream(filename, std::ios::binary) << encoded;
+    MappedDocument doc(filename);
+    TextLines tlines(content);
+    assert(doc.size_in_bytes() == encoded.size());
+    // nothing past what is asked for is indexed
+    assert(doc.line(3) == tlines.lines()[3].content());
+    assert(doc.index_memory_usage() < 64 && doc.has_line(4) && !doc.has_line(5001));
+    // in order, out of order, and across index entries
+    for (std::size_t i = 1000; i != 1100; ++i)
+        assert(doc.line(i) == tlines.lines()[i].content());
+    for (std::size_t i : { 4999, 0, 2048, 2047, 1024, 5000, 17 })
+        assert(doc.line(i) == tlines.lines()[i].content());
+    assert(doc.line_count() == tlines.lines().size());
+    // searched as the same content in TextLines is
+    for (const auto & pattern : { std::u32string(U"9 é"), std::u32string(U"é\nline 1") }) {
+        SubstringSearcher searcher(pattern);
+        assert(searcher.find_all(doc) == searcher.find_all(tlines));
+        SubstringSearcher::Match expected, match;
+        assert(searcher.find_previous(tlines, Cursor(3000, 0), expected));
+        assert(searcher.find_previous(doc, Cursor(3000, 0), match));
+        assert(match == expected);
+    }
+    bool threw = false;
+    try {
+        doc.line(doc.line_count());
+    } catch (std::invalid_argument &) {
+        threw = true;
+    }
+    assert(threw);
+    }
+    // invalid bytes, nulls, and a trailing new line
+    {
+    std::ofstream(filename, std::ios::binary) << std::string("a\xFF" "b\0c\n\xC3", 7) << "\n";
+    MappedDocument doc(filename);
+    assert(doc.line_count() == 3);
+    assert(doc.line(0) == U"a�b�c");
+    assert(doc.line(1) == U"�" && doc.line(2).empty());
+    }
+    // an empty file has one empty line
+    {
+    std::ofstream(filename, std::ios::binary);
+    MappedDocument doc(filename);
+    assert(doc.line_count() == 1 && doc.line(0).empty());
+    }
+    // rendered wrapped, from the given line on, blank after the last
+    {
+    std::ofstream(filename, std::ios::binary) << "zero\none two three\nfour";
+    MappedDocument doc(filename);
+    TestGrid grid(8, 5);
+    doc.render_to(grid, 1);
+    assert(grid.row(0).substr(0, 4) == U"one " && grid.row(2) == U"four    ");
+    assert(grid.row(3) == U"        " && grid.row(4) == U"        ");
+    }
+    std::remove(filename.c_str());
+    // files which can not be opened are thrown for
+    {
+    bool threw = false;
+    try {
+        MappedDocument doc("no-such-directory/file.txt");
+    } catch (std::runtime_error &) {
+        threw = true;
+    }
+    assert(threw);
+    }
+}
+
+} // end of <anonymous> namespace
@@ -0,0 +1,115 @@
+/****************************************************************************
+
+    File: MappedDocument.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+class TargetTextGrid;
+class RenderOptions;
+
+/** A read-only view of a (UTF-8) file, for files too large to be worth
+ *  turning into TextLines, such as multi-gigabyte logs.
+ *
+ *  The file is memory mapped (where the platform allows), and lines are only
+ *  decoded when asked for. Where lines begin is indexed sparsely, one entry
+ *  for every so many lines, and only as far into the file as has been asked
+ *  for. Pages of the file which have only been scanned for the index are
+ *  released as it goes, so memory held is the index plus whatever lines are
+ *  being shown.
+ *
+ *  Lines are split as TextLines would split the file's content.
+ */
+class MappedDocument {
+public:
+    // a line's beginning is kept for every this many lines
+    static constexpr const std::size_t LINES_PER_INDEX_ENTRY = 1024;
+
+    /** @throws std::runtime_error if the file could not be opened or mapped
+     */
+    explicit MappedDocument(const std::string & filename);
+    ~MappedDocument();
+
+    MappedDocument(const MappedDocument &) = delete;
+    MappedDocument & operator = (const MappedDocument &) = delete;
+
+    std::size_t size_in_bytes() const { return m_size; }
+
+    /** Indexes only as far as the given line.
+     *  @return true if the file has the given line
+     */
+    bool has_line(std::size_t line) const { return index_through(line); }
+
+    /** O(n) the first time (the rest of the file is indexed), O(1) after. */
+    std::size_t line_count() const;
+
+    /** Decodes the line, each invalid byte (and any null) as U+FFFD.
+     *  Reading the line after the last one read only scans that line,
+     *  otherwise up to LINES_PER_INDEX_ENTRY lines are scanned over.
+     *  @throws std::invalid_argument if there is no such line
+     */
+    std::u32string line(std::size_t) const;
+
+    /** @warning Does not in anyway maintain ownership over the given object
+     *           reference. Given object must survive the life of this object.
+     */
+    void assign_render_options(const RenderOptions &);
+
+    /** Renders lines from the given one on, wrapped to the target's width,
+     *  until the target is full (any cells left after the last are blanked).
+     */
+    void render_to(TargetTextGrid &, std::size_t first_line) const;
+
+    /** @return bytes of heap memory held for the index */
+    std::size_t index_memory_usage() const
+        { return m_index.capacity()*sizeof(std::size_t); }
+
+    static void run_tests();
+private:
+    // indexes up to the given line (or the end of the file)
+    // @return true if the line exists
+    bool index_through(std::size_t line) const;
+    // @return byte offset where the (existing) line begins
+    std::size_t line_begin(std::size_t line) const;
+    // @return byte offset of the new line ending the line which begins at
+    //         the given offset (or the file size for the last line)
+    std::size_t line_end_from(std::size_t offset) const;
+
+    const char * m_data;
+    std::size_t m_size;
+#   ifndef MACRO_PLATFORM_LINUX
+    // where the file can not be mapped, it is read in whole
+    std::string m_content;
+#   endif
+    const RenderOptions * m_rendering_options;
+
+    // where every LINES_PER_INDEX_ENTRY-th line begins
+    mutable std::vector<std::size_t> m_index;
+    // the furthest line indexed, and where it begins
+    mutable std::size_t m_scanned_line;
+    mutable std::size_t m_scanned_offset;
+    mutable bool m_fully_indexed;
+    // the last line read, and where it begins
+    mutable std::size_t m_hint_line;
+    mutable std::size_t m_hint_offset;
+};
@@ -0,0 +1,209 @@
+/****************************************************************************
+
+    File: ModelCache.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "ModelCache.hpp"
+#include "LuaCodeModeler.hpp"
+#include "TextLine.hpp"
+
+#include <stdexcept>
+
+#include <cassert>
+
+namespace {
+
+// rough per entry cost of the list and hash table nodes
+constexpr const std::size_t NODE_OVERHEAD = 64;
+
+std::uint64_t hash_of(const std::u32string &);
+
+void run_model_cache_tests();
+
+} // end of <anonymous> namespace
+
+double ModelCache::Statistics::hit_rate() const {
+    auto lookups = hits + misses;
+    return lookups == 0 ? 0. : double(hits) / double(lookups);
+}
+
+/* explicit */ ModelCache::ModelCache(std::size_t capacity_):
+    m_capacity(capacity_),
+    m_bytes   (0),
+    m_hits    (0),
+    m_misses  (0)
+{
+    if (m_capacity == 0) {
+        throw std::invalid_argument("ModelCache::ModelCache: capacity must be "
+                                    "at least one entry.");
+    }
+}
+
+const TextLineImage * ModelCache::find
+    (std::uint64_t content_hash, const std::u32string & content,
+     CodeModeler::State entry_state, int width)
+{
+    auto itr = m_index.find(Key { content_hash, entry_state, width });
+    // hashes may collide, so the content is checked also
+    if (itr == m_index.end() || itr->second->content != content) {
+        ++m_misses;
+        return nullptr;
+    }
+    ++m_hits;
+    m_entries.splice(m_entries.begin(), m_entries, itr->second);
+    return &itr->second->image;
+}
+
+void ModelCache::insert
+    (std::uint64_t content_hash, const std::u32string & content,
+     const TextLineImage & image)
+{
+    Key key { content_hash, image.modeler_entry_state(), image.width_constraint() };
+    auto itr = m_index.find(key);
+    if (itr != m_index.end())
+        erase(itr->second);
+    evict_down_to(m_capacity - 1);
+
+    m_entries.push_front(Entry { key, content, image, 0 });
+    auto & entry = m_entries.front();
+    entry.bytes = sizeof(Entry) + NODE_OVERHEAD +
+                  entry.content.capacity()*sizeof(UChar) +
+                  entry.image.model_memory_usage();
+    m_bytes += entry.bytes;
+    m_index[key] = m_entries.begin();
+}
+
+void ModelCache::set_capacity(std::size_t capacity_) {
+    if (capacity_ == 0) {
+        throw std::invalid_argument("ModelCache::set_capacity: capacity must "
+                                    "be at least one entry.");
+    }
+    m_capacity = capacity_;
+    evict_down_to(m_capacity);
+}
+
+void ModelCache::clear() {
+    m_index.clear();
+    m_entries.clear();
+    m_bytes = 0;
+}
+
+ModelCache::Statistics ModelCache::statistics() const {
+    Statistics rv;
+    rv.hits    = m_hits;
+    rv.misses  = m_misses;
+    rv.entries = m_entries.size();
+    rv.bytes   = m_bytes;
+    return rv;
+}
+
+void ModelCache::reset_statistics() { m_hits = m_misses = 0; }
+
+/* static */ void ModelCache::run_tests() { run_model_cache_tests(); }
+
+bool ModelCache::Key::operator == (const Key & rhs) const {
+    return content_hash == rhs.content_hash &&
+           entry_state  == rhs.entry_state  && width == rhs.width;
+}
+
+std::size_t ModelCache::KeyHasher::operator () (const Key & key) const {
+    auto hash = key.content_hash ^ (key.entry_state.value()*0x9E3779B97F4A7C15ull);
+    return std::size_t(hash ^ std::uint64_t(key.width));
+}
+
+/* private */ void ModelCache::evict_down_to(std::size_t count) {
+    while (m_entries.size() > count)
+        erase(std::prev(m_entries.end()));
+}
+
+/* private */ void ModelCache::erase(EntryList::iterator itr) {
+    assert(m_bytes >= itr->bytes);
+    m_bytes -= itr->bytes;
+    m_index.erase(itr->key);
+    m_entries.erase(itr);
+}
+
+namespace {
+
+std::uint64_t hash_of(const std::u32string & content)
+    { return TextLine::hash_of(content.data(), content.data() + content.size()); }
+
+void run_model_cache_tests() {
+    // hits come back identical to a fresh model, and leave the modeler in
+    // the same state
+    {
+    static const std::u32string line_c = U"local s = [[ open";
+    ModelCache cache;
+    LuaCodeModeler fresh_lcm, cached_lcm;
+    TextLineImage fresh, first, second;
+    fresh .update_modeler(fresh_lcm , line_c);
+    first .update_modeler(cached_lcm, line_c, hash_of(line_c), cache);
+    cached_lcm.reset_state();
+    second.update_modeler(cached_lcm, line_c, hash_of(line_c), cache);
+    assert(fresh == first && fresh == second);
+    assert(cached_lcm.state_equals(fresh_lcm.save_state()));
+    auto stats = cache.statistics();
+    assert(stats.hits == 1 && stats.misses == 1 && stats.entries == 1);
+    assert(stats.bytes > 0 && stats.hit_rate() == 0.5);
+    }
+    // a different entry state or width is a different entry
+    {
+    ModelCache cache;
+    LuaCodeModeler lcm;
+    TextLineImage image;
+    image.update_modeler(lcm, U"end", hash_of(U"end"), cache);
+    lcm.restore_state(LuaCodeModeler::State(3));
+    image.update_modeler(lcm, U"end", hash_of(U"end"), cache);
+    lcm.reset_state();
+    image.constrain_to_width(2);
+    image.update_modeler(lcm, U"end", hash_of(U"end"), cache);
+    assert(cache.statistics().entries == 3 && cache.statistics().hits == 0);
+    }
+    // least recently used entries are evicted first
+    {
+    ModelCache cache(2);
+    LuaCodeModeler lcm;
+    TextLineImage image;
+    image.update_modeler(lcm, U"a", hash_of(U"a"), cache);
+    image.update_modeler(lcm, U"b", hash_of(U"b"), cache);
+    image.update_modeler(lcm, U"a", hash_of(U"a"), cache); // a is now most recent
+    image.update_modeler(lcm, U"c", hash_of(U"c"), cache); // so b goes
+    assert(cache.find(hash_of(U"a"), U"a", lcm.save_state(), image.width_constraint()));
+    assert(!cache.find(hash_of(U"b"), U"b", lcm.save_state(), image.width_constraint()));
+    assert(cache.statistics().entries == 2);
+    cache.set_capacity(1);
+    assert(cache.statistics().entries == 1);
+    cache.clear();
+    assert(cache.statistics().entries == 0 && cache.statistics().bytes == 0);
+    }
+    // lines are looked up by the hash they keep, so an edited line finds
+    // what was modeled for the same content
+    {
+    ModelCache cache;
+    LuaCodeModeler lcm;
+    TextLine first(U"end"), second(U"en");
+    first.update_modeler(lcm, cache);
+    lcm.reset_state();
+    second.push(2, U'd');
+    second.update_modeler(lcm, cache);
+    assert(cache.statistics().hits == 1 && first.image() == second.image());
+    }
+}
+
+} // end of <anonymous> namespace
@@ -0,0 +1,113 @@
+/****************************************************************************
+
+    File: ModelCache.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "TextLineImage.hpp"
+
+#include <list>
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+
+/** A bounded, least recently used cache of modeled lines.
+ *
+ *  Entries are keyed by the line's content (by the hash TextLine keeps for
+ *  it, then verified), the modeler's state on entering the line and the
+ *  width the line was laid out for. Each holds the tokens, rows and exit
+ *  state of the line's image.
+ *
+ *  @note A cache must only ever be used with one kind of CodeModeler, as
+ *        states from different modelers are not comparable.
+ *  @note Not thread safe.
+ */
+class ModelCache {
+public:
+    static constexpr const std::size_t DEFAULT_CAPACITY = 4096;
+
+    struct Statistics {
+        Statistics(): hits(0), misses(0), entries(0), bytes(0) {}
+        double hit_rate() const;
+        std::size_t hits;
+        std::size_t misses;
+        std::size_t entries;
+        // approximate memory used by entries
+        std::size_t bytes;
+    };
+
+    explicit ModelCache(std::size_t capacity = DEFAULT_CAPACITY);
+    // index holds iterators into the entry list
+    ModelCache(const ModelCache &) = delete;
+    ModelCache & operator = (const ModelCache &) = delete;
+
+    /** @param content_hash must be the content's hash, as TextLine::hash_of
+     *                      gives for it
+     *  @return nullptr if there is no entry for the given line
+     */
+    const TextLineImage * find
+        (std::uint64_t content_hash, const std::u32string & content,
+         CodeModeler::State entry_state, int width);
+
+    /** Adds (or replaces) the entry for the given line, keyed by the image's
+     *  entry state and width.
+     */
+    void insert(std::uint64_t content_hash, const std::u32string & content,
+                const TextLineImage &);
+
+    /** Evicts least recently used entries if the new capacity is smaller. */
+    void set_capacity(std::size_t);
+    std::size_t capacity() const { return m_capacity; }
+
+    void clear();
+
+    Statistics statistics() const;
+    void reset_statistics();
+
+    static void run_tests();
+private:
+    struct Key {
+        bool operator == (const Key &) const;
+        std::uint64_t content_hash;
+        CodeModeler::State entry_state;
+        int width;
+    };
+    struct KeyHasher {
+        std::size_t operator () (const Key &) const;
+    };
+    struct Entry {
+        Key key;
+        std::u32string content;
+        TextLineImage image;
+        std::size_t bytes;
+    };
+    using EntryList = std::list<Entry>;
+
+    void evict_down_to(std::size_t);
+    void erase(EntryList::iterator);
+
+    // most recently used at the front
+    EntryList m_entries;
+    std::unordered_map<Key, EntryList::iterator, KeyHasher> m_index;
+    std::size_t m_capacity;
+    std::size_t m_bytes;
+    std::size_t m_hits;
+    std::size_t m_misses;
+};
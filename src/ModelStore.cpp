@@ -0,0 +1,582 @@
+/****************************************************************************
+
+    File: ModelStore.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "ModelStore.hpp"
+#include "TextLines.hpp"
+#include "DocumentDiff.hpp"
+#include "LuaCodeModeler.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#ifdef MACRO_PLATFORM_LINUX
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#endif
+
+#include <cassert>
+
+// The file is laid out as:
+// - a Header
+// - a LineRecord for each line
+// - every line's tokens, one after another (as TextLineImage::PackedToken)
+// - every line's row beginnings, one after another (as 32-bit columns)
+// Each array begins on a multiple of eight bytes, so that it can be used in
+// place from the mapping.
+
+struct ModelStore::Header {
+    std::uint64_t magic_number;
+    std::uint32_t format_version;
+    std::int32_t  width;
+    std::uint64_t model_version;
+    std::uint64_t document_hash;
+    std::uint64_t line_count;
+    std::uint64_t token_count;
+    std::uint64_t row_count;
+    std::uint64_t reserved;
+};
+
+struct ModelStore::LineRecord {
+    std::uint64_t hash;
+    std::uint64_t entry_state;
+    std::uint64_t exit_state;
+    // one past the line's last token and row (so the next line's first)
+    std::uint32_t tokens_end;
+    std::uint32_t rows_end;
+    std::uint32_t flags;
+    std::uint32_t reserved;
+};
+
+namespace {
+
+using PackedToken = TextLineImage::PackedToken;
+
+// written in the machine's own byte order, so that it reads back as
+// something else on a machine of the other
+constexpr const std::uint64_t MAGIC_NUMBER = 0x4B53472D54452D4Dull;
+
+// of LineRecord::flags
+constexpr const std::uint32_t MODELED_FLAG         = 1;
+constexpr const std::uint32_t EXTRA_END_SPACE_FLAG = 2;
+
+// where the store goes before it replaces the target
+std::string temporary_name_for(const std::string & filename)
+    { return filename + ".ksg-te-save"; }
+
+std::vector<std::uint64_t> line_hashes_of(const TextLines &);
+
+std::uint64_t document_hash_from(const std::vector<std::uint64_t> & line_hashes);
+
+void run_model_store_tests();
+
+} // end of <anonymous> namespace
+
+/* static */ constexpr const std::uint32_t ModelStore::FORMAT_VERSION;
+
+/* static */ void ModelStore::write
+    (const TextLines & tlines, const CodeModeler & modeler,
+     const std::string & filename)
+{ write_packed(pack(tlines, modeler), filename); }
+
+/* static */ std::string ModelStore::pack
+    (const TextLines & tlines, const CodeModeler & modeler)
+{
+    static_assert(sizeof(Header) == 64 && sizeof(LineRecord) == 40 &&
+                  sizeof(PackedToken) == 8, "store arrays must stay aligned");
+    const auto line_hashes = line_hashes_of(tlines);
+    std::vector<LineRecord> records;
+    std::vector<PackedToken> tokens;
+    std::vector<std::uint32_t> rows;
+    records.reserve(line_hashes.size());
+    for (std::size_t i = 0; i != line_hashes.size(); ++i) {
+        const auto & line = tlines.lines()[i];
+        LineRecord record = {};
+        record.hash = line_hashes[i];
+        if (!line.needs_modeling() && line.image().pack_model(tokens, rows)) {
+            record.entry_state = line.modeler_entry_state().value();
+            record.exit_state  = line.modeler_exit_state ().value();
+            record.flags = MODELED_FLAG |
+                (line.image().has_extra_end_space() ? EXTRA_END_SPACE_FLAG : 0);
+        }
+        if (tokens.size() > std::numeric_limits<std::uint32_t>::max() ||
+            rows  .size() > std::numeric_limits<std::uint32_t>::max())
+        {
+            throw std::runtime_error("ModelStore::pack: there are too many "
+                                     "tokens for a store.");
+        }
+        record.tokens_end = std::uint32_t(tokens.size());
+        record.rows_end   = std::uint32_t(rows  .size());
+        records.push_back(record);
+    }
+    Header header = {};
+    header.magic_number   = MAGIC_NUMBER;
+    header.format_version = FORMAT_VERSION;
+    header.width          = tlines.width_constraint();
+    header.model_version  = modeler.model_version();
+    header.document_hash  = document_hash_from(line_hashes);
+    header.line_count     = records.size();
+    header.token_count    = tokens .size();
+    header.row_count      = rows   .size();
+    // keeps the row array ending on a multiple of eight bytes too
+    if (rows.size() % 2 != 0) rows.push_back(0);
+
+    std::string packed;
+    packed.reserve(sizeof(Header) + records.size()*sizeof(LineRecord) +
+                   tokens.size()*sizeof(PackedToken) +
+                   rows.size()*sizeof(std::uint32_t));
+    auto append_bytes = [&packed](const void * data, std::size_t size)
+        { packed.append(static_cast<const char *>(data), size); };
+    append_bytes(&header, sizeof(Header));
+    append_bytes(records.data(), records.size()*sizeof(LineRecord));
+    append_bytes(tokens .data(), tokens .size()*sizeof(PackedToken));
+    append_bytes(rows   .data(), rows   .size()*sizeof(std::uint32_t));
+    return packed;
+}
+
+/* static */ void ModelStore::write_packed
+    (const std::string & packed, const std::string & filename)
+{
+    const auto temporary_name = temporary_name_for(filename);
+    {
+    std::ofstream fout(temporary_name, std::ios::binary | std::ios::trunc);
+    fout.write(packed.data(), std::streamsize(packed.size()));
+    fout.close();
+    if (!fout) {
+        std::remove(temporary_name.c_str());
+        throw std::runtime_error("ModelStore::write: \"" + temporary_name +
+                                 "\" could not be written.");
+    }
+    }
+    if (std::rename(temporary_name.c_str(), filename.c_str()) != 0) {
+        const auto error = std::string(std::strerror(errno));
+        std::remove(temporary_name.c_str());
+        throw std::runtime_error("ModelStore::write: could not replace \"" +
+                                 filename + "\": " + error);
+    }
+}
+
+/* explicit */ ModelStore::ModelStore(const std::string & filename):
+    m_data(nullptr),
+    m_size(0)
+{
+    auto throw_error = [&filename](const char * what) {
+        throw std::runtime_error("ModelStore: \"" + filename + "\" " + what +
+                                 ": " + std::strerror(errno));
+    };
+#   ifdef MACRO_PLATFORM_LINUX
+    const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) throw_error("could not be opened");
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0) {
+        ::close(fd);
+        throw_error("could not be examined");
+    }
+    m_size = std::size_t(file_stat.st_size);
+    // an empty file can not be mapped, nor is it a store
+    if (m_size != 0) {
+        void * mapped = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            throw_error("could not be mapped");
+        }
+        m_data = static_cast<const char *>(mapped);
+    }
+    // the mapping keeps the file for as long as it needs it
+    ::close(fd);
+#   else
+    std::ifstream fin(filename, std::ios::binary);
+    if (!fin) throw_error("could not be opened");
+    m_content.assign(std::istreambuf_iterator<char>(fin),
+                     std::istreambuf_iterator<char>());
+    m_data = m_content.data();
+    m_size = m_content.size();
+#   endif
+
+    // every count is checked against the size before it is multiplied, so
+    // that no product can overflow
+    bool is_store = m_size >= sizeof(Header);
+    if (is_store) {
+        const auto & head = header();
+        auto left = m_size - sizeof(Header);
+        auto take = [&left](std::uint64_t count, std::size_t element_size) {
+            if (count > left / element_size) return false;
+            left -= std::size_t(count)*element_size;
+            return true;
+        };
+        is_store = head.magic_number == MAGIC_NUMBER &&
+                   head.format_version == FORMAT_VERSION &&
+                   take(head.line_count , sizeof(LineRecord)) &&
+                   take(head.token_count, sizeof(PackedToken)) &&
+                   take(head.row_count + head.row_count % 2, sizeof(std::uint32_t)) &&
+                   left == 0;
+    }
+    if (!is_store) {
+#       ifdef MACRO_PLATFORM_LINUX
+        if (m_data) ::munmap(const_cast<char *>(m_data), m_size);
+#       endif
+        throw std::runtime_error("ModelStore: \"" + filename + "\" is not a "
+                                 "store of this format.");
+    }
+}
+
+ModelStore::~ModelStore() {
+#   ifdef MACRO_PLATFORM_LINUX
+    if (m_data) ::munmap(const_cast<char *>(m_data), m_size);
+#   endif
+}
+
+std::uint64_t ModelStore::document_hash() const
+    { return header().document_hash; }
+
+std::uint64_t ModelStore::model_version() const
+    { return header().model_version; }
+
+int ModelStore::width() const { return header().width; }
+
+std::size_t ModelStore::line_count() const
+    { return std::size_t(header().line_count); }
+
+bool ModelStore::matches
+    (const TextLines & tlines, const CodeModeler & modeler) const
+{
+    return width() == tlines.width_constraint() &&
+           model_version() == modeler.model_version() &&
+           line_count() == tlines.lines().size() &&
+           document_hash() == document_hash_of(tlines);
+}
+
+std::size_t ModelStore::apply_to
+    (TextLines & tlines, const CodeModeler & modeler) const
+{
+    if (width() != tlines.width_constraint() ||
+        model_version() != modeler.model_version())
+    { return 0; }
+
+    const auto * records_ = records();
+    const auto * tokens = reinterpret_cast<const PackedToken *>
+        (records_ + line_count());
+    const auto * rows = reinterpret_cast<const std::uint32_t *>
+        (tokens + header().token_count);
+    const auto new_hashes = line_hashes_of(tlines);
+    // each line leaves the image with its old model, which is cleared by the
+    // next one unpacked, so that the vectors are reused
+    TextLineImage image;
+    image.constrain_to_width(width());
+    // a stored line takes a model only if it checks out for the line
+    auto apply_line = [&](std::size_t stored, std::size_t line) {
+        const auto & record = records_[stored];
+        if ((record.flags & MODELED_FLAG) == 0 || record.hash != new_hashes[line])
+            return false;
+        const auto tokens_beg = stored == 0 ? 0 : records_[stored - 1].tokens_end;
+        const auto rows_beg   = stored == 0 ? 0 : records_[stored - 1].rows_end;
+        if (tokens_beg > record.tokens_end || record.tokens_end > header().token_count ||
+            rows_beg   > record.rows_end   || record.rows_end   > header().row_count)
+        { return false; }
+        if (!image.unpack_model
+            (tokens + tokens_beg, tokens + record.tokens_end,
+             rows + rows_beg, rows + record.rows_end,
+             (record.flags & EXTRA_END_SPACE_FLAG) != 0,
+             tlines.lines()[line].content_length(),
+             CodeModeler::State(record.entry_state),
+             CodeModeler::State(record.exit_state)))
+        { return false; }
+        tlines.take_model_of(int(line), image);
+        return true;
+    };
+
+    // unchanged content is one run of lines in common, found in one pass
+    std::vector<std::uint64_t> old_hashes;
+    old_hashes.reserve(line_count());
+    for (std::size_t i = 0; i != line_count(); ++i)
+        old_hashes.push_back(records_[i].hash);
+    std::size_t applied = 0;
+    std::size_t old_line = 0, new_line = 0;
+    auto apply_until = [&](std::size_t old_end) {
+        for (; old_line != old_end; ++old_line, ++new_line) {
+            if (apply_line(old_line, new_line)) ++applied;
+        }
+    };
+    for (const auto & hunk : DocumentDiff::diff_lines(old_hashes, new_hashes)) {
+        apply_until(hunk.old_begin);
+        old_line = hunk.old_end;
+        new_line = hunk.new_end;
+    }
+    apply_until(old_hashes.size());
+    return applied;
+}
+
+/* static */ std::uint64_t ModelStore::document_hash_of(const TextLines & tlines)
+    { return document_hash_from(line_hashes_of(tlines)); }
+
+/* static */ void ModelStore::run_tests() { run_model_store_tests(); }
+
+/* private */ const ModelStore::Header & ModelStore::header() const
+    { return *reinterpret_cast<const Header *>(m_data); }
+
+/* private */ const ModelStore::LineRecord * ModelStore::records() const
+    { return reinterpret_cast<const LineRecord *>(m_data + sizeof(Header)); }
+
+ModelStoreWriter::ModelStoreWriter():
+    m_working       (false),
+    m_stop_requested(false)
+{
+    m_worker = std::thread([this]() { run_worker(); });
+}
+
+ModelStoreWriter::~ModelStoreWriter() {
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop_requested = true;
+    }
+    m_job_posted.notify_one();
+    m_worker.join();
+}
+
+void ModelStoreWriter::post
+    (const TextLines & tlines, const CodeModeler & modeler,
+     const std::string & filename)
+{
+    Job job;
+    job.packed   = ModelStore::pack(tlines, modeler);
+    job.filename = filename;
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_pending_jobs.push_back(std::move(job));
+    }
+    m_job_posted.notify_one();
+}
+
+bool ModelStoreWriter::take_error(std::string & error) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_errors.empty()) return false;
+    error = std::move(m_errors.front());
+    m_errors.erase(m_errors.begin());
+    return true;
+}
+
+bool ModelStoreWriter::is_working() const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_working || !m_pending_jobs.empty();
+}
+
+/* private */ void ModelStoreWriter::run_worker() {
+    while (true) {
+        std::vector<Job> jobs;
+        {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_job_posted.wait(lock, [this]()
+            { return m_stop_requested || !m_pending_jobs.empty(); });
+        // whatever was posted is still written before stopping
+        if (m_pending_jobs.empty()) return;
+        jobs.swap(m_pending_jobs);
+        m_working = true;
+        }
+        for (auto & job : jobs) {
+            try {
+                ModelStore::write_packed(job.packed, job.filename);
+            } catch (std::exception & exp) {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_errors.push_back(exp.what());
+            }
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_working = false;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+std::vector<std::uint64_t> line_hashes_of(const TextLines & tlines) {
+    std::vector<std::uint64_t> rv;
+    rv.reserve(tlines.lines().size());
+    for (const auto & line : tlines.lines()) rv.push_back(line.hash());
+    return rv;
+}
+
+std::uint64_t document_hash_from(const std::vector<std::uint64_t> & line_hashes) {
+    // line hashes are already well mixed, so they need only be combined in a
+    // way which depends on their order
+    std::uint64_t hash = line_hashes.size();
+    for (auto line_hash : line_hashes) {
+        hash = (hash ^ line_hash)*0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+std::u32string content_of(const TextLines & tlines) {
+    if (tlines.lines().empty()) return std::u32string();
+    return tlines.copy_characters_from(Cursor(), tlines.end_cursor());
+}
+
+// @return true if each line's model is the same as a fresh modeling gives
+bool models_as_fresh(const TextLines & tlines) {
+    TextLines fresh(content_of(tlines));
+    fresh.constrain_to_width(tlines.width_constraint());
+    LuaCodeModeler lcm;
+    fresh.update_modeler(lcm);
+    for (std::size_t i = 0; i != fresh.lines().size(); ++i) {
+        if (tlines.lines()[i].needs_modeling() ||
+            tlines.lines()[i].image() != fresh.lines()[i].image())
+        { return false; }
+    }
+    return true;
+}
+
+void run_model_store_tests() {
+    const std::string filename = "ksg-te-model-store-test.lua.ksg-te-models";
+    std::u32string content =
+        U"local s = [[ a long string, which opens\n"
+         "and goes on over several lines ]]\n"
+         "\n"
+         "function f(a, b) return a*b + 0x1234567890abcdef end\n"
+         "-- a comment long enough to be wrapped over a few rows";
+    for (int i = 0; i != 50; ++i)
+        content += U"\nlocal v" + std::u32string(std::size_t(i % 30), U'x') + U" = 'q'";
+    const auto line_count = std::size_t(std::count(content.begin(), content.end(), U'\n') + 1);
+    auto make_lines = [](const std::u32string & content_, int width) {
+        TextLines tlines(content_);
+        tlines.constrain_to_width(width);
+        return tlines;
+    };
+    LuaCodeModeler lcm;
+    {
+    auto tlines = make_lines(content, 20);
+    tlines.update_modeler(lcm);
+    ModelStore::write(tlines, lcm, filename);
+    }
+    // reopened unchanged, every line shows as modeled, and nothing is left to
+    // model
+    {
+    auto tlines = make_lines(content, 20);
+    ModelStore store(filename);
+    assert(store.matches(tlines, lcm) && store.line_count() == line_count);
+    assert(store.apply_to(tlines, lcm) == line_count);
+    assert(models_as_fresh(tlines));
+    assert(tlines.update_modeler_where_needed(lcm) == 0);
+    }
+    // changed elsewhere, unchanged lines take their models, and those
+    // entered differently are modeled again once passed over
+    {
+    auto changed = U"local t = [[ now in a string\n" + content;
+    changed.erase(changed.find(U"\n\n"), 1);
+    auto tlines = make_lines(changed, 20);
+    ModelStore store(filename);
+    assert(!store.matches(tlines, lcm));
+    assert(store.apply_to(tlines, lcm) == line_count - 1);
+    assert(tlines.lines()[0].needs_modeling());
+    // the new line, and the one it now leaves in a string
+    assert(tlines.update_modeler_where_needed(lcm) == 2);
+    assert(models_as_fresh(tlines));
+    }
+    // stores for another width or kind of modeler are not applied
+    {
+    ModelStore store(filename);
+    auto narrower = make_lines(content, 19);
+    assert(!store.matches(narrower, lcm) && store.apply_to(narrower, lcm) == 0);
+    auto same = make_lines(content, 20);
+    const auto & other_modeler = CodeModeler::default_instance();
+    assert(!store.matches(same, other_modeler));
+    assert(store.apply_to(same, other_modeler) == 0);
+    }
+    // lines needing modeling are stored without models
+    {
+    auto tlines = make_lines(content, 20);
+    tlines.update_modeler(lcm);
+    tlines.push(Cursor(2, 0), U'a');
+    ModelStore::write(tlines, lcm, filename);
+    auto reopened = make_lines(content_of(tlines), 20);
+    assert(ModelStore(filename).apply_to(reopened, lcm) == line_count - 1);
+    assert(reopened.lines()[2].needs_modeling());
+    }
+    // a line whose stored model could not be for it is refused
+    {
+    auto tlines = make_lines(content, 20);
+    tlines.update_modeler(lcm);
+    ModelStore::write(tlines, lcm, filename);
+    std::string bytes;
+    {
+    std::ifstream fin(filename, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+    }
+    // the first line's first token is made to end past the line
+    const auto first_token_at = 64 + line_count*40;
+    std::memset(&bytes[first_token_at], 0x7F, 4);
+    std::ofstream(filename, std::ios::binary | std::ios::trunc) << bytes;
+    auto reopened = make_lines(content, 20);
+    assert(ModelStore(filename).apply_to(reopened, lcm) == line_count - 1);
+    assert(reopened.lines()[0].needs_modeling());
+    // cut short, it is not a store at all
+    std::ofstream(filename, std::ios::binary | std::ios::trunc)
+        << bytes.substr(0, bytes.size() - 8);
+    bool threw = false;
+    try {
+        ModelStore store(filename);
+    } catch (std::runtime_error &) {
+        threw = true;
+    }
+    assert(threw);
+    }
+    // written on the worker, the same as written here
+    {
+    auto tlines = make_lines(content, 20);
+    tlines.update_modeler(lcm);
+    const auto packed = ModelStore::pack(tlines, lcm);
+    {
+    ModelStoreWriter writer;
+    writer.post(tlines, lcm, filename);
+    // the lines may be edited as soon as it is posted
+    tlines.push(Cursor(0, 0), U'a');
+    }
+    std::ifstream fin(filename, std::ios::binary);
+    assert(std::string(std::istreambuf_iterator<char>(fin),
+                       std::istreambuf_iterator<char>()) == packed);
+    ModelStoreWriter writer;
+    writer.post(tlines, lcm, "no-such-directory/store");
+    while (writer.is_working())
+        std::this_thread::yield();
+    std::string error;
+    assert(writer.take_error(error) && !error.empty());
+    assert(!writer.take_error(error));
+    }
+    // nor is a missing file
+    std::remove(filename.c_str());
+    bool threw = false;
+    try {
+        ModelStore store(filename);
+    } catch (std::runtime_error &) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+} // end of <anonymous> namespace
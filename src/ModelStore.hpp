@@ -0,0 +1,177 @@
+/****************************************************************************
+
+    File: ModelStore.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+
+class TextLines;
+class CodeModeler;
+
+/** An on-disk cache of a document's modeled lines, so that reopening a
+ *  document shows it highlighted without modeling it again.
+ *
+ *  A store is keyed by a hash of the document's content, the modeler's
+ *  model_version and the width lines were laid out for. It holds, for each
+ *  line, the line's hash, its entry and exit states and its packed tokens
+ *  and rows (see TextLineImage::pack_model), in flat arrays which are used
+ *  straight from the memory mapped file.
+ *
+ *  Nothing is modeled when a store is applied. The stored states are
+ *  checked as lines are next passed over (by update_modeler_where_needed or
+ *  a ModelingScheduler), and any line entered in a different state than was
+ *  stored is modeled again then.
+ *
+ *  @note Stores are written in the machine's own byte order, a store from a
+ *        machine of another order is refused as not being a store.
+ */
+class ModelStore {
+public:
+    // of the file's layout, stores of any other are refused
+    static constexpr const std::uint32_t FORMAT_VERSION = 1;
+
+    /** @return where the store for the given document is kept */
+    static std::string store_name_for(const std::string & document_filename)
+        { return document_filename + ".ksg-te-models"; }
+
+    /** Writes the models of the given lines, for the given kind of modeler.
+     *  Lines which need modeling are stored without one. Everything is
+     *  written to a temporary file which then replaces the target, so that
+     *  a store being read is never written over.
+     *  @throws std::runtime_error if the file could not be written
+     */
+    static void write(const TextLines &, const CodeModeler &,
+                      const std::string & filename);
+
+    /** Packs the models of the given lines into the bytes of a store, which
+     *  (unlike the lines) may be handed to another thread to be written.
+     *  @throws std::runtime_error if there are too many tokens for a store
+     */
+    static std::string pack(const TextLines &, const CodeModeler &);
+
+    /** Writes a packed store, the same way as write does the lines'. */
+    static void write_packed(const std::string & packed,
+                             const std::string & filename);
+
+    /** Maps the file (where the platform allows), and checks that its
+     *  arrays are all there. Each line's model is checked only as it is
+     *  applied.
+     *  @throws std::runtime_error if the file could not be opened, or is not
+     *          a store (of this format)
+     */
+    explicit ModelStore(const std::string & filename);
+    ~ModelStore();
+
+    ModelStore(const ModelStore &) = delete;
+    ModelStore & operator = (const ModelStore &) = delete;
+
+    std::uint64_t document_hash() const;
+    std::uint64_t model_version() const;
+    int width() const;
+    std::size_t line_count() const;
+
+    /** @return true if the store was written for the same content, width and
+     *          kind of modeler as given
+     */
+    bool matches(const TextLines &, const CodeModeler &) const;
+
+    /** Hands lines the models stored for them, if the store is for the given
+     *  lines' width and kind of modeler (otherwise nothing is applied).
+     *  If the content has changed since it was stored, lines are matched by
+     *  content with a DocumentDiff, and only those matched take a model.
+     *  @return number of lines which took a model
+     */
+    std::size_t apply_to(TextLines &, const CodeModeler &) const;
+
+    /** O(n) for lines whose hashes are not yet known.
+     *  @return a hash of all the lines' contents
+     */
+    static std::uint64_t document_hash_of(const TextLines &);
+
+    static void run_tests();
+private:
+    struct Header;
+    struct LineRecord;
+
+    const Header & header() const;
+    const LineRecord * records() const;
+
+    const char * m_data;
+    std::size_t m_size;
+#   ifndef MACRO_PLATFORM_LINUX
+    // where the file can not be mapped, it is read in whole
+    std::string m_content;
+#   endif
+};
+
+/** Writes stores on a worker thread, so that storing the models of a large
+ *  document does not stall the UI thread.
+ *
+ *  Models belong to the lines, so they are packed when a store is posted.
+ *  Only that copy is made on the posting thread, writing it out is left to
+ *  the worker.
+ */
+class ModelStoreWriter {
+public:
+    ModelStoreWriter();
+    ModelStoreWriter(const ModelStoreWriter &) = delete;
+    ModelStoreWriter & operator = (const ModelStoreWriter &) = delete;
+    /** Waits for any store in progress (or posted) to be written. */
+    ~ModelStoreWriter();
+
+    /** Packs the lines' models and writes them on the worker thread. Stores
+     *  are written in the order they are posted.
+     *  @throws std::runtime_error if they could not be packed
+     */
+    void post(const TextLines &, const CodeModeler &, const std::string & filename);
+
+    /** @return true if a store could not be written since last asked, in
+     *          which case error is set to why not
+     */
+    bool take_error(std::string & error);
+
+    /** @return true if a posted store has yet to be written */
+    bool is_working() const;
+
+private:
+    struct Job {
+        std::string packed;
+        std::string filename;
+    };
+
+    void run_worker();
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_job_posted;
+    std::vector<Job> m_pending_jobs;
+    std::vector<std::string> m_errors;
+    bool m_working;
+    bool m_stop_requested;
+
+    // must be last, the worker may only start once everything else is ready
+    std::thread m_worker;
+};
@@ -0,0 +1,232 @@
+/****************************************************************************
+
+    File: ModelingScheduler.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "ModelingScheduler.hpp"
+#include "TextLines.hpp"
+#include "LuaCodeModeler.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <cassert>
+
+namespace {
+
+// skipping a line is very cheap compared to reading the clock
+constexpr const std::size_t SKIPS_PER_CLOCK_CHECK = 1024;
+
+void run_modeling_scheduler_tests();
+
+} // end of <anonymous> namespace
+
+/* static */ constexpr const int ModelingScheduler::DEFAULT_BUDGET_IN_MICROSECONDS;
+
+/* explicit */ ModelingScheduler::ModelingScheduler
+    (std::unique_ptr<CodeModeler> modeler):
+    m_modeler     (std::move(modeler)),
+    m_budget      (std::chrono::microseconds(DEFAULT_BUDGET_IN_MICROSECONDS)),
+    m_next_line   (0),
+    m_pass_started(false),
+    m_pass_version(0)
+{
+    if (!m_modeler) {
+        throw std::invalid_argument("ModelingScheduler::ModelingScheduler: "
+                                    "modeler must not be null.");
+    }
+}
+
+void ModelingScheduler::set_budget_in_microseconds(int budget) {
+    if (budget < 0) {
+        throw std::invalid_argument("ModelingScheduler::set_budget_in_microseconds: "
+                                    "budget must not be negative.");
+    }
+    m_budget = std::chrono::microseconds(budget);
+}
+
+bool ModelingScheduler::advance
+    (TextLines & textlines, int visible_begin, int visible_end)
+{
+    const auto deadline = Clock::now() + m_budget;
+    if (!m_pass_started || m_pass_version != textlines.version()) {
+        m_pass_started = true;
+        m_pass_version = textlines.version();
+        m_next_line = 0;
+        m_modeler->reset_state();
+    }
+    model_visible_lines(textlines, visible_begin, visible_end);
+    return continue_pass(textlines, deadline);
+}
+
+void ModelingScheduler::resume_after_append
+    (const TextLines & textlines, std::size_t first_changed_line,
+     std::size_t version_before)
+{
+    if (!m_pass_started || m_pass_version != version_before) return;
+    m_pass_version = textlines.version();
+    if (first_changed_line >= m_next_line) return;
+    // lines before are passed, so their exit states are as the pass left them
+    m_next_line = first_changed_line;
+    if (first_changed_line == 0) {
+        m_modeler->reset_state();
+    } else {
+        m_modeler->restore_state
+            (textlines.lines()[first_changed_line - 1].modeler_exit_state());
+    }
+}
+
+/* static */ void ModelingScheduler::run_tests()
+    { run_modeling_scheduler_tests(); }
+
+/* private */ void ModelingScheduler::model_visible_lines
+    (TextLines & textlines, int visible_begin, int visible_end)
+{
+    const auto & lines = textlines.lines();
+    visible_begin = std::max(0, visible_begin);
+    visible_end   = std::min(int(lines.size()), visible_end);
+    if (visible_begin >= visible_end) return;
+
+    // the pass' modeler is borrowed, and must be put back as it was
+    const auto pass_state = m_modeler->save_state();
+    for (int i = visible_begin; i < visible_end; ++i) {
+        const auto & line = lines[std::size_t(i)];
+        if (!line.needs_modeling()) continue;
+        // our best guess, the pass will correct this line if it is wrong
+        m_modeler->restore_state(i == 0 ? CodeModeler::State() :
+                                 lines[std::size_t(i - 1)].modeler_exit_state());
+        textlines.update_line_modeler(i, *m_modeler);
+    }
+    m_modeler->restore_state(pass_state);
+}
+
+/* private */ bool ModelingScheduler::continue_pass
+    (TextLines & textlines, Clock::time_point deadline)
+{
+    const auto & lines = textlines.lines();
+    std::size_t skips_since_check = 0;
+    for (; m_next_line < lines.size(); ++m_next_line) {
+        const auto & line = lines[m_next_line];
+        if (!line.needs_modeling() &&
+            m_modeler->state_equals(line.modeler_entry_state()))
+        {
+            m_modeler->restore_state(line.modeler_exit_state());
+            if (++skips_since_check != SKIPS_PER_CLOCK_CHECK) continue;
+            skips_since_check = 0;
+        } else {
+            textlines.update_line_modeler(int(m_next_line), *m_modeler);
+        }
+        // checked only after a line is done, so that there's always progress
+        if (Clock::now() >= deadline) {
+            ++m_next_line;
+            return m_next_line < lines.size();
+        }
+    }
+    return false;
+}
+
+namespace {
+
+void run_modeling_scheduler_tests() {
+    static const std::u32string code_c =
+        U"local a = 1\nlocal b = [[\nnot code\n]]\nreturn a\nend\nend\n"
+         "local c = 2\n-- comment\nreturn c";
+    auto make_scheduler = []() {
+        return ModelingScheduler(std::unique_ptr<CodeModeler>(new LuaCodeModeler()));
+    };
+    auto modeled_line_count = [](const TextLines & tlines) {
+        return std::count_if(tlines.lines().begin(), tlines.lines().end(),
+            [](const TextLine & line) { return !line.needs_modeling(); });
+    };
+    // with a zero budget, visible lines are still done, and the pass still
+    // progresses, until eventually it is finished
+    {
+    TextLines tlines(code_c);
+    auto scheduler = make_scheduler();
+    scheduler.set_budget_in_microseconds(0);
+    assert(scheduler.advance(tlines, 5, 8));
+    for (int i = 5; i != 8; ++i)
+        assert(!tlines.lines()[std::size_t(i)].needs_modeling());
+    assert(modeled_line_count(tlines) < int(tlines.lines().size()));
+    int calls = 1;
+    while (scheduler.advance(tlines, 5, 8)) ++calls;
+    assert(calls < int(tlines.lines().size()));
+    assert(modeled_line_count(tlines) == int(tlines.lines().size()));
+
+    // results must match a full pass
+    TextLines expected(code_c);
+    LuaCodeModeler lcm;
+    expected.update_modeler(lcm);
+    for (std::size_t i = 0; i != tlines.lines().size(); ++i) {
+        assert(tlines.lines()[i].modeler_entry_state() ==
+               expected.lines()[i].modeler_entry_state());
+    }
+    }
+    // a visible line modeled from the wrong state is corrected by the pass
+    {
+    TextLines tlines(code_c);
+    auto scheduler = make_scheduler();
+    while (scheduler.advance(tlines, 0, 0)) {}
+    // opens a multiline string, every line below changes
+    tlines.push(Cursor(0, 0), U'[');
+    tlines.push(Cursor(0, 1), U'[');
+    scheduler.set_budget_in_microseconds(0);
+    scheduler.advance(tlines, 0, 1);
+    while (scheduler.advance(tlines, 0, 1)) {}
+    TextLines expected(tlines.copy_characters_from(Cursor(), tlines.end_cursor()));
+    LuaCodeModeler lcm;
+    expected.update_modeler(lcm);
+    for (std::size_t i = 0; i != tlines.lines().size(); ++i) {
+        assert(tlines.lines()[i].modeler_exit_state() ==
+               expected.lines()[i].modeler_exit_state());
+    }
+    }
+    // appended to, the pass carries on from the line appended to (or starts
+    // over, if there were other edits), and ends the same as a full pass
+    for (bool stale : { false, true }) {
+    TextLines tlines(code_c);
+    auto scheduler = make_scheduler();
+    while (scheduler.advance(tlines, 0, 0)) {}
+    // an edit the pass has not seen, made before appending
+    if (stale) tlines.push(Cursor(0, 0), U' ');
+    const auto version = tlines.version();
+    const auto last = tlines.lines().size() - 1;
+    const std::u32string appended = U" = [[\nstill\n]] .. 'code'\nlocal d";
+    tlines.deposit_chatacters_to(appended.data(), appended.data() + appended.size(),
+                                 tlines.end_cursor());
+    scheduler.resume_after_append(tlines, last, version);
+    while (scheduler.advance(tlines, 0, 0)) {}
+    TextLines expected(tlines.copy_characters_from(Cursor(), tlines.end_cursor()));
+    LuaCodeModeler lcm;
+    expected.update_modeler(lcm);
+    for (std::size_t i = 0; i != tlines.lines().size(); ++i) {
+        assert(!tlines.lines()[i].needs_modeling());
+        assert(tlines.lines()[i].modeler_exit_state() ==
+               expected.lines()[i].modeler_exit_state());
+    }
+    }
+    // nothing to do
+    {
+    TextLines tlines;
+    auto scheduler = make_scheduler();
+    assert(!scheduler.advance(tlines, 0, 10));
+    }
+}
+
+} // end of <anonymous> namespace
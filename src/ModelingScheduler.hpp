@@ -0,0 +1,79 @@
+/****************************************************************************
+
+    File: ModelingScheduler.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "TextLineImage.hpp"
+
+#include <memory>
+#include <chrono>
+
+class TextLines;
+
+/** Spreads modeling of a TextLines over several frames.
+ *
+ *  Each call to advance first models whichever visible lines need it (from
+ *  the exit state of the line before), then resumes a pass over the whole
+ *  document from where the last call left off, until the time budget runs
+ *  out. The pass skips lines whose recorded entry state still matches, and
+ *  starts over whenever the TextLines changes.
+ */
+class ModelingScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr const int DEFAULT_BUDGET_IN_MICROSECONDS = 4000;
+
+    explicit ModelingScheduler(std::unique_ptr<CodeModeler>);
+
+    void set_budget_in_microseconds(int);
+
+    /** Does (roughly) at most one budget's worth of modeling, visible lines
+     *  are always modeled, and the pass always makes some progress.
+     *  @param visible_begin first line on screen
+     *  @param visible_end   one past the last line on screen
+     *  @return true if there is still modeling left to do
+     */
+    bool advance(TextLines &, int visible_begin, int visible_end);
+
+    /** For lines which were only appended to (such as a followed log), so
+     *  that the pass carries on rather than starting over. Lines before the
+     *  given one must be as they were when the lines were at the given
+     *  version, otherwise (or if the pass was not at that version) the pass
+     *  starts over anyway.
+     *  @param first_changed_line the line appended to (the last before)
+     *  @param version_before     the lines' version before appending
+     */
+    void resume_after_append(const TextLines &, std::size_t first_changed_line,
+                             std::size_t version_before);
+
+    static void run_tests();
+private:
+    void model_visible_lines(TextLines &, int visible_begin, int visible_end);
+    bool continue_pass(TextLines &, Clock::time_point deadline);
+
+    std::unique_ptr<CodeModeler> m_modeler;
+    Clock::duration m_budget;
+    // the pass resumes at this line, with the modeler in the state to enter
+    // it with
+    std::size_t m_next_line;
+    bool m_pass_started;
+    std::size_t m_pass_version;
+};
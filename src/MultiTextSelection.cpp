@@ -0,0 +1,294 @@
+/****************************************************************************
+
+    File: MultiTextSelection.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "MultiTextSelection.hpp"
+#include "TextLines.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <cassert>
+
+namespace {
+
+void run_multi_text_selection_tests();
+
+// the end cursor is the end of the content, as far as editing goes
+Cursor to_content(const TextLines &, Cursor);
+
+bool begins_before(const CursorRange &, const CursorRange &);
+
+} // end of <anonymous> namespace
+
+/* explicit */ MultiTextSelection::MultiTextSelection
+    (const std::vector<CursorRange> & ranges):
+    m_ranges(ranges)
+{ sort_and_merge(); }
+
+void MultiTextSelection::add(CursorRange range) {
+    if (range.end < range.begin) std::swap(range.begin, range.end);
+    // only the neighbours at the insertion point can touch the new range
+    auto itr = std::upper_bound(m_ranges.begin(), m_ranges.end(), range,
+                                begins_before);
+    if (itr != m_ranges.begin() && !((itr - 1)->end < range.begin)) {
+        --itr;
+        range.begin = itr->begin;
+        if (range.end < itr->end) range.end = itr->end;
+    } else {
+        itr = m_ranges.insert(itr, range);
+    }
+    auto last = itr + 1;
+    for (; last != m_ranges.end() && !(range.end < last->begin); ++last) {
+        if (range.end < last->end) range.end = last->end;
+    }
+    *itr = range;
+    m_ranges.erase(itr + 1, last);
+}
+
+void MultiTextSelection::push(TextLines * tlines, UChar uchr) {
+    verify_text_lines_pointer("MultiTextSelection::push", tlines);
+    paste(tlines, std::u32string(1, uchr));
+}
+
+void MultiTextSelection::paste(TextLines * tlines, const std::u32string & text) {
+    verify_text_lines_pointer("MultiTextSelection::paste", tlines);
+    if (m_ranges.empty()) return;
+    if (tlines->lines().empty()) {
+        // nothing to replace, every caret can only be at the very start
+        auto end = tlines->deposit_chatacters_to
+            (text.data(), text.data() + text.size(), Cursor());
+        m_ranges.assign(1, CursorRange(end, end));
+        return;
+    }
+    auto ranges = m_ranges;
+    for (auto & range : ranges) {
+        range.begin = to_content(*tlines, range.begin);
+        range.end   = to_content(*tlines, range.end  );
+    }
+    replace(*tlines, ranges, std::vector<std::u32string>(ranges.size(), text));
+}
+
+void MultiTextSelection::delete_ahead(TextLines * tlines) {
+    verify_text_lines_pointer("MultiTextSelection::delete_ahead", tlines);
+    if (m_ranges.empty() || tlines->lines().empty()) return;
+    auto ranges = removal_ranges(*tlines, [tlines](Cursor cursor)
+        { return CursorRange(cursor, tlines->next_cursor(cursor)); });
+    replace(*tlines, ranges, std::vector<std::u32string>(ranges.size()));
+}
+
+void MultiTextSelection::delete_behind(TextLines * tlines) {
+    verify_text_lines_pointer("MultiTextSelection::delete_behind", tlines);
+    if (m_ranges.empty() || tlines->lines().empty()) return;
+    auto ranges = removal_ranges(*tlines, [tlines](Cursor cursor)
+        { return CursorRange(tlines->previous_cursor(cursor), cursor); });
+    replace(*tlines, ranges, std::vector<std::u32string>(ranges.size()));
+}
+
+/* static */ void MultiTextSelection::run_tests()
+    { run_multi_text_selection_tests(); }
+
+/* private */ void MultiTextSelection::replace
+    (TextLines & tlines, const std::vector<CursorRange> & ranges,
+     const std::vector<std::u32string> & texts)
+{
+    assert(ranges.size() == texts.size());
+    tlines.replace_each(ranges, texts);
+    // each caret is moved by what was done before it, positions after a
+    // replaced range move with the end of its text
+    m_ranges.clear();
+    Cursor old_end, new_end;
+    for (std::size_t i = 0; i != ranges.size(); ++i) {
+        const auto & beg = ranges[i].begin;
+        Cursor new_beg(beg.line - old_end.line + new_end.line, beg.column);
+        if (i != 0 && beg.line == old_end.line)
+            new_beg.column = beg.column - old_end.column + new_end.column;
+        old_end = ranges[i].end;
+        new_end = TextLines::end_of_insertion(new_beg, texts[i]);
+        m_ranges.emplace_back(new_end, new_end);
+    }
+    // carets which ended up in the same place are one
+    sort_and_merge();
+}
+
+template <typename StepFunc>
+/* private */ std::vector<CursorRange> MultiTextSelection::removal_ranges
+    (const TextLines & tlines, StepFunc && step) const
+{
+    std::vector<CursorRange> rv;
+    rv.reserve(m_ranges.size());
+    for (const auto & range : m_ranges) {
+        CursorRange removed(to_content(tlines, range.begin),
+                            to_content(tlines, range.end  ));
+        if (removed.begin == removed.end) {
+            removed = step(removed.begin);
+            removed.begin = to_content(tlines, removed.begin);
+            removed.end   = to_content(tlines, removed.end  );
+        }
+        // a caret reaching into its neighbour's selection (or character)
+        // only removes what is left
+        if (!rv.empty() && removed.begin < rv.back().end)
+            removed.begin = std::min(rv.back().end, removed.end);
+        rv.push_back(removed);
+    }
+    return rv;
+}
+
+/* private */ void MultiTextSelection::sort_and_merge() {
+    for (auto & range : m_ranges) {
+        if (range.end < range.begin) std::swap(range.begin, range.end);
+    }
+    if (!std::is_sorted(m_ranges.begin(), m_ranges.end(), begins_before))
+        std::sort(m_ranges.begin(), m_ranges.end(), begins_before);
+    if (m_ranges.empty()) return;
+    // touching or overlapping ranges are merged
+    auto last = m_ranges.begin();
+    for (auto itr = last + 1; itr != m_ranges.end(); ++itr) {
+        if (last->end < itr->begin) {
+            *++last = *itr;
+        } else if (last->end < itr->end) {
+            last->end = itr->end;
+        }
+    }
+    m_ranges.erase(last + 1, m_ranges.end());
+}
+
+/* private */ void MultiTextSelection::verify_text_lines_pointer
+    (const char * caller, TextLines * tlines) const
+{
+    if (tlines) return;
+    throw std::invalid_argument
+        (std::string(caller) + ": TextLines pointer parameter must be set.");
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+Cursor to_content(const TextLines & tlines, Cursor cursor) {
+    if (cursor != tlines.end_cursor() || tlines.lines().empty()) return cursor;
+    return Cursor(int(tlines.lines().size()) - 1,
+                  tlines.lines().back().content_length());
+}
+
+bool begins_before(const CursorRange & lhs, const CursorRange & rhs)
+    { return lhs.begin < rhs.begin; }
+
+std::u32string content_of(const TextLines & tlines)
+    { return tlines.copy_characters_from(Cursor(), tlines.end_cursor()); }
+
+std::vector<Cursor> carets_of(const MultiTextSelection & selection) {
+    std::vector<Cursor> rv;
+    for (const auto & range : selection.ranges()) {
+        assert(range.begin == range.end);
+        rv.push_back(range.end);
+    }
+    return rv;
+}
+
+void run_multi_text_selection_tests() {
+    // sorted and merged
+    {
+    MultiTextSelection selection({
+        CursorRange(Cursor(2, 0), Cursor(2, 3)), CursorRange(Cursor(0, 4), Cursor(0, 1)),
+        CursorRange(Cursor(2, 3), Cursor(2, 3)), CursorRange(Cursor(0, 2), Cursor(0, 3))
+    });
+    assert(selection.size() == 2);
+    assert(selection.ranges()[0] == CursorRange(Cursor(0, 1), Cursor(0, 4)));
+    selection.add_caret(Cursor(1, 0));
+    assert(selection.size() == 3 && selection.ranges()[1].begin == Cursor(1, 0));
+    }
+    // adding one at a time, against sorting and merging them all at once
+    {
+    std::vector<CursorRange> ranges;
+    MultiTextSelection added;
+    for (int i = 0; i != 300; ++i) {
+        const int line = (i*37) % 50;
+        CursorRange range(Cursor(line, (i*11) % 7), Cursor(line, (i*5) % 9));
+        if (i % 13 == 0) range.end = Cursor(line + 1, 2);
+        ranges.push_back(range);
+        added.add(range);
+        assert(added.ranges() == MultiTextSelection(ranges).ranges());
+    }
+    }
+    // typing at carets on the same line and on different lines
+    {
+    TextLines tlines(U"a b c\nd e");
+    MultiTextSelection selection;
+    for (auto cursor : { Cursor(0, 1), Cursor(0, 3), Cursor(1, 1), Cursor(1, 3) })
+        selection.add_caret(cursor);
+    selection.push(&tlines, U'x');
+    assert(content_of(tlines) == U"ax bx c\ndx ex");
+    assert(carets_of(selection) == std::vector<Cursor>
+           ({ Cursor(0, 2), Cursor(0, 5), Cursor(1, 2), Cursor(1, 5) }));
+    selection.paste(&tlines, U"1\n2");
+    assert(content_of(tlines) == U"ax1\n2 bx1\n2 c\ndx1\n2 ex1\n2");
+    assert(carets_of(selection) == std::vector<Cursor>
+           ({ Cursor(1, 1), Cursor(2, 1), Cursor(4, 1), Cursor(5, 1) }));
+    selection.delete_behind(&tlines);
+    selection.delete_behind(&tlines);
+    assert(content_of(tlines) == U"ax1 bx1 c\ndx1 ex1");
+    selection.delete_ahead(&tlines);
+    assert(content_of(tlines) == U"ax1bx1c\ndx1ex1");
+    }
+    // selections are replaced, carets next to each other delete together
+    {
+    TextLines tlines(U"local foo = foo + 1\nfoo()");
+    MultiTextSelection selection({
+        CursorRange(Cursor(0, 6), Cursor(0, 9)), CursorRange(Cursor(0, 12), Cursor(0, 15)),
+        CursorRange(Cursor(1, 0), Cursor(1, 3))
+    });
+    selection.paste(&tlines, U"bar_baz");
+    assert(content_of(tlines) == U"local bar_baz = bar_baz + 1\nbar_baz()");
+    assert(carets_of(selection).back() == Cursor(1, 7));
+    TextLines short_lines(U"ab\ncd");
+    MultiTextSelection carets({ CursorRange(Cursor(0, 1), Cursor(0, 1)),
+                                CursorRange(Cursor(1, 0), Cursor(1, 0)) });
+    carets.delete_behind(&short_lines);
+    assert(content_of(short_lines) == U"bcd");
+    assert(carets_of(carets) == std::vector<Cursor>({ Cursor(0, 0), Cursor(0, 1) }));
+    // the first caret has nothing behind it
+    carets.delete_behind(&short_lines);
+    assert(content_of(short_lines) == U"cd" && carets.size() == 1);
+    }
+    // many carets, against editing one caret at a time from the last
+    {
+    std::u32string content;
+    for (int i = 0; i != 200; ++i) content += U"x = x + 1\n";
+    TextLines tlines(content), expected(content);
+    MultiTextSelection selection;
+    for (int i = 0; i != 200; ++i) {
+        selection.add_caret(Cursor(i, 0));
+        selection.add_caret(Cursor(i, 4));
+    }
+    selection.paste(&tlines, U"y\n");
+    for (int i = 199; i != -1; --i) {
+        for (auto column : { 4, 0 }) {
+            static const std::u32string text = U"y\n";
+            expected.deposit_chatacters_to(text.data(), text.data() + text.size(),
+                                           Cursor(i, column));
+        }
+    }
+    assert(content_of(tlines) == content_of(expected));
+    assert(selection.size() == 400 && carets_of(selection).back() == Cursor(599, 0));
+    }
+}
+
+} // end of <anonymous> namespace
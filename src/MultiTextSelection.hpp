@@ -0,0 +1,81 @@
+/****************************************************************************
+
+    File: MultiTextSelection.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "Cursor.hpp"
+
+#include <vector>
+#include <string>
+
+class TextLines;
+
+/** Any number of selections (or bare carets) which are all edited at once,
+ *  as when every occurrence of some text has been selected.
+ *
+ *  Selections are kept sorted, and those which touch or overlap are merged.
+ *  Each edit is made to the TextLines in a single pass (one replace_each),
+ *  after which every caret is moved by the accumulated change of the edits
+ *  before it. So the cost is of the total edit, not of carets times the
+ *  document.
+ */
+class MultiTextSelection {
+public:
+    MultiTextSelection() {}
+    /** Selections may be given in any order, a caret is an empty range. */
+    explicit MultiTextSelection(const std::vector<CursorRange> &);
+
+    void add(CursorRange);
+    void add_caret(Cursor cursor) { add(CursorRange(cursor, cursor)); }
+    void clear() { m_ranges.clear(); }
+
+    /** Each selection is replaced by the character, leaving a caret after
+     *  it.
+     */
+    void push(TextLines *, UChar);
+    /** Same as push, with any number of characters. */
+    void paste(TextLines *, const std::u32string &);
+    /** Each selection is removed, each caret removes the character after
+     *  (for delete_ahead) or before (for delete_behind) it.
+     */
+    void delete_ahead (TextLines *);
+    void delete_behind(TextLines *);
+
+    bool empty() const { return m_ranges.empty(); }
+    std::size_t size() const { return m_ranges.size(); }
+    /** @return each selection in order, the caret is at its end */
+    const std::vector<CursorRange> & ranges() const { return m_ranges; }
+
+    static void run_tests();
+private:
+    // replaces each range (which must not overlap) with its text, and leaves
+    // a caret after each text
+    void replace(TextLines &, const std::vector<CursorRange> & ranges,
+                 const std::vector<std::u32string> & texts);
+    // ranges with the selections which each caret removes a character from
+    // (or to) added
+    template <typename StepFunc>
+    std::vector<CursorRange> removal_ranges(const TextLines &, StepFunc &&) const;
+    void sort_and_merge();
+    void verify_text_lines_pointer(const char * caller, TextLines *) const;
+
+    std::vector<CursorRange> m_ranges;
+};
@@ -0,0 +1,272 @@
+/****************************************************************************
+
+    File: ParallelModeler.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "ParallelModeler.hpp"
+#include "LuaCodeModeler.hpp"
+#include "TextLines.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+#include <cassert>
+
+namespace {
+
+// chunks per thread, more chunks evens out uneven line lengths
+constexpr const std::size_t CHUNKS_PER_THREAD = 4;
+
+// how many lines are modeled between polls of the abandon test
+constexpr const std::size_t LINES_PER_ABANDON_CHECK = 256;
+
+// cache may be nullptr
+void model_line(CodeModeler &, const std::u32string &, int line_number,
+                int width, TextLineImage &, ModelCache *);
+
+void run_parallel_modeler_tests();
+
+} // end of <anonymous> namespace
+
+/* explicit */ ParallelModeler::ParallelModeler
+    (ModelerFactory make_modeler, int thread_count):
+    m_make_modeler  (make_modeler),
+    m_thread_count  (thread_count),
+    m_min_chunk_size(DEFAULT_MIN_CHUNK_SIZE)
+{
+    if (!m_make_modeler) {
+        throw std::invalid_argument("ParallelModeler::ParallelModeler: "
+                                    "modeler factory must be callable.");
+    }
+    if (m_thread_count < 0) {
+        throw std::invalid_argument("ParallelModeler::ParallelModeler: "
+                                    "thread count must not be negative.");
+    }
+    if (m_thread_count == HARDWARE_THREAD_COUNT)
+        m_thread_count = int(ThreadPool::shared_instance().thread_count());
+    for (int i = 0; i != m_thread_count; ++i)
+        m_caches.emplace_back(new ModelCache());
+}
+
+bool ParallelModeler::model
+    (const TextLinesSnapshot & lines, int width,
+     std::vector<TextLineImage> & images, const AbandonTest & should_abandon)
+{
+    images.resize(lines.line_count());
+    auto chunks = make_chunks(lines.line_count());
+    for (auto & chunk : chunks)
+        chunk.modeler = m_make_modeler();
+
+    // each thread takes the next unclaimed chunk until there are none left
+    std::atomic<std::size_t> next_chunk(0);
+    std::atomic<bool> abandoned(false);
+    auto do_chunks = [&](std::size_t thread_idx) {
+        auto & cache = *m_caches[thread_idx];
+        std::size_t idx;
+        while ((idx = next_chunk++) < chunks.size()) {
+            if (!model_chunk(chunks[idx], lines, width, images, should_abandon,
+                             cache))
+            { abandoned = true; }
+            if (abandoned) return;
+        }
+    };
+    auto thread_count = std::min(std::size_t(m_thread_count), chunks.size());
+    // this thread does its share too
+    ThreadPool::shared_instance().run_in_parallel(thread_count, do_chunks);
+    if (abandoned) return false;
+
+    fix_up_chunks(chunks, lines, width, images);
+    return true;
+}
+
+void ParallelModeler::set_minimum_chunk_size(int size) {
+    if (size < 1) {
+        throw std::invalid_argument("ParallelModeler::set_minimum_chunk_size: "
+                                    "size must be a positive integer.");
+    }
+    m_min_chunk_size = size;
+}
+
+void ParallelModeler::set_cache_capacity(std::size_t capacity) {
+    for (auto & cache : m_caches)
+        cache->set_capacity(capacity);
+}
+
+ModelCache::Statistics ParallelModeler::cache_statistics() const {
+    ModelCache::Statistics rv;
+    for (const auto & cache : m_caches) {
+        auto stats = cache->statistics();
+        rv.hits    += stats.hits;
+        rv.misses  += stats.misses;
+        rv.entries += stats.entries;
+        rv.bytes   += stats.bytes;
+    }
+    return rv;
+}
+
+/* static */ void ParallelModeler::run_tests()
+    { run_parallel_modeler_tests(); }
+
+/* private */ std::vector<ParallelModeler::Chunk>
+    ParallelModeler::make_chunks(std::size_t line_count) const
+{
+    auto chunk_size = line_count / (std::size_t(m_thread_count)*CHUNKS_PER_THREAD);
+    chunk_size = std::max(chunk_size, std::size_t(m_min_chunk_size));
+    std::vector<Chunk> chunks;
+    for (std::size_t beg = 0; beg < line_count; beg += chunk_size) {
+        chunks.emplace_back();
+        chunks.back().begin = beg;
+        chunks.back().end   = std::min(line_count, beg + chunk_size);
+    }
+    return chunks;
+}
+
+/* private */ bool ParallelModeler::model_chunk
+    (Chunk & chunk, const TextLinesSnapshot & lines, int width,
+     std::vector<TextLineImage> & images, const AbandonTest & should_abandon,
+     ModelCache & cache) const
+{
+    auto & modeler = *chunk.modeler;
+    modeler.reset_state();
+    for (auto i = chunk.begin; i != chunk.end; ++i) {
+        if ((i - chunk.begin) % LINES_PER_ABANDON_CHECK == 0 &&
+            should_abandon && should_abandon())
+        { return false; }
+        model_line(modeler, lines.line(i), int(i), width, images[i], &cache);
+    }
+    return true;
+}
+
+/* private */ void ParallelModeler::fix_up_chunks
+    (std::vector<Chunk> & chunks, const TextLinesSnapshot & lines,
+     int width, std::vector<TextLineImage> & images) const
+{
+    if (chunks.empty()) return;
+    // the first chunk really did start from the reset state, so whatever
+    // state its modeler is left in, is the true state
+    CodeModeler * true_modeler = chunks.front().modeler.get();
+    for (auto itr = chunks.begin() + 1; itr != chunks.end(); ++itr) {
+        auto & chunk = *itr;
+        auto i = chunk.begin;
+        for (; i != chunk.end; ++i) {
+            // states meet, the rest of the speculation holds
+            if (true_modeler->state_equals(images[i].modeler_entry_state()))
+                break;
+            model_line(*true_modeler, lines.line(i), int(i), width, images[i],
+                       m_caches.front().get());
+        }
+        // if the states never met, the true modeler is left at the true exit
+        // state of this chunk, and carries on into the next
+        if (i != chunk.end)
+            true_modeler = chunk.modeler.get();
+    }
+}
+
+namespace {
+
+void model_line
+    (CodeModeler & modeler, const std::u32string & line, int line_number,
+     int width, TextLineImage & image, ModelCache * cache)
+{
+    image.constrain_to_width(width);
+    image.set_line_number(line_number);
+    if (cache) {
+        image.update_modeler(modeler, line, TextLine::hash_of
+            (line.data(), line.data() + line.size()), *cache);
+    } else {
+        image.update_modeler(modeler, line);
+    }
+}
+
+std::unique_ptr<CodeModeler> make_lua_modeler()
+    { return std::unique_ptr<CodeModeler>(new LuaCodeModeler()); }
+
+TextLinesSnapshot snapshot_of(const std::vector<std::u32string> & lines) {
+    std::u32string content;
+    for (const auto & line : lines)
+        content += line + TextLines::NEW_LINE;
+    content.pop_back();
+    return TextLines(content).snapshot();
+}
+
+std::vector<TextLineImage> model_serially
+    (const std::vector<std::u32string> & lines, int width)
+{
+    LuaCodeModeler lcm;
+    std::vector<TextLineImage> images(lines.size());
+    for (std::size_t i = 0; i != lines.size(); ++i)
+        model_line(lcm, lines[i], int(i), width, images[i], nullptr);
+    return images;
+}
+
+void run_parallel_modeler_tests() {
+    // multiline strings that cross chunk boundaries, the parallel results
+    // must be identical to modeling line by line
+    static const std::vector<std::u32string> lines_c = {
+        U"local a = [[", U"not code", U"still not code", U"]] local b = 1",
+        U"-- comment", U"local c = [==[", U"x", U"y", U"z", U"w", U"]==]",
+        U"return a", U"[[", U"", U"", U"", U"", U"]]", U"end"
+    };
+    for (int chunk_size : { 1, 2, 3, 5, 100 }) {
+        ParallelModeler modeler(make_lua_modeler, 3);
+        modeler.set_minimum_chunk_size(chunk_size);
+        std::vector<TextLineImage> images;
+        assert(modeler.model(snapshot_of(lines_c), 80, images));
+        assert(images == model_serially(lines_c, 80));
+    }
+    // second time around is served by the cache, with the same results
+    {
+    ParallelModeler modeler(make_lua_modeler, 1);
+    modeler.set_minimum_chunk_size(4);
+    std::vector<TextLineImage> images;
+    assert(modeler.model(snapshot_of(lines_c), 80, images));
+    auto misses = modeler.cache_statistics().misses;
+    assert(modeler.model(snapshot_of(lines_c), 80, images));
+    assert(images == model_serially(lines_c, 80));
+    assert(modeler.cache_statistics().misses == misses);
+    }
+    // unterminated multiline runs to the end of the document
+    {
+    std::vector<std::u32string> lines = { U"[[" };
+    for (int i = 0; i != 40; ++i) lines.emplace_back(U"local x = 1");
+    ParallelModeler modeler(make_lua_modeler, 4);
+    modeler.set_minimum_chunk_size(7);
+    std::vector<TextLineImage> images;
+    assert(modeler.model(snapshot_of(lines), 20, images));
+    assert(images == model_serially(lines, 20));
+    }
+    // abandoning
+    {
+    std::vector<std::u32string> lines(1000, U"local x = 1");
+    ParallelModeler modeler(make_lua_modeler, 2);
+    std::vector<TextLineImage> images;
+    assert(!modeler.model(snapshot_of(lines), 80, images, []() { return true; }));
+    }
+    // empty document
+    {
+    ParallelModeler modeler(make_lua_modeler);
+    std::vector<TextLineImage> images;
+    assert(modeler.model(TextLinesSnapshot(), 80, images));
+    assert(images.empty());
+    }
+}
+
+} // end of <anonymous> namespace
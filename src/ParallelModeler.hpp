@@ -0,0 +1,100 @@
+/****************************************************************************
+
+    File: ParallelModeler.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "TextLineImage.hpp"
+#include "ModelCache.hpp"
+#include "TextLinesSnapshot.hpp"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+
+/** Models a whole document across several threads (of the shared
+ *  ThreadPool).
+ *
+ *  The lines are split into chunks, and each chunk is modeled speculatively
+ *  from the reset state by its own modeler. Afterwards the chunks are walked
+ *  in order, and any chunk whose true entry state was not the reset state
+ *  (only possible after an unterminated multiline string or comment) is
+ *  remodeled until the true state matches the entry state recorded by the
+ *  speculative pass.
+ *
+ *  Each thread keeps its own ModelCache across calls to model, so remodeling
+ *  a mostly unchanged document is mostly cache hits.
+ */
+class ParallelModeler {
+public:
+    using ModelerFactory = std::function<std::unique_ptr<CodeModeler>()>;
+    using AbandonTest    = std::function<bool()>;
+    // uses however many threads the hardware supports
+    static constexpr const int HARDWARE_THREAD_COUNT = 0;
+    static constexpr const int DEFAULT_MIN_CHUNK_SIZE = 2048;
+
+    explicit ParallelModeler
+        (ModelerFactory, int thread_count = HARDWARE_THREAD_COUNT);
+
+    /** @param images is resized to match lines, each image being modeled for
+     *                its line at the given width
+     *  @param should_abandon is polled periodically by each thread, if it
+     *                        returns true, modeling stops early
+     *  @return false if modeling was abandoned (images are then incomplete)
+     */
+    bool model(const TextLinesSnapshot & lines, int width,
+               std::vector<TextLineImage> & images,
+               const AbandonTest & should_abandon = AbandonTest());
+
+    /** Chunks are never made smaller than this (except the last). */
+    void set_minimum_chunk_size(int);
+
+    int thread_count() const { return m_thread_count; }
+
+    /** Sets the capacity of each thread's cache. */
+    void set_cache_capacity(std::size_t);
+
+    /** @return statistics summed over every thread's cache */
+    ModelCache::Statistics cache_statistics() const;
+
+    static void run_tests();
+private:
+    struct Chunk {
+        std::size_t begin;
+        std::size_t end;
+        // left at the speculative exit state of the chunk
+        std::unique_ptr<CodeModeler> modeler;
+    };
+
+    std::vector<Chunk> make_chunks(std::size_t line_count) const;
+    bool model_chunk(Chunk &, const TextLinesSnapshot &, int width,
+                     std::vector<TextLineImage> &, const AbandonTest &,
+                     ModelCache &) const;
+    void fix_up_chunks(std::vector<Chunk> &,
+                       const TextLinesSnapshot &, int width,
+                       std::vector<TextLineImage> &) const;
+
+    ModelerFactory m_make_modeler;
+    int m_thread_count;
+    int m_min_chunk_size;
+    // one per thread, the calling thread uses the first
+    std::vector<std::unique_ptr<ModelCache>> m_caches;
+};
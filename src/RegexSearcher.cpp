@@ -0,0 +1,338 @@
+/****************************************************************************
+
+    File: RegexSearcher.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "RegexSearcher.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <cassert>
+
+namespace {
+
+void to_wide_string(const std::u32string &, std::wstring &);
+
+std::wregex compile(const std::u32string & pattern,
+                    RegexSearcher::CaseSensitivity);
+
+void run_regex_searcher_tests();
+
+} // end of <anonymous> namespace
+
+RegexSearcher::RegexSearcher
+    (TextLines & tlines, const std::u32string & pattern,
+     CaseSensitivity case_sensitivity):
+    m_lines(&tlines),
+    m_regex(compile(pattern, case_sensitivity)),
+    m_results(tlines.lines().size()),
+    m_dirty_begin(0),
+    m_dirty_end(tlines.lines().size()),
+    m_match_count(0)
+{ m_lines->add_edit_listener(this); }
+
+RegexSearcher::~RegexSearcher()
+    { m_lines->remove_edit_listener(this); }
+
+std::size_t RegexSearcher::refresh() {
+    std::size_t searched = 0;
+    for (auto i = m_dirty_begin; i < m_dirty_end; ++i) {
+        if (m_results[i].searched) continue;
+        spans_on(i);
+        ++searched;
+    }
+    m_dirty_begin = m_dirty_end = 0;
+    return searched;
+}
+
+bool RegexSearcher::find_next(Cursor from, Match & match) {
+    for (auto i = std::size_t(std::max(0, from.line)); i < m_results.size(); ++i) {
+        const int min_column = int(i) == from.line ? from.column : 0;
+        for (const auto & span : spans_on(i)) {
+            if (span.first < min_column) continue;
+            match = Match(Cursor(int(i), span.first), Cursor(int(i), span.second));
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RegexSearcher::find_previous(Cursor from, Match & match) {
+    if (m_results.empty() || from.line < 0) return false;
+    auto i = std::min(std::size_t(from.line), m_results.size() - 1);
+    while (true) {
+        const auto & spans = spans_on(i);
+        for (auto itr = spans.rbegin(); itr != spans.rend(); ++itr) {
+            if (int(i) == from.line && itr->first >= from.column) continue;
+            match = Match(Cursor(int(i), itr->first), Cursor(int(i), itr->second));
+            return true;
+        }
+        if (i-- == 0) return false;
+    }
+}
+
+std::vector<RegexSearcher::Match> RegexSearcher::matches_on_lines
+    (int first_line, int last_line)
+{
+    std::vector<Match> rv;
+    auto last = std::min(std::size_t(std::max(0, last_line)), m_results.size());
+    for (auto i = std::size_t(std::max(0, first_line)); i < last; ++i) {
+        for (const auto & span : spans_on(i)) {
+            rv.emplace_back(Cursor(int(i), span.first),
+                            Cursor(int(i), span.second));
+        }
+    }
+    return rv;
+}
+
+/* static */ std::u32string RegexSearcher::escape(const std::u32string & text) {
+    static const std::u32string SPECIAL_CHARACTERS = U"\\^$.|?*+()[]{}";
+    std::u32string rv;
+    rv.reserve(text.size());
+    for (auto uchr : text) {
+        if (SPECIAL_CHARACTERS.find(uchr) != std::u32string::npos)
+            rv += U'\\';
+        rv += uchr;
+    }
+    return rv;
+}
+
+/* static */ void RegexSearcher::run_tests()
+    { run_regex_searcher_tests(); }
+
+/* private */ void RegexSearcher::on_insertion
+    (const TextLines &, Cursor beg, Cursor end)
+{
+    // line counts are taken from the cursors, as listeners may be told of a
+    // group of edits only once all of them are made
+    const auto old_size = m_results.size();
+    // new lines follow the one the insertion began on, an insertion into an
+    // empty document creates its first line too
+    const auto added = std::size_t(end.line - beg.line) + (old_size == 0 ? 1 : 0);
+    const auto new_size = old_size + added;
+    const auto at    = std::min(std::size_t(beg.line) + 1, old_size);
+    m_results.insert(m_results.begin() + std::ptrdiff_t(at), added, LineResults());
+    if (m_dirty_begin < m_dirty_end) {
+        if (m_dirty_begin >= at) m_dirty_begin += added;
+        if (m_dirty_end   >  at) m_dirty_end   += added;
+    }
+    invalidate(std::min(std::size_t(beg.line), new_size),
+               std::min(std::size_t(beg.line) + 1 + added, new_size));
+}
+
+/* private */ void RegexSearcher::on_removal
+    (const TextLines &, Cursor beg, Cursor end, const std::u32string &)
+{
+    const auto old_size = m_results.size();
+    // removed lines are those which followed the one the removal began on
+    const auto removed = std::size_t(end.line - beg.line);
+    assert(removed < old_size);
+    const auto new_size = old_size - removed;
+    const auto at      = std::min(std::size_t(beg.line) + 1, new_size);
+    auto first = m_results.begin() + std::ptrdiff_t(at);
+    auto last  = first + std::ptrdiff_t(removed);
+    for (auto itr = first; itr != last; ++itr)
+        m_match_count -= itr->spans.size();
+    m_results.erase(first, last);
+    // lines which were removed collapse onto the first one that follows
+    auto shifted = [at, removed](std::size_t line)
+        { return line <= at + removed ? std::min(line, at) : line - removed; };
+    m_dirty_begin = shifted(m_dirty_begin);
+    m_dirty_end   = shifted(m_dirty_end  );
+    invalidate(std::min(std::size_t(beg.line), new_size),
+               std::min(std::size_t(beg.line) + 1, new_size));
+}
+
+/* private */ void RegexSearcher::on_reset(const TextLines & tlines) {
+    m_results.assign(tlines.lines().size(), LineResults());
+    m_match_count = 0;
+    m_dirty_begin = 0;
+    m_dirty_end   = m_results.size();
+}
+
+/* private */ const std::vector<RegexSearcher::Span> &
+    RegexSearcher::spans_on(std::size_t line)
+{
+    auto & results = m_results[line];
+    if (results.searched) return results.spans;
+    to_wide_string(m_lines->lines()[line].content(), m_buffer);
+    using Iterator = std::wsregex_iterator;
+    for (auto itr = Iterator(m_buffer.begin(), m_buffer.end(), m_regex);
+         itr != Iterator(); ++itr)
+    {
+        if (itr->length() == 0) continue;
+        auto beg = int(itr->position());
+        results.spans.emplace_back(beg, beg + int(itr->length()));
+    }
+    results.searched = true;
+    m_match_count += results.spans.size();
+    return results.spans;
+}
+
+/* private */ void RegexSearcher::invalidate
+    (std::size_t first, std::size_t last)
+{
+    if (first >= last) return;
+    for (auto i = first; i != last; ++i) {
+        auto & results = m_results[i];
+        m_match_count -= results.spans.size();
+        results.spans.clear();
+        results.searched = false;
+    }
+    if (m_dirty_begin >= m_dirty_end) {
+        m_dirty_begin = first;
+        m_dirty_end   = last;
+    } else {
+        m_dirty_begin = std::min(m_dirty_begin, first);
+        m_dirty_end   = std::max(m_dirty_end  , last );
+    }
+}
+
+namespace {
+
+void to_wide_string(const std::u32string & ustr, std::wstring & wstr) {
+    wstr.resize(ustr.size());
+    std::transform(ustr.begin(), ustr.end(), wstr.begin(), [](UChar uchr) {
+        // where wchar_t is too narrow, keep each character in one place so
+        // that columns still line up
+        if (sizeof(wchar_t) < sizeof(UChar) && uchr > 0xFFFF)
+            return wchar_t(0xFFFD);
+        return wchar_t(uchr);
+    });
+}
+
+std::wregex compile
+    (const std::u32string & pattern,
+     RegexSearcher::CaseSensitivity case_sensitivity)
+{
+    auto flags = std::regex::ECMAScript | std::regex::optimize;
+    if (case_sensitivity == SubstringSearcher::IGNORE_ASCII_CASE)
+        flags |= std::regex::icase;
+    std::wstring wpattern;
+    to_wide_string(pattern, wpattern);
+    try {
+        return std::wregex(wpattern, flags);
+    } catch (std::regex_error & exp) {
+        throw std::invalid_argument(std::string("RegexSearcher::RegexSearcher: "
+                                    "pattern is not a valid regular "
+                                    "expression: ") + exp.what());
+    }
+}
+
+void run_regex_searcher_tests() {
+    using Match = RegexSearcher::Match;
+    // searching, then only what was edited
+    {
+    TextLines tlines(U"local x = 10\nlocal yy = 200\n\nreturn x + yy");
+    RegexSearcher searcher(tlines, U"[0-9]+");
+    assert(searcher.refresh() == 4);
+    assert(searcher.match_count() == 2);
+    assert(searcher.refresh() == 0);
+    Match match;
+    assert(searcher.find_next(Cursor(0, 11), match));
+    assert(match == Match(Cursor(1, 11), Cursor(1, 14)));
+    assert(searcher.find_previous(Cursor(1, 11), match));
+    assert(match == Match(Cursor(0, 10), Cursor(0, 12)));
+    assert(!searcher.find_previous(Cursor(0, 10), match));
+
+    tlines.push(Cursor(3, 0), U'5');
+    assert(searcher.refresh() == 1);
+    assert(searcher.match_count() == 3);
+    static const std::u32string inserted = U"1\n2 3\n";
+    tlines.deposit_chatacters_to(inserted.data(), inserted.data() + inserted.size(),
+                                 Cursor(1, 0));
+    assert(searcher.refresh() == 3);
+    assert(searcher.match_count() == 6);
+    tlines.wipe(Cursor(0, 0), Cursor(3, 0));
+    assert(searcher.refresh() == 1);
+    assert(searcher.match_count() == 2);
+    assert(searcher.matches_on_lines(0, 1).front() == Match(Cursor(0, 11), Cursor(0, 14)));
+    tlines.set_content(U"1 2");
+    assert(searcher.refresh() == 1);
+    assert(searcher.match_count() == 2);
+    }
+    // escaped text is matched as it is
+    {
+    TextLines tlines(U"a.b a+b (a.b)");
+    RegexSearcher searcher(tlines, RegexSearcher::escape(U"(a.b)"));
+    searcher.refresh();
+    assert(searcher.match_count() == 1);
+    }
+    // case, and bad patterns
+    {
+    TextLines tlines(U"Local LOCAL local");
+    RegexSearcher searcher(tlines, U"lo[a-z]al", SubstringSearcher::IGNORE_ASCII_CASE);
+    searcher.refresh();
+    assert(searcher.match_count() == 3);
+    bool threw = false;
+    try {
+        RegexSearcher bad(tlines, U"(unclosed");
+    } catch (std::invalid_argument &) {
+        threw = true;
+    }
+    assert(threw);
+    }
+    // random edits, checked against searching all over again
+    {
+    unsigned seed = 3;
+    auto next_random = [&seed](std::size_t limit) {
+        seed = seed*1103515245u + 12345u;
+        return limit == 0 ? 0 : int((seed >> 8) % limit);
+    };
+    auto random_cursor = [&next_random](const TextLines & tlines) {
+        int line = next_random(tlines.lines().size());
+        return Cursor(line, next_random(tlines.lines()[std::size_t(line)].content().size() + 1));
+    };
+    TextLines tlines(U"a1b22\n\n333 c\nd4");
+    RegexSearcher searcher(tlines, U"[0-9]+");
+    static const std::u32string alphabet = U"a1 \n";
+    for (int round = 0; round != 300; ++round) {
+        auto beg = random_cursor(tlines);
+        switch (next_random(4)) {
+        case 0: tlines.push(beg, alphabet[std::size_t(next_random(4))]); break;
+        case 1: {
+            auto end = random_cursor(tlines);
+            if (end < beg) std::swap(beg, end);
+            tlines.wipe(beg, end);
+            break;
+        }
+        case 2: {
+            std::u32string text;
+            for (int i = next_random(8); i != 0; --i)
+                text += alphabet[std::size_t(next_random(4))];
+            tlines.deposit_chatacters_to(text.data(), text.data() + text.size(), beg);
+            break;
+        }
+        case 3: SubstringSearcher(U"a").replace_all(tlines, U"\n11"); break;
+        }
+        if (round % 3 == 0) searcher.refresh();
+        if (round % 7 != 0) continue;
+        searcher.refresh();
+        RegexSearcher fresh(tlines, U"[0-9]+");
+        fresh.refresh();
+        int line_count = int(tlines.lines().size());
+        assert(searcher.match_count() == fresh.match_count());
+        assert(searcher.matches_on_lines(0, line_count) ==
+               fresh.matches_on_lines(0, line_count));
+    }
+    }
+}
+
+} // end of <anonymous> namespace
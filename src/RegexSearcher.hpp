@@ -0,0 +1,112 @@
+/****************************************************************************
+
+    File: RegexSearcher.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "TextLines.hpp"
+#include "SubstringSearcher.hpp"
+
+#include <regex>
+#include <vector>
+#include <string>
+
+/** Keeps the matches of a regular expression over every line of a TextLines
+ *  while it is being edited.
+ *
+ *  The expression is compiled once. Each line's matches are kept, and only
+ *  lines which the TextLines reports as edited (or inserted) are searched
+ *  again, so keeping the results current costs in proportion to the edits
+ *  made, not to the size of the document.
+ *
+ *  Matches never span lines, and empty matches are ignored.
+ */
+class RegexSearcher final : public TextLines::EditListener {
+public:
+    using Match           = SubstringSearcher::Match;
+    using CaseSensitivity = SubstringSearcher::CaseSensitivity;
+
+    /** Starts listening to the given lines, nothing is searched until asked.
+     *  @throws std::invalid_argument if the pattern is not a valid
+     *          (ECMAScript) regular expression
+     *  @warning Does not in anyway maintain ownership over the given object.
+     *           Given object must survive the life of this object.
+     */
+    RegexSearcher(TextLines &, const std::u32string & pattern,
+                  CaseSensitivity = SubstringSearcher::CASE_SENSITIVE);
+    ~RegexSearcher() override;
+
+    RegexSearcher(const RegexSearcher &) = delete;
+    RegexSearcher & operator = (const RegexSearcher &) = delete;
+
+    /** Searches every line edited since the last refresh (every line, the
+     *  first time).
+     *  @return number of lines searched
+     */
+    std::size_t refresh();
+
+    /** @return number of matches in the whole document, as of the last
+     *          refresh
+     */
+    std::size_t match_count() const { return m_match_count; }
+
+    /** Finds the first match beginning at or after the given cursor.
+     *  @return true if there is one, in which case match is set to it
+     */
+    bool find_next(Cursor from, Match & match);
+
+    /** Finds the last match beginning before the given cursor.
+     *  @return true if there is one, in which case match is set to it
+     */
+    bool find_previous(Cursor from, Match & match);
+
+    /** @return every match on lines [first_line, last_line), in order */
+    std::vector<Match> matches_on_lines(int first_line, int last_line);
+
+    /** @return a pattern which matches exactly the given text */
+    static std::u32string escape(const std::u32string &);
+
+    static void run_tests();
+private:
+    // [begin, end) columns of one match
+    using Span = std::pair<int, int>;
+    struct LineResults {
+        std::vector<Span> spans;
+        bool searched = false;
+    };
+
+    void on_insertion(const TextLines &, Cursor beg, Cursor end) override;
+    void on_removal(const TextLines &, Cursor beg, Cursor end,
+                    const std::u32string & removed) override;
+    void on_reset(const TextLines &) override;
+
+    const std::vector<Span> & spans_on(std::size_t line);
+    void invalidate(std::size_t first, std::size_t last);
+
+    TextLines * m_lines;
+    std::wregex m_regex;
+    std::vector<LineResults> m_results;
+    // lines outside [m_dirty_begin, m_dirty_end) are all searched
+    std::size_t m_dirty_begin;
+    std::size_t m_dirty_end;
+    std::size_t m_match_count;
+    // line content as the regex library expects it, reused between lines
+    std::wstring m_buffer;
+};
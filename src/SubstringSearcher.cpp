@@ -0,0 +1,428 @@
+/****************************************************************************
+
+    File: SubstringSearcher.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "SubstringSearcher.hpp"
+#include "TextLines.hpp"
+#include "TextLinesSnapshot.hpp"
+#include "MappedDocument.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <cwchar>
+#include <cassert>
+
+namespace {
+
+constexpr const std::size_t NPOS = std::u32string::npos;
+
+// below this length, shifts are too short for Horspool to beat scanning for
+// the first character
+constexpr const std::size_t HORSPOOL_MIN_LENGTH = 6;
+
+// line access, uniform for TextLines and snapshots
+std::size_t line_count(const TextLines & tlines)
+    { return tlines.lines().size(); }
+
+const std::u32string & line_at(const TextLines & tlines, std::size_t idx)
+    { return tlines.lines()[idx].content(); }
+
+std::size_t line_count(const TextLinesSnapshot & snapshot)
+    { return snapshot.line_count(); }
+
+const std::u32string & line_at(const TextLinesSnapshot & snapshot, std::size_t idx)
+    { return snapshot.line(idx); }
+
+// mapped lines are decoded on each access, and so returned by value
+std::size_t line_count(const MappedDocument & document)
+    { return document.line_count(); }
+
+std::u32string line_at(const MappedDocument & document, std::size_t idx)
+    { return document.line(idx); }
+
+bool is_ascii_upper(UChar uchr) { return uchr >= U'A' && uchr <= U'Z'; }
+
+UChar to_ascii_lower(UChar uchr)
+    { return is_ascii_upper(uchr) ? uchr - U'A' + U'a' : uchr; }
+
+// @return index of the first uchr in [beg, end), or end
+std::size_t find_character
+    (const UChar * data, std::size_t beg, std::size_t end, UChar uchr);
+
+void run_substring_searcher_tests();
+
+} // end of <anonymous> namespace
+
+/* explicit */ SubstringSearcher::SubstringSearcher
+    (const std::u32string & pattern, CaseSensitivity case_sensitivity):
+    m_case(case_sensitivity)
+{
+    if (pattern.empty()) {
+        throw std::invalid_argument("SubstringSearcher::SubstringSearcher: "
+                                    "pattern must not be empty.");
+    }
+    std::size_t beg = 0;
+    while (true) {
+        auto end = pattern.find(TextLines::NEW_LINE, beg);
+        m_segments.emplace_back(pattern.substr(beg, end - beg));
+        if (end == NPOS) break;
+        beg = end + 1;
+    }
+    for (auto & segment : m_segments) {
+        for (auto & uchr : segment) uchr = fold(uchr);
+    }
+    // shifts are only for single line patterns
+    const auto & segment = m_segments.front();
+    m_shifts.fill(segment.size());
+    // ascending, so that characters sharing a byte take the shortest shift
+    for (std::size_t i = 0; i + 1 < segment.size(); ++i)
+        m_shifts[segment[i] & 0xFF] = segment.size() - 1 - i;
+}
+
+bool SubstringSearcher::find_next
+    (const TextLines & tlines, Cursor from, Match & match) const
+{ return find_next_in(tlines, from, match); }
+
+bool SubstringSearcher::find_next
+    (const TextLinesSnapshot & snapshot, Cursor from, Match & match) const
+{ return find_next_in(snapshot, from, match); }
+
+bool SubstringSearcher::find_next
+    (const MappedDocument & document, Cursor from, Match & match) const
+{ return find_next_in(document, from, match); }
+
+bool SubstringSearcher::find_previous
+    (const TextLines & tlines, Cursor from, Match & match) const
+{ return find_previous_in(tlines, from, match); }
+
+bool SubstringSearcher::find_previous
+    (const TextLinesSnapshot & snapshot, Cursor from, Match & match) const
+{ return find_previous_in(snapshot, from, match); }
+
+bool SubstringSearcher::find_previous
+    (const MappedDocument & document, Cursor from, Match & match) const
+{ return find_previous_in(document, from, match); }
+
+std::vector<SubstringSearcher::Match> SubstringSearcher::find_all
+    (const TextLines & tlines, Cursor from) const
+{ return find_all_in(tlines, from); }
+
+std::vector<SubstringSearcher::Match> SubstringSearcher::find_all
+    (const TextLinesSnapshot & snapshot, Cursor from) const
+{ return find_all_in(snapshot, from); }
+
+std::vector<SubstringSearcher::Match> SubstringSearcher::find_all
+    (const MappedDocument & document, Cursor from) const
+{ return find_all_in(document, from); }
+
+std::size_t SubstringSearcher::replace_all
+    (TextLines & tlines, const std::u32string & replacement) const
+{ return tlines.replace_all(find_all(tlines), replacement); }
+
+/* static */ void SubstringSearcher::run_tests()
+    { run_substring_searcher_tests(); }
+
+template <typename Lines>
+/* private */ bool SubstringSearcher::find_next_in
+    (const Lines & lines, Cursor from, Match & match) const
+{
+    const auto count = line_count(lines);
+    for (auto i = std::size_t(std::max(0, from.line)); i < count; ++i) {
+        std::size_t min_column = int(i) == from.line ? std::size_t(std::max(0, from.column)) : 0;
+        if (m_segments.size() > 1) {
+            if (spans_from(lines, i, match) &&
+                std::size_t(match.begin.column) >= min_column)
+            { return true; }
+            continue;
+        }
+        auto column = find_in_line(line_at(lines, i), min_column);
+        if (column == NPOS) continue;
+        match = Match(Cursor(int(i), int(column)),
+                      Cursor(int(i), int(column + m_segments.front().size())));
+        return true;
+    }
+    return false;
+}
+
+template <typename Lines>
+/* private */ bool SubstringSearcher::find_previous_in
+    (const Lines & lines, Cursor from, Match & match) const
+{
+    const auto count = line_count(lines);
+    if (count == 0 || from.line < 0) return false;
+    auto i = std::min(std::size_t(from.line), count - 1);
+    while (true) {
+        // matches must begin before this column
+        auto limit = int(i) == from.line ? std::size_t(std::max(0, from.column)) : NPOS;
+        if (m_segments.size() > 1) {
+            if (spans_from(lines, i, match) &&
+                std::size_t(match.begin.column) < limit)
+            { return true; }
+        } else {
+            const auto & line = line_at(lines, i);
+            auto last = NPOS;
+            for (auto column = find_in_line(line, 0);
+                 column != NPOS && column < limit;
+                 column = find_in_line(line, column + 1))
+            { last = column; }
+            if (last != NPOS) {
+                match = Match(Cursor(int(i), int(last)),
+                              Cursor(int(i), int(last + m_segments.front().size())));
+                return true;
+            }
+        }
+        if (i-- == 0) return false;
+    }
+}
+
+template <typename Lines>
+/* private */ std::vector<SubstringSearcher::Match>
+    SubstringSearcher::find_all_in(const Lines & lines, Cursor from) const
+{
+    std::vector<Match> rv;
+    Match match;
+    while (find_next_in(lines, from, match)) {
+        rv.push_back(match);
+        from = match.end;
+    }
+    return rv;
+}
+
+template <typename Lines>
+/* private */ bool SubstringSearcher::spans_from
+    (const Lines & lines, std::size_t i, Match & match) const
+{
+    assert(m_segments.size() > 1);
+    const auto last_line = i + m_segments.size() - 1;
+    if (last_line >= line_count(lines)) return false;
+    // first segment ends the first line, the last begins the last line, and
+    // any others are whole lines
+    const auto & first = line_at(lines, i);
+    if (first.size() < m_segments.front().size()) return false;
+    const auto begin_column = first.size() - m_segments.front().size();
+    if (!equals_at(first, begin_column, m_segments.front())) return false;
+    for (std::size_t j = 1; j + 1 < m_segments.size(); ++j) {
+        const auto & line = line_at(lines, i + j);
+        if (line.size() != m_segments[j].size() ||
+            !equals_at(line, 0, m_segments[j]))
+        { return false; }
+    }
+    const auto & last = line_at(lines, last_line);
+    if (last.size() < m_segments.back().size() ||
+        !equals_at(last, 0, m_segments.back()))
+    { return false; }
+    match = Match(Cursor(int(i), int(begin_column)),
+                  Cursor(int(last_line), int(m_segments.back().size())));
+    return true;
+}
+
+/* private */ std::size_t SubstringSearcher::find_in_line
+    (const std::u32string & line, std::size_t from) const
+{
+    assert(m_segments.size() == 1);
+    const auto & pattern = m_segments.front();
+    if (line.size() < pattern.size() || from > line.size() - pattern.size())
+        return NPOS;
+    if (pattern.size() >= HORSPOOL_MIN_LENGTH)
+        return find_by_horspool(line, from);
+    return find_by_first_character(line, from);
+}
+
+/* private */ std::size_t SubstringSearcher::find_by_first_character
+    (const std::u32string & line, std::size_t from) const
+{
+    const auto & pattern = m_segments.front();
+    const auto first = pattern.front();
+    // one past the last column a match could begin on
+    const auto end = line.size() - pattern.size() + 1;
+    const bool either_case = m_case == IGNORE_ASCII_CASE && first >= U'a' &&
+                             first <= U'z';
+    for (auto column = from; column < end; ++column) {
+        if (either_case) {
+            auto itr = std::find_if(line.begin() + std::ptrdiff_t(column),
+                                    line.begin() + std::ptrdiff_t(end),
+                [first](UChar uchr) { return to_ascii_lower(uchr) == first; });
+            column = std::size_t(itr - line.begin());
+        } else {
+            column = find_character(line.data(), column, end, first);
+        }
+        if (column == end) return NPOS;
+        if (equals_at(line, column, pattern)) return column;
+    }
+    return NPOS;
+}
+
+/* private */ std::size_t SubstringSearcher::find_by_horspool
+    (const std::u32string & line, std::size_t from) const
+{
+    const auto & pattern = m_segments.front();
+    const auto last_idx = pattern.size() - 1;
+    const auto end = line.size() - pattern.size() + 1;
+    for (auto column = from; column < end; ) {
+        auto uchr = fold(line[column + last_idx]);
+        if (uchr == pattern[last_idx] && equals_at(line, column, pattern))
+            return column;
+        column += m_shifts[uchr & 0xFF];
+    }
+    return NPOS;
+}
+
+/* private */ bool SubstringSearcher::equals_at
+    (const std::u32string & line, std::size_t column,
+     const std::u32string & segment) const
+{
+    assert(column + segment.size() <= line.size());
+    auto itr = line.begin() + std::ptrdiff_t(column);
+    if (m_case == CASE_SENSITIVE)
+        return std::equal(segment.begin(), segment.end(), itr);
+    return std::equal(segment.begin(), segment.end(), itr,
+        [](UChar lhs, UChar rhs) { return lhs == to_ascii_lower(rhs); });
+}
+
+/* private */ UChar SubstringSearcher::fold(UChar uchr) const
+    { return m_case == IGNORE_ASCII_CASE ? to_ascii_lower(uchr) : uchr; }
+
+namespace {
+
+std::size_t find_character
+    (const UChar * data, std::size_t beg, std::size_t end, UChar uchr)
+{
+    if (beg >= end) return end;
+    if (sizeof(wchar_t) == sizeof(UChar)) {
+        // the C library's version is vectorized
+        auto found = std::wmemchr(reinterpret_cast<const wchar_t *>(data + beg),
+                                  wchar_t(uchr), end - beg);
+        if (!found) return end;
+        return std::size_t(reinterpret_cast<const UChar *>(found) - data);
+    }
+    return std::size_t(std::find(data + beg, data + end, uchr) - data);
+}
+
+// the obvious way, over the whole document joined together
+std::vector<SubstringSearcher::Match> find_all_naively
+    (const std::u32string & content, std::u32string pattern,
+     SubstringSearcher::CaseSensitivity case_sensitivity)
+{
+    auto folded = content;
+    if (case_sensitivity == SubstringSearcher::IGNORE_ASCII_CASE) {
+        for (auto & uchr : folded ) uchr = to_ascii_lower(uchr);
+        for (auto & uchr : pattern) uchr = to_ascii_lower(uchr);
+    }
+    auto cursor_at = [&content](std::size_t offset) {
+        Cursor cursor;
+        for (std::size_t i = 0; i != offset; ++i) {
+            if (content[i] == TextLines::NEW_LINE) {
+                ++cursor.line;
+                cursor.column = 0;
+            } else {
+                ++cursor.column;
+            }
+        }
+        return cursor;
+    };
+    std::vector<SubstringSearcher::Match> rv;
+    for (auto pos = folded.find(pattern); pos != NPOS;
+         pos = folded.find(pattern, pos + pattern.size()))
+    { rv.emplace_back(cursor_at(pos), cursor_at(pos + pattern.size())); }
+    return rv;
+}
+
+void run_substring_searcher_tests() {
+    using Match = SubstringSearcher::Match;
+    // on a single line, from the middle of a line
+    {
+    TextLines tlines(U"the cat sat\non the mat");
+    SubstringSearcher searcher(U"at");
+    auto matches = searcher.find_all(tlines);
+    assert(matches.size() == 3);
+    assert(matches[0] == Match(Cursor(0, 5), Cursor(0, 7)));
+    assert(matches[2] == Match(Cursor(1, 8), Cursor(1, 10)));
+    assert(searcher.find_all(tlines, Cursor(0, 6)).size() == 2);
+    Match match;
+    assert(searcher.find_next(tlines, Cursor(0, 10), match));
+    assert(match == matches[2]);
+    assert(searcher.find_previous(tlines, Cursor(1, 8), match));
+    assert(match == matches[1]);
+    assert(searcher.find_previous(tlines, tlines.end_cursor(), match));
+    assert(match == matches[2]);
+    assert(!searcher.find_previous(tlines, Cursor(0, 5), match));
+    assert(!SubstringSearcher(U"dog").find_next(tlines, Cursor(), match));
+    }
+    // spanning lines
+    {
+    TextLines tlines(U"local a = 1\nlocal b = 2\nend\nlocal a = 1\nlocal b");
+    SubstringSearcher searcher(U"1\nlocal b");
+    auto matches = searcher.find_all(tlines);
+    assert(matches.size() == 2);
+    assert(matches[0] == Match(Cursor(0, 10), Cursor(1, 7)));
+    SubstringSearcher whole_line(U"= 2\nend\nlocal");
+    Match match;
+    assert(whole_line.find_next(tlines.snapshot(), Cursor(), match));
+    assert(match == Match(Cursor(1, 8), Cursor(3, 5)));
+    assert(whole_line.find_previous(tlines, tlines.end_cursor(), match));
+    assert(!whole_line.find_previous(tlines, Cursor(1, 8), match));
+    }
+    // ignoring case, only for ascii letters
+    {
+    TextLines tlines(U"Local LOCAL local lOcAl Àà");
+    SubstringSearcher searcher(U"local", SubstringSearcher::IGNORE_ASCII_CASE);
+    assert(searcher.find_all(tlines).size() == 4);
+    SubstringSearcher accents(U"à", SubstringSearcher::IGNORE_ASCII_CASE);
+    assert(accents.find_all(tlines).size() == 1);
+    }
+    // replacing every match
+    {
+    TextLines tlines(U"x = a.b;\ny = a.b + a.c");
+    assert(SubstringSearcher(U"a.").replace_all(tlines, U"") == 3);
+    assert(tlines.copy_characters_from(Cursor(), tlines.end_cursor()) ==
+           U"x = b;\ny = b + c");
+    }
+    // against the obvious way, for short and long patterns, both cases
+    {
+    unsigned seed = 11;
+    auto next_random = [&seed](unsigned limit) {
+        seed = seed*1103515245u + 12345u;
+        return (seed >> 8) % limit;
+    };
+    static const std::u32string alphabet = U"abAB\n";
+    for (int round = 0; round != 200; ++round) {
+        std::u32string content, pattern;
+        for (int i = 0; i != 300; ++i)
+            content += alphabet[next_random(5)];
+        auto pattern_length = 1 + next_random(round % 2 ? 12 : 3);
+        for (unsigned i = 0; i != pattern_length; ++i)
+            pattern += alphabet[next_random(round % 3 ? 4 : 5)];
+        auto case_sensitivity = round % 4 < 2 ? SubstringSearcher::CASE_SENSITIVE :
+                                                SubstringSearcher::IGNORE_ASCII_CASE;
+        TextLines tlines(content);
+        SubstringSearcher searcher(pattern, case_sensitivity);
+        auto expected = find_all_naively(content, pattern, case_sensitivity);
+        assert(searcher.find_all(tlines) == expected);
+        assert(searcher.find_all(tlines.snapshot()) == expected);
+        Match match;
+        if (expected.empty()) continue;
+        assert(searcher.find_previous(tlines, tlines.end_cursor(), match));
+        assert(!(match.begin < expected.back().begin));
+    }
+    }
+}
+
+} // end of <anonymous> namespace
@@ -0,0 +1,107 @@
+/****************************************************************************
+
+    File: SubstringSearcher.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "Cursor.hpp"
+
+#include <array>
+#include <vector>
+#include <string>
+
+class TextLines;
+class TextLinesSnapshot;
+class MappedDocument;
+
+/** Finds occurrences of a fixed pattern in a document, line by line, without
+ *  ever joining lines together.
+ *
+ *  Patterns may span lines (contain TextLines::NEW_LINE). Short patterns are
+ *  found by scanning for their first character (with the C library's
+ *  vectorized wmemchr, where wchar_t is 32 bits) and then comparing the
+ *  rest, longer patterns with Boyer-Moore-Horspool.
+ *
+ *  Searching a MappedDocument decodes each line as it is searched (and
+ *  indexes the whole file first).
+ */
+class SubstringSearcher {
+public:
+    enum CaseSensitivity { CASE_SENSITIVE, IGNORE_ASCII_CASE };
+
+    using Match = CursorRange;
+
+    explicit SubstringSearcher(const std::u32string & pattern,
+                               CaseSensitivity = CASE_SENSITIVE);
+
+    /** Finds the first match beginning at or after the given cursor.
+     *  @return true if there is one, in which case match is set to it
+     */
+    bool find_next(const TextLines &, Cursor from, Match & match) const;
+    bool find_next(const TextLinesSnapshot &, Cursor from, Match & match) const;
+    bool find_next(const MappedDocument &, Cursor from, Match & match) const;
+
+    /** Finds the last match beginning before the given cursor.
+     *  @return true if there is one, in which case match is set to it
+     */
+    bool find_previous(const TextLines &, Cursor from, Match & match) const;
+    bool find_previous(const TextLinesSnapshot &, Cursor from, Match & match) const;
+    bool find_previous(const MappedDocument &, Cursor from, Match & match) const;
+
+    /** @return every (non-overlapping) match beginning at or after the given
+     *          cursor, in order
+     */
+    std::vector<Match> find_all(const TextLines &, Cursor from = Cursor()) const;
+    std::vector<Match> find_all(const TextLinesSnapshot &, Cursor from = Cursor()) const;
+    std::vector<Match> find_all(const MappedDocument &, Cursor from = Cursor()) const;
+
+    /** Replaces every match with the given text, all as one edit.
+     *  @see TextLines::replace_all
+     *  @return number of matches replaced
+     */
+    std::size_t replace_all(TextLines &, const std::u32string & replacement) const;
+
+    static void run_tests();
+private:
+    template <typename Lines>
+    bool find_next_in(const Lines &, Cursor from, Match &) const;
+    template <typename Lines>
+    bool find_previous_in(const Lines &, Cursor from, Match &) const;
+    template <typename Lines>
+    std::vector<Match> find_all_in(const Lines &, Cursor from) const;
+    // for patterns spanning lines, whether a match begins on the given line
+    template <typename Lines>
+    bool spans_from(const Lines &, std::size_t line, Match &) const;
+
+    // @return column of the first occurrence (of a single line pattern) at or
+    //         after from, or npos if there is none
+    std::size_t find_in_line(const std::u32string &, std::size_t from) const;
+    std::size_t find_by_first_character(const std::u32string &, std::size_t from) const;
+    std::size_t find_by_horspool(const std::u32string &, std::size_t from) const;
+    bool equals_at(const std::u32string &, std::size_t column,
+                   const std::u32string & segment) const;
+    UChar fold(UChar) const;
+
+    // pattern split at new lines, already folded if case is ignored
+    std::vector<std::u32string> m_segments;
+    CaseSensitivity m_case;
+    // Horspool shifts, by the low byte of a (folded) character
+    std::array<std::size_t, 256> m_shifts;
+};
@@ -23,6 +23,8 @@
 #include "LuaCodeModeler.hpp"
 
 #include <stdexcept>
+#include <algorithm>
+#include <limits>
 
 #include <cassert>
 
@@ -97,6 +99,38 @@ int RenderOptions::tab_width() const { return m_tab_width; }
 void RenderOptions::set_text_selection(const UserTextSelection & sel)
     { m_user_text_selection = sel; }
 
+void RenderOptions::set_highlights(const std::vector<CursorRange> & ranges) {
+    static constexpr const int REST_OF_LINE = std::numeric_limits<int>::max();
+    m_highlights.clear();
+    m_highlights.reserve(ranges.size());
+    for (const auto & range : ranges) {
+        if (range.end < range.begin || (!m_highlights.empty() &&
+            range.begin < m_highlights.back().end))
+        {
+            throw std::invalid_argument("RenderOptions::set_highlights: ranges "
+                                        "must be in order and must not "
+                                        "overlap.");
+        }
+        // only the last line's part ends before the end of its line
+        for (int line = range.begin.line; line != range.end.line; ++line) {
+            int beg = line == range.begin.line ? range.begin.column : 0;
+            m_highlights.emplace_back(Cursor(line, beg), Cursor(line, REST_OF_LINE));
+        }
+        int beg = range.begin.line == range.end.line ? range.begin.column : 0;
+        m_highlights.emplace_back(Cursor(range.end.line, beg), range.end);
+    }
+}
+
+IteratorPair<RenderOptions::HighlightIter>
+    RenderOptions::highlights_on(int line) const
+{
+    auto beg = std::lower_bound(m_highlights.begin(), m_highlights.end(), line,
+        [](const CursorRange & range, int line_) { return range.begin.line < line_; });
+    auto end = beg;
+    while (end != m_highlights.end() && end->begin.line == line) ++end;
+    return IteratorPair<HighlightIter>(beg, end);
+}
+
 void RenderOptions::set_cursor_flash_off()
     { m_cursor_flash = false; }
 
@@ -118,6 +152,9 @@ RenderOptions::ColorPairTransformFunc
 /* static */ ColorPair RenderOptions::pass  (ColorPair color_pair)
     { return color_pair; }
 
+/* static */ ColorPair RenderOptions::highlight(ColorPair color_pair)
+    { return ColorPair(color_pair.fore, sf::Color(110, 90, 20)); }
+
 /* static */ ColorPair RenderOptions::invert(ColorPair color_pair) {
     auto invert_single = [](sf::Color color)
         { return sf::Color(255 - color.r, 255 - color.g, 255 - color.r, color.a); };
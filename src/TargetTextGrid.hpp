@@ -23,9 +23,11 @@
 
 #include "Cursor.hpp"
 #include "UserTextSelection.hpp"
+#include "IteratorPair.hpp"
 
 #include <string>
 #include <set>
+#include <vector>
 #include <SFML/Graphics/Color.hpp>
 
 struct ColorPair {
@@ -107,6 +109,7 @@ public:
     static const sf::Color default_back_c;
     static constexpr const int DEFAULT_TAB_WIDTH = 4;
     using ColorPairTransformFunc = ColorPair (*)(ColorPair);
+    using HighlightIter = std::vector<CursorRange>::const_iterator;
     enum { DEFAULT_PAIR, KEYWORD_PAIR };
 
     static const RenderOptions & get_default_instance();
@@ -123,16 +126,30 @@ public:
 
     void set_text_selection(const UserTextSelection &);
 
+    /** Highlights the given ranges (search matches), on top of whatever else
+     *  colors the characters. Ranges spanning lines are split by line.
+     *  @param ranges must be in order and must not overlap
+     */
+    void set_highlights(const std::vector<CursorRange> & ranges);
+    void clear_highlights() { m_highlights.clear(); }
+    /** @return highlighted ranges on the given line, in order, each of which
+     *          begins and ends on that line
+     */
+    IteratorPair<HighlightIter> highlights_on(int line) const;
+
     void set_cursor_flash_off();
     void toggle_cursor_flash();
     ColorPairTransformFunc color_adjust_for(Cursor) const;
 
     static ColorPair pass  (ColorPair);
     static ColorPair invert(ColorPair);
+    static ColorPair highlight(ColorPair);
 private:
     int m_tab_width;
     std::set<std::u32string> m_keywords;
     sf::Color m_fore_color, m_back_color, m_keyword_color;
     UserTextSelection m_user_text_selection;
+    // sorted, one line each, so a row finds its own with a binary search
+    std::vector<CursorRange> m_highlights;
     bool m_cursor_flash;
 };
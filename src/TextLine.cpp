@@ -36,9 +36,46 @@ void run_text_line_tests();
 
 void verify_text_line_content_string(const char * caller, const std::u32string &);
 
+// all empty lines share the one string
+const TextLine::SharedContent & empty_content();
+
+// Hashing is done modulo the Mersenne prime 2^61 - 1, which is cheap to reduce
+// by, and does not share the weaknesses of arithmetic modulo 2^64 (for which
+// some simple, repetitive strings collide).
+constexpr const std::uint64_t HASH_MODULUS = (std::uint64_t(1) << 61) - 1;
+constexpr const std::uint64_t HASH_BASE    = 0x0DE9C5A1B7F3246Bu;
+
+// of any value
+std::uint64_t reduce(std::uint64_t);
+std::uint64_t add_mod(std::uint64_t, std::uint64_t);
+std::uint64_t sub_mod(std::uint64_t, std::uint64_t);
+std::uint64_t mul_mod(std::uint64_t, std::uint64_t);
+// hash*HASH_BASE^4 plus the terms of the four given characters
+std::uint64_t hash_four(std::uint64_t hash, const UChar * chars);
+// O(log n)
+std::uint64_t base_power(std::size_t n);
+std::uint64_t inverse_base_power(std::size_t n);
+
+// For edits at either end of the content, the new hash follows from the old
+// one, hashing only what is inserted or erased.
+// @return true if the hash could be found this way, in which case it is
+//         updated
+bool hash_after_insertion(const std::u32string & content, std::size_t pos,
+                          const UChar * beg, const UChar * end,
+                          std::uint64_t & hash);
+bool hash_after_erasure(const std::u32string & content, std::size_t beg,
+                        std::size_t end, std::uint64_t & hash);
+
+// of content whose two parts hash to the given values
+std::uint64_t joined_hash(std::uint64_t front, std::uint64_t back,
+                          std::size_t back_length);
+
 class DefaultCodeModeler final : public CodeModeler {
     void reset_state() override {}
+    State save_state() const override { return State(); }
+    void restore_state(State) override {}
     Response update_model(UStringCIter itr, Cursor) override;
+    std::uint64_t model_version() const override { return 1; }
 };
 
 // assumes certain optimizations are present, which for supported platforms
@@ -58,22 +95,32 @@ CodeModeler::~CodeModeler() {}
 
 // ----------------------------------------------------------------------------
 
-TextLine::TextLine() {}
+TextLine::TextLine():
+    m_content(empty_content()),
+    m_needs_modeling(true),
+    m_hash(0),
+    m_hash_known(true)
+{}
 
 TextLine::TextLine(const TextLine & rhs):
-    m_content(rhs.m_content)
-{
-    m_image.copy_rendering_details(rhs.m_image);
-}
-
-TextLine::TextLine(TextLine && rhs):
+    m_content(rhs.m_content),
+    m_image(rhs.m_image),
+    m_needs_modeling(rhs.m_needs_modeling),
+    m_hash(rhs.m_hash),
+    m_hash_known(rhs.m_hash_known)
+{}
+
+TextLine::TextLine(TextLine && rhs) noexcept:
     TextLine()
 { swap(rhs); }
 
 /* explicit */ TextLine::TextLine(const std::u32string & content_):
-    m_content(content_)
+    m_content(std::make_shared<const std::u32string>(content_)),
+    m_hash(0),
+    m_hash_known(false)
 {
     verify_text_line_content_string("TextLine::TextLine", content_);
+    model_plainly();
 }
 
 TextLine & TextLine::operator = (const TextLine & rhs) {
@@ -84,17 +131,25 @@ TextLine & TextLine::operator = (const TextLine & rhs) {
     return *this;
 }
 
-TextLine & TextLine::operator = (TextLine && rhs) {
+TextLine & TextLine::operator = (TextLine && rhs) noexcept {
     if (&rhs != this) swap(rhs);
     return *this;
 }
 
-void TextLine::constrain_to_width(int target_width)
-    { m_image.constrain_to_width(target_width); }
+void TextLine::constrain_to_width(int target_width) {
+    if (target_width == m_image.width_constraint()) return;
+    m_image.constrain_to_width(target_width);
+    model_plainly();
+}
 
 void TextLine::set_content(const std::u32string & content_) {
     verify_text_line_content_string("TextLine::set_content", content_);
-    m_content = content_;
+    replace_content(std::u32string(content_));
+}
+
+void TextLine::set_content(std::u32string && content_) {
+    verify_text_line_content_string("TextLine::set_content", content_);
+    replace_content(std::move(content_));
 }
 
 void TextLine::assign_render_options(const RenderOptions & options)
@@ -108,9 +163,27 @@ void TextLine::assign_default_render_options()
 
 TextLine TextLine::split(int column) {
     verify_column_number("TextLine::split", column);
-    auto new_line = TextLine(m_content.substr(std::size_t(column)));
+    auto new_line = TextLine(m_content->substr(std::size_t(column)));
     new_line.m_image.copy_rendering_details(m_image);
-    m_content.erase(m_content.begin() + column, m_content.end());
+    new_line.model_plainly();
+    if (!m_hash_known) {
+        replace_content(m_content->substr(0, std::size_t(column)));
+        return new_line;
+    }
+    // only the shorter side is hashed, the other follows from the whole
+    const auto * beg = m_content->data();
+    const auto * mid = beg + column;
+    const auto * end = beg + m_content->size();
+    auto kept_hash = m_hash;
+    if (end - mid <= mid - beg) {
+        new_line.m_hash = hash_of(mid, end);
+        hash_after_erasure(*m_content, std::size_t(column), m_content->size(), kept_hash);
+    } else {
+        kept_hash = hash_of(beg, mid);
+        new_line.m_hash = sub_mod(m_hash, mul_mod(kept_hash, base_power(std::size_t(end - mid))));
+    }
+    new_line.m_hash_known = true;
+    replace_content(m_content->substr(0, std::size_t(column)), true, kept_hash);
     return new_line;
 }
 
@@ -118,33 +191,50 @@ int TextLine::push(int column, UChar uchr) {
     verify_column_number("TextLine::push", column);
     if (uchr == TextLines::NEW_LINE) return SPLIT_REQUESTED;
     verify_text("TextLine::push", uchr);
-    m_content.insert(m_content.begin() + column, 1, uchr);
+    auto hash_ = m_hash;
+    const bool hash_known = m_hash_known &&
+        hash_after_insertion(*m_content, std::size_t(column), &uchr, &uchr + 1, hash_);
+    auto content_ = *m_content;
+    content_.insert(content_.begin() + column, 1, uchr);
+    replace_content(std::move(content_), hash_known, hash_);
     return column + 1;
 }
 
 int TextLine::delete_ahead(int column) {
     verify_column_number("TextLine::delete_ahead", column);
-    if (column == int(m_content.size())) return MERGE_REQUESTED;
-    m_content.erase(m_content.begin() + column);
+    if (column == int(m_content->size())) return MERGE_REQUESTED;
+    auto hash_ = m_hash;
+    const bool hash_known = m_hash_known &&
+        hash_after_erasure(*m_content, std::size_t(column), std::size_t(column + 1), hash_);
+    auto content_ = *m_content;
+    content_.erase(content_.begin() + column);
+    replace_content(std::move(content_), hash_known, hash_);
     return column;
 }
 
 int TextLine::delete_behind(int column) {
     verify_column_number("TextLine::delete_behind", column);
     if (column == 0) return MERGE_REQUESTED;
-    m_content.erase(m_content.begin() + column - 1);
+    auto hash_ = m_hash;
+    const bool hash_known = m_hash_known &&
+        hash_after_erasure(*m_content, std::size_t(column - 1), std::size_t(column), hash_);
+    auto content_ = *m_content;
+    content_.erase(content_.begin() + column - 1);
+    replace_content(std::move(content_), hash_known, hash_);
     return column - 1;
 }
 
 void TextLine::take_contents_of
     (TextLine & other_line, ContentTakingPlacement place)
 {
+    const bool hash_known = m_hash_known && other_line.m_hash_known;
     if (place == PLACE_AT_END) {
-        m_content += other_line.content();
+        replace_content(*m_content + other_line.content(), hash_known,
+                        joined_hash(m_hash, other_line.m_hash, other_line.m_content->size()));
     } else {
         assert(place == PLACE_AT_BEGINING);
-        m_content.insert(m_content.begin(), other_line.content().begin(),
-                         other_line.content().end()                     );
+        replace_content(other_line.content() + *m_content, hash_known,
+                        joined_hash(other_line.m_hash, m_hash, m_content->size()));
     }
     other_line.wipe(0, other_line.content_length());
 }
@@ -152,8 +242,13 @@ void TextLine::take_contents_of
 int TextLine::wipe(int beg, int end) {
     verify_column_number("TextLine::wipe (for beg)", beg);
     verify_column_number("TextLine::wipe (for end)", end);
-    m_content.erase(m_content.begin() + beg, m_content.begin() + end);
-    return int(m_content.length());
+    auto hash_ = m_hash;
+    const bool hash_known = m_hash_known && beg <= end &&
+        hash_after_erasure(*m_content, std::size_t(beg), std::size_t(end), hash_);
+    auto content_ = *m_content;
+    content_.erase(content_.begin() + beg, content_.begin() + end);
+    replace_content(std::move(content_), hash_known, hash_);
+    return int(m_content->length());
 }
 
 void TextLine::copy_characters_from
@@ -161,7 +256,7 @@ void TextLine::copy_characters_from
 {
     verify_column_number("TextLine::copy_characters_from (for beg)", beg);
     verify_column_number("TextLine::copy_characters_from (for end)", end);
-    dest.append(m_content.begin() + beg, m_content.begin() + end);
+    dest.append(m_content->begin() + beg, m_content->begin() + end);
 }
 
 int TextLine::deposit_chatacters_to
@@ -178,31 +273,107 @@ int TextLine::deposit_chatacters_to
     verify_column_number("TextLine::deposit_chatacters_to", pos);
     verify_text("TextLine::deposit_chatacters_to", beg, end);
     if (beg == end) return pos;
-    m_content.insert(m_content.begin() + pos, beg, end);
+    auto hash_ = m_hash;
+    const bool hash_known = m_hash_known &&
+        hash_after_insertion(*m_content, std::size_t(pos), beg, end, hash_);
+    auto content_ = *m_content;
+    content_.insert(content_.begin() + pos, beg, end);
+    replace_content(std::move(content_), hash_known, hash_);
     return pos + int(end - beg);
 }
 
-void TextLine::swap(TextLine & other) {
+void TextLine::swap(TextLine & other) noexcept {
     m_content.swap(other.m_content);
     m_image  .swap(other.m_image  );
+    std::swap(m_needs_modeling, other.m_needs_modeling);
+    std::swap(m_hash          , other.m_hash          );
+    std::swap(m_hash_known    , other.m_hash_known    );
 }
 
-void TextLine::update_modeler(CodeModeler & modeler)
-    { m_image.update_modeler(modeler, m_content); }
+void TextLine::update_modeler(CodeModeler & modeler) {
+    m_image.update_modeler(modeler, *m_content);
+    m_needs_modeling = false;
+}
+
+void TextLine::update_modeler(CodeModeler & modeler, ModelCache & cache) {
+    m_image.update_modeler(modeler, *m_content, hash(), cache);
+    m_needs_modeling = false;
+}
+
+void TextLine::take_model_of(TextLineImage & image) {
+    m_image.take_model_of(image);
+    m_needs_modeling = false;
+}
 
 int TextLine::height_in_cells() const { return m_image.height_in_cells(); }
 
-const std::u32string & TextLine::content() const { return m_content; }
+const std::u32string & TextLine::content() const { return *m_content; }
 
 void TextLine::render_to(TargetTextGrid & target, int offset) const
-    { m_image.render_to(target, offset); }
+    { m_image.render_to(target, offset, *m_content); }
+
+std::uint64_t TextLine::hash() const {
+    if (!m_hash_known) {
+        m_hash       = hash_of(m_content->data(), m_content->data() + m_content->size());
+        m_hash_known = true;
+    }
+    return m_hash;
+}
+
+bool TextLine::has_same_content(const TextLine & other) const {
+    if (m_content == other.m_content) return true;
+    if (m_content->size() != other.m_content->size()) return false;
+    if (m_hash_known && other.m_hash_known && m_hash != other.m_hash)
+        return false;
+    return *m_content == *other.m_content;
+}
+
+/* static */ std::uint64_t TextLine::hash_of
+    (const UChar * beg, const UChar * end)
+{
+    // One is added so that no character counts as nothing. Four characters
+    // are taken at a time, so that only one full multiply is waited on for
+    // each step.
+    std::uint64_t hash_ = 0;
+    for (; end - beg >= 4; beg += 4)
+        hash_ = hash_four(hash_, beg);
+    for (; beg != end; ++beg)
+        hash_ = reduce(mul_mod(hash_, HASH_BASE) + std::uint64_t(*beg) + 1);
+    return hash_;
+}
 
 /* static */ void TextLine::run_tests() { run_text_line_tests(); }
 
+/* private */ void TextLine::model_plainly() {
+    // stands in for the real modeler's results until it has had a chance to
+    // look at this line again
+    m_image.update_modeler(CodeModeler::default_instance(), *m_content);
+    m_needs_modeling = true;
+}
+
+/* private */ void TextLine::replace_content(std::u32string && content_) {
+    m_content = content_.empty() ? empty_content() :
+                std::make_shared<const std::u32string>(std::move(content_));
+    // every empty line hashes the same
+    m_hash       = 0;
+    m_hash_known = m_content->empty();
+    model_plainly();
+}
+
+/* private */ void TextLine::replace_content
+    (std::u32string && content_, bool hash_known, std::uint64_t hash_)
+{
+    replace_content(std::move(content_));
+    if (!hash_known) return;
+    assert(hash_ == hash_of(m_content->data(), m_content->data() + m_content->size()));
+    m_hash       = hash_;
+    m_hash_known = true;
+}
+
 /* private */ void TextLine::verify_column_number
     (const char * callername, int column) const
 {
-    if (column > -1 && column <= int(m_content.size())) return;
+    if (column > -1 && column <= int(m_content->size())) return;
     throw std::invalid_argument
         (std::string(callername) + ": given column number is invalid.");
 }
@@ -226,6 +397,12 @@ void TextLine::render_to(TargetTextGrid & target, int offset) const
 
 namespace {
 
+const TextLine::SharedContent & empty_content() {
+    static const TextLine::SharedContent instance =
+        std::make_shared<const std::u32string>();
+    return instance;
+}
+
 void verify_text_line_content_string(const char * caller, const std::u32string & content) {
     if (content.find(TextLines::NEW_LINE) != std::u32string::npos ||
         content.find(           UChar(0)) != std::u32string::npos   )
@@ -235,6 +412,129 @@ void verify_text_line_content_string(const char * caller, const std::u32string &
     }
 }
 
+std::uint64_t reduce(std::uint64_t x) {
+    x = (x & HASH_MODULUS) + (x >> 61);
+    return x >= HASH_MODULUS ? x - HASH_MODULUS : x;
+}
+
+std::uint64_t add_mod(std::uint64_t a, std::uint64_t b) {
+    const auto sum = a + b;
+    return sum >= HASH_MODULUS ? sum - HASH_MODULUS : sum;
+}
+
+std::uint64_t sub_mod(std::uint64_t a, std::uint64_t b)
+    { return a >= b ? a - b : a + HASH_MODULUS - b; }
+
+#ifdef __SIZEOF_INT128__
+
+// (the marker keeps -pedantic from objecting to the extension)
+__extension__ typedef unsigned __int128 UInt128;
+
+// of any value under 2^125
+std::uint64_t reduce(UInt128 x)
+    { return reduce((std::uint64_t(x) & HASH_MODULUS) + reduce(std::uint64_t(x >> 61))); }
+
+std::uint64_t mul_mod(std::uint64_t a, std::uint64_t b)
+    { return reduce(UInt128(a)*b); }
+
+std::uint64_t hash_four(std::uint64_t hash, const UChar * chars) {
+    static const auto base_2 = mul_mod(HASH_BASE, HASH_BASE);
+    static const auto base_3 = mul_mod(base_2   , HASH_BASE);
+    static const auto base_4 = mul_mod(base_3   , HASH_BASE);
+    // under 2^123, reduced only once
+    return reduce(UInt128(hash)*base_4 +
+                  UInt128(std::uint64_t(chars[0]) + 1)*base_3 +
+                  UInt128(std::uint64_t(chars[1]) + 1)*base_2 +
+                  UInt128(std::uint64_t(chars[2]) + 1)*HASH_BASE +
+                  std::uint64_t(chars[3]) + 1);
+}
+
+#else
+
+std::uint64_t mul_mod(std::uint64_t a, std::uint64_t b) {
+    // in 32-bit halves
+    const std::uint64_t a_lo = a & 0xFFFFFFFFu, a_hi = a >> 32;
+    const std::uint64_t b_lo = b & 0xFFFFFFFFu, b_hi = b >> 32;
+    const std::uint64_t lo  = a_lo*b_lo;
+    const std::uint64_t mid = a_lo*b_hi + a_hi*b_lo;
+    const std::uint64_t hi  = a_hi*b_hi;
+    // 2^61 = 1 and so 2^64 = 8, mid is taken as mid*2^32 split at 2^61
+    auto rv = (lo & HASH_MODULUS) + (lo >> 61) + (hi << 3) + (mid >> 29) +
+              ((mid << 35) >> 3);
+    return reduce(reduce(rv));
+}
+
+std::uint64_t hash_four(std::uint64_t hash, const UChar * chars) {
+    static const auto base_2 = mul_mod(HASH_BASE, HASH_BASE);
+    static const auto base_3 = mul_mod(base_2   , HASH_BASE);
+    static const auto base_4 = mul_mod(base_3   , HASH_BASE);
+    // a character's term (at most 2^32) by a power, left under 2^62 + 2^35
+    auto small_mul_mod = [](std::uint64_t small, std::uint64_t b) {
+        const std::uint64_t hi = small*(b >> 32);
+        const std::uint64_t lo = small*(b & 0xFFFFFFFFu);
+        return (hi >> 29) + ((hi & 0x1FFFFFFFu) << 32) + (lo & HASH_MODULUS) + (lo >> 61);
+    };
+    return reduce(mul_mod(hash, base_4) +
+                  small_mul_mod(std::uint64_t(chars[0]) + 1, base_3   ) +
+                  small_mul_mod(std::uint64_t(chars[1]) + 1, base_2   ) +
+                  small_mul_mod(std::uint64_t(chars[2]) + 1, HASH_BASE) +
+                  std::uint64_t(chars[3]) + 1);
+}
+
+#endif
+
+std::uint64_t power_mod(std::uint64_t base, std::uint64_t exponent) {
+    std::uint64_t rv = 1;
+    for (; exponent; exponent >>= 1) {
+        if (exponent & 1) rv = mul_mod(rv, base);
+        base = mul_mod(base, base);
+    }
+    return rv;
+}
+
+std::uint64_t base_power(std::size_t n) { return power_mod(HASH_BASE, n); }
+
+std::uint64_t inverse_base_power(std::size_t n) {
+    // by Fermat's little theorem
+    static const auto inverse = power_mod(HASH_BASE, HASH_MODULUS - 2);
+    return power_mod(inverse, n);
+}
+
+bool hash_after_insertion(const std::u32string & content, std::size_t pos,
+                          const UChar * beg, const UChar * end,
+                          std::uint64_t & hash)
+{
+    const auto inserted = TextLine::hash_of(beg, end);
+    if (pos == content.size()) {
+        hash = joined_hash(hash, inserted, std::size_t(end - beg));
+    } else if (pos == 0) {
+        hash = joined_hash(inserted, hash, content.size());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool hash_after_erasure(const std::u32string & content, std::size_t beg,
+                        std::size_t end, std::uint64_t & hash)
+{
+    const auto * data = content.data();
+    if (end == content.size()) {
+        const auto erased = TextLine::hash_of(data + beg, data + end);
+        hash = mul_mod(sub_mod(hash, erased), inverse_base_power(end - beg));
+    } else if (beg == 0) {
+        const auto erased = TextLine::hash_of(data, data + end);
+        hash = sub_mod(hash, mul_mod(erased, base_power(content.size() - end)));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::uint64_t joined_hash(std::uint64_t front, std::uint64_t back,
+                          std::size_t back_length)
+    { return add_mod(mul_mod(front, base_power(back_length)), back); }
+
 CodeModeler::Response DefaultCodeModeler::update_model(UStringCIter itr, Cursor) {
     bool is_ws = is_whitespace(*itr);
     for (; *itr && is_ws == is_whitespace(*itr); ++itr) {}
@@ -291,6 +591,61 @@ void run_text_line_tests() {
         line->update_modeler(CodeModeler::default_instance());
     assert(tline.content() == U"0123456789" && otline.content_length() == 0);
     }
+    // hashes kept by edits match those of the whole content
+    {
+    unsigned seed = 11;
+    auto next_random = [&seed](unsigned limit) {
+        seed = seed*1103515245u + 12345u;
+        return int((seed >> 8) % limit);
+    };
+    auto hash_of = [](const std::u32string & str)
+        { return TextLine::hash_of(str.data(), str.data() + str.size()); };
+    TextLine tline(U"hashed");
+    TextLine other;
+    const std::u32string inserts = U"ab c\tλ";
+    for (int i = 0; i != 2000; ++i) {
+        const int length = tline.content_length();
+        // edits at either end more often than not
+        const int end_pos = next_random(2) ? length : 0;
+        const int pos = next_random(3) ? end_pos : next_random(unsigned(length + 1));
+        switch (next_random(7)) {
+        case 0: tline.push(pos, inserts[std::size_t(next_random(6))]); break;
+        case 1: if (pos != length) tline.delete_ahead(pos); break;
+        case 2: if (pos != 0) tline.delete_behind(pos); break;
+        case 3:
+            tline.deposit_chatacters_to(inserts.data(), inserts.data() +
+                                        next_random(7), pos);
+            break;
+        case 4:
+            tline.wipe(next_random(2) ? 0 : pos, next_random(2) ? length : pos);
+            break;
+        case 5:
+            other = tline.split(pos);
+            assert(other.hash() == hash_of(other.content()));
+            break;
+        case 6:
+            tline.take_contents_of(other, next_random(2) ?
+                TextLine::PLACE_AT_END : TextLine::PLACE_AT_BEGINING);
+            assert(other.hash() == 0);
+            break;
+        }
+        assert(tline.hash() == hash_of(tline.content()));
+        if (tline.content_length() > 200) tline.wipe(0, 100);
+    }
+    }
+    // equal content, equal hashes, wherever it came from
+    {
+    TextLine a(U"local x = 1");
+    TextLine b;
+    for (auto uchr : std::u32string(U"local x = 1")) b.push(b.content_length(), uchr);
+    TextLine c(U"local x = 2");
+    assert(a.hash() == b.hash() && a.has_same_content(b));
+    assert(a.hash() != c.hash() && !a.has_same_content(c));
+    assert(TextLine(U"ab").hash() != TextLine(U"ba").hash());
+    assert(TextLine().hash() == 0 && TextLine(U"").hash() == 0);
+    TextLine copy(a);
+    assert(copy.has_same_content(a) && copy.hash() == a.hash());
+    }
     // wipe
     // copy_characters_from
     // deposit_chatacters_to
@@ -30,6 +30,7 @@
 #include <string>
 #include <stdexcept>
 #include <memory>
+#include <cstdint>
 
 #pragma once
 
@@ -42,19 +43,25 @@ public:
     static constexpr const int NO_LINE_NUMBER  = -1;
     using UStringCIter = std::u32string::const_iterator;
     using UStrIteratorPair = IteratorPair<UStringCIter>;
+    /** Content is never changed in place, every edit makes a new string, so
+     *  that it may be shared with snapshots (and other threads).
+     */
+    using SharedContent = std::shared_ptr<const std::u32string>;
     TextLine();
     TextLine(const TextLine &);
-    TextLine(TextLine &&);
+    // never throws, so that vectors of lines move rather than copy them
+    TextLine(TextLine &&) noexcept;
     explicit TextLine(const std::u32string &);
 
     TextLine & operator = (const TextLine &);
-    TextLine & operator = (TextLine &&);
+    TextLine & operator = (TextLine &&) noexcept;
 
     // -------------------------- TextLine Settings ---------------------------
 
     void constrain_to_width(int);
 
     void set_content(const std::u32string &);
+    void set_content(std::u32string &&);
     /** @warning Does not in anyway maintain ownership over the given object
      *           reference. Given object must survive the life of this object.
      */
@@ -79,9 +86,15 @@ public:
 
     int deposit_chatacters_to(const UChar * beg, const UChar * end, int pos);
 
-    void swap(TextLine &);
+    void swap(TextLine &) noexcept;
 
     void update_modeler(CodeModeler &);
+    void update_modeler(CodeModeler &, ModelCache &);
+
+    /** Takes the tokens of an image modeled elsewhere (for instance on
+     *  another thread) for this line's current content.
+     */
+    void take_model_of(TextLineImage &);
 
     // ----------------------- single character editing -----------------------
 
@@ -96,15 +109,47 @@ public:
 
     int height_in_cells() const;
     const std::u32string & content() const;
+    const SharedContent & shared_content() const { return m_content; }
     int content_length() const { return int(content().length()); }
+    /** A 64-bit hash of the content, the same as hash_of gives for it. It is
+     *  kept up to date by edits at either end of the line (pushing and
+     *  deleting at the end, splitting, merging and wiping from either end),
+     *  any other edit has it recomputed when next asked for.
+     */
+    std::uint64_t hash() const;
+    /** O(1) if the contents are shared, or their hashes differ. */
+    bool has_same_content(const TextLine &) const;
+    /** @returns true if this line has changed since it was last modeled, in
+     *           which case it is rendered with plain default coloring.
+     */
+    bool needs_modeling() const { return m_needs_modeling; }
+    CodeModeler::State modeler_entry_state() const
+        { return m_image.modeler_entry_state(); }
+    CodeModeler::State modeler_exit_state() const
+        { return m_image.modeler_exit_state(); }
+    /** @return the line's model, as it was last modeled (or taken) */
+    const TextLineImage & image() const { return m_image; }
 
     void render_to(TargetTextGrid &, int offset) const;
 
+    /** A polynomial hash, modulo the prime 2^61 - 1, of the given characters.
+     *  Hashes are equal for equal content wherever they come from (a line,
+     *  a snapshot, a string read from a file).
+     */
+    static std::uint64_t hash_of(const UChar * beg, const UChar * end);
+
     static void run_tests();
 private:
+    void model_plainly();
+    void replace_content(std::u32string &&);
+    // with its hash, if it is known
+    void replace_content(std::u32string &&, bool hash_known, std::uint64_t hash_);
     void verify_column_number(const char * callername, int) const;
     void verify_text(const char * callername, UChar) const;
     void verify_text(const char * callername, const UChar *, const UChar *) const;
-    std::u32string m_content;
+    SharedContent m_content;
     TextLineImage m_image;
+    bool m_needs_modeling;
+    mutable std::uint64_t m_hash;
+    mutable bool m_hash_known;
 };
@@ -20,8 +20,11 @@
 *****************************************************************************/
 
 #include "TextLineImage.hpp"
+#include "ModelCache.hpp"
 
 #include <limits>
+#include <vector>
+#include <algorithm>
 
 #include <cassert>
 
@@ -38,13 +41,22 @@ TextLineImage::TextLineImage():
     m_line_number(NO_LINE_NUMBER)
 {}
 
-TextLineImage::TextLineImage(TextLineImage && rhs) { swap(rhs); }
+TextLineImage::TextLineImage(TextLineImage && rhs) noexcept:
+    TextLineImage()
+{ swap(rhs); }
 
-TextLineImage & TextLineImage::operator = (TextLineImage && rhs) {
+TextLineImage & TextLineImage::operator = (TextLineImage && rhs) noexcept {
     swap(rhs);
     return *this;
 }
 
+bool TextLineImage::operator == (const TextLineImage & rhs) const {
+    return m_grid_width == rhs.m_grid_width &&
+           m_extra_end_space == rhs.m_extra_end_space &&
+           m_row_ranges == rhs.m_row_ranges && m_tokens == rhs.m_tokens &&
+           m_entry_state == rhs.m_entry_state && m_exit_state == rhs.m_exit_state;
+}
+
 void TextLineImage::update_modeler
     (CodeModeler & modeler, const std::u32string & string)
 {
@@ -55,32 +67,36 @@ void TextLineImage::update_modeler
     (CodeModeler & modeler, UStringCIter beg, UStringCIter end)
 {
     clear_image();
+    m_entry_state = modeler.save_state();
     int working_width = m_grid_width;
     for (UStringCIter itr = beg; itr != end;) {
         assert(*itr);
         assert(itr != end);
         int col = int(itr - beg);
         const auto resp = modeler.update_model(itr, Cursor(m_line_number, col));
-        const auto seq_len = resp.next - itr;
+        const auto seq_len = int(resp.next - itr);
+        const auto next_col = int(resp.next - beg);
         assert(seq_len != 0);
 
         // forced split
         if (seq_len > m_grid_width) {
-            working_width = handle_hard_wraps(resp, itr, working_width);
+            working_width = handle_hard_wraps
+                (resp.token_type, col, next_col, working_width);
         }
         // split
         else if (resp.always_hardwrap && seq_len > working_width) {
-            working_width = handle_hard_wraps(resp, itr, working_width);
+            working_width = handle_hard_wraps
+                (resp.token_type, col, next_col, working_width);
         }
         // flow over
         else if (!resp.always_hardwrap && seq_len > working_width) {
-            m_row_ranges.push_back(itr);
-            m_tokens.emplace_back(resp.token_type, itr, resp.next);
-            working_width = m_grid_width - int(seq_len);
+            m_row_ranges.push_back(col);
+            m_tokens.emplace_back(resp.token_type, col, next_col);
+            working_width = m_grid_width - seq_len;
         }
         // regular write
         else {
-            m_tokens.emplace_back(resp.token_type, itr, resp.next);
+            m_tokens.emplace_back(resp.token_type, col, next_col);
             working_width -= seq_len;
         }
         itr = resp.next;
@@ -88,14 +104,31 @@ void TextLineImage::update_modeler
     static const std::u32string NEW_LINE = U"\n";
     modeler.update_model(NEW_LINE.begin(),
                          Cursor(m_line_number, int(end - beg)));
+    m_exit_state = modeler.save_state();
     m_extra_end_space = (working_width == 0) ? 1 : 0;
     check_invarients();
 }
 
+void TextLineImage::update_modeler
+    (CodeModeler & modeler, const std::u32string & string,
+     std::uint64_t content_hash, ModelCache & cache)
+{
+    const auto * cached = cache.find
+        (content_hash, string, modeler.save_state(), m_grid_width);
+    if (cached) {
+        copy_model_of(*cached);
+        modeler.restore_state(m_exit_state);
+        return;
+    }
+    update_modeler(modeler, string);
+    cache.insert(content_hash, string, *this);
+}
+
 void TextLineImage::clear_image() {
     m_tokens.clear();
     m_row_ranges.clear();
     m_extra_end_space = 0;
+    m_entry_state = m_exit_state = CodeModeler::State();
 }
 
 int TextLineImage::height_in_cells() const {
@@ -106,7 +139,9 @@ void TextLineImage::assign_render_options(const RenderOptions & options) {
     m_rendering_options = &options;
 }
 
-void TextLineImage::render_to(TargetTextGrid & target, int offset) const {
+void TextLineImage::render_to
+    (TargetTextGrid & target, int offset, const std::u32string & content) const
+{
     if (m_grid_width != target.width()) {
         throw std::runtime_error(
             "TextLine::render_to: TextLine::constrain_to_width must be "
@@ -118,34 +153,34 @@ void TextLineImage::render_to(TargetTextGrid & target, int offset) const {
         return;
     }
 
-    using IterPairIter = decltype (m_tokens.begin());
+    assert(m_tokens.back().end <= int(content.length()));
     auto process_row_ =
-        [this, &target, &offset]
-        (IterPairIter word_itr, UStringCIter end)
-    { return render_row(target, offset, word_itr, end); };
+        [this, &target, &offset, &content]
+        (TokenInfoCIter word_itr, int end)
+    { return render_row(target, offset, word_itr, end, content); };
 
     const int original_offset_c = offset;
-    auto row_begin = m_tokens.front().pair.begin();
-    auto cur_word_range = m_tokens.begin();
+    TokenInfoCIter cur_word_range = m_tokens.begin();
     for (auto row_end : m_row_ranges) {
         // do stuff with range
         cur_word_range = process_row_(cur_word_range, row_end);
         ++offset;
-        row_begin = row_end;
     }
-    cur_word_range = process_row_(cur_word_range, m_tokens.back().pair.end());
+    cur_word_range = process_row_(cur_word_range, m_tokens.back().end);
     ++offset;
     assert(cur_word_range == m_tokens.end());
     render_end_space(target, original_offset_c);
 }
 
-void TextLineImage::swap(TextLineImage & other) {
+void TextLineImage::swap(TextLineImage & other) noexcept {
     std::swap(m_grid_width, other.m_grid_width);
     std::swap(m_extra_end_space, other.m_extra_end_space);
     m_row_ranges.swap(other.m_row_ranges);
     std::swap(m_rendering_options, other.m_rendering_options);
     std::swap(m_line_number, other.m_line_number);
     m_tokens.swap(other.m_tokens);
+    std::swap(m_entry_state, other.m_entry_state);
+    std::swap(m_exit_state , other.m_exit_state );
 
     check_invarients();
     other.check_invarients();
@@ -157,6 +192,24 @@ void TextLineImage::copy_rendering_details(const TextLineImage & rhs) {
     check_invarients();
 }
 
+void TextLineImage::take_model_of(TextLineImage & rhs) {
+    if (rhs.m_grid_width != m_grid_width) {
+        throw std::invalid_argument("TextLineImage::take_model_of: other "
+                                    "image was modeled for a different width.");
+    }
+    std::swap(m_extra_end_space, rhs.m_extra_end_space);
+    m_row_ranges.swap(rhs.m_row_ranges);
+    m_tokens.swap(rhs.m_tokens);
+    std::swap(m_entry_state, rhs.m_entry_state);
+    std::swap(m_exit_state , rhs.m_exit_state );
+    check_invarients();
+}
+
+void TextLineImage::copy_model_of(const TextLineImage & rhs) {
+    TextLineImage temp(rhs);
+    take_model_of(temp);
+}
+
 void TextLineImage::constrain_to_width(int target_width) {
     if (target_width < 1) {
         throw std::invalid_argument("TextLineImage::constrain_to_width: "
@@ -176,32 +229,106 @@ void TextLineImage::set_line_number(int line_number) {
     check_invarients();
 }
 
+bool TextLineImage::pack_model
+    (std::vector<PackedToken> & tokens, std::vector<std::uint32_t> & rows) const
+{
+    int last_end = 0;
+    for (const auto & token : m_tokens) {
+        if (token.begin != last_end) return false;
+        last_end = token.end;
+    }
+    for (const auto & token : m_tokens) {
+        tokens.push_back(PackedToken
+            { std::uint32_t(token.end), std::int32_t(token.type) });
+    }
+    for (auto row : m_row_ranges)
+        rows.push_back(std::uint32_t(row));
+    return true;
+}
+
+bool TextLineImage::unpack_model
+    (const PackedToken * tokens_beg, const PackedToken * tokens_end,
+     const std::uint32_t * rows_beg, const std::uint32_t * rows_end,
+     bool extra_end_space, int content_length,
+     CodeModeler::State entry_state, CodeModeler::State exit_state)
+{
+    const auto length = std::uint32_t(std::max(content_length, 0));
+    const auto width  = std::uint32_t(m_grid_width);
+    // tokens must cover the content exactly, in order
+    std::uint32_t last_end = 0;
+    for (auto itr = tokens_beg; itr != tokens_end; ++itr) {
+        if (itr->end < last_end || itr->end > length) return false;
+        last_end = itr->end;
+    }
+    if (last_end != length) return false;
+    // and each row must begin on a token's end, and fit in the width
+    std::uint32_t row_begin = 0;
+    auto token_itr = tokens_beg;
+    for (auto itr = rows_beg; itr != rows_end; ++itr) {
+        if (*itr <= row_begin || *itr >= length || *itr - row_begin > width)
+            return false;
+        while (token_itr != tokens_end && token_itr->end < *itr) ++token_itr;
+        if (token_itr == tokens_end || token_itr->end != *itr) return false;
+        row_begin = *itr;
+    }
+    if (length - row_begin > width) return false;
+
+    m_tokens.clear();
+    m_tokens.reserve(std::size_t(tokens_end - tokens_beg));
+    last_end = 0;
+    for (auto itr = tokens_beg; itr != tokens_end; ++itr) {
+        m_tokens.emplace_back(int(itr->type), int(last_end), int(itr->end));
+        last_end = itr->end;
+    }
+    m_row_ranges.assign(rows_beg, rows_end);
+    m_extra_end_space = extra_end_space ? 1 : 0;
+    m_entry_state = entry_state;
+    m_exit_state  = exit_state;
+    check_invarients();
+    return true;
+}
+
+std::size_t TextLineImage::model_memory_usage() const {
+    return m_tokens.capacity()*sizeof(TokenInfo) +
+           m_row_ranges.capacity()*sizeof(int);
+}
+
 /* static */ void TextLineImage::run_tests() { run_text_line_image_tests(); }
 
 /* private */ TextLineImage::TokenInfoCIter TextLineImage::render_row
     (TargetTextGrid & target, int offset, TokenInfoCIter word_itr,
-     UStringCIter row_end) const
+     int row_end, const std::u32string & content) const
 {
     if (offset >= target.height()) {
         return m_tokens.end();
     } else if (offset < 0) {
         for (; word_itr != m_tokens.end(); ++word_itr) {
-            if (!word_itr->pair.is_behind(row_end)) break;
+            if (!word_itr->is_behind(row_end)) break;
         }
         return word_itr;
     }
     Cursor write_pos(offset, 0);
     assert(word_itr >= m_tokens.begin() && word_itr < m_tokens.end());
+    // highlights are walked alongside the columns, rather than looked up for
+    // each character
+    const auto highlights = m_rendering_options->highlights_on(m_line_number);
+    auto highlight_itr = highlights.begin();
     for (; word_itr != m_tokens.end(); ++word_itr) {
-        if (!word_itr->pair.is_behind(row_end)) break;
-        assert(word_itr->pair.begin() <= word_itr->pair.end());
+        if (!word_itr->is_behind(row_end)) break;
+        assert(word_itr->begin <= word_itr->end);
         auto color_pair = m_rendering_options->get_pair_for_token_type(word_itr->type);
-        for (const auto & chr : word_itr->pair) {
+        for (int col = word_itr->begin; col != word_itr->end; ++col) {
             assert(write_pos.column < m_grid_width);
-            auto content_begin = &*m_tokens.front().pair.begin();
-            Cursor text_pos(m_line_number, int(&chr - content_begin));
-            auto char_cpair = m_rendering_options->
-                color_adjust_for(text_pos)(color_pair);
+            UChar chr = content[std::size_t(col)];
+            Cursor text_pos(m_line_number, col);
+            auto char_cpair = color_pair;
+            while (highlight_itr != highlights.end() &&
+                   highlight_itr->end.column <= col)
+            { ++highlight_itr; }
+            if (highlight_itr != highlights.end() &&
+                highlight_itr->begin.column <= col)
+            { char_cpair = RenderOptions::highlight(char_cpair); }
+            char_cpair = m_rendering_options->color_adjust_for(text_pos)(char_cpair);
             target.set_cell(write_pos, chr, char_cpair);
             if (chr == U'\t')
                 write_pos.column += m_rendering_options->tab_width();
@@ -231,14 +358,14 @@ void TextLineImage::set_line_number(int line_number) {
     Cursor write_pos(offset + height_in_cells() - 1, 0);
     int content_len = 0;
     if (!m_tokens.empty())
-        content_len = int(m_tokens.back().pair.end() - m_tokens.front().pair.begin());
+        content_len = m_tokens.back().end;
     assert(content_len >= 0);
     if (m_extra_end_space == 1) {
         write_pos.column = 0;
     } else if (m_row_ranges.empty()) {
         write_pos.column = content_len;
     } else {
-        write_pos.column = int(m_tokens.back().pair.end() - m_row_ranges.back());
+        write_pos.column = m_tokens.back().end - m_row_ranges.back();
     }
     if (write_pos.line >= target.height() || write_pos.line < 0) return;
     auto color_pair = m_rendering_options->get_default_pair();
@@ -250,22 +377,22 @@ void TextLineImage::set_line_number(int line_number) {
 }
 
 /* private */ int TextLineImage::handle_hard_wraps
-    (const CodeModeler::Response & resp, UStringCIter itr, int working_width)
+    (int token_type, int beg, int end, int working_width)
 {
-    assert(resp.next - itr > working_width);
+    assert(end - beg > working_width);
     const auto grid_width_c = m_grid_width;
-    auto mid = itr + working_width;
+    auto mid = beg + working_width;
     while (true) {
-        m_tokens.emplace_back(resp.token_type, itr, mid);
+        m_tokens.emplace_back(token_type, beg, mid);
         m_row_ranges.push_back(mid);
-        itr = mid;
-        if (resp.next - mid > grid_width_c)
+        beg = mid;
+        if (end - mid > grid_width_c)
             mid += grid_width_c;
         else
             break;
     }
-    m_tokens.emplace_back(resp.token_type, mid, resp.next);
-    return m_grid_width - int(resp.next - mid);
+    m_tokens.emplace_back(token_type, mid, end);
+    return m_grid_width - (end - mid);
 }
 
 /* private */ void TextLineImage::check_invarients() const {
@@ -280,7 +407,7 @@ void TextLineImage::set_line_number(int line_number) {
             assert(last < *itr);
             assert(*itr - last <= m_grid_width);
             while (word_itr != m_tokens.end()) {
-                if (word_itr->pair.is_behind(*itr)) {
+                if (word_itr->is_behind(*itr)) {
                     ++word_itr;
                     continue;
                 } else {
@@ -295,7 +422,7 @@ void TextLineImage::set_line_number(int line_number) {
         auto last = m_tokens.front();
         auto itr  = m_tokens.begin() + 1;
         for (; itr != m_tokens.end(); ++itr) {
-            assert(last.pair.is_behind(itr->pair));
+            assert(last.is_behind(itr->begin));
             last = *itr;
         }
     }
@@ -303,8 +430,45 @@ void TextLineImage::set_line_number(int line_number) {
 
 namespace {
 
-void run_text_line_image_tests() {
+// remembers the back color written to each cell of one row
+class RowRecorder final : public TargetTextGrid {
+public:
+    explicit RowRecorder(int width_): m_backs(std::size_t(width_)) {}
+    int width () const override { return int(m_backs.size()); }
+    int height() const override { return 1; }
+    void set_cell(Cursor cursor, UChar, ColorPair pair) override
+        { m_backs.at(std::size_t(cursor.column)) = pair.back; }
+    bool is_highlighted(int column) const {
+        return m_backs.at(std::size_t(column)) ==
+               RenderOptions::highlight(ColorPair()).back;
+    }
+private:
+    std::vector<sf::Color> m_backs;
+};
 
+void run_text_line_image_tests() {
+    // search highlights are drawn over exactly their columns
+    {
+    static const std::u32string content = U"local a = b.c + b.c";
+    RenderOptions options;
+    options.set_highlights({ CursorRange(Cursor(2, 10), Cursor(2, 13)),
+                             CursorRange(Cursor(3, 16), Cursor(4, 2)),
+                             CursorRange(Cursor(4, 16), Cursor(4, 19)) });
+    assert(options.highlights_on(0).begin() == options.highlights_on(0).end());
+    TextLineImage image;
+    image.assign_render_options(options);
+    image.constrain_to_width(30);
+    image.update_modeler(CodeModeler::default_instance(), content);
+    for (int line : { 0, 4 }) {
+        image.set_line_number(line);
+        RowRecorder recorder(30);
+        image.render_to(recorder, 0, content);
+        for (int col = 0; col != int(content.size()); ++col) {
+            bool expected = line == 4 && (col < 2 || col >= 16);
+            assert(recorder.is_highlighted(col) == expected);
+        }
+    }
+    }
 }
 
 } // end of <anonymous> namespace
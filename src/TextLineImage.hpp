@@ -26,6 +26,7 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 
 // multi line "objects" make this especially difficult...
 // namely C's multiline comments, Lua's multiline strings
@@ -38,6 +39,20 @@ public:
         int token_type;
         bool always_hardwrap;
     };
+    /** A compact copy of everything a modeler carries over from one line to
+     *  the next. It only means something to the kind of modeler that saved
+     *  it. By convention, a default constructed state is the reset state.
+     */
+    class State {
+    public:
+        State(): m_value(0) {}
+        explicit State(std::uint64_t value_): m_value(value_) {}
+        bool operator == (const State & rhs) const { return m_value == rhs.m_value; }
+        bool operator != (const State & rhs) const { return m_value != rhs.m_value; }
+        std::uint64_t value() const { return m_value; }
+    private:
+        std::uint64_t m_value;
+    };
     // token type's returned by the default instance
     static constexpr const int REGULAR_SEQUENCE   = 0;
     static constexpr const int LEADING_WHITESPACE = 1;
@@ -45,24 +60,57 @@ public:
     static CodeModeler & default_instance();
     virtual ~CodeModeler();
     virtual void reset_state() = 0;
+    virtual State save_state() const = 0;
+    virtual void restore_state(State) = 0;
     virtual Response update_model(UStringCIter, Cursor) = 0;
+    /** Identifies the kind of modeler, and how it models lines, for models
+     *  kept beyond the life of the program (see ModelStore). It must change
+     *  whenever the tokens, rows or states given for some line change.
+     */
+    virtual std::uint64_t model_version() const = 0;
+
+    bool state_equals(State rhs) const { return save_state() == rhs; }
+    /** @return true if the modeler is in the same state reset_state leaves it
+     *          in, that is, nothing carries over into the next line
+     */
+    bool is_in_reset_state() const { return state_equals(State()); }
 };
 
+class ModelCache;
+
 class TextLineImage {
 public:
     static constexpr const int NO_LINE_NUMBER  = -1;
     using UStringCIter = std::u32string::const_iterator;
+    /** A token as it is kept outside of an image (see ModelStore), each
+     *  begins where the one before it ends, and the first at column zero.
+     */
+    struct PackedToken {
+        std::uint32_t end;
+        std::int32_t  type;
+    };
     TextLineImage();
-    TextLineImage(const TextLineImage &) = delete;
-    TextLineImage(TextLineImage &&);
+    TextLineImage(const TextLineImage &) = default;
+    TextLineImage(TextLineImage &&) noexcept;
 
-    TextLineImage & operator = (const TextLineImage &) = delete;
-    TextLineImage & operator = (TextLineImage &&);
+    TextLineImage & operator = (const TextLineImage &) = default;
+    TextLineImage & operator = (TextLineImage &&) noexcept;
 
     ~TextLineImage() {}
 
+    /** Compares only tokens, rows and width (not rendering details). */
+    bool operator == (const TextLineImage &) const;
+    bool operator != (const TextLineImage & rhs) const
+        { return !(*this == rhs); }
+
     void update_modeler(CodeModeler &, const std::u32string &);
     void update_modeler(CodeModeler &, UStringCIter, UStringCIter);
+    /** Same as update_modeler, except that the cache is consulted first, on a
+     *  hit the modeler is not run but left in the cached exit state.
+     *  @param content_hash the string's hash, as TextLine::hash_of gives
+     */
+    void update_modeler(CodeModeler &, const std::u32string &,
+                        std::uint64_t content_hash, ModelCache &);
     void clear_image();
     int height_in_cells() const;
 
@@ -71,45 +119,89 @@ public:
      */
     void assign_render_options(const RenderOptions &);
 
-    void render_to(TargetTextGrid &, int offset) const;
-    void swap(TextLineImage &);
+    /** @param content must be the same string (by value) that this image was
+     *                 last modeled with.
+     */
+    void render_to(TargetTextGrid &, int offset, const std::u32string & content) const;
+    void swap(TextLineImage &) noexcept;
     void copy_rendering_details(const TextLineImage & rhs);
+    /** Takes only the tokens and rows of another image, which must have been
+     *  modeled for the same width. Rendering details are left untouched.
+     */
+    void take_model_of(TextLineImage &);
+    /** Same as take_model_of, but leaves the other image untouched. */
+    void copy_model_of(const TextLineImage &);
     void constrain_to_width(int target_width);
     void set_line_number(int line_number);
+    int width_constraint() const { return m_grid_width; }
+
+    // states of the modeler before and after it was last run over the line
+    CodeModeler::State modeler_entry_state() const { return m_entry_state; }
+    CodeModeler::State modeler_exit_state () const { return m_exit_state ; }
+
+    /** Appends the model's tokens, and the columns where each row (after
+     *  the first) begins, if the tokens follow one another without gaps (as
+     *  update_modeler leaves them).
+     *  @return false (appending nothing) if they do not
+     */
+    bool pack_model(std::vector<PackedToken> & tokens,
+                    std::vector<std::uint32_t> & rows) const;
+    bool has_extra_end_space() const { return m_extra_end_space == 1; }
+
+    /** Replaces the model with one packed by pack_model, for this image's
+     *  width. The packed model is checked, as it may come from a file.
+     *  @param content_length of the content the model is for
+     *  @return false (leaving the model as it was) if the packed model could
+     *          not have been laid out for this width over that content
+     */
+    bool unpack_model
+        (const PackedToken * tokens_beg, const PackedToken * tokens_end,
+         const std::uint32_t * rows_beg, const std::uint32_t * rows_end,
+         bool extra_end_space, int content_length,
+         CodeModeler::State entry_state, CodeModeler::State exit_state);
+
+    /** @return bytes of heap memory held for the tokens and rows */
+    std::size_t model_memory_usage() const;
 
     static void run_tests();
 private:
-    using UStrIteratorPair = IteratorPair<UStringCIter>;
+    // tokens and rows are kept as column numbers rather than iterators, so
+    // that an image is independent of where its content string lives
     struct TokenInfo {
-        TokenInfo(): type(0) {}
-        TokenInfo(int type_, UStrIteratorPair pair_): type(type_), pair(pair_) {}
-        TokenInfo(int type_, UStringCIter beg, UStringCIter end):
-            type(type_), pair(beg, end)
+        TokenInfo(): type(0), begin(0), end(0) {}
+        TokenInfo(int type_, int beg_, int end_):
+            type(type_), begin(beg_), end(end_)
         {}
+        bool is_behind(int column) const noexcept { return end <= column; }
+        bool operator == (const TokenInfo & rhs) const noexcept
+            { return type == rhs.type && begin == rhs.begin && end == rhs.end; }
         int type;
-        UStrIteratorPair pair;
+        int begin;
+        int end;
     };
     using TokenInfoCIter = std::vector<TokenInfo>::const_iterator;
 
     TokenInfoCIter render_row
         (TargetTextGrid & target, int offset, TokenInfoCIter word_itr,
-         UStringCIter row_end) const;
+         int row_end, const std::u32string & content) const;
     void fill_row_with_blanks(TargetTextGrid &, Cursor write_pos) const;
     void render_end_space(TargetTextGrid &, int offset) const;
-    int handle_hard_wraps
-        (const CodeModeler::Response &, UStringCIter, int working_width);
+    int handle_hard_wraps(int token_type, int beg, int end, int working_width);
     void check_invarients() const;
     int m_grid_width;
     // required for edge case were all cells on the last row are occupied by
     // content, and therefore needing an extra space on the next so that the
     // user can type text at the end of the line
     int m_extra_end_space;
-    // does not contain iterators begin and end in m_content
-    std::vector<UStringCIter> m_row_ranges;
+    // columns where each row (after the first) begins
+    std::vector<int> m_row_ranges;
 
     const RenderOptions * m_rendering_options;
 
     int m_line_number;
 
     std::vector<TokenInfo> m_tokens;
+
+    CodeModeler::State m_entry_state;
+    CodeModeler::State m_exit_state;
 };
@@ -20,30 +20,107 @@
 *****************************************************************************/
 
 #include "TextLines.hpp"
+#include "LuaCodeModeler.hpp"
+#include "ModelCache.hpp"
+#include "ThreadPool.hpp"
 
 #include <limits>
 #include <stdexcept>
 #include <iostream>
 #include <functional>
+#include <algorithm>
+#include <iterator>
 
 #include <cassert>
 
 namespace {
 
+// content is only split across threads once each has at least this many
+// characters to build lines from
+constexpr const std::size_t MIN_CHARACTERS_PER_THREAD = 1 << 16;
+
+std::size_t thread_count_for(std::size_t character_count) {
+    return std::max(std::size_t(1), std::min(
+        ThreadPool::shared_instance().thread_count(),
+        character_count / MIN_CHARACTERS_PER_THREAD));
+}
+
 void do_text_lines_unit_tests();
 
 } // end of <anonymous> namespace
 
+/* static */ constexpr const UChar TextLines::NEW_LINE;
+
+TextLines::EditListener::~EditListener() {}
+
 TextLines::TextLines():
+    m_line_index(std::make_shared<SharedLineIndex>()),
     m_rendering_options(&RenderOptions::get_default_instance()),
-    m_width_constraint(std::numeric_limits<int>::max())
+    m_model_cache(nullptr),
+    m_width_constraint(std::numeric_limits<int>::max()),
+    m_version(0),
+    m_transaction_depth(0)
 {}
 
 /* explicit */ TextLines::TextLines(const std::u32string & content_):
+    m_line_index(std::make_shared<SharedLineIndex>()),
     m_rendering_options(&RenderOptions::get_default_instance()),
-    m_width_constraint(std::numeric_limits<int>::max())
+    m_model_cache(nullptr),
+    m_width_constraint(std::numeric_limits<int>::max()),
+    m_version(0),
+    m_transaction_depth(0)
 { set_content(content_); }
 
+TextLines::TextLines(const TextLines & rhs):
+    m_lines            (rhs.m_lines            ),
+    // shared until either one is edited
+    m_line_index       (rhs.m_line_index       ),
+    m_line_offsets     (rhs.m_line_offsets     ),
+    m_rendering_options(rhs.m_rendering_options),
+    m_model_cache      (rhs.m_model_cache      ),
+    m_width_constraint (rhs.m_width_constraint ),
+    m_version          (rhs.m_version          ),
+    m_transaction_depth(0                      )
+{ rhs.verify_no_transaction("TextLines::TextLines"); }
+
+TextLines & TextLines::operator = (const TextLines & rhs) {
+    if (this == &rhs) return *this;
+    rhs.verify_no_transaction("TextLines::operator=");
+    m_lines             = rhs.m_lines;
+    m_line_index        = rhs.m_line_index;
+    m_line_offsets      = rhs.m_line_offsets;
+    m_rendering_options = rhs.m_rendering_options;
+    m_model_cache       = rhs.m_model_cache;
+    m_width_constraint  = rhs.m_width_constraint;
+    // must still differ from any version of the old content
+    m_version = std::max(m_version, rhs.m_version) + 1;
+    // whatever was pending is gone with the old content
+    m_pending_edit = PendingEdit();
+    for (auto * listener : m_edit_listeners)
+        listener->on_reset(*this);
+    return *this;
+}
+
+TextLines::TextLines(TextLines && rhs): TextLines()
+    { *this = std::move(rhs); }
+
+TextLines & TextLines::operator = (TextLines && rhs) {
+    if (this == &rhs) return *this;
+    rhs.verify_no_transaction("TextLines::operator=");
+    m_lines             = std::move(rhs.m_lines);
+    m_line_index        = std::move(rhs.m_line_index);
+    m_line_offsets      = std::move(rhs.m_line_offsets);
+    m_rendering_options = rhs.m_rendering_options;
+    m_model_cache       = rhs.m_model_cache;
+    m_width_constraint  = rhs.m_width_constraint;
+    m_version = std::max(m_version, rhs.m_version) + 1;
+    m_pending_edit = PendingEdit();
+    // its listeners stay with it, and see it emptied
+    rhs.set_content(U"");
+    for (auto * listener : m_edit_listeners)
+        listener->on_reset(*this);
+    return *this;
+}
 
 void TextLines::constrain_to_width(int target_width) {
     m_width_constraint = target_width;
@@ -53,26 +130,19 @@ void TextLines::constrain_to_width(int target_width) {
 }
 
 void TextLines::set_content(const std::u32string & content_string) {
-    auto index_to_iterator = [&content_string](std::size_t index) {
-        if (index == std::u32string::npos)
-            return content_string.end();
-        else
-            return content_string.begin() + int(index);
-    };
-    std::size_t index = 0;
-    while (true) {
-        auto next = content_string.find(NEW_LINE, index);
-        auto beg = index_to_iterator(index);
-        auto end = index_to_iterator(next );
-        // design issue, parent TextLines, on reallocation, we're jumping back
-        // to parent while the vector is being modified
-        m_lines.emplace_back(std::u32string(beg, end));
-        if (end == content_string.end()) break;
-        assert(next + 1 < content_string.size());
-        index = next + 1;
-    }
-    refresh_lines_information();
+    // a trailing new line leaves an empty last line
+    m_lines = build_lines(content_string.data(),
+                          content_string.data() + content_string.size(), 0);
+    ++m_version;
+    refresh_lines_information(0, int(m_lines.size()));
+    m_pending_edit = PendingEdit();
+    m_line_index = std::make_shared<SharedLineIndex>();
+    update_line_index(0, 0, int(m_lines.size()));
+    m_line_offsets = LineOffsetIndex();
+    update_line_offsets(0, 0, int(m_lines.size()));
     check_invarients();
+    for (auto * listener : m_edit_listeners)
+        listener->on_reset(*this);
 }
 
 void TextLines::assign_render_options(const RenderOptions & options) {
@@ -85,17 +155,74 @@ void TextLines::assign_default_render_options() {
     assign_render_options(RenderOptions::get_default_instance());
 }
 
+void TextLines::add_edit_listener(EditListener * listener) {
+    if (!listener) {
+        throw std::invalid_argument
+            ("TextLines::add_edit_listener: listener must not be null.");
+    }
+    m_edit_listeners.push_back(listener);
+}
+
+void TextLines::remove_edit_listener(EditListener * listener) {
+    m_edit_listeners.erase(std::remove(m_edit_listeners.begin(),
+                                       m_edit_listeners.end(), listener),
+                           m_edit_listeners.end());
+}
+
 void TextLines::update_modeler(CodeModeler & modeler) {
     for (auto & line : m_lines)
-        line.update_modeler(modeler);
+        update_line_model(line, modeler);
+}
+
+int TextLines::update_modeler_where_needed(CodeModeler & modeler) {
+    modeler.reset_state();
+    int modeled_count = 0;
+    for (auto & line : m_lines) {
+        if (!line.needs_modeling() &&
+            modeler.state_equals(line.modeler_entry_state()))
+        {
+            modeler.restore_state(line.modeler_exit_state());
+            continue;
+        }
+        update_line_model(line, modeler);
+        ++modeled_count;
+    }
+    return modeled_count;
+}
+
+void TextLines::update_line_modeler(int line, CodeModeler & modeler) {
+    if (line < 0 || line >= int(m_lines.size())) {
+        throw std::invalid_argument
+            ("TextLines::update_line_modeler: given line number is invalid.");
+    }
+    update_line_model(m_lines[std::size_t(line)], modeler);
 }
 
+void TextLines::take_model_of(int line, TextLineImage & image) {
+    if (line < 0 || line >= int(m_lines.size())) {
+        throw std::invalid_argument
+            ("TextLines::take_model_of: given line number is invalid.");
+    }
+    m_lines[std::size_t(line)].take_model_of(image);
+}
+
+std::uint64_t TextLines::line_hash(int line) const {
+    if (line < 0 || line >= int(m_lines.size())) {
+        throw std::invalid_argument
+            ("TextLines::line_hash: given line number is invalid.");
+    }
+    return m_lines[std::size_t(line)].hash();
+}
 
 Cursor TextLines::push(Cursor cursor, UChar uchar) {
     verify_cursor_validity("TextLines::push", cursor);
+    const auto inserted_at = insertion_point(cursor);
+    const bool after_new_line = inserted_at != cursor;
+    const int old_count = cursor == end_cursor() ? 0 : 1;
+    const int old_size  = int(m_lines.size());
+    ++m_version;
     if (cursor == end_cursor()) {
         m_lines.emplace_back();
-        refresh_lines_information();
     }
     auto & line = m_lines[std::size_t(cursor.line)];
     auto resp = line.push(cursor.column, uchar);
@@ -103,38 +230,49 @@ Cursor TextLines::push(Cursor cursor, UChar uchar) {
         // if split is requested, the line has not been modified
         auto spl = line.split(cursor.column);
         m_lines.insert(m_lines.begin() + cursor.line + 1, spl);
-        refresh_lines_information();
+        finish_edit(cursor.line, old_count,
+                    old_count + int(m_lines.size()) - old_size);
         ++cursor.line;
         cursor.column = 0;
-        check_invarients();
+        notify_insertion(inserted_at, cursor, &uchar, &uchar + 1, after_new_line);
         return cursor;
     }
     // we know resp is a new column position now
     auto new_col = resp;
-    check_invarients();
+    finish_edit(cursor.line, old_count,
+                old_count + int(m_lines.size()) - old_size);
+    notify_insertion(inserted_at, Cursor(cursor.line, new_col), &uchar,
+                     &uchar + 1, after_new_line);
     return Cursor(cursor.line, new_col);
 }
 
 Cursor TextLines::delete_ahead(Cursor cursor) {
     verify_cursor_validity("TextLines::delete_ahead", cursor);
     if (cursor == end_cursor()) return cursor;
+    if (cursor.line + 1 == int(m_lines.size()) &&
+        cursor.column == m_lines.back().content_length())
+    { return cursor; }
+    const auto removed_end = next_cursor(cursor);
+    const auto removed = removal_of(cursor, removed_end);
+    ++m_version;
     auto & line = m_lines[std::size_t(cursor.line)];
     auto resp = line.delete_ahead(cursor.column);
     if (resp == TextLine::MERGE_REQUESTED) {
-        // merge with the next line if it exists
-        if (cursor.line + 1 >= int(m_lines.size()))
-            return cursor;
+        // merge with the next line (known to exist from the check above)
+        assert(cursor.line + 1 < int(m_lines.size()));
         auto & next_line = m_lines[std::size_t(cursor.line + 1)];
         auto old_line_size = next_line.content_length();
         line.take_contents_of(next_line, TextLine::PLACE_AT_END);
         // note: line, next_line become danglers after this statement
         //       so it's important that we do not access them again
         m_lines.erase(m_lines.begin() + cursor.line + 1);
-        refresh_lines_information();
-        check_invarients();
+        finish_edit(cursor.line, 2, 1);
+        notify_removal(cursor, removed_end, removed);
         return Cursor(cursor.line, old_line_size);
     } else {
         auto new_col = resp;
+        finish_edit(cursor.line, 1, 1);
+        notify_removal(cursor, removed_end, removed);
         return Cursor(cursor.line, new_col);
     }
 }
@@ -148,6 +286,9 @@ Cursor TextLines::delete_behind(Cursor cursor) {
     } else if (cursor == Cursor()) {
         return cursor;
     }
+    const auto removed_beg = previous_cursor(cursor);
+    const auto removed = removal_of(removed_beg, cursor);
+    ++m_version;
     auto & line = m_lines[std::size_t(cursor.line)];
     auto resp = line.delete_behind(cursor.column);
     if (resp == TextLine::MERGE_REQUESTED) {
@@ -157,16 +298,25 @@ Cursor TextLines::delete_behind(Cursor cursor) {
         auto line_size = line.content_length();
         // invalidates: prev_line, line
         m_lines.erase(m_lines.begin() + cursor.line);
-        refresh_lines_information();
-        check_invarients();
+        finish_edit(cursor.line - 1, 2, 1);
+        notify_removal(removed_beg, cursor, removed);
         return Cursor(cursor.line - 1, line_size);
     }
+    finish_edit(cursor.line, 1, 1);
+    notify_removal(removed_beg, cursor, removed);
     return Cursor(cursor.line, cursor.column - 1);
 }
 
 Cursor TextLines::wipe(Cursor beg, Cursor end) {
     verify_cursor_validity("TextLines::wipe (for beg)", beg);
     verify_cursor_validity("TextLines::wipe (for end)", end);
+    // wiping to the end cursor is wiping to the end of the last line
+    if (end == end_cursor() && !m_lines.empty())
+        end = Cursor(int(m_lines.size()) - 1, m_lines.back().content_length());
+    if (beg == end) return beg;
+    const auto removed_end = end;
+    const auto removed = removal_of(beg, end);
+    ++m_version;
     auto wipe_chars = [this](int line_idx, int line_beg, int line_end) {
         auto & line = m_lines[std::size_t(line_idx)];
         line.wipe(line_beg, line_end);
@@ -185,8 +335,8 @@ Cursor TextLines::wipe(Cursor beg, Cursor end) {
         ++end.line;
     assert(beg.line + 1 <= end.line);
     m_lines.erase(m_lines.begin() + beg.line + 1, m_lines.begin() + end.line);
-    refresh_lines_information();
-    check_invarients();
+    finish_edit(beg.line, removed_end.line - beg.line + 1, 1);
+    notify_removal(beg, removed_end, removed);
     return beg;
 }
 
@@ -216,9 +366,188 @@ void TextLines::deposit_chatacters_to
 Cursor TextLines::deposit_chatacters_to
     (const UChar * beg, const UChar * end, Cursor pos)
 {
-    for (; beg != end; ++beg)
-        pos = push(pos, *beg);
-    return pos;
+    verify_cursor_validity("TextLines::deposit_chatacters_to", pos);
+    if (beg == end) return pos;
+    const auto inserted_at = insertion_point(pos);
+    const bool after_new_line = inserted_at != pos;
+    const int old_count = pos == end_cursor() ? 0 : 1;
+    const int old_size  = int(m_lines.size());
+    ++m_version;
+    if (pos == end_cursor()) {
+        m_lines.emplace_back();
+    }
+    auto & line = m_lines[std::size_t(pos.line)];
+    auto first_break = std::find(beg, end, NEW_LINE);
+    if (first_break == end) {
+        pos.column = line.deposit_chatacters_to(beg, end, pos.column);
+        finish_edit(pos.line, old_count,
+                    old_count + int(m_lines.size()) - old_size);
+        notify_insertion(inserted_at, pos, beg, end, after_new_line);
+        return pos;
+    }
+    // whatever followed the cursor ends up on the last of the new lines
+    auto tail = line.split(pos.column);
+    line.deposit_chatacters_to(beg, first_break, pos.column);
+    auto new_lines = build_lines(first_break + 1, end, pos.line + 1);
+    // the last line's characters go before the tail instead
+    auto line_beg = end - new_lines.back().content_length();
+    Cursor rv(pos.line + int(new_lines.size()),
+              tail.deposit_chatacters_to(line_beg, end, 0));
+    new_lines.back() = std::move(tail);
+    m_lines.insert(m_lines.begin() + pos.line + 1,
+                   std::make_move_iterator(new_lines.begin()),
+                   std::make_move_iterator(new_lines.end  ()));
+    finish_edit(pos.line, old_count,
+                old_count + int(m_lines.size()) - old_size);
+    notify_insertion(inserted_at, rv, beg, end, after_new_line);
+    return rv;
+}
+
+std::size_t TextLines::replace_all
+    (const std::vector<CursorRange> & ranges, const std::u32string & replacement)
+{
+    return replace_ranges(ranges,
+        [&replacement](std::size_t) -> const std::u32string & { return replacement; });
+}
+
+std::size_t TextLines::replace_each
+    (const std::vector<CursorRange> & ranges,
+     const std::vector<std::u32string> & replacements)
+{
+    if (ranges.size() != replacements.size()) {
+        throw std::invalid_argument("TextLines::replace_each: there must be "
+                                    "exactly one replacement for each range.");
+    }
+    return replace_ranges(ranges,
+        [&replacements](std::size_t idx) -> const std::u32string &
+        { return replacements[idx]; });
+}
+
+template <typename ReplacementOf>
+/* private */ std::size_t TextLines::replace_ranges
+    (const std::vector<CursorRange> & ranges, ReplacementOf && replacement_of)
+{
+    // there are no characters to replace
+    if (ranges.empty() || m_lines.empty()) return 0;
+    // ranges to the end cursor are to the end of the last line (as with wipe)
+    const auto content_end = Cursor(int(m_lines.size()) - 1,
+                                    m_lines.back().content_length());
+    auto end_of = [this, &content_end](const CursorRange & range)
+        { return range.end == end_cursor() ? content_end : range.end; };
+    Cursor last_end;
+    for (const auto & range : ranges) {
+        verify_cursor_validity("TextLines::replace_ranges (for begin)", range.begin);
+        verify_cursor_validity("TextLines::replace_ranges (for end)"  , range.end  );
+        if (range.begin == end_cursor() || end_of(range) < range.begin ||
+            range.begin < last_end)
+        {
+            throw std::invalid_argument("TextLines::replace_ranges: ranges must "
+                                        "be within the content, in order and "
+                                        "must not overlap.");
+        }
+        last_end = end_of(range);
+    }
+    std::vector<std::u32string> removed;
+    if (!m_edit_listeners.empty()) {
+        removed.reserve(ranges.size());
+        for (const auto & range : ranges) {
+            const auto end = end_of(range);
+            if (range.begin.line != end.line) {
+                removed.push_back(copy_characters_from(range.begin, end));
+                continue;
+            }
+            // the usual case, and far quicker than copy_characters_from
+            removed.push_back(m_lines[std::size_t(end.line)].content().substr
+                (std::size_t(range.begin.column),
+                 std::size_t(end.column - range.begin.column)));
+        }
+    }
+
+    // lines from the first range's to the last's are rebuilt, those between
+    // ranges are kept as they are
+    const int first_line = ranges.front().begin.line;
+    std::vector<TextLine> rebuilt;
+    std::u32string content;
+    auto finish_line = [this, &rebuilt, &content](Cursor from) {
+        const auto & rest = m_lines[std::size_t(from.line)].content();
+        content.append(rest, std::size_t(from.column), std::u32string::npos);
+        std::size_t beg = 0;
+        for (auto end = content.find(NEW_LINE); end != std::u32string::npos;
+             end = content.find(NEW_LINE, beg))
+        {
+            rebuilt.emplace_back(content.substr(beg, end - beg));
+            beg = end + 1;
+        }
+        rebuilt.emplace_back(content.substr(beg));
+        content.clear();
+    };
+    // next character of the old content yet to be copied
+    Cursor from(first_line, 0);
+    for (std::size_t i = 0; i != ranges.size(); ++i) {
+        const auto & range = ranges[i];
+        if (range.begin.line != from.line) {
+            finish_line(from);
+            for (int line = from.line + 1; line < range.begin.line; ++line)
+                rebuilt.emplace_back(std::move(m_lines[std::size_t(line)]));
+            from = Cursor(range.begin.line, 0);
+        }
+        content.append(m_lines[std::size_t(from.line)].content(),
+                       std::size_t(from.column),
+                       std::size_t(range.begin.column - from.column));
+        content += replacement_of(i);
+        from = end_of(range);
+    }
+    finish_line(from);
+
+    const int old_count = from.line - first_line + 1;
+    const int new_count = int(rebuilt.size());
+    // listeners are told of it as one group, and the bookkeeping is done
+    // once this is over
+    Transaction transaction(*this);
+    ++m_version;
+    auto first_itr = m_lines.begin() + first_line;
+    if (old_count == new_count) {
+        std::move(rebuilt.begin(), rebuilt.end(), first_itr);
+    } else {
+        first_itr = m_lines.erase(first_itr, first_itr + old_count);
+        m_lines.insert(first_itr, std::make_move_iterator(rebuilt.begin()),
+                                  std::make_move_iterator(rebuilt.end  ()));
+    }
+    finish_edit(first_line, old_count, new_count);
+    if (m_edit_listeners.empty()) return ranges.size();
+
+    // as if replaced one at a time from last to first, so that each range's
+    // cursors are still good when told of
+    for (auto i = ranges.size(); i-- != 0; ) {
+        const auto & range = ranges[i];
+        const auto & replacement = replacement_of(i);
+        if (range.begin != end_of(range))
+            notify_removal(range.begin, end_of(range), removed[i]);
+        if (!replacement.empty())
+            notify_insertion(range.begin, end_of_insertion(range.begin, replacement),
+                             replacement.data(), replacement.data() + replacement.size(),
+                             false);
+    }
+    return ranges.size();
+}
+
+void TextLines::begin_transaction() {
+    if (m_transaction_depth++ == 0)
+        notify_group_begin();
+}
+
+void TextLines::commit_transaction() {
+    if (m_transaction_depth == 0) {
+        throw std::runtime_error("TextLines::commit_transaction: no "
+                                 "transaction was begun.");
+    }
+    if (--m_transaction_depth != 0) return;
+    if (m_pending_edit.any) {
+        auto edit = m_pending_edit;
+        m_pending_edit = PendingEdit();
+        finish_edit(edit.first, edit.old_count, edit.new_count);
+    }
+    notify_group_end();
 }
 
 Cursor TextLines::next_cursor(Cursor cursor) const {
@@ -274,7 +603,34 @@ bool TextLines::is_valid_cursor(Cursor cursor) const noexcept {
     return cursor.column <= int(line.content().length());
 }
 
+std::size_t TextLines::offset_of(Cursor cursor) const {
+    verify_no_transaction("TextLines::offset_of");
+    verify_cursor_validity("TextLines::offset_of", cursor);
+    if (cursor == end_cursor())
+        return m_lines.empty() ? 0 : m_line_offsets.total() - 1;
+    return m_line_offsets.offset_of(std::size_t(cursor.line)) +
+           std::size_t(cursor.column);
+}
+
+Cursor TextLines::cursor_at(std::size_t offset) const {
+    verify_no_transaction("TextLines::cursor_at");
+    // the last line has no new line
+    if (offset >= m_line_offsets.total() && !(m_lines.empty() && offset == 0)) {
+        throw std::invalid_argument("TextLines::cursor_at: given offset is "
+                                    "past the content.");
+    }
+    if (m_lines.empty()) return Cursor();
+    const auto line = m_line_offsets.line_at(offset);
+    return Cursor(int(line), int(offset - m_line_offsets.offset_of(line)));
+}
+
+TextLinesSnapshot TextLines::snapshot() const {
+    verify_no_transaction("TextLines::snapshot");
+    return TextLinesSnapshot(m_line_index, m_version, m_width_constraint);
+}
+
 void TextLines::render_to(TargetTextGrid & target, int offset) const {
+    verify_no_transaction("TextLines::render_to");
     for (const auto & line : m_lines) {
         line.render_to(target, offset);
         offset += line.height_in_cells();
@@ -310,7 +666,8 @@ template <typename Func>
 }
 
 /* private */ void TextLines::check_invarients() const {
-    ;
+    assert(m_line_index && m_line_index->size() == m_lines.size());
+    assert(m_line_offsets.size() == m_lines.size());
 }
 
 /* private */ void TextLines::verify_cursor_validity
@@ -321,15 +678,186 @@ template <typename Func>
         (std::string(caller) + ": given cursor is invalid.");
 }
 
-/* private */ void TextLines::refresh_lines_information() {
-    int line_num = 0;
-    for (auto & line : m_lines) {
-        line.set_line_number(line_num++);
+/* private */ void TextLines::verify_no_transaction(const char * caller) const {
+    if (m_transaction_depth == 0) return;
+    throw std::runtime_error
+        (std::string(caller) + ": cannot be done while a transaction is open.");
+}
+
+/* private */ void TextLines::refresh_lines_information(int first, int last) {
+    for (int i = first; i != last; ++i) {
+        auto & line = m_lines[std::size_t(i)];
+        line.set_line_number(i);
         line.assign_render_options(*m_rendering_options);
         line.constrain_to_width(m_width_constraint);
     }
 }
 
+/* private */ std::vector<TextLine> TextLines::build_lines
+    (const UChar * beg, const UChar * end, int first_line) const
+{
+    const auto size = std::size_t(end - beg);
+    const auto thread_count = thread_count_for(size);
+    // each thread finds the new lines in its own slice of the characters
+    std::vector<std::vector<std::size_t>> slice_breaks(thread_count);
+    ThreadPool::shared_instance().run_in_parallel(thread_count, [&](std::size_t idx) {
+        const auto slice_end = beg + size*(idx + 1) / thread_count;
+        auto & breaks = slice_breaks[idx];
+        for (auto itr = std::find(beg + size*idx / thread_count, slice_end, NEW_LINE);
+             itr != slice_end; itr = std::find(itr + 1, slice_end, NEW_LINE))
+        { breaks.push_back(std::size_t(itr - beg)); }
+    });
+    // where each line begins, then one past where the last would begin
+    std::vector<std::size_t> line_begs(1, 0);
+    for (const auto & breaks : slice_breaks) {
+        for (auto brk : breaks)
+            line_begs.push_back(brk + 1);
+    }
+    line_begs.push_back(size + 1);
+
+    // then each builds an even share of the lines, in place
+    std::vector<TextLine> lines(line_begs.size() - 1);
+    ThreadPool::shared_instance().run_in_parallel(thread_count, [&](std::size_t idx) {
+        const auto last = lines.size()*(idx + 1) / thread_count;
+        for (auto i = lines.size()*idx / thread_count; i != last; ++i) {
+            auto & line = lines[i];
+            line.set_line_number(first_line + int(i));
+            line.assign_render_options(*m_rendering_options);
+            // while still empty, so it is only modeled once its content is in
+            line.constrain_to_width(m_width_constraint);
+            line.set_content(std::u32string(beg + line_begs[i], beg + line_begs[i + 1] - 1));
+            // while the content is at hand, so that it is known when a
+            // document is matched with its stored models (or reloaded)
+            (void)line.hash();
+        }
+    });
+    return lines;
+}
+
+/* private */ void TextLines::update_line_model
+    (TextLine & line, CodeModeler & modeler)
+{
+    if (m_model_cache)
+        line.update_modeler(modeler, *m_model_cache);
+    else
+        line.update_modeler(modeler);
+}
+
+/* private */ Cursor TextLines::insertion_point(Cursor cursor) const {
+    if (cursor != end_cursor() || m_lines.empty()) return cursor;
+    return Cursor(int(m_lines.size()) - 1, m_lines.back().content_length());
+}
+
+/* private */ std::u32string TextLines::removal_of
+    (Cursor beg, Cursor end) const
+{
+    if (m_edit_listeners.empty()) return std::u32string();
+    return copy_characters_from(beg, end);
+}
+
+/* private */ void TextLines::finish_edit
+    (int first, int old_count, int new_count)
+{
+    if (m_transaction_depth != 0) {
+        m_pending_edit.merge(first, old_count, new_count);
+        return;
+    }
+    // lines after the edited ones only need renumbering if lines were added
+    // or removed
+    refresh_lines_information(first, old_count == new_count ?
+                                     first + new_count : int(m_lines.size()));
+    update_line_index(first, old_count, new_count);
+    update_line_offsets(first, old_count, new_count);
+    check_invarients();
+}
+
+/* private */ void TextLines::update_line_index
+    (int first, int old_count, int new_count)
+{
+    if (!m_line_index) {
+        m_line_index = std::make_shared<SharedLineIndex>();
+    } else if (m_line_index.use_count() > 1) {
+        // a snapshot (or a copy of this object) still needs the old one
+        m_line_index = std::make_shared<SharedLineIndex>(*m_line_index);
+    }
+    std::vector<TextLine::SharedContent> contents;
+    contents.reserve(std::size_t(new_count));
+    for (int i = first; i != first + new_count; ++i)
+        contents.push_back(m_lines[std::size_t(i)].shared_content());
+    m_line_index->splice(std::size_t(first), std::size_t(old_count),
+                         contents.data(), contents.data() + contents.size());
+}
+
+/* private */ void TextLines::update_line_offsets
+    (int first, int old_count, int new_count)
+{
+    std::vector<std::size_t> lengths;
+    lengths.reserve(std::size_t(new_count));
+    for (int i = first; i != first + new_count; ++i)
+        lengths.push_back(std::size_t(m_lines[std::size_t(i)].content_length()) + 1);
+    m_line_offsets.splice(std::size_t(first), std::size_t(old_count),
+                          lengths.data(), lengths.data() + lengths.size());
+}
+
+/* private */ void TextLines::notify_insertion
+    (Cursor beg, Cursor end, const UChar * text_beg, const UChar * text_end,
+     bool after_new_line) const
+{
+    if (m_edit_listeners.empty()) return;
+    std::u32string inserted;
+    inserted.reserve(std::size_t(text_end - text_beg) + 1);
+    if (after_new_line) inserted.push_back(NEW_LINE);
+    inserted.append(text_beg, text_end);
+    for (auto * listener : m_edit_listeners)
+        listener->on_insertion_of(*this, beg, end, inserted);
+}
+
+/* private */ void TextLines::notify_removal
+    (Cursor beg, Cursor end, const std::u32string & removed) const
+{
+    for (auto * listener : m_edit_listeners)
+        listener->on_removal(*this, beg, end, removed);
+}
+
+/* static */ Cursor TextLines::end_of_insertion
+    (Cursor pos, const std::u32string & inserted)
+{
+    const auto last_break = inserted.rfind(NEW_LINE);
+    if (last_break == std::u32string::npos)
+        return Cursor(pos.line, pos.column + int(inserted.size()));
+    return Cursor(pos.line + int(std::count(inserted.begin(), inserted.end(), NEW_LINE)),
+                  int(inserted.size() - last_break - 1));
+}
+
+/* private */ void TextLines::notify_group_begin() const {
+    for (auto * listener : m_edit_listeners)
+        listener->on_group_begin(*this);
+}
+
+/* private */ void TextLines::notify_group_end() const {
+    for (auto * listener : m_edit_listeners)
+        listener->on_group_end(*this);
+}
+
+/* private */ void TextLines::PendingEdit::merge
+    (int first_, int old_count_, int new_count_)
+{
+    if (!any) {
+        first     = first_;
+        old_count = old_count_;
+        new_count = new_count_;
+        any       = true;
+        return;
+    }
+    // the lines spanned by both edits (as they are before this one), inside
+    // which line counts are only known for the whole
+    const int beg = std::min(first, first_);
+    const int end = std::max(first + new_count, first_ + old_count_);
+    old_count = end - beg - new_count  + old_count;
+    new_count = end - beg - old_count_ + new_count_;
+    first     = beg;
+}
+
 namespace {
 
 void do_text_lines_unit_tests() {
@@ -438,6 +966,248 @@ void do_text_lines_unit_tests() {
     assert(ustr == utext);
     }
     {
+    static const std::u32string utext = U"one\ntwo\n\nthree";
+    TextLines tlines(U"before after");
+    auto end = tlines.deposit_chatacters_to
+        (utext.data(), utext.data() + utext.length(), Cursor(0, 7));
+    auto ustr = tlines.copy_characters_from(Cursor(0, 0), tlines.end_cursor());
+    assert(ustr == U"before one\ntwo\n\nthreeafter" && end == Cursor(3, 5));
+    assert(tlines.lines().size() == 4);
+    }
+    // set_content replaces, a trailing new line leaves an empty line
+    {
+    TextLines tlines(U"abc");
+    tlines.set_content(U"def\n");
+    assert(tlines.lines().size() == 2 && tlines.lines()[0].content() == U"def");
+    }
+    // content large enough to be built across threads, with lines of every
+    // length (some empty) landing on either side of where it is split
+    {
+    std::u32string content;
+    std::vector<std::u32string> expected;
+    for (std::size_t i = 0; content.size() < MIN_CHARACTERS_PER_THREAD*8; ++i) {
+        expected.emplace_back((i*7) % 300, UChar(U'a' + i % 26));
+        content += expected.back() + U"\n";
+    }
+    expected.emplace_back();
+    TextLines tlines;
+    tlines.constrain_to_width(40);
+    tlines.set_content(content);
+    assert(tlines.lines().size() == expected.size());
+    for (std::size_t i = 0; i != expected.size(); ++i) {
+        assert(tlines.lines()[i].content() == expected[i]);
+        // each is wrapped to the width
+        if (i % 37 != 0) continue;
+        TextLine tline(expected[i]);
+        tline.constrain_to_width(40);
+        assert(tlines.lines()[i].height_in_cells() == tline.height_in_cells());
+    }
+    // and inserted into the middle of a line
+    tlines.set_content(U"[]");
+    auto end = tlines.deposit_chatacters_to
+        (content.data(), content.data() + content.size(), Cursor(0, 1));
+    assert(end == Cursor(int(expected.size()) - 1, 0));
+    assert(tlines.lines().front().content() == U"[" + expected.front());
+    assert(tlines.lines().back ().content() == U"]");
+    assert(tlines.offset_of(tlines.end_cursor()) == content.size() + 2);
+    // characters lines may not hold are still refused
+    bool threw = false;
+    try {
+        tlines.set_content(content + std::u32string(1, U'\0'));
+    } catch (std::invalid_argument &) {
+        threw = true;
+    }
+    assert(threw && tlines.lines().size() == expected.size());
+    }
+    // replace_all, against replacing one range at a time from last to first
+    {
+    auto content_of = [](const TextLines & tlines)
+        { return tlines.copy_characters_from(Cursor(), tlines.end_cursor()); };
+    auto one_at_a_time = [](TextLines & tlines, const std::vector<CursorRange> & ranges,
+                            const std::u32string & replacement)
+    {
+        for (auto itr = ranges.rbegin(); itr != ranges.rend(); ++itr) {
+            tlines.wipe(itr->begin, itr->end);
+            tlines.deposit_chatacters_to(replacement.begin(), replacement.end(),
+                                         itr->begin);
+        }
+    };
+    const std::vector<CursorRange> ranges = {
+        CursorRange(Cursor(0, 1), Cursor(0, 2)), CursorRange(Cursor(0, 3), Cursor(0, 4)),
+        CursorRange(Cursor(0, 5), Cursor(2, 1)), CursorRange(Cursor(2, 1), Cursor(2, 1)),
+        CursorRange(Cursor(4, 0), Cursor(4, 2))
+    };
+    for (auto replacement : { U"", U"++", U"\n", U"x\ny\n" }) {
+        TextLines tlines(U"a-b-c\nd-e\nf-g\nh\nij");
+        TextLines expected(tlines);
+        assert(tlines.replace_all(ranges, replacement) == ranges.size());
+        one_at_a_time(expected, ranges, replacement);
+        assert(content_of(tlines) == content_of(expected));
+        assert(tlines.lines().size() == expected.lines().size());
+        auto snapshot = tlines.snapshot();
+        for (std::size_t i = 0; i != snapshot.line_count(); ++i)
+            assert(snapshot.line(i) == expected.lines()[i].content());
+    }
+    TextLines tlines(U"abc");
+    bool threw = false;
+    try {
+        tlines.replace_all({ CursorRange(Cursor(0, 2), Cursor(0, 3)),
+                             CursorRange(Cursor(0, 0), Cursor(0, 1)) }, U"x");
+    } catch (std::invalid_argument &) {
+        threw = true;
+    }
+    assert(threw && content_of(tlines) == U"abc");
+    }
+    // edits in a transaction, against the same edits made one at a time
+    {
+    class GroupCounter final : public TextLines::EditListener {
+    public:
+        void on_insertion(const TextLines &, Cursor, Cursor) override { ++edits; }
+        void on_removal(const TextLines &, Cursor, Cursor,
+                        const std::u32string &) override { ++edits; }
+        void on_reset(const TextLines &) override {}
+        void on_group_begin(const TextLines &) override { ++begins; }
+        void on_group_end  (const TextLines &) override { ++ends; }
+        int edits = 0, begins = 0, ends = 0;
+    };
+    auto edit = [](TextLines & tlines, int step) {
+        static const std::u32string text = U"x\ny";
+        const int line = (step*7) % int(tlines.lines().size());
+        switch (step % 4) {
+        case 0: tlines.push(Cursor(line, 0), TextLines::NEW_LINE); break;
+        case 1: tlines.deposit_chatacters_to(text.data(), text.data() + text.size(),
+                                             Cursor(line, 0)); break;
+        case 2: tlines.delete_behind(Cursor(line, 0)); break;
+        case 3: tlines.wipe(Cursor(line, 0), tlines.next_cursor(Cursor(line, 0))); break;
+        }
+    };
+    TextLines tlines(U"a\nbb\nccc\ndddd\neeeee"), expected(tlines);
+    GroupCounter counter, expected_counter;
+    tlines  .add_edit_listener(&counter         );
+    expected.add_edit_listener(&expected_counter);
+    {
+    TextLines::Transaction transaction(tlines);
+    tlines.begin_transaction();
+    for (int i = 0; i != 40; ++i) {
+        edit(tlines  , i);
+        edit(expected, i);
+    }
+    tlines.commit_transaction();
+    bool threw = false;
+    try {
+        tlines.snapshot();
+    } catch (std::runtime_error &) {
+        threw = true;
+    }
+    assert(threw && tlines.in_transaction());
+    }
+    assert(!tlines.in_transaction());
+    assert(counter.begins == 1 && counter.ends == 1);
+    assert(counter.edits == expected_counter.edits && expected_counter.begins == 0);
+    assert(tlines.copy_characters_from(Cursor(), tlines.end_cursor()) ==
+           expected.copy_characters_from(Cursor(), expected.end_cursor()));
+    auto snapshot = tlines.snapshot();
+    assert(snapshot.line_count() == expected.lines().size());
+    for (std::size_t i = 0; i != snapshot.line_count(); ++i)
+        assert(snapshot.line(i) == expected.lines()[i].content());
+    bool threw = false;
+    try {
+        tlines.commit_transaction();
+    } catch (std::runtime_error &) {
+        threw = true;
+    }
+    assert(threw);
+    tlines  .remove_edit_listener(&counter         );
+    expected.remove_edit_listener(&expected_counter);
+    }
+    // moving leaves listeners on their own objects, and versions only rise
+    {
+    class ResetCounter final : public TextLines::EditListener {
+    public:
+        void on_insertion(const TextLines &, Cursor, Cursor) override {}
+        void on_removal(const TextLines &, Cursor, Cursor,
+                        const std::u32string &) override {}
+        void on_reset(const TextLines & tlines) override { last = &tlines; ++resets; }
+        const TextLines * last = nullptr;
+        int resets = 0;
+    };
+    TextLines source(U"a\nbc"), target;
+    ResetCounter source_counter, target_counter;
+    source.add_edit_listener(&source_counter);
+    target.add_edit_listener(&target_counter);
+    for (int i = 0; i != 3; ++i) target.push(Cursor(), U'x');
+    const auto old_version = target.version();
+    target = std::move(source);
+    assert(target.version() > old_version);
+    assert(target_counter.resets == 1 && target_counter.last == &target);
+    assert(source_counter.resets == 1 && source_counter.last == &source);
+    assert(target.copy_characters_from(Cursor(), target.end_cursor()) == U"a\nbc");
+    assert(source.copy_characters_from(Cursor(), source.end_cursor()).empty());
+    TextLines moved(std::move(target));
+    assert(target_counter.resets == 2 && target.lines().size() == 1);
+    assert(moved.lines().size() == 2 && moved.snapshot().line(1) == U"bc");
+    source.remove_edit_listener(&source_counter);
+    target.remove_edit_listener(&target_counter);
+    }
+    // line hashes, kept through edits, the same for the same content
+    {
+    TextLines tlines(U"alpha\nbeta\ngamma\ndelta");
+    const TextLines before(U"alpha\nbeta\ngamma\ndelta");
+    tlines.push(Cursor(1, 4), U'!');
+    tlines.push(Cursor(2, 2), TextLines::NEW_LINE);
+    tlines.wipe(Cursor(4, 0), Cursor(4, 1));
+    assert(tlines.line_hash(0) == before.line_hash(0));
+    assert(tlines.line_hash(1) != before.line_hash(1));
+    for (int line = 0; line != int(tlines.lines().size()); ++line) {
+        const auto & content = tlines.lines()[std::size_t(line)].content();
+        assert(tlines.line_hash(line) ==
+               TextLine::hash_of(content.data(), content.data() + content.size()));
+    }
+    tlines.wipe(Cursor(1, 4), Cursor(1, 5));
+    assert(tlines.line_hash(1) == before.line_hash(1));
+    bool threw = false;
+    try {
+        tlines.line_hash(5);
+    } catch (std::invalid_argument &) {
+        threw = true;
+    }
+    assert(threw);
+    }
+    // offsets, against counting every character before
+    {
+    TextLines tlines;
+    assert(tlines.offset_of(tlines.end_cursor()) == 0 && tlines.cursor_at(0) == Cursor());
+    tlines.set_content(U"ab\n\ncde");
+    assert(tlines.offset_of(Cursor(2, 1)) == 5 && tlines.cursor_at(5) == Cursor(2, 1));
+    assert(tlines.offset_of(tlines.end_cursor()) == 7 && tlines.cursor_at(7) == Cursor(2, 3));
+    assert(tlines.cursor_at(3) == Cursor(1, 0));
+    bool threw = false;
+    try {
+        tlines.cursor_at(8);
+    } catch (std::invalid_argument &) {
+        threw = true;
+    }
+    assert(threw);
+    static const std::u32string text = U"12\n345\n";
+    for (int i = 0; i != 60; ++i) {
+        auto at = tlines.cursor_at(std::size_t(i*13) % (tlines.offset_of(tlines.end_cursor()) + 1));
+        if (i % 3 == 2) {
+            tlines.wipe(at, tlines.constrain_cursor(Cursor(at.line + 1, 1)));
+        } else {
+            TextLines::Transaction transaction(tlines);
+            tlines.push(at, U'x');
+            tlines.deposit_chatacters_to(text.data(), text.data() + text.size(), at);
+        }
+        for (int line = 0; line != int(tlines.lines().size()); ++line) {
+            for (int column = 0; column <= tlines.lines()[std::size_t(line)].content_length(); ++column) {
+                const auto offset = tlines.copy_characters_from(Cursor(), Cursor(line, column)).size();
+                assert(tlines.offset_of(Cursor(line, column)) == offset);
+                assert(tlines.cursor_at(offset) == Cursor(line, column));
+            }
+        }
+    }
+    }
+    {
     NullTextGrid ntg;
     TextLines tlines;
     UserTextSelection uts;
@@ -460,6 +1230,30 @@ void do_text_lines_unit_tests() {
     TextLines tlines;
     assert(tlines.constrain_cursor(Cursor(10, 10)) == tlines.end_cursor());
     }
+    // update_modeler_where_needed
+    {
+    LuaCodeModeler lcm;
+    TextLines tlines(U"local a = 1\nlocal b = 2\nlocal c = 3");
+    assert(tlines.update_modeler_where_needed(lcm) == 3);
+    assert(tlines.update_modeler_where_needed(lcm) == 0);
+    tlines.push(Cursor(1, 0), U' ');
+    assert(tlines.update_modeler_where_needed(lcm) == 1);
+    // opening a multiline string changes how every line after is entered
+    tlines.push(Cursor(0, 0), U'[');
+    tlines.push(Cursor(0, 1), U'[');
+    assert(tlines.update_modeler_where_needed(lcm) == 3);
+    assert(tlines.lines()[2].modeler_entry_state() != CodeModeler::State());
+    }
+    // repeated lines are served from an assigned cache
+    {
+    LuaCodeModeler lcm;
+    ModelCache cache;
+    TextLines tlines(U"end\nend\nend\n    end");
+    tlines.assign_model_cache(&cache);
+    tlines.update_modeler(lcm);
+    assert(cache.statistics().hits == 2 && cache.statistics().misses == 2);
+    assert(!tlines.lines()[3].needs_modeling());
+    }
 }
 
 } // end of <anonymous> namespace
@@ -26,6 +26,8 @@
 #include "Cursor.hpp"
 #include "TargetTextGrid.hpp"
 #include "TextLine.hpp"
+#include "TextLinesSnapshot.hpp"
+#include "LineOffsetIndex.hpp"
 
 #pragma once
 
@@ -34,12 +36,58 @@ public:
     static constexpr const UChar NEW_LINE = U'\n';
     using UStringCIter = std::u32string::const_iterator;
 
+    /** Told of every change to the content, after it has been made. All
+     *  edits are described as either an insertion or a removal of a range of
+     *  characters (new lines included).
+     */
+    class EditListener {
+    public:
+        virtual ~EditListener();
+        /** @param beg where the inserted characters now begin
+         *  @param end where the inserted characters now end
+         */
+        virtual void on_insertion(const TextLines &, Cursor beg, Cursor end) = 0;
+        /** As on_insertion, for listeners which need the inserted characters
+         *  themselves. They can not always be copied back out, as the ranges
+         *  of a replace_all are only told of once every one is replaced.
+         *  By default, only on_insertion is called.
+         *  @param inserted begins with a new line for an insertion at the
+         *                  end cursor
+         */
+        virtual void on_insertion_of
+            (const TextLines & tlines, Cursor beg, Cursor end,
+             const std::u32string & /* inserted */)
+        { on_insertion(tlines, beg, end); }
+        /** @param beg     where the removed characters began
+         *  @param end     where the removed characters ended, before removal
+         *  @param removed the characters which were removed
+         */
+        virtual void on_removal
+            (const TextLines &, Cursor beg, Cursor end,
+             const std::u32string & removed) = 0;
+        /** The content was replaced entirely (by set_content). */
+        virtual void on_reset(const TextLines &) = 0;
+        /** Every notification between these calls belongs to one edit (for
+         *  instance a replace-all), which is to be undone as a whole.
+         */
+        virtual void on_group_begin(const TextLines &) {}
+        virtual void on_group_end  (const TextLines &) {}
+    };
+
     TextLines();
     explicit TextLines(const std::u32string &);
+    // listeners are for one object only, so they are not copied (or moved)
+    TextLines(const TextLines &);
+    // the moved from object is left empty
+    TextLines(TextLines &&);
+
+    TextLines & operator = (const TextLines &);
+    TextLines & operator = (TextLines &&);
 
     // ------------------------ whole content editing -------------------------
 
     void constrain_to_width(int);
+    /** Replaces all content. */
     void set_content(const std::u32string &);
     /** @warning Does not in anyway maintain ownership over the given object
      *           reference. Given object must survive the life of this object.
@@ -47,8 +95,41 @@ public:
     void assign_render_options(const RenderOptions &);
     void assign_default_render_options();
 
+    /** Has update_modeler and update_modeler_where_needed look up lines in
+     *  the given cache before running the modeler over them.
+     *  @param cache may be nullptr, in which case no cache is used
+     *  @warning Does not in anyway maintain ownership over the given object.
+     *           Given object must survive the life of this object (or until
+     *           another cache is assigned).
+     */
+    void assign_model_cache(ModelCache * cache) { m_model_cache = cache; }
+
+    /** @warning Does not in anyway maintain ownership over the given object.
+     *           Given object must survive the life of this object (or be
+     *           removed before it is destroyed).
+     */
+    void add_edit_listener(EditListener *);
+    void remove_edit_listener(EditListener *);
+
     void update_modeler(CodeModeler &);
 
+    /** Models only those lines which have changed, or which the modeler now
+     *  enters in a different state than when they were last modeled. Unchanged
+     *  lines are stepped over by restoring their recorded exit state.
+     *  @return number of lines modeled
+     */
+    int update_modeler_where_needed(CodeModeler &);
+
+    /** Models a single line, using the assigned cache if any. The modeler
+     *  should be in the state that the line is entered with.
+     */
+    void update_line_modeler(int line, CodeModeler &);
+
+    /** Hands a line an image that was modeled elsewhere for its current
+     *  content and this collection's width constraint.
+     */
+    void take_model_of(int line, TextLineImage &);
+
     // ----------------------- single character editing -----------------------
 
     Cursor push(Cursor, UChar);
@@ -60,9 +141,54 @@ public:
     std::u32string copy_characters_from(Cursor beg, Cursor end) const;
     void deposit_chatacters_to
         (UStringCIter beg, UStringCIter end, Cursor pos = Cursor());
+    /** Inserts any number of characters (new lines included) all at once,
+     *  each affected line is only rebuilt one time.
+     *  @return cursor one past the last inserted character
+     */
     Cursor deposit_chatacters_to
         (const UChar * beg, const UChar * end, Cursor pos = Cursor());
 
+    /** Replaces each of the given ranges with the same text, all at once.
+     *  Each affected line is rebuilt only one time, and lines are inserted or
+     *  erased in one go. Listeners are told of it as a group of removals and
+     *  insertions, the last range's first.
+     *  @param ranges must be in order and must not overlap
+     *  @return number of ranges replaced
+     */
+    std::size_t replace_all(const std::vector<CursorRange> & ranges,
+                            const std::u32string & replacement);
+
+    /** As replace_all, but with a replacement for each range. */
+    std::size_t replace_each(const std::vector<CursorRange> & ranges,
+                             const std::vector<std::u32string> & replacements);
+
+    // ----------------------------- transactions -----------------------------
+
+    /** Edits made until the matching commit have their line bookkeeping
+     *  (numbering, render options and the line index which snapshots share)
+     *  done once at commit, over every line they touched together. Listeners
+     *  are still told of each edit as it is made, as one group.
+     *  Transactions may be nested, only the outermost commit does anything.
+     *  @note snapshot, render_to and copying throw while one is open
+     */
+    void begin_transaction();
+    /** @throws std::runtime_error if no transaction was begun */
+    void commit_transaction();
+    bool in_transaction() const noexcept { return m_transaction_depth != 0; }
+
+    /** Begins a transaction for as long as it lives. */
+    class Transaction {
+    public:
+        explicit Transaction(TextLines & tlines): m_lines(tlines)
+            { m_lines.begin_transaction(); }
+        ~Transaction() { m_lines.commit_transaction(); }
+
+        Transaction(const Transaction &) = delete;
+        Transaction & operator = (const Transaction &) = delete;
+    private:
+        TextLines & m_lines;
+    };
+
     // ------------------------------ accessors -------------------------------
 
     Cursor next_cursor(Cursor) const;
@@ -76,8 +202,40 @@ public:
      *  @return
      */
     Cursor end_cursor() const;
+
+    /** @return where the given characters end, were they inserted at the
+     *          given position
+     */
+    static Cursor end_of_insertion(Cursor pos, const std::u32string & inserted);
     bool is_valid_cursor(Cursor) const noexcept;
 
+    /** O(log n), counting each new line as one character.
+     *  @return number of characters before the cursor
+     */
+    std::size_t offset_of(Cursor) const;
+    /** O(log n), the inverse of offset_of. The offset of the end of the
+     *  content gives the end of the last line (rather than the end cursor).
+     *  @throws std::invalid_argument if the offset is past the content
+     */
+    Cursor cursor_at(std::size_t offset) const;
+
+    /** O(1) for lines whose hash is known (see TextLine::hash), so that
+     *  unchanged lines may be found without comparing their content.
+     *  @throws std::invalid_argument if there is no such line
+     */
+    std::uint64_t line_hash(int line) const;
+
+    /** Incremented on every modification of the content, so that work done on
+     *  a copy of the content can tell if it is still current.
+     */
+    std::size_t version() const noexcept { return m_version; }
+    int width_constraint() const noexcept { return m_width_constraint; }
+
+    /** O(1), the snapshot shares all line contents with this object, and is
+     *  not disturbed by any later edit.
+     */
+    TextLinesSnapshot snapshot() const;
+
     void render_to(TargetTextGrid &, int offset) const;
     void render_to(TargetTextGrid && rvalue, int offset) const
         { render_to(rvalue, offset); }
@@ -94,6 +252,7 @@ private:
     void for_each_line_in_range(Cursor beg, Cursor end, Func && func) const;
     void check_invarients() const;
     void verify_cursor_validity(const char * caller, Cursor) const;
+    void verify_no_transaction(const char * caller) const;
 
     // A should be called after every modification of the m_lines vector
     //
@@ -104,9 +263,59 @@ private:
         const std::vector<TextLine> & text_lines();
     };
 
-    void refresh_lines_information();
+    // lines [first, last) are numbered and given this object's options
+    void refresh_lines_information(int first, int last);
+    // the lines of [beg, end) (split at each new line), each already
+    // numbered from first_line on and given this object's options, large
+    // content is split and built across several threads
+    std::vector<TextLine> build_lines
+        (const UChar * beg, const UChar * end, int first_line) const;
+    void update_line_model(TextLine &, CodeModeler &);
+
+    // where an insertion at the given cursor truly begins, an insertion at
+    // the end cursor begins with an implicit new line
+    Cursor insertion_point(Cursor) const;
+    // removed characters are only collected if someone is listening
+    std::u32string removal_of(Cursor beg, Cursor end) const;
+    // replacement_of(i) gives the characters to replace ranges[i] with
+    template <typename ReplacementOf>
+    std::size_t replace_ranges(const std::vector<CursorRange> & ranges,
+                               ReplacementOf && replacement_of);
+    // old_count lines starting from first were replaced by new_count lines,
+    // the bookkeeping for which is left for the commit in a transaction
+    void finish_edit(int first, int old_count, int new_count);
+    void update_line_index(int first, int old_count, int new_count);
+    void update_line_offsets(int first, int old_count, int new_count);
+    // the inserted characters are [text_beg, text_end), after a new line if
+    // the insertion was at the end cursor
+    void notify_insertion(Cursor beg, Cursor end, const UChar * text_beg,
+                          const UChar * text_end, bool after_new_line) const;
+    void notify_removal
+        (Cursor beg, Cursor end, const std::u32string & removed) const;
+    void notify_group_begin() const;
+    void notify_group_end() const;
+
     std::vector<TextLine> m_lines;
+    std::vector<EditListener *> m_edit_listeners;
+    // shared with snapshots, and copied on write when it is
+    std::shared_ptr<SharedLineIndex> m_line_index;
+    // lengths of each line, with its new line
+    LineOffsetIndex m_line_offsets;
     const RenderOptions * m_rendering_options;
+    ModelCache * m_model_cache;
     int m_width_constraint;
+    std::size_t m_version;
+
+    // every edit made so far in a transaction, as one replacement of lines
+    struct PendingEdit {
+        void merge(int first, int old_count, int new_count);
+
+        int first     = 0;
+        int old_count = 0;
+        int new_count = 0;
+        bool any      = false;
+    };
+    int m_transaction_depth;
+    PendingEdit m_pending_edit;
 };
 
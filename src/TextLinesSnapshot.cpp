@@ -0,0 +1,252 @@
+/****************************************************************************
+
+    File: TextLinesSnapshot.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "TextLinesSnapshot.hpp"
+#include "TextLines.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+#include <cassert>
+
+namespace {
+
+// chunks are rebuilt half full, so that they may grow a while before they
+// need splitting again
+constexpr const std::size_t REBUILT_CHUNK_SIZE = SharedLineIndex::MAX_CHUNK_SIZE / 2;
+
+const std::shared_ptr<const SharedLineIndex> & empty_index();
+
+void run_text_lines_snapshot_tests();
+
+} // end of <anonymous> namespace
+
+/* static */ constexpr const std::size_t SharedLineIndex::MAX_CHUNK_SIZE;
+
+void SharedLineIndex::splice
+    (std::size_t first, std::size_t old_count,
+     const SharedContent * beg, const SharedContent * end)
+{
+    if (first > m_size || old_count > m_size - first) {
+        throw std::invalid_argument("SharedLineIndex::splice: given range of "
+                                    "lines is out of bounds.");
+    }
+    const auto new_count = std::size_t(end - beg);
+    if (old_count == 0 && new_count == 0) return;
+
+    // chunks spanned by the old lines [chunk_beg, chunk_end), an insertion
+    // goes into the chunk it falls in (or the last, at the very end)
+    std::size_t chunk_beg = 0, chunk_end = 0;
+    if (!m_chunks.empty()) {
+        chunk_beg = chunk_of(std::min(first, m_size - 1));
+        chunk_end = 1 + (old_count == 0 ? chunk_beg :
+                                          chunk_of(first + old_count - 1));
+    }
+    const bool edits_one_chunk_in_place =
+        chunk_end == chunk_beg + 1 && m_chunks[chunk_beg].use_count() == 1 &&
+        m_chunks[chunk_beg]->size() - old_count + new_count <= MAX_CHUNK_SIZE;
+
+    if (edits_one_chunk_in_place) {
+        auto & chunk = *m_chunks[chunk_beg];
+        auto at = chunk.begin() + std::ptrdiff_t(first - m_starts[chunk_beg]);
+        if (old_count == new_count) {
+            std::copy(beg, end, at);
+        } else {
+            at = chunk.erase(at, at + std::ptrdiff_t(old_count));
+            chunk.insert(at, beg, end);
+        }
+        if (chunk.empty())
+            m_chunks.erase(m_chunks.begin() + std::ptrdiff_t(chunk_beg));
+    } else {
+        // rebuild the spanned chunks from what's left of them, and the new
+        // lines, the old chunks are left to whoever else shares them
+        Chunk lines;
+        if (chunk_beg != chunk_end) {
+            const auto & first_chunk = *m_chunks[chunk_beg];
+            lines.insert(lines.end(), first_chunk.begin(), first_chunk.begin() +
+                         std::ptrdiff_t(first - m_starts[chunk_beg]));
+        }
+        lines.insert(lines.end(), beg, end);
+        if (chunk_beg != chunk_end) {
+            const auto & last_chunk = *m_chunks[chunk_end - 1];
+            auto kept_from = first + old_count - m_starts[chunk_end - 1];
+            lines.insert(lines.end(), last_chunk.begin() +
+                         std::ptrdiff_t(kept_from), last_chunk.end());
+        }
+        std::vector<std::shared_ptr<Chunk>> new_chunks;
+        for (std::size_t i = 0; i < lines.size(); i += REBUILT_CHUNK_SIZE) {
+            auto chunk_last = std::min(lines.size(), i + REBUILT_CHUNK_SIZE);
+            new_chunks.push_back(std::make_shared<Chunk>
+                (lines.begin() + std::ptrdiff_t(i),
+                 lines.begin() + std::ptrdiff_t(chunk_last)));
+        }
+        m_chunks.erase(m_chunks.begin() + std::ptrdiff_t(chunk_beg),
+                       m_chunks.begin() + std::ptrdiff_t(chunk_end));
+        m_chunks.insert(m_chunks.begin() + std::ptrdiff_t(chunk_beg),
+                        new_chunks.begin(), new_chunks.end());
+    }
+    m_size = m_size - old_count + new_count;
+    update_starts_from(chunk_beg);
+}
+
+const SharedLineIndex::SharedContent & SharedLineIndex::line
+    (std::size_t idx) const
+{
+    if (idx >= m_size) {
+        throw std::invalid_argument("SharedLineIndex::line: given line number "
+                                    "is out of bounds.");
+    }
+    auto chunk = chunk_of(idx);
+    return (*m_chunks[chunk])[idx - m_starts[chunk]];
+}
+
+/* private */ std::size_t SharedLineIndex::chunk_of(std::size_t line) const {
+    assert(line < m_size);
+    auto itr = std::upper_bound(m_starts.begin(), m_starts.end(), line);
+    assert(itr != m_starts.begin());
+    return std::size_t(itr - m_starts.begin()) - 1;
+}
+
+/* private */ void SharedLineIndex::update_starts_from(std::size_t chunk) {
+    assert(chunk <= m_chunks.size());
+    m_starts.resize(m_chunks.size());
+    std::size_t start = 0;
+    if (chunk != 0)
+        start = m_starts[chunk - 1] + m_chunks[chunk - 1]->size();
+    for (auto i = chunk; i != m_chunks.size(); ++i) {
+        m_starts[i] = start;
+        start += m_chunks[i]->size();
+    }
+    assert(start == m_size);
+}
+
+// ----------------------------------------------------------------------------
+
+TextLinesSnapshot::TextLinesSnapshot():
+    m_index(empty_index()),
+    m_version(0),
+    m_width_constraint(0)
+{}
+
+TextLinesSnapshot::TextLinesSnapshot
+    (std::shared_ptr<const SharedLineIndex> index, std::size_t version_,
+     int width_constraint_):
+    m_index(index ? std::move(index) : empty_index()),
+    m_version(version_),
+    m_width_constraint(width_constraint_)
+{}
+
+/* static */ void TextLinesSnapshot::run_tests()
+    { run_text_lines_snapshot_tests(); }
+
+namespace {
+
+const std::shared_ptr<const SharedLineIndex> & empty_index() {
+    static const std::shared_ptr<const SharedLineIndex> instance =
+        std::make_shared<const SharedLineIndex>();
+    return instance;
+}
+
+std::vector<std::u32string> lines_of(const TextLinesSnapshot & snapshot) {
+    std::vector<std::u32string> rv;
+    snapshot.for_each_line([&rv](const std::u32string & line)
+        { rv.push_back(line); });
+    return rv;
+}
+
+void run_text_lines_snapshot_tests() {
+    // later edits do not disturb a snapshot
+    {
+    TextLines tlines(U"one\ntwo\nthree");
+    auto snapshot = tlines.snapshot();
+    tlines.push(Cursor(0, 0), U'x');
+    tlines.wipe(Cursor(1, 0), tlines.end_cursor());
+    tlines.push(Cursor(0, 1), TextLines::NEW_LINE);
+    assert(lines_of(snapshot) == std::vector<std::u32string>
+           ({ U"one", U"two", U"three" }));
+    assert(snapshot.version() != tlines.version());
+    assert(lines_of(tlines.snapshot()) == std::vector<std::u32string>
+           ({ U"x", U"one", U"" }));
+    assert(TextLinesSnapshot().line_count() == 0);
+    }
+    // unchanged lines are shared, not copied
+    {
+    std::u32string content;
+    for (int i = 0; i != 5000; ++i)
+        content += U"line " + std::u32string(std::size_t(i % 7), U'x') + U"\n";
+    TextLines tlines(content);
+    auto before = tlines.snapshot();
+    tlines.push(Cursor(2500, 0), U'y');
+    auto after = tlines.snapshot();
+    assert(before.line_count() == after.line_count());
+    for (std::size_t i = 0; i != before.line_count(); ++i) {
+        bool same = before.shared_line(i) == after.shared_line(i);
+        assert(same == (i != 2500));
+        assert(after.shared_line(i) == tlines.lines()[i].shared_content());
+    }
+    }
+    // splicing against a plain vector, with copies held so that chunks are
+    // both edited in place and copied
+    {
+    SharedLineIndex index;
+    std::vector<TextLine::SharedContent> expected;
+    std::vector<SharedLineIndex> copies;
+    unsigned seed = 7;
+    auto next_random = [&seed](std::size_t limit) {
+        seed = seed*1103515245u + 12345u;
+        return limit == 0 ? 0 : std::size_t((seed >> 8) % limit);
+    };
+    for (int round = 0; round != 400; ++round) {
+        auto first = next_random(expected.size() + 1);
+        auto old_count = next_random(std::min(std::size_t(300), expected.size() - first + 1));
+        std::vector<TextLine::SharedContent> new_lines(next_random(700));
+        for (auto & line : new_lines)
+            line = std::make_shared<const std::u32string>(1, UChar(U'a' + round % 26));
+        index.splice(first, old_count, new_lines.data(),
+                     new_lines.data() + new_lines.size());
+        expected.erase(expected.begin() + std::ptrdiff_t(first),
+                       expected.begin() + std::ptrdiff_t(first + old_count));
+        expected.insert(expected.begin() + std::ptrdiff_t(first),
+                        new_lines.begin(), new_lines.end());
+        if (round % 5 == 0) copies.push_back(index);
+        assert(index.size() == expected.size());
+    }
+    for (std::size_t i = 0; i != expected.size(); ++i)
+        assert(index.line(i) == expected[i]);
+    }
+    // a snapshot is read on another thread while this one edits
+    {
+    TextLines tlines(std::u32string(3000, U'a') + U"\n" + std::u32string(200, U'\n'));
+    auto snapshot = tlines.snapshot();
+    std::size_t total = 0;
+    std::thread reader([&snapshot, &total]() {
+        snapshot.for_each_line([&total](const std::u32string & line)
+            { total += line.size(); });
+    });
+    for (int i = 0; i != 100; ++i)
+        tlines.push(Cursor(i, 0), U'b');
+    reader.join();
+    assert(total == 3000);
+    }
+}
+
+} // end of <anonymous> namespace
@@ -0,0 +1,116 @@
+/****************************************************************************
+
+    File: TextLinesSnapshot.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "Cursor.hpp"
+#include "TextLine.hpp"
+
+#include <vector>
+#include <string>
+#include <memory>
+
+/** The content of every line of a TextLines, held in chunks of lines which
+ *  are shared between copies.
+ *
+ *  Copying an index only copies pointers to its chunks. A chunk is only
+ *  copied when it is changed while another index still shares it, so two
+ *  copies cost only as much memory as the chunks where they differ.
+ *
+ *  @note Line contents themselves are immutable, so any number of threads
+ *        may read (copies of) an index at once. Only the owner of an index
+ *        may splice it.
+ */
+class SharedLineIndex {
+public:
+    using SharedContent = TextLine::SharedContent;
+    // chunks are split once they grow past this many lines
+    static constexpr const std::size_t MAX_CHUNK_SIZE = 512;
+
+    SharedLineIndex(): m_size(0) {}
+
+    /** Replaces old_count lines starting from first with the given ones. */
+    void splice(std::size_t first, std::size_t old_count,
+                const SharedContent * beg, const SharedContent * end);
+
+    std::size_t size() const { return m_size; }
+    const SharedContent & line(std::size_t) const;
+
+    /** Calls func(const std::u32string &) for each line in order. */
+    template <typename Func>
+    void for_each_line(Func && func) const;
+
+private:
+    using Chunk = std::vector<SharedContent>;
+    std::size_t chunk_of(std::size_t line) const;
+    void update_starts_from(std::size_t chunk);
+
+    std::vector<std::shared_ptr<Chunk>> m_chunks;
+    // first line of each chunk
+    std::vector<std::size_t> m_starts;
+    std::size_t m_size;
+};
+
+/** A read only view of a TextLines' content as it was at some version,
+ *  which later edits to the TextLines never disturb.
+ *
+ *  Taking a snapshot is O(1), and it may be handed to (and read from) any
+ *  thread.
+ */
+class TextLinesSnapshot {
+public:
+    using SharedContent = TextLine::SharedContent;
+
+    /** An empty document */
+    TextLinesSnapshot();
+    TextLinesSnapshot(std::shared_ptr<const SharedLineIndex>,
+                      std::size_t version, int width_constraint);
+
+    std::size_t line_count() const { return m_index->size(); }
+    const std::u32string & line(std::size_t idx) const
+        { return *m_index->line(idx); }
+    const SharedContent & shared_line(std::size_t idx) const
+        { return m_index->line(idx); }
+
+    template <typename Func>
+    void for_each_line(Func && func) const
+        { m_index->for_each_line(std::forward<Func>(func)); }
+
+    /** @see TextLines::version */
+    std::size_t version() const { return m_version; }
+    int width_constraint() const { return m_width_constraint; }
+
+    static void run_tests();
+private:
+    std::shared_ptr<const SharedLineIndex> m_index;
+    std::size_t m_version;
+    int m_width_constraint;
+};
+
+// ----------------------------------------------------------------------------
+
+template <typename Func>
+void SharedLineIndex::for_each_line(Func && func) const {
+    for (const auto & chunk : m_chunks) {
+        for (const auto & content : *chunk)
+            func(*content);
+    }
+}
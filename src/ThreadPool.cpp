@@ -0,0 +1,196 @@
+/****************************************************************************
+
+    File: ThreadPool.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+#include <cassert>
+
+namespace {
+
+void run_thread_pool_tests();
+
+} // end of <anonymous> namespace
+
+/* explicit */ ThreadPool::ThreadPool(int worker_count):
+    m_stop_requested(false)
+{
+    if (worker_count < 0) {
+        throw std::invalid_argument("ThreadPool::ThreadPool: worker count "
+                                    "must not be negative.");
+    }
+    for (int i = 0; i != worker_count; ++i)
+        m_workers.emplace_back(&ThreadPool::run_worker, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop_requested = true;
+    }
+    m_batch_posted.notify_all();
+    for (auto & worker : m_workers)
+        worker.join();
+}
+
+/* static */ ThreadPool & ThreadPool::shared_instance() {
+    static ThreadPool pool
+        (std::max(0, int(std::thread::hardware_concurrency()) - 1));
+    return pool;
+}
+
+void ThreadPool::run_in_parallel(std::size_t count, const Task & task) {
+    if (count == 0) return;
+    Batch batch;
+    batch.task       = &task;
+    batch.count      = count;
+    batch.unfinished = count;
+    batch.errors.resize(count);
+    if (count > 1) {
+        {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_batches.push_back(&batch);
+        }
+        m_batch_posted.notify_all();
+    }
+    std::size_t idx;
+    while (true) {
+        {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!claim_task(batch, idx)) break;
+        }
+        run_task(batch, idx);
+    }
+    {
+    // tasks claimed by workers may still be running
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_task_finished.wait(lock, [&batch]() { return batch.unfinished == 0; });
+    }
+    for (auto & error : batch.errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+/* static */ void ThreadPool::run_tests()
+    { run_thread_pool_tests(); }
+
+/* private */ void ThreadPool::run_worker() {
+    while (true) {
+        Batch * batch = nullptr;
+        std::size_t idx = 0;
+        {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_batch_posted.wait(lock, [this]()
+            { return m_stop_requested || !m_batches.empty(); });
+        // every batch waits on its own thread, so none are left behind
+        if (m_batches.empty()) return;
+        batch = m_batches.front();
+        claim_task(*batch, idx);
+        }
+        run_task(*batch, idx);
+    }
+}
+
+/* private */ bool ThreadPool::claim_task(Batch & batch, std::size_t & idx) {
+    if (batch.next == batch.count) return false;
+    idx = batch.next++;
+    if (batch.next == batch.count) {
+        auto itr = std::find(m_batches.begin(), m_batches.end(), &batch);
+        if (itr != m_batches.end()) m_batches.erase(itr);
+    }
+    return true;
+}
+
+/* private */ void ThreadPool::run_task(Batch & batch, std::size_t idx) {
+    try {
+        (*batch.task)(idx);
+    } catch (...) {
+        batch.errors[idx] = std::current_exception();
+    }
+    bool batch_finished;
+    {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    batch_finished = (--batch.unfinished == 0);
+    }
+    if (batch_finished) m_task_finished.notify_all();
+}
+
+namespace {
+
+void run_thread_pool_tests() {
+    // every task is run exactly once
+    {
+    ThreadPool pool(3);
+    std::vector<std::atomic<int>> runs(100);
+    for (auto & run : runs) run = 0;
+    pool.run_in_parallel(runs.size(), [&runs](std::size_t idx) { ++runs[idx]; });
+    assert(std::all_of(runs.begin(), runs.end(),
+                       [](const std::atomic<int> & run) { return run == 1; }));
+    pool.run_in_parallel(0, [](std::size_t) { assert(false); });
+    }
+    // without workers, this thread runs each itself
+    {
+    ThreadPool pool(0);
+    assert(pool.thread_count() == 1);
+    const auto this_id = std::this_thread::get_id();
+    std::size_t total = 0;
+    pool.run_in_parallel(10, [&](std::size_t idx) {
+        assert(std::this_thread::get_id() == this_id);
+        total += idx;
+    });
+    assert(total == 45);
+    }
+    // the first exception (by index) is rethrown, once every task returns
+    {
+    ThreadPool pool(2);
+    std::atomic<int> finished(0);
+    bool caught = false;
+    try {
+        pool.run_in_parallel(8, [&finished](std::size_t idx) {
+            ++finished;
+            if (idx == 3) throw std::runtime_error("3");
+            if (idx == 5) throw std::runtime_error("5");
+        });
+    } catch (std::runtime_error & exp) {
+        caught = (std::string(exp.what()) == "3");
+    }
+    assert(caught && finished == 8);
+    }
+    // batches run from inside tasks, and from several threads at once, all
+    // finish even with every worker busy
+    {
+    ThreadPool pool(1);
+    std::atomic<int> total(0);
+    auto nested = [&](std::size_t) {
+        pool.run_in_parallel(4, [&total](std::size_t) { ++total; });
+    };
+    std::thread other([&]() { pool.run_in_parallel(4, nested); });
+    pool.run_in_parallel(4, nested);
+    other.join();
+    assert(total == 32);
+    }
+}
+
+} // end of <anonymous> namespace
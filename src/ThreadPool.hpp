@@ -0,0 +1,90 @@
+/****************************************************************************
+
+    File: ThreadPool.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/** A fixed set of worker threads which work is split across, so that those
+ *  splitting work (building lines, modeling) do not start and join threads
+ *  each time.
+ *
+ *  The thread running a batch of tasks takes part in it, claiming tasks
+ *  just as the workers do. So a batch is always finished, even while every
+ *  worker is busy with another batch (or one run from inside a task).
+ */
+class ThreadPool {
+public:
+    using Task = std::function<void(std::size_t)>;
+
+    /** @param worker_count threads started, besides those running batches */
+    explicit ThreadPool(int worker_count);
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator = (const ThreadPool &) = delete;
+    /** Waits for the workers to finish what they have claimed. */
+    ~ThreadPool();
+
+    /** @return pool with a worker for each hardware thread, but one (for the
+     *          thread running a batch)
+     */
+    static ThreadPool & shared_instance();
+
+    /** Calls task(i) once for each i in [0, count), spread over the workers
+     *  and this thread, returning once each has returned.
+     *  @throws whatever the first task to throw (by index) threw
+     */
+    void run_in_parallel(std::size_t count, const Task & task);
+
+    /** @return most tasks run at once by a single batch */
+    std::size_t thread_count() const { return m_workers.size() + 1; }
+
+    static void run_tests();
+private:
+    struct Batch {
+        const Task * task = nullptr;
+        std::size_t count = 0;
+        // guarded by the pool's mutex
+        std::size_t next = 0;
+        std::size_t unfinished = 0;
+        std::vector<std::exception_ptr> errors;
+    };
+
+    void run_worker();
+    // lock must be held, @return false if every task is claimed
+    bool claim_task(Batch &, std::size_t & idx);
+    void run_task(Batch &, std::size_t idx);
+
+    std::mutex m_mutex;
+    std::condition_variable m_batch_posted;
+    std::condition_variable m_task_finished;
+    // batches with tasks yet to be claimed
+    std::deque<Batch *> m_batches;
+    bool m_stop_requested;
+
+    // must be last, workers may only start once everything else is ready
+    std::vector<std::thread> m_workers;
+};
@@ -0,0 +1,539 @@
+/****************************************************************************
+
+    File: UndoHistory.cpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#include "UndoHistory.hpp"
+#include "SubstringSearcher.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <cassert>
+
+namespace {
+
+void run_undo_history_tests();
+
+} // end of <anonymous> namespace
+
+/* explicit */ UndoHistory::UndoHistory(TextLines & lines):
+    m_lines         (&lines),
+    m_memory_limit  (DEFAULT_MEMORY_LIMIT),
+    m_bytes         (0),
+    m_group_depth   (0),
+    m_group_has_step(false),
+    m_can_coalesce  (false),
+    m_applying      (false)
+{ m_lines->add_edit_listener(this); }
+
+UndoHistory::~UndoHistory() { m_lines->remove_edit_listener(this); }
+
+Cursor UndoHistory::undo() {
+    if (!can_undo()) {
+        throw std::runtime_error("UndoHistory::undo: there is nothing to "
+                                 "undo.");
+    }
+    auto step = std::move(m_undo_steps.back());
+    m_undo_steps.pop_back();
+    m_bytes -= step_memory_usage(step);
+    // operations are undone last to first, as each one's cursors are only
+    // good for the content as it was right after it was made
+    std::vector<Change> changes;
+    changes.reserve(step.size());
+    for (auto itr = step.rbegin(); itr != step.rend(); ++itr) {
+        auto & op = *itr;
+        if (op.kind == Operation::INSERTION)
+            changes.push_back(Change { op.beg, op.end, std::u32string(), &op.text });
+        else
+            changes.push_back(Change { op.beg, op.beg, op.text, nullptr });
+    }
+    Cursor caret;
+    m_applying = true;
+    try {
+        caret = apply(std::move(changes));
+    } catch (...) {
+        m_applying = false;
+        throw;
+    }
+    m_applying = false;
+    m_bytes += step_memory_usage(step);
+    m_redo_steps.push_back(std::move(step));
+    m_group_has_step = m_can_coalesce = false;
+    enforce_memory_limit();
+    return caret;
+}
+
+Cursor UndoHistory::redo() {
+    if (!can_redo()) {
+        throw std::runtime_error("UndoHistory::redo: there is nothing to "
+                                 "redo.");
+    }
+    auto step = std::move(m_redo_steps.back());
+    m_redo_steps.pop_back();
+    m_bytes -= step_memory_usage(step);
+    std::vector<Change> changes;
+    changes.reserve(step.size());
+    for (auto & op : step) {
+        if (op.kind == Operation::INSERTION) {
+            // the characters will be in the document again, no need to keep
+            // a copy
+            changes.push_back(Change { op.beg, op.beg, std::move(op.text), nullptr });
+            std::u32string().swap(op.text);
+        } else {
+            changes.push_back(Change { op.beg, op.end, std::u32string(), nullptr });
+        }
+    }
+    Cursor caret;
+    m_applying = true;
+    try {
+        caret = apply(std::move(changes));
+    } catch (...) {
+        m_applying = false;
+        throw;
+    }
+    m_applying = false;
+    m_bytes += step_memory_usage(step);
+    m_undo_steps.push_back(std::move(step));
+    m_group_has_step = m_can_coalesce = false;
+    enforce_memory_limit();
+    return caret;
+}
+
+void UndoHistory::begin_group() {
+    if (m_group_depth++ == 0)
+        m_group_has_step = false;
+}
+
+void UndoHistory::end_group() {
+    if (m_group_depth == 0) {
+        throw std::runtime_error("UndoHistory::end_group: no group was "
+                                 "begun.");
+    }
+    if (--m_group_depth != 0) return;
+    m_group_has_step = m_can_coalesce = false;
+    enforce_memory_limit();
+}
+
+void UndoHistory::set_memory_limit(std::size_t limit) {
+    m_memory_limit = limit;
+    enforce_memory_limit();
+}
+
+void UndoHistory::clear() {
+    m_undo_steps.clear();
+    m_redo_steps.clear();
+    m_bytes = 0;
+    m_group_has_step = m_can_coalesce = false;
+}
+
+/* static */ void UndoHistory::run_tests() { run_undo_history_tests(); }
+
+/* private */ void UndoHistory::on_insertion
+    (const TextLines &, Cursor beg, Cursor end)
+{ record(Operation { Operation::INSERTION, beg, end, std::u32string() }); }
+
+/* private */ void UndoHistory::on_removal
+    (const TextLines &, Cursor beg, Cursor end, const std::u32string & removed)
+{ record(Operation { Operation::REMOVAL, beg, end, removed }); }
+
+/* private */ void UndoHistory::on_reset(const TextLines &) {
+    // none of the recorded cursors mean anything for the new content
+    if (!m_applying) clear();
+}
+
+/* private */ void UndoHistory::on_group_begin(const TextLines &)
+    { if (!m_applying) begin_group(); }
+
+/* private */ void UndoHistory::on_group_end(const TextLines &)
+    { if (!m_applying) end_group(); }
+
+/* private */ Cursor UndoHistory::apply(std::vector<Change> && changes) {
+    // a run of changes is gathered as ranges of the content as it was before
+    // the run, so that TextLines restructures itself only once for all of it
+    std::vector<CursorRange> ranges;
+    std::vector<std::u32string> texts;
+    enum { ANY_ORDER, ASCENDING, DESCENDING } order = ANY_ORDER;
+    // where the last change ended, before and after it was made
+    Cursor old_end, new_end;
+    auto original_of = [&old_end, &new_end](Cursor cursor) {
+        assert(!(cursor < new_end));
+        if (cursor.line == new_end.line)
+            return Cursor(old_end.line, old_end.column + cursor.column - new_end.column);
+        return Cursor(cursor.line - new_end.line + old_end.line, cursor.column);
+    };
+    auto make_run = [this, &ranges, &texts, &order]() {
+        if (order == DESCENDING) {
+            std::reverse(ranges.begin(), ranges.end());
+            std::reverse(texts .begin(), texts .end());
+        }
+        m_lines->replace_each(ranges, texts);
+        ranges.clear();
+        texts .clear();
+        order = ANY_ORDER;
+    };
+    Cursor caret;
+    for (auto & change : changes) {
+        if (change.beg == change.end && change.text.empty()) continue;
+        if (ranges.empty() && m_lines->lines().empty()) {
+            // there is nothing to replace, this can only be an insertion
+            caret = m_lines->deposit_chatacters_to
+                (change.text.data(), change.text.data() + change.text.size(),
+                 change.beg);
+            continue;
+        }
+        if (!ranges.empty() && change.beg == change.end && change.beg == new_end) {
+            // follows right after the last change's text, whatever the order
+            // (this is how a replacement is both undone and redone)
+            texts.back() += change.text;
+            new_end = caret = TextLines::end_of_insertion(change.beg, change.text);
+            continue;
+        }
+        CursorRange original(change.beg, change.end);
+        if (ranges.empty()) {
+            // the content is still as it was before the run
+        } else if (order != DESCENDING && !(change.beg < new_end)) {
+            order = ASCENDING;
+            original = CursorRange(original_of(change.beg), original_of(change.end));
+        } else if (order != ASCENDING && !(ranges.back().begin < change.end)) {
+            // content preceding every change so far is as it was
+            order = DESCENDING;
+        } else {
+            make_run();
+        }
+        if (change.replaced) {
+            *change.replaced = m_lines->copy_characters_from
+                (original.begin, original.end);
+        }
+        old_end = original.end;
+        new_end = caret = TextLines::end_of_insertion(change.beg, change.text);
+        ranges.push_back(original);
+        texts .push_back(std::move(change.text));
+    }
+    if (!ranges.empty()) make_run();
+    return caret;
+}
+
+/* private */ void UndoHistory::record(Operation && op) {
+    if (m_applying) return;
+    forget_redo_steps();
+    const bool typing = is_typing(op);
+    auto & steps = m_undo_steps;
+    const bool may_coalesce = m_group_depth == 0 && m_can_coalesce && typing;
+    if (m_group_depth > 0 && m_group_has_step) {
+        m_bytes += operation_memory_usage(op);
+        steps.back().push_back(std::move(op));
+    } else if (!may_coalesce || !try_coalescing(steps.back(), op)) {
+        steps.emplace_back();
+        steps.back().push_back(std::move(op));
+        m_bytes += step_memory_usage(steps.back());
+        m_group_has_step = m_group_depth > 0;
+    }
+    m_can_coalesce = m_group_depth == 0 && typing;
+    if (m_group_depth == 0) enforce_memory_limit();
+}
+
+/* private static */ bool UndoHistory::is_typing(const Operation & op) {
+    // one character, which is not a new line
+    return op.beg.line == op.end.line && op.beg.column + 1 == op.end.column;
+}
+
+/* private */ bool UndoHistory::try_coalescing
+    (Step & step, const Operation & new_op)
+{
+    assert(step.size() == 1);
+    auto & old_op = step.front();
+    if (old_op.kind != new_op.kind) return false;
+    const auto old_usage = step_memory_usage(step);
+    if (old_op.kind == Operation::INSERTION) {
+        if (old_op.end != new_op.beg) return false;
+        old_op.end = new_op.end;
+    } else if (new_op.end == old_op.beg) {
+        // backspacing, each character removed is before the last
+        old_op.text.insert(old_op.text.begin(), new_op.text.begin(),
+                           new_op.text.end());
+        old_op.beg = new_op.beg;
+    } else if (new_op.beg == old_op.beg) {
+        // deleting ahead, each character removed was after the last
+        old_op.text += new_op.text;
+        ++old_op.end.column;
+    } else {
+        return false;
+    }
+    m_bytes = m_bytes - old_usage + step_memory_usage(step);
+    return true;
+}
+
+/* private static */ std::size_t UndoHistory::operation_memory_usage
+    (const Operation & op)
+{ return sizeof(Operation) + op.text.capacity()*sizeof(UChar); }
+
+/* private static */ std::size_t UndoHistory::step_memory_usage
+    (const Step & step)
+{
+    std::size_t rv = sizeof(Step);
+    for (const auto & op : step)
+        rv += operation_memory_usage(op);
+    return rv;
+}
+
+/* private */ void UndoHistory::forget_redo_steps() {
+    for (const auto & step : m_redo_steps)
+        m_bytes -= step_memory_usage(step);
+    m_redo_steps.clear();
+}
+
+/* private */ void UndoHistory::enforce_memory_limit() {
+    // oldest undo steps go first, then the furthest redo steps, the steps
+    // nearest the present are kept no matter what
+    while (m_bytes > m_memory_limit && m_undo_steps.size() > 1) {
+        m_bytes -= step_memory_usage(m_undo_steps.front());
+        m_undo_steps.pop_front();
+    }
+    while (m_bytes > m_memory_limit && m_redo_steps.size() > 1) {
+        m_bytes -= step_memory_usage(m_redo_steps.front());
+        m_redo_steps.pop_front();
+    }
+}
+
+namespace {
+
+std::u32string content_of(const TextLines & tlines) {
+    if (tlines.lines().empty()) return std::u32string();
+    return tlines.copy_characters_from(Cursor(), tlines.end_cursor());
+}
+
+Cursor type_string(TextLines & tlines, const std::u32string & str, Cursor cur) {
+    for (auto c : str)
+        cur = tlines.push(cur, c);
+    return cur;
+}
+
+void run_undo_history_tests() {
+    // typing is coalesced, new lines begin new steps
+    {
+    TextLines tlines;
+    UndoHistory history(tlines);
+    auto cur = type_string(tlines, U"ab", Cursor());
+    cur = tlines.push(cur, TextLines::NEW_LINE);
+    type_string(tlines, U"cd", cur);
+    assert(content_of(tlines) == U"ab\ncd");
+    assert(history.undo() == Cursor(1, 0));
+    assert(content_of(tlines) == U"ab\n");
+    history.undo();
+    assert(content_of(tlines) == U"ab");
+    assert(history.undo() == Cursor(0, 0));
+    assert(content_of(tlines) == U"" && !history.can_undo());
+    history.redo();
+    history.redo();
+    assert(history.redo() == Cursor(1, 2));
+    assert(content_of(tlines) == U"ab\ncd" && !history.can_redo());
+    }
+    // typing elsewhere is a new step
+    {
+    TextLines tlines(U"abc");
+    UndoHistory history(tlines);
+    tlines.push(Cursor(0, 3), U'd');
+    tlines.push(Cursor(0, 0), U'x');
+    history.undo();
+    assert(content_of(tlines) == U"abcd");
+    }
+    // backspace and delete runs are coalesced
+    {
+    TextLines tlines(U"hello world");
+    UndoHistory history(tlines);
+    Cursor cur(0, 5);
+    for (int i = 0; i != 3; ++i)
+        cur = tlines.delete_behind(cur);
+    assert(content_of(tlines) == U"he world");
+    history.break_coalescing();
+    for (int i = 0; i != 3; ++i)
+        tlines.delete_ahead(Cursor(0, 3));
+    assert(content_of(tlines) == U"he ld");
+    history.undo();
+    assert(content_of(tlines) == U"he world");
+    assert(history.undo() == Cursor(0, 5));
+    assert(content_of(tlines) == U"hello world");
+    history.redo();
+    history.redo();
+    assert(content_of(tlines) == U"he ld");
+    }
+    // removing, and merging lines
+    {
+    TextLines tlines(U"first\nsecond\nthird\nfourth");
+    UndoHistory history(tlines);
+    tlines.wipe(Cursor(0, 2), Cursor(2, 3));
+    tlines.delete_behind(Cursor(1, 0));
+    assert(content_of(tlines) == U"firdfourth");
+    tlines.wipe(Cursor(0, 1), tlines.end_cursor());
+    assert(content_of(tlines) == U"f");
+    history.undo();
+    history.undo();
+    history.undo();
+    assert(content_of(tlines) == U"first\nsecond\nthird\nfourth");
+    }
+    // typing at the end cursor begins a new line
+    {
+    TextLines tlines(U"abc");
+    UndoHistory history(tlines);
+    tlines.push(tlines.end_cursor(), U'x');
+    assert(content_of(tlines) == U"abc\nx");
+    history.undo();
+    assert(content_of(tlines) == U"abc" && tlines.lines().size() == 1);
+    history.redo();
+    assert(content_of(tlines) == U"abc\nx");
+    }
+    // a large paste costs (almost) nothing to record, only its undone text
+    // is held
+    {
+    std::u32string paste;
+    for (int i = 0; i != 20000; ++i)
+        paste += U"local x = 1\n";
+    TextLines tlines(U"before after");
+    UndoHistory history(tlines);
+    tlines.deposit_chatacters_to(paste.data(), paste.data() + paste.size(),
+                                 Cursor(0, 7));
+    assert(tlines.lines().size() == 20001);
+    assert(history.memory_usage() < 1024);
+    history.undo();
+    assert(content_of(tlines) == U"before after");
+    assert(history.memory_usage() >= paste.size()*sizeof(UChar));
+    history.redo();
+    assert(content_of(tlines) == U"before " + paste + U"after");
+    assert(history.memory_usage() < 1024);
+    }
+    // groups are a single step
+    {
+    TextLines tlines(U"one two");
+    UndoHistory history(tlines);
+    history.begin_group();
+    tlines.wipe(Cursor(0, 0), Cursor(0, 3));
+    history.begin_group();
+    type_string(tlines, U"three", Cursor(0, 0));
+    history.end_group();
+    tlines.push(Cursor(0, 5), TextLines::NEW_LINE);
+    history.end_group();
+    assert(content_of(tlines) == U"three\n two");
+    history.undo();
+    assert(content_of(tlines) == U"one two" && !history.can_undo());
+    history.redo();
+    assert(content_of(tlines) == U"three\n two");
+    }
+    // a new edit discards what could be redone
+    {
+    TextLines tlines(U"abc");
+    UndoHistory history(tlines);
+    tlines.delete_ahead(Cursor(0, 0));
+    history.undo();
+    tlines.push(Cursor(0, 0), U'x');
+    assert(!history.can_redo());
+    }
+    // oldest steps are forgotten past the memory limit
+    {
+    TextLines tlines(std::u32string(1000, U'a'));
+    UndoHistory history(tlines);
+    for (int i = 0; i != 10; ++i) {
+        tlines.wipe(Cursor(0, 0), Cursor(0, 50));
+        history.break_coalescing();
+    }
+    auto usage = history.memory_usage();
+    history.set_memory_limit(usage / 2);
+    assert(history.memory_usage() <= usage / 2 && history.can_undo());
+    int undos = 0;
+    for (; history.can_undo(); ++undos) history.undo();
+    assert(undos > 0 && undos < 10);
+    // though the most recent is kept however large
+    tlines.wipe(Cursor(0, 0), Cursor(0, 500));
+    history.set_memory_limit(1);
+    assert(history.can_undo());
+    }
+    // a replace-all is one step
+    {
+    TextLines tlines(U"a-b-c\nd-e");
+    UndoHistory history(tlines);
+    tlines.push(Cursor(1, 3), U'f');
+    tlines.replace_all({ CursorRange(Cursor(0, 1), Cursor(0, 2)),
+                         CursorRange(Cursor(0, 3), Cursor(1, 1)),
+                         CursorRange(Cursor(1, 1), Cursor(1, 2)) }, U"\n");
+    assert(content_of(tlines) == U"a\nb\n\nef");
+    history.undo();
+    assert(content_of(tlines) == U"a-b-c\nd-ef");
+    history.redo();
+    assert(content_of(tlines) == U"a\nb\n\nef");
+    history.undo();
+    history.undo();
+    assert(content_of(tlines) == U"a-b-c\nd-e" && !history.can_undo());
+    }
+    // random groups of edits, all undone then all redone
+    {
+    unsigned seed = 5;
+    auto next_random = [&seed](std::size_t limit) {
+        seed = seed*1103515245u + 12345u;
+        return limit == 0 ? 0 : int((seed >> 8) % limit);
+    };
+    auto random_cursor = [&next_random](const TextLines & tlines) {
+        int line = next_random(tlines.lines().size());
+        return Cursor(line, next_random(tlines.lines()[std::size_t(line)].content().size() + 1));
+    };
+    TextLines tlines(U"ab\ncd-ef\n-\ng");
+    UndoHistory history(tlines);
+    std::vector<std::u32string> contents = { content_of(tlines) };
+    for (int round = 0; round != 60; ++round) {
+        history.begin_group();
+        for (int i = next_random(4) + 1; i != 0; --i) {
+            auto beg = random_cursor(tlines);
+            auto end = random_cursor(tlines);
+            if (end < beg) std::swap(beg, end);
+            switch (next_random(4)) {
+            case 0: tlines.push(beg, U"x\n"[next_random(2)]); break;
+            case 1: tlines.wipe(beg, end); break;
+            case 2: tlines.replace_all({ CursorRange(beg, end) }, U"y\nz"); break;
+            case 3: {
+                tlines.replace_all(SubstringSearcher(U"-").find_all(tlines),
+                                   next_random(2) ? U"-\n-" : U"");
+                break;
+            }
+            }
+        }
+        history.end_group();
+        if (content_of(tlines) != contents.back())
+            contents.push_back(content_of(tlines));
+    }
+    for (auto itr = contents.rbegin() + 1; itr != contents.rend(); ++itr) {
+        while (content_of(tlines) != *itr) history.undo();
+    }
+    while (history.can_undo()) history.undo();
+    assert(content_of(tlines) == contents.front());
+    for (auto itr = contents.begin() + 1; itr != contents.end(); ++itr) {
+        while (content_of(tlines) != *itr) history.redo();
+    }
+    assert(content_of(tlines) == contents.back());
+    }
+    // replacing all content forgets everything
+    {
+    TextLines tlines(U"abc");
+    UndoHistory history(tlines);
+    tlines.push(Cursor(0, 0), U'x');
+    tlines.set_content(U"new\ncontent");
+    assert(!history.can_undo() && history.memory_usage() == 0);
+    assert(content_of(tlines) == U"new\ncontent");
+    }
+}
+
+} // end of <anonymous> namespace
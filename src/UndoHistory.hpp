@@ -0,0 +1,140 @@
+/****************************************************************************
+
+    File: UndoHistory.hpp
+    Author: Andrew Janke
+    License: GPLv3
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*****************************************************************************/
+
+#pragma once
+
+#include "TextLines.hpp"
+
+#include <deque>
+#include <vector>
+#include <string>
+
+/** Records every edit made to a TextLines so that it may be undone and
+ *  redone.
+ *
+ *  Edits are kept as deltas, never as copies of the document. An insertion
+ *  is recorded only by where it begins and ends, its characters are copied
+ *  out only when it is undone (so that it may be redone). A removal keeps the
+ *  characters it removed. Consecutive typing (or backspacing, or deleting)
+ *  is coalesced into a single step.
+ *
+ *  Once the recorded steps use more memory than the limit, the oldest are
+ *  forgotten. The steps nearest the present (the last one made, and the
+ *  next one to redo) are always kept, however large.
+ */
+class UndoHistory final : public TextLines::EditListener {
+public:
+    static constexpr const std::size_t DEFAULT_MEMORY_LIMIT = 64*1024*1024;
+
+    /** Starts listening to the given lines.
+     *  @warning Does not in anyway maintain ownership over the given object.
+     *           Given object must survive the life of this object.
+     */
+    explicit UndoHistory(TextLines &);
+    ~UndoHistory() override;
+
+    UndoHistory(const UndoHistory &) = delete;
+    UndoHistory & operator = (const UndoHistory &) = delete;
+
+    bool can_undo() const { return !m_undo_steps.empty(); }
+    bool can_redo() const { return !m_redo_steps.empty(); }
+
+    /** Reverts the most recent step.
+     *  @return where the user's cursor should now be
+     */
+    Cursor undo();
+
+    /** Reapplies the most recently undone step.
+     *  @return where the user's cursor should now be
+     */
+    Cursor redo();
+
+    /** All edits made between these calls are undone/redone as one step.
+     *  Groups may be nested, only the outermost one counts.
+     */
+    void begin_group();
+    void end_group();
+
+    /** The next edit always starts a new step, for instance when the user
+     *  moves the cursor elsewhere.
+     */
+    void break_coalescing() { m_can_coalesce = false; }
+
+    void set_memory_limit(std::size_t);
+    std::size_t memory_limit() const { return m_memory_limit; }
+    /** @return approximate memory used by undo and redo steps */
+    std::size_t memory_usage() const { return m_bytes; }
+
+    void clear();
+
+    static void run_tests();
+private:
+    struct Operation {
+        enum Kind { INSERTION, REMOVAL };
+        Kind kind;
+        Cursor beg;
+        Cursor end;
+        // for removals, the characters removed
+        // for insertions, the characters inserted, only while undone
+        std::u32string text;
+    };
+    using Step = std::vector<Operation>;
+    // replaces [beg, end) (of the content as it is when applied) with text
+    struct Change {
+        Cursor beg;
+        Cursor end;
+        std::u32string text;
+        // if not null, where the replaced characters are to be kept
+        std::u32string * replaced;
+    };
+
+    void on_insertion(const TextLines &, Cursor beg, Cursor end) override;
+    void on_removal(const TextLines &, Cursor beg, Cursor end,
+                    const std::u32string & removed) override;
+    void on_reset(const TextLines &) override;
+    void on_group_begin(const TextLines &) override;
+    void on_group_end  (const TextLines &) override;
+
+    // changes are made one after the other, though runs of them which
+    // each follow (or each precede) the last are made all at once
+    // @return cursor at the end of the last change's text
+    Cursor apply(std::vector<Change> &&);
+    void record(Operation &&);
+    static bool is_typing(const Operation &);
+    // @return true if the operation was merged into the step's only one
+    bool try_coalescing(Step &, const Operation &);
+    static std::size_t operation_memory_usage(const Operation &);
+    static std::size_t step_memory_usage(const Step &);
+    void forget_redo_steps();
+    void enforce_memory_limit();
+
+    TextLines * m_lines;
+    std::deque<Step> m_undo_steps;
+    // the next step to redo is at the back
+    std::deque<Step> m_redo_steps;
+    std::size_t m_memory_limit;
+    std::size_t m_bytes;
+    int m_group_depth;
+    bool m_group_has_step;
+    bool m_can_coalesce;
+    // edits made by undo/redo themselves are not recorded
+    bool m_applying;
+};
@@ -84,11 +84,26 @@ void UserTextSelection::page_up
 void UserTextSelection::push(TextLines * textlines, UChar uchar) {
     verify_text_lines_pointer("UserTextSelection::push", textlines);
     if (m_alt_held && m_primary != m_alt) {
+        // the selection is typed over as one edit
+        TextLines::Transaction transaction(*textlines);
         m_primary = textlines->wipe(begin(), end());
+        m_alt = m_primary = textlines->push(m_primary, uchar);
+        return;
     }
     m_alt = m_primary = textlines->push(m_primary, uchar);
 }
 
+void UserTextSelection::paste
+    (TextLines * textlines, const std::u32string & text)
+{
+    verify_text_lines_pointer("UserTextSelection::paste", textlines);
+    TextLines::Transaction transaction(*textlines);
+    if (m_primary != m_alt)
+        m_primary = textlines->wipe(begin(), end());
+    m_alt = m_primary = textlines->deposit_chatacters_to
+        (text.data(), text.data() + text.size(), m_primary);
+}
+
 void UserTextSelection::delete_ahead(TextLines * textlines) {
     verify_text_lines_pointer("UserTextSelection::delete_ahead", textlines);
     if (m_alt_held) {
@@ -311,6 +326,19 @@ void do_user_text_selection_tests() {
     assert(!uts.contains(Cursor(1, 8)));
     assert(!uts.contains(Cursor(3, 2)));
     }
+    // 18. paste over a selection
+    {
+    TextLines tlines(U"sample text\nsecond");
+    UserTextSelection uts(Cursor(0, 7));
+    uts.hold_alt_cursor();
+    do_n_times(6, [&](){ uts.move_right(tlines); });
+    uts.release_alt_cursor();
+    uts.paste(&tlines, U"text\npasted\n");
+    assert(tlines.copy_characters_from(Cursor(), tlines.end_cursor()) ==
+           U"sample text\npasted\necond");
+    assert(uts.begin() == uts.end() && uts.begin() == Cursor(2, 0));
+    assert(!tlines.in_transaction());
+    }
 }
 
 } // end of <anonymous> namespace
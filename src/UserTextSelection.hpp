@@ -42,6 +42,10 @@ public:
     void page_up   (const TextLines &, int page_size);
 
     void push         (TextLines *, UChar);
+    /** Replaces the selection (if any) with the given characters, as one
+     *  edit.
+     */
+    void paste        (TextLines *, const std::u32string &);
     void delete_ahead (TextLines *);
     void delete_behind(TextLines *);
 
@@ -20,11 +20,15 @@
 *****************************************************************************/
 
 #include <cstdint>
+#include <cstdio>
 #include <cassert>
 
 #include <vector>
+#include <utility>
 #include <set>
+#include <deque>
 #include <fstream>
+#include <iostream>
 
 #include <ksg/Widget.hpp>
 #include <ksg/Frame.hpp>
@@ -37,6 +41,24 @@
 #include "KsgTextGrid.hpp"
 #include "UserTextSelection.hpp"
 #include "LuaCodeModeler.hpp"
+#include "BackgroundModeler.hpp"
+#include "ModelCache.hpp"
+#include "ModelingScheduler.hpp"
+#include "UndoHistory.hpp"
+#include "SubstringSearcher.hpp"
+#include "RegexSearcher.hpp"
+#include "MultiTextSelection.hpp"
+#include "AnchorRegistry.hpp"
+#include "LineOffsetIndex.hpp"
+#include "DocumentWriter.hpp"
+#include "EditJournal.hpp"
+#include "DocumentReader.hpp"
+#include "MappedDocument.hpp"
+#include "FileFollower.hpp"
+#include "DocumentReloader.hpp"
+#include "DocumentDiff.hpp"
+#include "ModelStore.hpp"
+#include "ThreadPool.hpp"
 
 constexpr const auto * const SAMPLE_CODE =
     U"function do_something(a, b)\n"
@@ -54,10 +76,27 @@ constexpr const auto * const SAMPLE_CODE =
      "    return self\n"
      "end";
 
+// where the document goes when saved (Ctrl+S)
+constexpr const auto * const SAVE_FILENAME = "ksg-te-document.lua";
+
+// lines modeled on the UI thread (by the scheduler, or as they're edited)
+// are looked up in a cache of about this many lines first
+constexpr const std::size_t MODEL_CACHE_CAPACITY = 16384;
+
+// stands in for the journal checkpoint of a save made with no journal
+constexpr const std::size_t NO_CHECKPOINT = std::size_t(-1);
+
 void handle_event(TextLines *, const sf::Event &);
 void handle_event(UserTextSelection *, TextLines * tlines, const sf::Event &);
 std::u32string load_ascii_textfile(const char * filename);
 int bottom_offset(const TextLines &, const TargetTextGrid &);
+// first line, and one past the last line, which appear on the grid when
+// rendered at the given offset
+std::pair<int, int> visible_line_range
+    (const TextLines &, const TargetTextGrid &, int offset);
+// each selection, with each bare caret shown as the one cell it sits on
+std::vector<CursorRange> highlights_of(const MultiTextSelection &);
+std::unique_ptr<CodeModeler> make_lua_modeler();
 class TextTyperBot;
 
 std::u32string expand_char_width(const std::string & str) {
@@ -68,12 +107,69 @@ std::u32string expand_char_width(const std::string & str) {
 
 class EditorDialog final : public ksg::Frame {
 public:
-    EditorDialog(): m_delay(false) {}
+    EditorDialog():
+        m_model_cache(MODEL_CACHE_CAPACITY),
+        m_delay(false),
+        m_background_modeler(make_lua_modeler),
+        m_modeling_scheduler(make_lua_modeler()),
+        m_undo_history(m_lines),
+        m_reloader(m_lines),
+        m_filename(SAVE_FILENAME),
+        m_loading(false),
+        m_file_version(0),
+        m_models_stored(true),
+        m_restored_version(std::size_t(-1)),
+        m_view_line(0)
+    {}
     ~EditorDialog() override;
     void setup_dialog(const sf::Font &);
+    /** Replaces the document with the file's content, which is loaded in
+     *  the background (and shown as it is loaded).
+     */
+    void open(const std::string & filename);
+    /** Shows the file read-only, mapped rather than loaded, for files too
+     *  large to edit (such as logs).
+     */
+    void view(const std::string & filename);
+    /** Shows the file as it is written to (such as a log), read-only until
+     *  following is stopped (with escape).
+     */
+    void follow(const std::string & filename);
     void process_event(const sf::Event &) override;
     void do_update(float et, TextTyperBot &);
 private:
+    // @return true if the event was an undo or redo
+    bool handle_undo_event(const sf::Event &);
+    // @return true if the event began or ended a search
+    bool handle_search_event(const sf::Event &);
+    // @return true if the event was taken by (or began) editing at many
+    //         places at once
+    bool handle_multi_selection_event(const sf::Event &);
+    // @return true if the event was a save
+    bool handle_save_event(const sf::Event &);
+    // @return true if the event was a reload (of the file, changed elsewhere)
+    bool handle_reload_event(const sf::Event &);
+    // empties the document, which is to be read from the given file
+    // (no journal is kept until it is)
+    void clear_document(const std::string & filename);
+    // journals edits from here on, setting aside any journal a crash left
+    // for the file, whose edits are replayed if asked to (they only follow
+    // from the file's content)
+    void start_journal(bool recover_edits);
+    // scrolls the read-only view
+    void handle_view_event(const sf::Event &);
+    // stops following on escape, anything else is ignored while following
+    void handle_follow_event(const sf::Event &);
+    // appends whatever has been written to the followed file
+    void update_following();
+    // hands the loaded document whatever models were stored for its file
+    void restore_models();
+    // stores the document's models for the next time its file is opened,
+    // if it is as the file is and they have not been stored already
+    void store_models();
+
+    // must outlive the lines which use it
+    ModelCache m_model_cache;
     TextLines m_lines;
 
     KsgTextGrid m_grid;
@@ -84,6 +180,38 @@ private:
     Cursor m_cursor;
     UserTextSelection m_user_selection;
     RenderOptions m_render_options;
+    BackgroundModeler m_background_modeler;
+    ModelingScheduler m_modeling_scheduler;
+    UndoHistory m_undo_history;
+    // only lines changed in the file are edited, and may be undone
+    DocumentReloader m_reloader;
+    // matches are highlighted while there is a search
+    std::unique_ptr<RegexSearcher> m_search;
+    // while not empty, editing happens at each of these instead
+    MultiTextSelection m_multi_selection;
+    DocumentWriter m_writer;
+    // where the document is saved (and was opened from)
+    std::string m_filename;
+    // edits since the last save, in case of a crash
+    // (none while the document is being loaded, nor before a document
+    // which was not opened is first saved)
+    std::unique_ptr<EditJournal> m_journal;
+    // journal checkpoint of each save posted, yet to finish
+    std::deque<std::size_t> m_save_checkpoints;
+    DocumentReader m_reader;
+    bool m_loading;
+    // version of the document which is as its file is (as loaded or last
+    // saved), its models are stored once every line is modeled
+    std::size_t m_file_version;
+    bool m_models_stored;
+    ModelStoreWriter m_store_writer;
+    // version of the document which took models from a store, there is no
+    // need to model it in the background, the scheduler's pass checks them
+    std::size_t m_restored_version;
+    // while set, this is shown (from the given line) instead of m_lines
+    std::unique_ptr<MappedDocument> m_view;
+    std::size_t m_view_line;
+    FileFollower m_follower;
 };
 
 class TextTyperBot {
@@ -102,12 +230,33 @@ private:
     Cursor m_curent_cursor;
 };
 
-int main() {
+int main(int argc, char ** argv) {
 #   ifndef NDEBUG
     TextLineImage    ::run_tests();
     TextLine         ::run_tests();
     TextLines        ::run_tests();
     UserTextSelection::run_tests();
+    LuaCodeModeler   ::run_tests();
+    BackgroundModeler::run_tests();
+    ParallelModeler  ::run_tests();
+    ModelCache       ::run_tests();
+    ModelingScheduler::run_tests();
+    UndoHistory      ::run_tests();
+    TextLinesSnapshot::run_tests();
+    SubstringSearcher::run_tests();
+    RegexSearcher    ::run_tests();
+    MultiTextSelection::run_tests();
+    AnchorRegistry   ::run_tests();
+    LineOffsetIndex  ::run_tests();
+    DocumentWriter   ::run_tests();
+    EditJournal      ::run_tests();
+    DocumentReader   ::run_tests();
+    MappedDocument   ::run_tests();
+    FileFollower     ::run_tests();
+    DocumentReloader ::run_tests();
+    DocumentDiff     ::run_tests();
+    ModelStore       ::run_tests();
+    ThreadPool       ::run_tests();
 #   endif
     {
     TextLine tline;
@@ -115,13 +264,22 @@ int main() {
     }
     EditorDialog editor;
     TextTyperBot bot;
-    (void)bot.set_content(load_ascii_textfile("vector.lua")).set_type_rate(0.0075);
+    // "--view <file>" shows a file read-only, "--follow <file>" shows it as
+    // it is written to
+    const bool view_only = argc >= 3 && std::string(argv[1]) == "--view";
+    const bool follow    = argc >= 3 && std::string(argv[1]) == "--follow";
+    // with no file to open, the bot types one out instead
+    if (argc < 2)
+        (void)bot.set_content(load_ascii_textfile("vector.lua")).set_type_rate(0.0075);
 
     sf::Font font;
     if (!font.loadFromFile("SourceCodePro-Regular.ttf")) {
         throw std::runtime_error("Cannot load font");
     }
     editor.setup_dialog(font);
+    if (view_only)      editor.view(argv[2]);
+    else if (follow)    editor.follow(argv[2]);
+    else if (argc >= 2) editor.open(argv[1]);
 
     auto editor_width  = unsigned(editor.width ());
     auto editor_height = unsigned(editor.height());
@@ -166,6 +324,7 @@ void EditorDialog::setup_dialog(const sf::Font & font) {
         m_render_options.add_keyword(keyword);
     m_lines.constrain_to_width(m_grid.width_in_cells());
     m_lines.assign_render_options(m_render_options);
+    m_lines.assign_model_cache(&m_model_cache);
     //m_lines.set_content(U"'l'l\nd");
 
     m_grid.assign_font(font);
@@ -183,10 +342,52 @@ void EditorDialog::setup_dialog(const sf::Font & font) {
     update_geometry();
 }
 
+void EditorDialog::open(const std::string & filename) {
+    clear_document(filename);
+    m_reader.open(filename);
+    m_loading = true;
+}
+
+void EditorDialog::follow(const std::string & filename) {
+    clear_document(filename);
+    m_follower.follow(filename);
+}
+
+/* private */ void EditorDialog::clear_document(const std::string & filename) {
+    // what was journaled for the last document is left as it is
+    m_journal.reset();
+    m_follower.stop();
+    m_save_checkpoints.clear();
+    m_multi_selection.clear();
+    m_search.reset();
+    m_render_options.clear_highlights();
+    m_user_selection = UserTextSelection();
+    m_lines.set_content(U"");
+    m_filename = filename;
+    // until it is loaded
+    m_models_stored    = true;
+    m_restored_version = std::size_t(-1);
+}
+
+void EditorDialog::view(const std::string & filename) {
+    m_view.reset(new MappedDocument(filename));
+    m_view->assign_render_options(m_render_options);
+    m_view_line = 0;
+}
+
 void EditorDialog::process_event(const sf::Event & event) {
     Frame::process_event(event);
+    if (m_view) return handle_view_event(event);
+    if (m_follower.is_following()) return handle_follow_event(event);
     auto old_selection = m_user_selection;
-    handle_event(&m_user_selection, &m_lines, event);
+    auto old_version   = m_lines.version();
+    if (!handle_undo_event(event) && !handle_save_event(event) &&
+        !handle_reload_event(event) &&
+        !handle_multi_selection_event(event) && !handle_search_event(event))
+    { handle_event(&m_user_selection, &m_lines, event); }
+    // the user moved elsewhere, typing from here is a new undo step
+    if (old_version == m_lines.version() && old_selection != m_user_selection)
+        m_undo_history.break_coalescing();
     if (old_selection != m_user_selection) {
         m_render_options.set_text_selection(m_user_selection);
         m_render_options.toggle_cursor_flash();
@@ -194,22 +395,282 @@ void EditorDialog::process_event(const sf::Event & event) {
     }
 }
 
+/* private */ bool EditorDialog::handle_undo_event(const sf::Event & event) {
+    if (event.type != sf::Event::KeyPressed || !event.key.control) return false;
+    if (event.key.code == sf::Keyboard::Z && m_undo_history.can_undo()) {
+        m_user_selection = UserTextSelection(m_undo_history.undo());
+    } else if (event.key.code == sf::Keyboard::Y && m_undo_history.can_redo()) {
+        m_user_selection = UserTextSelection(m_undo_history.redo());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* private */ bool EditorDialog::handle_save_event(const sf::Event & event) {
+    if (event.type != sf::Event::KeyPressed || !event.key.control ||
+        event.key.code != sf::Keyboard::S)
+    { return false; }
+    // a partly loaded document is not saved over the file
+    if (m_loading) return true;
+    // a document which was not opened is journaled from its first save
+    if (!m_journal) start_journal(false);
+    // written out on the writer's thread, editing carries on meanwhile
+    m_save_checkpoints.push_back(m_journal ? m_journal->checkpoint() : NO_CHECKPOINT);
+    m_writer.post(m_lines, m_filename);
+    return true;
+}
+
+/* private */ void EditorDialog::handle_view_event(const sf::Event & event) {
+    if (event.type != sf::Event::KeyPressed) return;
+    const auto page = std::size_t(m_doc.height());
+    switch (event.key.code) {
+    case sf::Keyboard::Up      : m_view_line -= std::min(m_view_line, std::size_t(1)); break;
+    case sf::Keyboard::PageUp  : m_view_line -= std::min(m_view_line, page); break;
+    case sf::Keyboard::Down    : ++m_view_line; break;
+    case sf::Keyboard::PageDown: m_view_line += page; break;
+    case sf::Keyboard::Home    : m_view_line = 0; break;
+    // only here is the whole file indexed
+    case sf::Keyboard::End     : m_view_line = m_view->line_count() - 1; break;
+    default: return;
+    }
+    // scrolling past the last line is left at it
+    if (!m_view->has_line(m_view_line))
+        m_view_line = m_view->line_count() - 1;
+}
+
+/* private */ void EditorDialog::handle_follow_event(const sf::Event & event) {
+    if (event.type != sf::Event::KeyPressed ||
+        event.key.code != sf::Keyboard::Escape)
+    { return; }
+    m_follower.stop();
+    // from here on it is edited as any other document
+    start_journal(true);
+}
+
+/* private */ void EditorDialog::start_journal(bool recover_edits) {
+    const auto filename = EditJournal::journal_name_for(m_filename);
+    std::string crashed;
+    try {
+        if (EditJournal::has_unsaved_edits(filename))
+            crashed = EditJournal::set_aside(filename);
+        m_journal.reset(new EditJournal(m_lines, filename));
+    } catch (std::runtime_error & exp) {
+        std::cerr << exp.what() << std::endl;
+        m_journal.reset();
+    }
+    if (crashed.empty()) return;
+    if (m_journal && recover_edits) {
+        try {
+            // replayed through the new journal, so they are journaled again
+            // (and may be undone)
+            (void)EditJournal::recover(crashed, m_lines);
+            m_journal->sync();
+            std::remove(crashed.c_str());
+            return;
+        } catch (std::runtime_error & exp) {
+            std::cerr << exp.what() << std::endl;
+        }
+    }
+    std::cerr << "Edits which were never saved are left at \"" << crashed
+              << "\"." << std::endl;
+}
+
+/* private */ void EditorDialog::update_following() {
+    const auto version   = m_lines.version();
+    const auto last_line = std::max<std::size_t>(m_lines.lines().size(), 1) - 1;
+    auto res = FileFollower::NOTHING_NEW;
+    try {
+        res = m_follower.append_new_to(m_lines);
+    } catch (std::runtime_error & exp) {
+        std::cerr << exp.what() << std::endl;
+        m_follower.stop();
+        return;
+    }
+    if (res == FileFollower::NOTHING_NEW) return;
+    // only the new lines are modeled, rather than the pass starting over
+    if (res == FileFollower::APPENDED)
+        m_modeling_scheduler.resume_after_append(m_lines, last_line, version);
+    // what the file has is not something to undo
+    m_undo_history.clear();
+}
+
+/* private */ void EditorDialog::restore_models() {
+    m_file_version  = m_lines.version();
+    m_models_stored = false;
+    const auto modeler = make_lua_modeler();
+    try {
+        ModelStore store(ModelStore::store_name_for(m_filename));
+        // a store for the same content need not be written again
+        m_models_stored = store.matches(m_lines, *modeler);
+        if (store.apply_to(m_lines, *modeler) != 0)
+            m_restored_version = m_lines.version();
+    } catch (std::runtime_error &) {
+        // no store yet (or none of any use), so one is written once the
+        // document is modeled
+    }
+}
+
+/* private */ void EditorDialog::store_models() {
+    if (m_models_stored || m_loading || m_follower.is_following() ||
+        m_lines.version() != m_file_version)
+    { return; }
+    m_models_stored = true;
+    try {
+        // only packed here, it is written on the store writer's thread
+        m_store_writer.post(m_lines, *make_lua_modeler(),
+                            ModelStore::store_name_for(m_filename));
+    } catch (std::runtime_error & exp) {
+        std::cerr << exp.what() << std::endl;
+    }
+}
+
+/* private */ bool EditorDialog::handle_reload_event(const sf::Event & event) {
+    if (event.type != sf::Event::KeyPressed || !event.key.control ||
+        event.key.code != sf::Keyboard::R)
+    { return false; }
+    if (m_loading) return true;
+    m_multi_selection.clear();
+    try {
+        (void)m_reloader.reload_file(m_filename);
+    } catch (std::runtime_error & exp) {
+        std::cerr << exp.what() << std::endl;
+    }
+    // lines may be gone from under it
+    m_user_selection = UserTextSelection
+        (m_lines.constrain_cursor(m_user_selection.end()));
+    return true;
+}
+
+/* private */ bool EditorDialog::handle_search_event(const sf::Event & event) {
+    if (event.type != sf::Event::KeyPressed) return false;
+    if (event.key.code == sf::Keyboard::Escape && m_search) {
+        m_search.reset();
+        m_render_options.clear_highlights();
+        return true;
+    }
+    if (event.key.code != sf::Keyboard::F || !event.key.control) return false;
+    // searches for whatever is selected (on one line)
+    auto beg = m_user_selection.begin();
+    auto end = m_user_selection.end();
+    if (beg == end || beg.line != end.line) return true;
+    m_search.reset(new RegexSearcher
+        (m_lines, RegexSearcher::escape(m_lines.copy_characters_from(beg, end))));
+    return true;
+}
+
+/* private */ bool EditorDialog::handle_multi_selection_event
+    (const sf::Event & event)
+{
+    bool control = event.type == sf::Event::KeyPressed && event.key.control;
+    // every match of the search is selected
+    if (control && event.key.code == sf::Keyboard::D && m_search) {
+        m_multi_selection = MultiTextSelection
+            (m_search->matches_on_lines(0, int(m_lines.lines().size())));
+        return true;
+    }
+    if (m_multi_selection.empty() || control) return false;
+    switch (event.type) {
+    case sf::Event::KeyPressed:
+        switch (event.key.code) {
+        case sf::Keyboard::Escape:
+            m_multi_selection.clear();
+            m_render_options.clear_highlights();
+            break;
+        case sf::Keyboard::Delete:
+            m_multi_selection.delete_ahead(&m_lines);
+            break;
+        case sf::Keyboard::BackSpace:
+            m_multi_selection.delete_behind(&m_lines);
+            break;
+        case sf::Keyboard::Return:
+            m_multi_selection.push(&m_lines, TextLines::NEW_LINE);
+            break;
+        default: return false;
+        }
+        return true;
+    case sf::Event::TextEntered:
+        if (event.text.unicode == 8 || event.text.unicode == 127 || event.text.unicode == 13) return true;
+        if (event.text.unicode < 32 && event.text.unicode != U'\t') return true;
+        m_multi_selection.push(&m_lines, UChar(event.text.unicode));
+        return true;
+    default: return false;
+    }
+}
+
 void EditorDialog::do_update(float et, TextTyperBot & bot) {
     bool requires_rerender = false;
     requires_rerender = (bot.update(m_lines, m_user_selection, double(et)) == TextTyperBot::HAS_UPDATE);
     m_delay += et;
 
+    DocumentWriter::Result save_result;
+    while (m_writer.take_result(save_result)) {
+        // saves of a document since replaced have no checkpoint
+        if (m_save_checkpoints.empty()) continue;
+        const auto checkpoint = m_save_checkpoints.front();
+        m_save_checkpoints.pop_front();
+        if (save_result.succeeded) {
+            if (m_journal && checkpoint != NO_CHECKPOINT)
+                m_journal->mark_saved(checkpoint);
+            m_file_version  = save_result.version;
+            m_models_stored = false;
+            continue;
+        }
+        std::cerr << "Failed to save: " << save_result.error << std::endl;
+    }
+    {
+    std::string store_error;
+    while (m_store_writer.take_error(store_error))
+        std::cerr << store_error << std::endl;
+    }
+
+    // whatever has been loaded is shown the frame it arrives
+    if (m_loading) {
+        m_reader.append_loaded_to(m_lines);
+        if (!m_reader.is_loading()) {
+            m_loading = false;
+            if (!m_reader.error().empty())
+                std::cerr << m_reader.error() << std::endl;
+            // loading the document is not something to undo
+            m_undo_history.clear();
+            // models are of the file's content, before any edits a crash
+            // left are recovered
+            restore_models();
+            start_journal(true);
+        }
+    }
+
+    // the document always shows its end, so what is appended is shown
+    if (m_follower.is_following()) update_following();
+
     {
     static float min = std::numeric_limits<float>::min();
     static float max = std::numeric_limits<float>::max();
     min = std::max(min, et);
     max = std::min(max, et);
-    TextLine tline(expand_char_width(std::to_string(min) + " " + std::to_string(max)));
+    auto status = std::to_string(min) + " " + std::to_string(max);
+    if (m_loading)
+        status += " loading " + std::to_string(int(m_reader.progress()*100.)) + "%";
+    if (m_follower.is_following())
+        status += " following";
+    {
+    const auto cache_stats = m_model_cache.statistics();
+    status += " cache " + std::to_string(int(cache_stats.hit_rate()*100.)) + "% "
+              + std::to_string(cache_stats.bytes / 1024) + "KiB";
+    }
+    if (m_view)
+        status += " viewing from line " + std::to_string(m_view_line + 1);
+    TextLine tline(expand_char_width(status));
     tline.constrain_to_width(m_elapsed_time_grid.width());
     tline.update_modeler(CodeModeler::default_instance());
     tline.render_to(m_elapsed_time_grid, 0);
     }
 
+    if (m_view) {
+        m_view->render_to(m_doc, m_view_line);
+        return;
+    }
+
     if (m_delay > 0.3f) {
         m_delay = 0.f;
         m_render_options.toggle_cursor_flash();
@@ -217,9 +678,26 @@ void EditorDialog::do_update(float et, TextTyperBot & bot) {
     }
     //if (requires_rerender) {
         m_render_options.set_text_selection(m_user_selection);
-        LuaCodeModeler lcm;
-        m_lines.update_modeler(lcm);
-        m_lines.render_to(m_doc, bottom_offset(m_lines,  m_doc));
+        auto offset = bottom_offset(m_lines, m_doc);
+        auto visible = visible_line_range(m_lines, m_doc, offset);
+        // whatever the background has finished is taken first, so that the
+        // scheduler only has what's left over to do
+        m_background_modeler.apply_results_to(m_lines);
+        const bool modeling_left =
+            m_modeling_scheduler.advance(m_lines, visible.first, visible.second);
+        // a followed file changes too often for whole snapshots to be
+        // worth taking, the scheduler models what is appended instead
+        if (!m_follower.is_following() && m_lines.version() != m_restored_version)
+            m_background_modeler.post_if_idle(m_lines);
+        if (!modeling_left) store_models();
+        // only lines on screen are searched (and only again once edited)
+        if (!m_multi_selection.empty()) {
+            m_render_options.set_highlights(highlights_of(m_multi_selection));
+        } else if (m_search) {
+            m_render_options.set_highlights
+                (m_search->matches_on_lines(visible.first, visible.second));
+        }
+        m_lines.render_to(m_doc, offset);
     //}
 }
 
@@ -234,6 +712,8 @@ decltype (TextTyperBot::NO_UPDATE) TextTyperBot::update
     if (m_type_rate == 0.0 || m_content.empty()) return NO_UPDATE;
     m_delay += et;
     auto rv = NO_UPDATE;
+    // however much is typed this frame is bookkept once
+    TextLines::Transaction transaction(lines);
     while (m_delay > m_type_rate) {
         textsel.push(&lines, m_content[m_current_index]);
         rv = HAS_UPDATE;
@@ -312,6 +792,8 @@ void handle_event
         break;
     case sf::Event::TextEntered:
         if (event.text.unicode == 8 || event.text.unicode == 127 || event.text.unicode == 13) break;
+        // other control characters (like ctrl+z's) are not text
+        if (event.text.unicode < 32 && event.text.unicode != U'\t') break;
         selection->push(tlines, UChar(event.text.unicode));
         break;
     default: break;
@@ -342,3 +824,31 @@ int bottom_offset(const TextLines & textlines, const TargetTextGrid & text_grid)
     }
     return -std::max(0, height_so_far - text_grid.height());
 }
+
+std::pair<int, int> visible_line_range
+    (const TextLines & textlines, const TargetTextGrid & text_grid, int offset)
+{
+    const auto & lines = textlines.lines();
+    int beg = int(lines.size()), end = 0;
+    for (int i = 0; i != int(lines.size()); ++i) {
+        int next_offset = offset + lines[std::size_t(i)].height_in_cells();
+        if (next_offset > 0 && offset < text_grid.height()) {
+            beg = std::min(beg, i);
+            end = i + 1;
+        }
+        offset = next_offset;
+    }
+    if (beg > end) beg = end;
+    return std::make_pair(beg, end);
+}
+
+std::vector<CursorRange> highlights_of(const MultiTextSelection & selection) {
+    auto rv = selection.ranges();
+    for (auto & range : rv) {
+        if (range.begin == range.end) ++range.end.column;
+    }
+    return rv;
+}
+
+std::unique_ptr<CodeModeler> make_lua_modeler()
+    { return std::unique_ptr<CodeModeler>(new LuaCodeModeler()); }